@@ -1,17 +1,65 @@
 // Wraps access to the unpacked data at the current barycentric position of a single triangle
 
+vec3 octDecode(vec2 e) {
+	vec3 v = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+	if (v.z < 0.0) {
+		v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(v);
+}
+
 Triangle unpackTriangle(uint index, int vertexSize) {
 	Triangle tri;
-	const uint triIndex = index * 3;
 
 	ObjBuffers objResource = scene_desc.i[gl_InstanceCustomIndexEXT];
 	Indices    indices     = Indices(objResource.indices);
 	Vertices   vertices    = Vertices(objResource.vertices);
+	Geometries geometries  = Geometries(objResource.geometries);
+
+	// Primitive indices are relative to the geometry
+	GeometryRecord geometry = geometries.g[gl_GeometryIndexEXT];
+
+	// Hits on pre-split triangles are mapped back to the original triangle
+	vec2 barycentrics = attribs.xy;
+	if (geometry.firstSplitTriangle != 0xFFFFFFFF) {
+		SplitTriangles splitTriangles = SplitTriangles(objResource.splitTriangles);
+		SplitTriangle splitTriangle = splitTriangles.t[geometry.firstSplitTriangle + index];
+		vec2 corners[3];
+		for (uint i = 0; i < 3; i++) {
+			corners[i] = vec2(splitTriangle.barycentrics[i] & 0xFFFF, splitTriangle.barycentrics[i] >> 16) / 32768.0;
+		}
+		barycentrics = corners[0] * (1.0 - attribs.x - attribs.y) + corners[1] * attribs.x + corners[2] * attribs.y;
+		index = splitTriangle.triangle;
+	}
+	const uint triIndex = geometry.firstIndex + index * 3;
 
 	// Unpack vertices
 	// Data is packed as vec4 so we can map to the glTF vertex structure from the host side
 	for (uint i = 0; i < 3; i++) {
-		const uint offset = indices.i[triIndex + i] * (vertexSize / 16);
+		uint vertexIndex;
+		if (objResource.indexFormat == 1) {
+			// 16-bit indices are read in pairs
+			const uint pair = indices.i[(triIndex + i) >> 1];
+			vertexIndex = ((triIndex + i) & 1) == 0 ? (pair & 0xFFFF) : (pair >> 16);
+		} else {
+			vertexIndex = indices.i[triIndex + i];
+		}
+		vertexIndex += geometry.firstVertex;
+
+		if (objResource.vertexFormat == 1) {
+			Positions positions = Positions(objResource.vertices);
+			Attributes attributes = Attributes(objResource.attributes);
+			PackedAttributes a = attributes.a[vertexIndex];
+			vec4 color = unpackUnorm4x8(a.color);
+			tri.vertices[i].pos = positions.p[vertexIndex];
+			tri.vertices[i].uv = unpackHalf2x16(a.uv);
+			tri.vertices[i].normal = octDecode(unpackSnorm2x16(a.normal));
+			tri.vertices[i].color = vec4(color.rgb, 1.0);
+			tri.vertices[i].tangent = (color.a < 0.25) ? vec4(0.0) : vec4(octDecode(unpackSnorm2x16(a.tangent)), color.a > 0.75 ? 1.0 : -1.0);
+			continue;
+		}
+
+		const uint offset = vertexIndex * (vertexSize / 16);
 
 		vec4 d0 = vertices.v[offset + 0]; // pos.xyz, n.x
 		vec4 d1 = vertices.v[offset + 1]; // n.yz, uv.xy
@@ -19,25 +67,23 @@ Triangle unpackTriangle(uint index, int vertexSize) {
 		vec4 d3 = vertices.v[offset + 3]; // joint0
 		vec4 d4 = vertices.v[offset + 4]; // weight0
 		vec4 d5 = vertices.v[offset + 5]; // tangent
-		vec4 d6 = vertices.v[offset + 6]; // material
 
 		tri.vertices[i].pos = d0.xyz;
 		tri.vertices[i].uv = d1.zw;
 		tri.vertices[i].normal = vec3(d0.w, d1.x, d1.y);
 		tri.vertices[i].color = vec4(d2.x, d2.y, d2.z, 1.0);
 		tri.vertices[i].tangent = d5;
-		tri.vertices[i].materialIndex = floatBitsToInt(d6.x);
 	}
 
 	// Calculate values at barycentric coordinates
-	vec3 barycentricCoords = vec3(1.0f - attribs.x - attribs.y, attribs.x, attribs.y);
+	vec3 barycentricCoords = vec3(1.0f - barycentrics.x - barycentrics.y, barycentrics.x, barycentrics.y);
 	tri.normal = normalize(tri.vertices[0].normal * barycentricCoords.x + tri.vertices[1].normal * barycentricCoords.y + tri.vertices[2].normal * barycentricCoords.z);
 	tri.tangent = tri.vertices[0].tangent * barycentricCoords.x + tri.vertices[1].tangent * barycentricCoords.y + tri.vertices[2].tangent * barycentricCoords.z;
 	tri.uv = tri.vertices[0].uv * barycentricCoords.x + tri.vertices[1].uv * barycentricCoords.y + tri.vertices[2].uv * barycentricCoords.z;
 	tri.color = tri.vertices[0].color * barycentricCoords.x + tri.vertices[1].color * barycentricCoords.y + tri.vertices[2].color * barycentricCoords.z;
 
 	// Fixed values
-	tri.materialIndex = tri.vertices[0].materialIndex;
+	tri.materialIndex = geometry.materialIndex;
 
 	return tri;
 }
\ No newline at end of file
@@ -7,7 +7,28 @@ struct Vertex
   vec4 joint0; 
   vec4 weight0;
   vec4 tangent;
-  int materialIndex;
+};
+
+// Vertex attributes of the compact vertex layout
+struct PackedAttributes {
+	uint normal; // Octahedral encoded, snorm16x2
+	uint tangent; // Octahedral encoded, snorm16x2
+	uint uv; // half2
+	uint color; // unorm8x4, alpha stores the tangent's handedness (0 = no tangent, 0.5 = -1, 1 = +1)
+};
+
+// Per-geometry data, each primitive of a model is a separate geometry
+struct GeometryRecord {
+	uint firstIndex;
+	uint firstVertex; // Indices are relative to the primitive's first vertex
+	int materialIndex;
+	uint firstSplitTriangle; // 0xFFFFFFFF if the geometry is built from the index buffer
+};
+
+// Triangle of a pre-split geometry, referencing the original triangle it was split from
+struct SplitTriangle {
+	uint triangle;
+	uint barycentrics[3]; // Barycentrics of the corners in the original triangle, 16-bit fixed point with 15 fractional bits
 };
 
 struct Triangle {
@@ -3,4 +3,5 @@ struct Material {
 	int baseColorTextureIndex;
 	int normalTextureIndex;
 	uint type;
+	float alphaCutoff;
 };
\ No newline at end of file
@@ -0,0 +1,241 @@
+/* Copyright (c) 2021, Sascha Willems
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+/*
+	Microbenchmark for the glTF accessor decoding used by vkglTF::Model
+	Decodes synthetic primitives with the per-vertex push_back loop the loader used before, the scalar and the vector decoder and the vector decoder on all threads
+	Usage: AccessorDecodingBenchmark [vertex count] [iterations]
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <string>
+#include <cstdlib>
+#include <cstddef>
+
+#include "AccessorDecoder.h"
+#include "threadpool.hpp"
+
+// Same layout as vkglTF::Vertex
+struct Vertex {
+	float pos[3];
+	float normal[3];
+	float uv[2];
+	float color[4];
+	float joint0[4];
+	float weight0[4];
+	float tangent[4];
+};
+
+// Separate tightly packed buffer views per attribute, as written by most exporters
+struct Primitive {
+	std::vector<float> positions;
+	std::vector<float> normals;
+	std::vector<float> uvs;
+	std::vector<float> tangents;
+	std::vector<uint16_t> indices;
+	uint32_t firstVertex;
+	uint32_t firstIndex;
+};
+
+static void setDefaults(Vertex* vertices, size_t count)
+{
+	for (size_t v = 0; v < count; v++) {
+		Vertex& vertex = vertices[v];
+		for (uint32_t c = 0; c < 4; c++) {
+			vertex.color[c] = 1.0f;
+			vertex.joint0[c] = 0.0f;
+			vertex.weight0[c] = (c == 0) ? 1.0f : 0.0f;
+		}
+	}
+}
+
+// Per-vertex loop appending to the buffers, with a temporary copy of the indices
+static void decodeLegacy(const std::vector<Primitive>& primitives, std::vector<Vertex>& vertexBuffer, std::vector<uint32_t>& indexBuffer)
+{
+	vertexBuffer.clear();
+	indexBuffer.clear();
+	vertexBuffer.shrink_to_fit();
+	indexBuffer.shrink_to_fit();
+	for (const Primitive& primitive : primitives) {
+		const float* bufferNormals = primitive.normals.data();
+		const float* bufferTexCoords = primitive.uvs.data();
+		const float* bufferTangents = primitive.tangents.data();
+		const size_t vertexCount = primitive.positions.size() / 3;
+		for (size_t v = 0; v < vertexCount; v++) {
+			Vertex vertex{};
+			memcpy(vertex.pos, &primitive.positions[v * 3], sizeof(vertex.pos));
+			if (bufferNormals) {
+				memcpy(vertex.normal, &bufferNormals[v * 3], sizeof(vertex.normal));
+			}
+			const float length = std::sqrt(vertex.normal[0] * vertex.normal[0] + vertex.normal[1] * vertex.normal[1] + vertex.normal[2] * vertex.normal[2]);
+			for (uint32_t c = 0; c < 3; c++) {
+				vertex.normal[c] /= length;
+			}
+			if (bufferTexCoords) {
+				memcpy(vertex.uv, &bufferTexCoords[v * 2], sizeof(vertex.uv));
+			}
+			if (bufferTangents) {
+				memcpy(vertex.tangent, &bufferTangents[v * 4], sizeof(vertex.tangent));
+			}
+			setDefaults(&vertex, 1);
+			vertexBuffer.push_back(vertex);
+		}
+		std::vector<uint16_t> buf(primitive.indices.size());
+		memcpy(buf.data(), primitive.indices.data(), buf.size() * sizeof(uint16_t));
+		for (size_t index = 0; index < buf.size(); index++) {
+			indexBuffer.push_back(buf[index]);
+		}
+	}
+}
+
+template<typename Decoder>
+static void decodeRange(const Primitive& primitive, uint32_t first, uint32_t count, std::vector<Vertex>& vertexBuffer)
+{
+	Vertex* vertices = &vertexBuffer[primitive.firstVertex + first];
+	uint8_t* dst = reinterpret_cast<uint8_t*>(vertices);
+	setDefaults(vertices, count);
+	AccessorDecoder::decodeAttribute<3, sizeof(Vertex), Decoder>(AccessorDecoder::Float, false, reinterpret_cast<const uint8_t*>(&primitive.positions[first * 3]), 12, count, dst + offsetof(Vertex, pos));
+	AccessorDecoder::decodeAttribute<3, sizeof(Vertex), Decoder>(AccessorDecoder::Float, false, reinterpret_cast<const uint8_t*>(&primitive.normals[first * 3]), 12, count, dst + offsetof(Vertex, normal));
+	AccessorDecoder::normalizeVec3<sizeof(Vertex), Decoder>(dst + offsetof(Vertex, normal), count);
+	AccessorDecoder::decodeAttribute<2, sizeof(Vertex), Decoder>(AccessorDecoder::Float, false, reinterpret_cast<const uint8_t*>(&primitive.uvs[first * 2]), 8, count, dst + offsetof(Vertex, uv));
+	AccessorDecoder::decodeAttribute<4, sizeof(Vertex), Decoder>(AccessorDecoder::Float, false, reinterpret_cast<const uint8_t*>(&primitive.tangents[first * 4]), 16, count, dst + offsetof(Vertex, tangent));
+}
+
+template<typename Decoder>
+static void decodeIndexRange(const Primitive& primitive, uint32_t first, uint32_t count, std::vector<uint32_t>& indexBuffer)
+{
+	AccessorDecoder::decodeIndices<Decoder>(AccessorDecoder::UnsignedShort, reinterpret_cast<const uint8_t*>(&primitive.indices[first]), count, &indexBuffer[primitive.firstIndex + first]);
+}
+
+// Buffers are sized once from the accessor counts
+template<typename Decoder>
+static void decodePresized(const std::vector<Primitive>& primitives, size_t vertexCount, size_t indexCount, std::vector<Vertex>& vertexBuffer, std::vector<uint32_t>& indexBuffer)
+{
+	vertexBuffer.resize(vertexCount);
+	indexBuffer.resize(indexCount);
+	for (const Primitive& primitive : primitives) {
+		decodeRange<Decoder>(primitive, 0, static_cast<uint32_t>(primitive.positions.size() / 3), vertexBuffer);
+		decodeIndexRange<Decoder>(primitive, 0, static_cast<uint32_t>(primitive.indices.size()), indexBuffer);
+	}
+}
+
+static void decodeParallel(vks::ThreadPool& threadPool, const std::vector<Primitive>& primitives, size_t vertexCount, size_t indexCount, std::vector<Vertex>& vertexBuffer, std::vector<uint32_t>& indexBuffer)
+{
+	vertexBuffer.resize(vertexCount);
+	indexBuffer.resize(indexCount);
+	const size_t threadCount = threadPool.threads.size();
+	for (size_t i = 0; i < primitives.size(); i++) {
+		const Primitive* primitive = &primitives[i];
+		threadPool.threads[i % threadCount]->addJob([primitive, &vertexBuffer, &indexBuffer] {
+			decodeRange<AccessorDecoder::Native>(*primitive, 0, static_cast<uint32_t>(primitive->positions.size() / 3), vertexBuffer);
+			decodeIndexRange<AccessorDecoder::Native>(*primitive, 0, static_cast<uint32_t>(primitive->indices.size()), indexBuffer);
+		});
+	}
+	threadPool.wait();
+}
+
+int main(int argc, char* argv[])
+{
+	size_t vertexCount = 4 * 1024 * 1024;
+	uint32_t iterations = 5;
+	if (argc > 1) {
+		vertexCount = std::max(strtoull(argv[1], nullptr, 10), 1ull);
+	}
+	if (argc > 2) {
+		iterations = std::max(static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)), 1u);
+	}
+
+	// Primitives of up to 65536 vertices with 16-bit indices, three indices per vertex
+	const uint32_t primitiveVertexCount = 65536;
+	std::mt19937 generator(0);
+	std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+	std::vector<Primitive> primitives;
+	size_t indexCount = 0;
+	for (size_t firstVertex = 0; firstVertex < vertexCount; firstVertex += primitiveVertexCount) {
+		const uint32_t count = static_cast<uint32_t>(std::min<size_t>(primitiveVertexCount, vertexCount - firstVertex));
+		Primitive primitive;
+		primitive.firstVertex = static_cast<uint32_t>(firstVertex);
+		primitive.firstIndex = static_cast<uint32_t>(indexCount);
+		for (uint32_t v = 0; v < count; v++) {
+			for (uint32_t c = 0; c < 3; c++) {
+				primitive.positions.push_back(distribution(generator) * 100.0f);
+				primitive.normals.push_back(distribution(generator));
+			}
+			for (uint32_t c = 0; c < 2; c++) {
+				primitive.uvs.push_back(distribution(generator));
+			}
+			for (uint32_t c = 0; c < 4; c++) {
+				primitive.tangents.push_back(distribution(generator));
+			}
+			for (uint32_t c = 0; c < 3; c++) {
+				primitive.indices.push_back(static_cast<uint16_t>(generator() % count));
+			}
+		}
+		indexCount += primitive.indices.size();
+		primitives.push_back(std::move(primitive));
+	}
+
+	vks::ThreadPool threadPool;
+	threadPool.setThreadCount(std::max(1u, std::thread::hardware_concurrency()));
+
+	std::vector<Vertex> vertexBuffer;
+	std::vector<uint32_t> indexBuffer;
+	auto measure = [&](const std::function<void()>& decode) {
+		double best = 0.0;
+		for (uint32_t i = 0; i < iterations; i++) {
+			// Released between iterations, so each one pays for touching newly allocated memory like the loader does
+			vertexBuffer = std::vector<Vertex>();
+			indexBuffer = std::vector<uint32_t>();
+			auto tStart = std::chrono::high_resolution_clock::now();
+			decode();
+			const double time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+			best = (i == 0) ? time : std::min(best, time);
+		}
+		return best;
+	};
+
+	std::cout << "Decoding " << vertexCount << " vertices and " << indexCount << " indices in " << primitives.size() << " primitives, best of " << iterations << " iterations\n";
+#if defined(ACCESSOR_DECODER_SSE2)
+	std::cout << "Vector decoder: SSE2\n";
+#else
+	std::cout << "Vector decoder: not available, using the scalar decoder\n";
+#endif
+
+	const double legacyTime = measure([&] { decodeLegacy(primitives, vertexBuffer, indexBuffer); });
+	const std::vector<Vertex> legacyVertices = vertexBuffer;
+	const double scalarTime = measure([&] { decodePresized<AccessorDecoder::Scalar>(primitives, vertexCount, indexCount, vertexBuffer, indexBuffer); });
+	const std::vector<Vertex> scalarVertices = vertexBuffer;
+	const std::vector<uint32_t> scalarIndices = indexBuffer;
+	const double nativeTime = measure([&] { decodePresized<AccessorDecoder::Native>(primitives, vertexCount, indexCount, vertexBuffer, indexBuffer); });
+	const bool nativeMatches = (memcmp(vertexBuffer.data(), scalarVertices.data(), vertexCount * sizeof(Vertex)) == 0) && (indexBuffer == scalarIndices);
+	const double parallelTime = measure([&] { decodeParallel(threadPool, primitives, vertexCount, indexCount, vertexBuffer, indexBuffer); });
+	const bool parallelMatches = (memcmp(vertexBuffer.data(), scalarVertices.data(), vertexCount * sizeof(Vertex)) == 0) && (indexBuffer == scalarIndices);
+
+	// The legacy loop divides by the length instead of multiplying with its reciprocal, so normals may differ in the last bit
+	float maxDifference = 0.0f;
+	for (size_t v = 0; v < vertexCount; v++) {
+		const float* a = reinterpret_cast<const float*>(&legacyVertices[v]);
+		const float* b = reinterpret_cast<const float*>(&scalarVertices[v]);
+		for (size_t c = 0; c < sizeof(Vertex) / sizeof(float); c++) {
+			maxDifference = std::max(maxDifference, std::abs(a[c] - b[c]));
+		}
+	}
+
+	auto report = [&](const std::string& name, double time) {
+		std::cout << std::left << std::setw(32) << name << std::right << std::fixed << std::setprecision(2) << std::setw(10) << time << " ms " << std::setw(8) << legacyTime / time << "x\n";
+	};
+	report("Per-vertex push_back", legacyTime);
+	report("Scalar, presized", scalarTime);
+	report("Vector, presized", nativeTime);
+	report("Vector, presized, " + std::to_string(threadPool.threads.size()) + " threads", parallelTime);
+	std::cout << "Vector results " << (nativeMatches && parallelMatches ? "match" : "DIFFER FROM") << " the scalar results, maximum difference to the per-vertex loop " << std::scientific << maxDifference << "\n";
+
+	return (nativeMatches && parallelMatches) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
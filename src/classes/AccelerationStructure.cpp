@@ -6,13 +6,19 @@
 
 #include "AccelerationStructure.h"
 
-void AccelerationStructure::create(vks::VulkanDevice* device, VkAccelerationStructureTypeKHR type, VkAccelerationStructureBuildSizesInfoKHR buildSizeInfo)
+void AccelerationStructure::create(vks::VulkanDevice* device, VkAccelerationStructureTypeKHR type, VkAccelerationStructureBuildSizesInfoKHR buildSizeInfo, VkMemoryPropertyFlags memoryPropertyFlags)
+{
+	create(device, type, buildSizeInfo.accelerationStructureSize, memoryPropertyFlags);
+}
+
+void AccelerationStructure::create(vks::VulkanDevice* device, VkAccelerationStructureTypeKHR type, VkDeviceSize size, VkMemoryPropertyFlags memoryPropertyFlags)
 {
 	this->device = device;
+	this->size = size;
 	// Buffer and memory
 	VkBufferCreateInfo bufferCreateInfo{};
 	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	bufferCreateInfo.size = buildSizeInfo.accelerationStructureSize;
+	bufferCreateInfo.size = size;
 	bufferCreateInfo.usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
 	VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferCreateInfo, nullptr, &buffer));
 	VkMemoryRequirements memoryRequirements{};
@@ -24,14 +30,14 @@ void AccelerationStructure::create(vks::VulkanDevice* device, VkAccelerationStru
 	memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 	memoryAllocateInfo.pNext = &memoryAllocateFlagsInfo;
 	memoryAllocateInfo.allocationSize = memoryRequirements.size;
-	memoryAllocateInfo.memoryTypeIndex = device->getMemoryType(memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	memoryAllocateInfo.memoryTypeIndex = device->getMemoryType(memoryRequirements.memoryTypeBits, memoryPropertyFlags);
 	VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memoryAllocateInfo, nullptr, &memory));
 	VK_CHECK_RESULT(vkBindBufferMemory(device->logicalDevice, buffer, memory, 0));
 	// Acceleration structure
 	VkAccelerationStructureCreateInfoKHR accelerationStructureCreate_info{};
 	accelerationStructureCreate_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
 	accelerationStructureCreate_info.buffer = buffer;
-	accelerationStructureCreate_info.size = buildSizeInfo.accelerationStructureSize;
+	accelerationStructureCreate_info.size = size;
 	accelerationStructureCreate_info.type = type;
 	vkCreateAccelerationStructureKHR(device->logicalDevice, &accelerationStructureCreate_info, nullptr, &handle);
 	// AS device address
@@ -41,6 +47,43 @@ void AccelerationStructure::create(vks::VulkanDevice* device, VkAccelerationStru
 	deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(device->logicalDevice, &accelerationDeviceAddressInfo);
 }
 
+void AccelerationStructure::create(vks::VulkanDevice* device, VkAccelerationStructureTypeKHR type, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+	this->device = device;
+	this->size = size;
+	this->buffer = VK_NULL_HANDLE;
+	this->memory = VK_NULL_HANDLE;
+	VkAccelerationStructureCreateInfoKHR accelerationStructureCreate_info{};
+	accelerationStructureCreate_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+	accelerationStructureCreate_info.buffer = buffer;
+	accelerationStructureCreate_info.offset = offset;
+	accelerationStructureCreate_info.size = size;
+	accelerationStructureCreate_info.type = type;
+	VK_CHECK_RESULT(vkCreateAccelerationStructureKHR(device->logicalDevice, &accelerationStructureCreate_info, nullptr, &handle));
+	VkAccelerationStructureDeviceAddressInfoKHR accelerationDeviceAddressInfo{};
+	accelerationDeviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+	accelerationDeviceAddressInfo.accelerationStructure = handle;
+	deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(device->logicalDevice, &accelerationDeviceAddressInfo);
+}
+
+void AccelerationStructure::destroy()
+{
+	if (handle != VK_NULL_HANDLE) {
+		vkDestroyAccelerationStructureKHR(device->logicalDevice, handle, nullptr);
+	}
+	if (buffer != VK_NULL_HANDLE) {
+		vkDestroyBuffer(device->logicalDevice, buffer, nullptr);
+	}
+	if (memory != VK_NULL_HANDLE) {
+		vkFreeMemory(device->logicalDevice, memory, nullptr);
+	}
+	handle = VK_NULL_HANDLE;
+	buffer = VK_NULL_HANDLE;
+	memory = VK_NULL_HANDLE;
+	deviceAddress = 0;
+	size = 0;
+}
+
 AccelerationStructure::~AccelerationStructure()
 {
 	// @todo
@@ -11,11 +11,16 @@
 #include "VulkanTools.h"
 
 struct AccelerationStructure {
-	VkAccelerationStructureKHR handle;
+	VkAccelerationStructureKHR handle = VK_NULL_HANDLE;
 	uint64_t deviceAddress = 0;
-	VkDeviceMemory memory;
-	VkBuffer buffer;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceSize size = 0;
 	vks::VulkanDevice* device = nullptr;
-	void create(vks::VulkanDevice* device, VkAccelerationStructureTypeKHR type, VkAccelerationStructureBuildSizesInfoKHR buildSizeInfo);
+	void create(vks::VulkanDevice* device, VkAccelerationStructureTypeKHR type, VkAccelerationStructureBuildSizesInfoKHR buildSizeInfo, VkMemoryPropertyFlags memoryPropertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	void create(vks::VulkanDevice* device, VkAccelerationStructureTypeKHR type, VkDeviceSize size, VkMemoryPropertyFlags memoryPropertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	// Places the acceleration structure in a range of a buffer owned by the caller (offset must be a multiple of 256), destroy() only releases the handle
+	void create(vks::VulkanDevice* device, VkAccelerationStructureTypeKHR type, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size);
+	void destroy();
 	~AccelerationStructure();
 };
\ No newline at end of file
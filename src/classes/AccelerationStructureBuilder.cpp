@@ -0,0 +1,413 @@
+/* Copyright (c) 2021, Sascha Willems
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#include "AccelerationStructureBuilder.h"
+
+AccelerationStructureBuilder::AccelerationStructureBuilder(vks::VulkanDevice* device, VkPhysicalDeviceAccelerationStructurePropertiesKHR properties)
+{
+	this->device = device;
+	this->properties = properties;
+}
+
+std::vector<uint32_t> AccelerationStructureBuilder::primitiveCounts(const BuildInput& input)
+{
+	std::vector<uint32_t> counts(input.buildRanges.size());
+	for (size_t i = 0; i < input.buildRanges.size(); i++) {
+		counts[i] = input.buildRanges[i].primitiveCount;
+	}
+	return counts;
+}
+
+void AccelerationStructureBuilder::add(AccelerationStructure& accelerationStructure, const BuildInput& input)
+{
+	assert(input.geometries.size() == input.buildRanges.size());
+
+	PendingBuild pendingBuild{};
+	pendingBuild.input = input;
+	pendingBuild.accelerationStructure = &accelerationStructure;
+	if (compact) {
+		pendingBuild.input.flags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+	}
+	const VkAccelerationStructureBuildTypeKHR buildType = hostBuild ? VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR : VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR;
+
+	// Get size info
+	VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo = vks::initializers::accelerationStructureBuildGeometryInfoKHR();
+	buildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+	buildGeometryInfo.flags = pendingBuild.input.flags;
+	buildGeometryInfo.geometryCount = static_cast<uint32_t>(input.geometries.size());
+	buildGeometryInfo.pGeometries = input.geometries.data();
+	const std::vector<uint32_t> maxPrimitiveCounts = primitiveCounts(input);
+	pendingBuild.buildSizes = vks::initializers::accelerationStructureBuildSizesInfoKHR();
+	vkGetAccelerationStructureBuildSizesKHR(device->logicalDevice, buildType, &buildGeometryInfo, maxPrimitiveCounts.data(), &pendingBuild.buildSizes);
+	pendingBuild.scratchSize = vks::tools::alignedVkSize(pendingBuild.buildSizes.buildScratchSize, properties.minAccelerationStructureScratchOffsetAlignment);
+
+	// Host builds write to the acceleration structure's memory from the CPU
+	const VkMemoryPropertyFlags memoryPropertyFlags = hostBuild ? (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	accelerationStructure.create(device, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, pendingBuild.buildSizes, memoryPropertyFlags);
+
+	pendingBuilds.push_back(pendingBuild);
+}
+
+// Submit a recorded command buffer, it's freed along with the fence once the fence has been found signaled
+void AccelerationStructureBuilder::submitWithFence(VkCommandBuffer commandBuffer, VkQueue queue)
+{
+	VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+	VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	VkFenceCreateInfo fenceCI = vks::initializers::fenceCreateInfo(0);
+	VK_CHECK_RESULT(vkCreateFence(device->logicalDevice, &fenceCI, nullptr, &submission.fence));
+	VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, submission.fence));
+	submission.commandBuffer = commandBuffer;
+}
+
+void AccelerationStructureBuilder::releaseSubmission()
+{
+	vkDestroyFence(device->logicalDevice, submission.fence, nullptr);
+	submission.fence = VK_NULL_HANDLE;
+	vkFreeCommandBuffers(device->logicalDevice, device->commandPool, 1, &submission.commandBuffer);
+	submission.commandBuffer = VK_NULL_HANDLE;
+}
+
+// Query the compacted sizes of all pending (and already built) acceleration structures
+void AccelerationStructureBuilder::submitCompactedSizeQuery(VkQueue queue)
+{
+	const uint32_t count = static_cast<uint32_t>(pendingBuilds.size());
+
+	VkQueryPoolCreateInfo queryPoolCI{};
+	queryPoolCI.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCI.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
+	queryPoolCI.queryCount = count;
+	VK_CHECK_RESULT(vkCreateQueryPool(device->logicalDevice, &queryPoolCI, nullptr, &submission.compactedSizeQueryPool));
+
+	std::vector<VkAccelerationStructureKHR> handles(count);
+	for (uint32_t i = 0; i < count; i++) {
+		handles[i] = pendingBuilds[i].accelerationStructure->handle;
+	}
+
+	VkCommandBuffer commandBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	vkCmdResetQueryPool(commandBuffer, submission.compactedSizeQueryPool, 0, count);
+	vkCmdWriteAccelerationStructuresPropertiesKHR(commandBuffer, count, handles.data(), VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, submission.compactedSizeQueryPool, 0);
+	submitWithFence(commandBuffer, queue);
+	submission.stage = Stage::QueryingCompactedSizes;
+}
+
+// Copy the acceleration structures into right-sized ones, the query has finished at this point so reading it's results doesn't wait
+void AccelerationStructureBuilder::submitCompaction(VkQueue queue)
+{
+	const uint32_t count = static_cast<uint32_t>(pendingBuilds.size());
+
+	submission.compactedSizes.resize(count);
+	VK_CHECK_RESULT(vkGetQueryPoolResults(device->logicalDevice, submission.compactedSizeQueryPool, 0, count, count * sizeof(VkDeviceSize), submission.compactedSizes.data(), sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+	vkDestroyQueryPool(device->logicalDevice, submission.compactedSizeQueryPool, nullptr);
+	submission.compactedSizeQueryPool = VK_NULL_HANDLE;
+
+	submission.compacted.resize(count);
+	VkCommandBuffer commandBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	for (uint32_t i = 0; i < count; i++) {
+		submission.compacted[i].create(device, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, submission.compactedSizes[i]);
+		VkCopyAccelerationStructureInfoKHR copyInfo{};
+		copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR;
+		copyInfo.src = pendingBuilds[i].accelerationStructure->handle;
+		copyInfo.dst = submission.compacted[i].handle;
+		copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+		vkCmdCopyAccelerationStructureKHR(commandBuffer, &copyInfo);
+	}
+	submitWithFence(commandBuffer, queue);
+	submission.stage = Stage::Compacting;
+}
+
+// Replace the originals with the compacted copies once the copies have finished
+void AccelerationStructureBuilder::finishCompaction()
+{
+	const uint32_t count = static_cast<uint32_t>(pendingBuilds.size());
+	const std::vector<VkDeviceSize>& compactedSizes = submission.compactedSizes;
+	VkDeviceSize totalSize = 0;
+	VkDeviceSize totalCompactedSize = 0;
+	std::cout << "Compacted bottom level acceleration structures:\n";
+	for (uint32_t i = 0; i < count; i++) {
+		AccelerationStructure* accelerationStructure = pendingBuilds[i].accelerationStructure;
+		const VkDeviceSize size = accelerationStructure->size;
+		std::cout << "  " << pendingBuilds[i].input.name << ": " << size / 1024 << " KB -> " << compactedSizes[i] / 1024 << " KB (" << (100.0 * (double)compactedSizes[i] / (double)size) << " %)\n";
+		buildStatistics[i].compactedSize = compactedSizes[i];
+		totalSize += size;
+		totalCompactedSize += compactedSizes[i];
+		accelerationStructure->destroy();
+		*accelerationStructure = submission.compacted[i];
+	}
+	std::cout << "  Total: " << totalSize / (1024 * 1024) << " MB -> " << totalCompactedSize / (1024 * 1024) << " MB\n";
+	submission.compacted.clear();
+	submission.compactedSizes.clear();
+}
+
+// Build all pending acceleration structures on the host
+// Each build gets it's own deferred operation, which is joined by the worker threads of a pool so that multiple builds run concurrently
+void AccelerationStructureBuilder::buildOnHost()
+{
+	// Parameters of a deferred build have to stay valid until the operation has completed, so they are stored along with the scratch data
+	// The vector isn't resized after this, so pointers to it's elements stay valid
+	struct HostBuild {
+		VkDeferredOperationKHR deferredOperation = VK_NULL_HANDLE;
+		VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo;
+		const VkAccelerationStructureBuildRangeInfoKHR* buildRangeInfos = nullptr;
+		std::vector<uint8_t> scratchData;
+		uint32_t maxConcurrency = 0;
+	};
+	std::vector<HostBuild> hostBuilds(pendingBuilds.size());
+
+	for (size_t i = 0; i < pendingBuilds.size(); i++) {
+		const PendingBuild& pendingBuild = pendingBuilds[i];
+		HostBuild& hostBuild = hostBuilds[i];
+		hostBuild.scratchData.resize(static_cast<size_t>(pendingBuild.buildSizes.buildScratchSize));
+		VK_CHECK_RESULT(vkCreateDeferredOperationKHR(device->logicalDevice, nullptr, &hostBuild.deferredOperation));
+
+		VkAccelerationStructureBuildGeometryInfoKHR& buildGeometryInfo = hostBuild.buildGeometryInfo;
+		buildGeometryInfo = vks::initializers::accelerationStructureBuildGeometryInfoKHR();
+		buildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+		buildGeometryInfo.flags = pendingBuild.input.flags;
+		buildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+		buildGeometryInfo.dstAccelerationStructure = pendingBuild.accelerationStructure->handle;
+		buildGeometryInfo.geometryCount = static_cast<uint32_t>(pendingBuild.input.geometries.size());
+		buildGeometryInfo.pGeometries = pendingBuild.input.geometries.data();
+		buildGeometryInfo.scratchData.hostAddress = hostBuild.scratchData.data();
+		hostBuild.buildRangeInfos = pendingBuild.input.buildRanges.data();
+
+		VkResult result = vkBuildAccelerationStructuresKHR(device->logicalDevice, hostBuild.deferredOperation, 1, &hostBuild.buildGeometryInfo, &hostBuild.buildRangeInfos);
+		if (result == VK_OPERATION_DEFERRED_KHR) {
+			// At least one thread has to join a deferred operation to complete it
+			hostBuild.maxConcurrency = std::max(vkGetDeferredOperationMaxConcurrencyKHR(device->logicalDevice, hostBuild.deferredOperation), 1u);
+		} else if (result != VK_OPERATION_NOT_DEFERRED_KHR) {
+			VK_CHECK_RESULT(result);
+		}
+	}
+
+	// Distribute joins for all deferred builds across the pool's threads
+	const uint32_t threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+	vks::ThreadPool threadPool;
+	threadPool.setThreadCount(threadCount);
+	uint32_t threadIndex = 0;
+	for (auto& hostBuild : hostBuilds) {
+		const uint32_t joinCount = std::min(hostBuild.maxConcurrency, threadCount);
+		for (uint32_t i = 0; i < joinCount; i++) {
+			VkDevice logicalDevice = device->logicalDevice;
+			VkDeferredOperationKHR deferredOperation = hostBuild.deferredOperation;
+			threadPool.threads[threadIndex]->addJob([logicalDevice, deferredOperation] {
+				// VK_THREAD_IDLE_KHR signals that there is currently no work for this thread, but the operation hasn't completed yet
+				while (vkDeferredOperationJoinKHR(logicalDevice, deferredOperation) == VK_THREAD_IDLE_KHR) {
+					std::this_thread::yield();
+				}
+			});
+			threadIndex = (threadIndex + 1) % threadCount;
+		}
+	}
+	threadPool.wait();
+
+	for (auto& hostBuild : hostBuilds) {
+		VK_CHECK_RESULT(vkGetDeferredOperationResultKHR(device->logicalDevice, hostBuild.deferredOperation));
+		vkDestroyDeferredOperationKHR(device->logicalDevice, hostBuild.deferredOperation, nullptr);
+	}
+
+	std::cout << "Built " << pendingBuilds.size() << " bottom level acceleration structures on the host using " << threadCount << " thread(s)\n";
+}
+
+// Record all pending acceleration structure builds, batched by the scratch memory budget, and submit them with a fence
+void AccelerationStructureBuilder::submitOnDevice(VkQueue queue)
+{
+	// Split the pending builds into batches whose combined scratch size fits into the budget
+	// A single build that is larger than the budget gets a batch of it's own
+	std::vector<Batch>& batches = submission.batches;
+	batches.clear();
+	VkDeviceSize poolSize = 0;
+	for (size_t i = 0; i < pendingBuilds.size(); i++) {
+		const VkDeviceSize scratchSize = pendingBuilds[i].scratchSize;
+		if (batches.empty() || measureEachBuild || (batches.back().scratchSize + scratchSize > scratchBudget)) {
+			batches.push_back({ i, 0, 0 });
+		}
+		batches.back().count++;
+		batches.back().scratchSize += scratchSize;
+		poolSize = std::max(poolSize, batches.back().scratchSize);
+	}
+	if (poolSize > scratchBudget) {
+		std::cout << "Acceleration structure scratch size of " << poolSize / (1024 * 1024) << " MB exceeds the budget of " << scratchBudget / (1024 * 1024) << " MB\n";
+	}
+	submission.poolSize = poolSize;
+
+	// Pooled scratch allocation, padded so the first sub-allocation can be aligned
+	// It's kept alive until the builds have finished
+	const VkDeviceSize scratchAlignment = properties.minAccelerationStructureScratchOffsetAlignment;
+	submission.scratchBuffer.reset(new ScratchBuffer(device, poolSize + scratchAlignment));
+	const VkDeviceAddress scratchBaseAddress = vks::tools::alignedVkSize(submission.scratchBuffer->deviceAddress, scratchAlignment);
+
+	// Timestamps are used to measure the device build time per batch
+	const bool timestamps = device->properties.limits.timestampComputeAndGraphics;
+	if (timestamps) {
+		VkQueryPoolCreateInfo queryPoolCI{};
+		queryPoolCI.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolCI.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolCI.queryCount = static_cast<uint32_t>(batches.size()) * 2;
+		VK_CHECK_RESULT(vkCreateQueryPool(device->logicalDevice, &queryPoolCI, nullptr, &submission.queryPool));
+	}
+
+	VkCommandBuffer commandBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	if (timestamps) {
+		vkCmdResetQueryPool(commandBuffer, submission.queryPool, 0, static_cast<uint32_t>(batches.size()) * 2);
+	}
+
+	for (size_t b = 0; b < batches.size(); b++) {
+		const Batch& batch = batches[b];
+
+		if (b > 0) {
+			// The scratch memory is reused by the next batch, so the previous one must have finished
+			VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+			memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+			memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		}
+
+		std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildGeometryInfos(batch.count);
+		std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> buildRangeInfos(batch.count);
+		VkDeviceSize scratchOffset = 0;
+		for (size_t i = 0; i < batch.count; i++) {
+			const PendingBuild& pendingBuild = pendingBuilds[batch.first + i];
+			VkAccelerationStructureBuildGeometryInfoKHR& buildGeometryInfo = buildGeometryInfos[i];
+			buildGeometryInfo = vks::initializers::accelerationStructureBuildGeometryInfoKHR();
+			buildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+			buildGeometryInfo.flags = pendingBuild.input.flags;
+			buildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+			buildGeometryInfo.dstAccelerationStructure = pendingBuild.accelerationStructure->handle;
+			buildGeometryInfo.geometryCount = static_cast<uint32_t>(pendingBuild.input.geometries.size());
+			buildGeometryInfo.pGeometries = pendingBuild.input.geometries.data();
+			buildGeometryInfo.scratchData.deviceAddress = scratchBaseAddress + scratchOffset;
+			buildRangeInfos[i] = pendingBuild.input.buildRanges.data();
+			scratchOffset += pendingBuild.scratchSize;
+		}
+
+		if (timestamps) {
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, submission.queryPool, static_cast<uint32_t>(b) * 2);
+		}
+		vkCmdBuildAccelerationStructuresKHR(commandBuffer, static_cast<uint32_t>(buildGeometryInfos.size()), buildGeometryInfos.data(), buildRangeInfos.data());
+		if (timestamps) {
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, submission.queryPool, static_cast<uint32_t>(b) * 2 + 1);
+		}
+	}
+	submitWithFence(commandBuffer, queue);
+}
+
+// Release the resources of finished device builds and report their build times
+void AccelerationStructureBuilder::finishOnDevice()
+{
+	const std::vector<Batch>& batches = submission.batches;
+	std::vector<uint64_t> timestampValues(batches.size() * 2, 0);
+	const bool timestamps = (submission.queryPool != VK_NULL_HANDLE);
+	if (timestamps) {
+		VK_CHECK_RESULT(vkGetQueryPoolResults(device->logicalDevice, submission.queryPool, 0, static_cast<uint32_t>(timestampValues.size()), timestampValues.size() * sizeof(uint64_t), timestampValues.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+		vkDestroyQueryPool(device->logicalDevice, submission.queryPool, nullptr);
+		submission.queryPool = VK_NULL_HANDLE;
+	}
+	releaseSubmission();
+	submission.scratchBuffer.reset();
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "Built " << pendingBuilds.size() << " bottom level acceleration structures in " << batches.size() << " batch(es), " << submission.poolSize / (1024 * 1024) << " MB pooled scratch memory\n";
+	for (size_t b = 0; b < batches.size(); b++) {
+		BatchStatistics statistics{};
+		statistics.buildCount = static_cast<uint32_t>(batches[b].count);
+		statistics.scratchSize = batches[b].scratchSize;
+		statistics.buildTime = timestamps ? (double)(timestampValues[b * 2 + 1] - timestampValues[b * 2]) * device->properties.limits.timestampPeriod / 1000000.0 : 0.0;
+		batchStatistics.push_back(statistics);
+		std::cout << "  Batch " << b << ": " << statistics.buildCount << " build(s), " << statistics.scratchSize / 1024 << " KB scratch, ";
+		if (timestamps) {
+			std::cout << statistics.buildTime << " ms (device)\n";
+		} else {
+			std::cout << "no device timestamps available\n";
+		}
+	}
+}
+
+AccelerationStructureBuilder::~AccelerationStructureBuilder()
+{
+	// Unfinished compaction is dropped, the acceleration structures it was started for may already have been destroyed
+	if (submission.fence != VK_NULL_HANDLE) {
+		VK_CHECK_RESULT(vkWaitForFences(device->logicalDevice, 1, &submission.fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT));
+		if (submission.stage == Stage::Building) {
+			finishOnDevice();
+		} else {
+			releaseSubmission();
+		}
+	}
+	if (submission.compactedSizeQueryPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(device->logicalDevice, submission.compactedSizeQueryPool, nullptr);
+	}
+	for (auto& accelerationStructure : submission.compacted) {
+		accelerationStructure.destroy();
+	}
+}
+
+void AccelerationStructureBuilder::submit(VkQueue queue)
+{
+	batchStatistics.clear();
+	buildStatistics.clear();
+	buildTime = 0.0;
+	if (pendingBuilds.empty()) {
+		return;
+	}
+
+	submission.stage = Stage::Building;
+	submission.queue = queue;
+	submission.tStart = std::chrono::high_resolution_clock::now();
+	if (hostBuild) {
+		buildOnHost();
+	} else {
+		submitOnDevice(queue);
+	}
+}
+
+bool AccelerationStructureBuilder::poll()
+{
+	if (pendingBuilds.empty()) {
+		return true;
+	}
+	if ((submission.fence != VK_NULL_HANDLE) && (vkGetFenceStatus(device->logicalDevice, submission.fence) != VK_SUCCESS)) {
+		return false;
+	}
+	switch (submission.stage) {
+	case Stage::Building:
+		if (submission.fence != VK_NULL_HANDLE) {
+			finishOnDevice();
+		}
+		buildTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - submission.tStart).count();
+		std::cout << "  Total: " << buildTime << " ms (wall clock)\n";
+		for (size_t i = 0; i < pendingBuilds.size(); i++) {
+			const double time = (measureEachBuild && (i < batchStatistics.size())) ? batchStatistics[i].buildTime : 0.0;
+			buildStatistics.push_back({ pendingBuilds[i].input.name, pendingBuilds[i].accelerationStructure->size, 0, time });
+		}
+		if (compact) {
+			submitCompactedSizeQuery(submission.queue);
+			return false;
+		}
+		break;
+	case Stage::QueryingCompactedSizes:
+		releaseSubmission();
+		submitCompaction(submission.queue);
+		return false;
+	case Stage::Compacting:
+		releaseSubmission();
+		finishCompaction();
+		break;
+	}
+
+	submission.stage = Stage::Building;
+	pendingBuilds.clear();
+	return true;
+}
+
+void AccelerationStructureBuilder::build(VkQueue queue)
+{
+	submit(queue);
+	while (!poll()) {
+		VK_CHECK_RESULT(vkWaitForFences(device->logicalDevice, 1, &submission.fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT));
+	}
+}
@@ -0,0 +1,122 @@
+/* Copyright (c) 2021, Sascha Willems
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <memory>
+
+#include "volk/volk.h"
+#include "VulkanDevice.h"
+#include "VulkanTools.h"
+#include "VulkanInitializers.hpp"
+#include "AccelerationStructure.h"
+#include "ScratchBuffer.h"
+#include "threadpool.hpp"
+
+/*
+	Batches bottom level acceleration structure builds
+	All pending builds are recorded into as few vkCmdBuildAccelerationStructuresKHR calls as the scratch memory budget allows
+	Scratch memory for all builds of a batch is sub-allocated from a single pooled allocation
+	Alternatively builds can be done on the host, with all builds running concurrently via deferred host operations
+	Device builds can also be submitted without waiting for them, the caller then polls for their completion
+*/
+class AccelerationStructureBuilder {
+public:
+	/** @brief Geometry description for a single acceleration structure build */
+	struct BuildInput {
+		std::string name;
+		std::vector<VkAccelerationStructureGeometryKHR> geometries;
+		std::vector<VkAccelerationStructureBuildRangeInfoKHR> buildRanges;
+		VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+	};
+	/** @brief Timing information of a submitted batch */
+	struct BatchStatistics {
+		uint32_t buildCount;
+		VkDeviceSize scratchSize;
+		double buildTime;
+	};
+	/** @brief Size information of a built acceleration structure */
+	struct BuildStatistics {
+		std::string name;
+		VkDeviceSize size;
+		VkDeviceSize compactedSize;
+		// Device time in milliseconds, only measured with measureEachBuild
+		double buildTime;
+	};
+private:
+	struct PendingBuild {
+		BuildInput input;
+		AccelerationStructure* accelerationStructure;
+		VkAccelerationStructureBuildSizesInfoKHR buildSizes;
+		VkDeviceSize scratchSize;
+	};
+	struct Batch {
+		size_t first;
+		size_t count;
+		VkDeviceSize scratchSize;
+	};
+	// Work that has been submitted, but not finished yet
+	// Compaction is split into fenced steps that are advanced by poll(), so callers polling from a frame loop never wait for the device
+	enum class Stage { Building, QueryingCompactedSizes, Compacting };
+	struct Submission {
+		Stage stage = Stage::Building;
+		VkQueue queue = VK_NULL_HANDLE;
+		std::vector<Batch> batches;
+		VkDeviceSize poolSize = 0;
+		std::unique_ptr<ScratchBuffer> scratchBuffer;
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+		std::chrono::time_point<std::chrono::high_resolution_clock> tStart;
+		VkQueryPool compactedSizeQueryPool = VK_NULL_HANDLE;
+		std::vector<VkDeviceSize> compactedSizes;
+		std::vector<AccelerationStructure> compacted;
+	} submission;
+	vks::VulkanDevice* device;
+	VkPhysicalDeviceAccelerationStructurePropertiesKHR properties;
+	std::vector<PendingBuild> pendingBuilds;
+	std::vector<uint32_t> primitiveCounts(const BuildInput& input);
+	void submitWithFence(VkCommandBuffer commandBuffer, VkQueue queue);
+	void releaseSubmission();
+	void submitCompactedSizeQuery(VkQueue queue);
+	void submitCompaction(VkQueue queue);
+	void finishCompaction();
+	void buildOnHost();
+	void submitOnDevice(VkQueue queue);
+	void finishOnDevice();
+public:
+	/** @brief Upper limit for the pooled scratch allocation, builds exceeding it are split into barriered batches */
+	VkDeviceSize scratchBudget = 256 * 1024 * 1024;
+	/** @brief Build with ALLOW_COMPACTION and copy into right-sized acceleration structures afterwards (must be set before adding builds) */
+	bool compact = false;
+	/** @brief Give every build a batch of it's own, so it's device time can be measured (serializes the builds) */
+	bool measureEachBuild = false;
+	/** @brief Build on the host using deferred operations (requires the accelerationStructureHostCommands feature and host addresses for all geometry data, must be set before adding builds) */
+	bool hostBuild = false;
+	/** @brief Wall clock time of the last build in milliseconds, from submitting it until it was found to be finished */
+	double buildTime = 0.0;
+	/** @brief Statistics of the batches submitted by the last build */
+	std::vector<BatchStatistics> batchStatistics;
+	/** @brief Statistics of the acceleration structures built by the last build */
+	std::vector<BuildStatistics> buildStatistics;
+	AccelerationStructureBuilder(vks::VulkanDevice* device, VkPhysicalDeviceAccelerationStructurePropertiesKHR properties);
+	/** @brief Waits for builds that are still in flight */
+	~AccelerationStructureBuilder();
+	/** @brief Creates the acceleration structure for the given input and queues it's build */
+	void add(AccelerationStructure& accelerationStructure, const BuildInput& input);
+	/** @brief Records and submits all pending builds, returns after the device has finished them */
+	void build(VkQueue queue);
+	/** @brief Records and submits all pending builds without waiting for them (host builds still complete before returning) */
+	void submit(VkQueue queue);
+	/** @brief Returns true once the submitted builds and their compaction have finished, advances compaction by one fenced step per call and never blocks */
+	bool poll();
+};
@@ -0,0 +1,244 @@
+/* Copyright (c) 2021, Sascha Willems
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#include "AccelerationStructureCache.h"
+
+// Serialized acceleration structures start with a header defined by the spec:
+// driver UUID, compatibility UUID, serialized size, deserialized size, handle count
+const size_t serializedVersionDataSize = 2 * VK_UUID_SIZE;
+const size_t serializedHeaderSize = serializedVersionDataSize + 3 * sizeof(uint64_t);
+
+AccelerationStructureCache::AccelerationStructureCache(vks::VulkanDevice* device, const std::string& path)
+{
+	this->device = device;
+	this->path = path;
+	// Cached data is only valid for the same device and driver
+	deviceKey = vks::tools::getDeviceCacheKey(device->properties);
+}
+
+std::string AccelerationStructureCache::getFileName(uint64_t key)
+{
+	std::stringstream ss;
+	ss << path << "/" << deviceKey << "_" << std::hex << std::setfill('0') << std::setw(16) << key << ".as";
+	return ss.str();
+}
+
+bool AccelerationStructureCache::load(AccelerationStructure& accelerationStructure, VkAccelerationStructureTypeKHR type, uint64_t key, VkQueue queue)
+{
+	std::ifstream is(getFileName(key), std::ios::binary | std::ios::in | std::ios::ate);
+	if (!is.is_open()) {
+		return false;
+	}
+	const size_t size = static_cast<size_t>(is.tellg());
+	if (size < serializedHeaderSize) {
+		return false;
+	}
+	std::vector<char> data(size);
+	is.seekg(0, std::ios::beg);
+	is.read(data.data(), size);
+	is.close();
+
+	// The driver decides if the serialized data can be restored on this device
+	VkAccelerationStructureVersionInfoKHR versionInfo{};
+	versionInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR;
+	versionInfo.pVersionData = reinterpret_cast<const uint8_t*>(data.data());
+	VkAccelerationStructureCompatibilityKHR compatibility = VK_ACCELERATION_STRUCTURE_COMPATIBILITY_INCOMPATIBLE_KHR;
+	vkGetDeviceAccelerationStructureCompatibilityKHR(device->logicalDevice, &versionInfo, &compatibility);
+	if (compatibility != VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR) {
+		std::cout << "Cached acceleration structure " << getFileName(key) << " is not compatible with this device\n";
+		return false;
+	}
+
+	uint64_t serializedSize, deserializedSize;
+	memcpy(&serializedSize, data.data() + serializedVersionDataSize, sizeof(uint64_t));
+	memcpy(&deserializedSize, data.data() + serializedVersionDataSize + sizeof(uint64_t), sizeof(uint64_t));
+	if (serializedSize != size) {
+		return false;
+	}
+
+	vks::Buffer stagingBuffer;
+	VK_CHECK_RESULT(device->createBuffer(
+		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&stagingBuffer,
+		size,
+		data.data()));
+	VkBufferDeviceAddressInfoKHR bufferDeviceAddressInfo{};
+	bufferDeviceAddressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+	bufferDeviceAddressInfo.buffer = stagingBuffer.buffer;
+
+	accelerationStructure.create(device, type, deserializedSize);
+
+	VkCopyMemoryToAccelerationStructureInfoKHR copyInfo{};
+	copyInfo.sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR;
+	copyInfo.src.deviceAddress = vkGetBufferDeviceAddressKHR(device->logicalDevice, &bufferDeviceAddressInfo);
+	copyInfo.dst = accelerationStructure.handle;
+	copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR;
+	VkCommandBuffer commandBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	vkCmdCopyMemoryToAccelerationStructureKHR(commandBuffer, &copyInfo);
+	device->flushCommandBuffer(commandBuffer, queue);
+
+	stagingBuffer.destroy();
+	return true;
+}
+
+// Get the size required for serialization
+void AccelerationStructureCache::recordSizeQuery(VkCommandBuffer commandBuffer, VkAccelerationStructureKHR handle, VkQueryPool& queryPool)
+{
+	VkQueryPoolCreateInfo queryPoolCI{};
+	queryPoolCI.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCI.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR;
+	queryPoolCI.queryCount = 1;
+	VK_CHECK_RESULT(vkCreateQueryPool(device->logicalDevice, &queryPoolCI, nullptr, &queryPool));
+	vkCmdResetQueryPool(commandBuffer, queryPool, 0, 1);
+	vkCmdWriteAccelerationStructuresPropertiesKHR(commandBuffer, 1, &handle, VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR, queryPool, 0);
+}
+
+// Serialize into a host visible buffer that's created with the queried size
+void AccelerationStructureCache::recordSerialization(VkCommandBuffer commandBuffer, VkAccelerationStructureKHR handle, VkDeviceSize serializedSize, vks::Buffer& stagingBuffer)
+{
+	VK_CHECK_RESULT(device->createBuffer(
+		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&stagingBuffer,
+		serializedSize));
+	VkBufferDeviceAddressInfoKHR bufferDeviceAddressInfo{};
+	bufferDeviceAddressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+	bufferDeviceAddressInfo.buffer = stagingBuffer.buffer;
+
+	VkCopyAccelerationStructureToMemoryInfoKHR copyInfo{};
+	copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR;
+	copyInfo.src = handle;
+	copyInfo.dst.deviceAddress = vkGetBufferDeviceAddressKHR(device->logicalDevice, &bufferDeviceAddressInfo);
+	copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR;
+	vkCmdCopyAccelerationStructureToMemoryKHR(commandBuffer, &copyInfo);
+}
+
+void AccelerationStructureCache::writeFile(uint64_t key, const void* data, VkDeviceSize size)
+{
+	if (!vks::tools::createDirectory(path)) {
+		std::cerr << "Could not create acceleration structure cache directory \"" << path << "\"\n";
+	}
+	std::ofstream os(getFileName(key), std::ios::binary | std::ios::out | std::ios::trunc);
+	if (os.is_open()) {
+		os.write(static_cast<const char*>(data), size);
+		os.close();
+	} else {
+		std::cerr << "Could not write acceleration structure cache file " << getFileName(key) << "\n";
+	}
+}
+
+void AccelerationStructureCache::store(AccelerationStructure& accelerationStructure, uint64_t key, VkQueue queue)
+{
+	VkQueryPool queryPool;
+	VkCommandBuffer commandBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	recordSizeQuery(commandBuffer, accelerationStructure.handle, queryPool);
+	device->flushCommandBuffer(commandBuffer, queue);
+	VkDeviceSize serializedSize = 0;
+	VK_CHECK_RESULT(vkGetQueryPoolResults(device->logicalDevice, queryPool, 0, 1, sizeof(VkDeviceSize), &serializedSize, sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+	vkDestroyQueryPool(device->logicalDevice, queryPool, nullptr);
+
+	vks::Buffer stagingBuffer;
+	commandBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	recordSerialization(commandBuffer, accelerationStructure.handle, serializedSize, stagingBuffer);
+	device->flushCommandBuffer(commandBuffer, queue);
+
+	VK_CHECK_RESULT(stagingBuffer.map());
+	writeFile(key, stagingBuffer.mapped, serializedSize);
+	stagingBuffer.unmap();
+	stagingBuffer.destroy();
+}
+
+void AccelerationStructureCache::submitWithFence(PendingStore& pendingStore, VkQueue queue)
+{
+	VK_CHECK_RESULT(vkEndCommandBuffer(pendingStore.commandBuffer));
+	VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &pendingStore.commandBuffer;
+	VkFenceCreateInfo fenceCI = vks::initializers::fenceCreateInfo(0);
+	VK_CHECK_RESULT(vkCreateFence(device->logicalDevice, &fenceCI, nullptr, &pendingStore.fence));
+	VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, pendingStore.fence));
+}
+
+void AccelerationStructureCache::releaseSubmission(PendingStore& pendingStore)
+{
+	vkDestroyFence(device->logicalDevice, pendingStore.fence, nullptr);
+	pendingStore.fence = VK_NULL_HANDLE;
+	vkFreeCommandBuffers(device->logicalDevice, device->commandPool, 1, &pendingStore.commandBuffer);
+	pendingStore.commandBuffer = VK_NULL_HANDLE;
+}
+
+void AccelerationStructureCache::queueStore(AccelerationStructure& accelerationStructure, uint64_t key, VkQueue queue)
+{
+	std::unique_ptr<PendingStore> pendingStore(new PendingStore());
+	pendingStore->handle = accelerationStructure.handle;
+	pendingStore->key = key;
+	pendingStore->commandBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	recordSizeQuery(pendingStore->commandBuffer, pendingStore->handle, pendingStore->queryPool);
+	submitWithFence(*pendingStore, queue);
+	pendingStores.push_back(std::move(pendingStore));
+}
+
+bool AccelerationStructureCache::poll(VkQueue queue)
+{
+	for (auto& pendingStore : pendingStores) {
+		if ((pendingStore->fence != VK_NULL_HANDLE) && (vkGetFenceStatus(device->logicalDevice, pendingStore->fence) != VK_SUCCESS)) {
+			continue;
+		}
+		switch (pendingStore->stage) {
+		case PendingStore::Stage::QueryingSize:
+			releaseSubmission(*pendingStore);
+			VK_CHECK_RESULT(vkGetQueryPoolResults(device->logicalDevice, pendingStore->queryPool, 0, 1, sizeof(VkDeviceSize), &pendingStore->serializedSize, sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT));
+			vkDestroyQueryPool(device->logicalDevice, pendingStore->queryPool, nullptr);
+			pendingStore->queryPool = VK_NULL_HANDLE;
+			pendingStore->commandBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+			recordSerialization(pendingStore->commandBuffer, pendingStore->handle, pendingStore->serializedSize, pendingStore->stagingBuffer);
+			submitWithFence(*pendingStore, queue);
+			pendingStore->stage = PendingStore::Stage::Serializing;
+			break;
+		case PendingStore::Stage::Serializing: {
+			releaseSubmission(*pendingStore);
+			VK_CHECK_RESULT(pendingStore->stagingBuffer.map());
+			if (!writer) {
+				writer.reset(new vks::Thread());
+			}
+			PendingStore* store = pendingStore.get();
+			writer->addJob([this, store] {
+				writeFile(store->key, store->stagingBuffer.mapped, store->serializedSize);
+				store->written = true;
+			});
+			pendingStore->stage = PendingStore::Stage::Writing;
+			break;
+		}
+		case PendingStore::Stage::Writing:
+			if (pendingStore->written) {
+				pendingStore->stagingBuffer.unmap();
+				pendingStore->stagingBuffer.destroy();
+				pendingStore.reset();
+			}
+			break;
+		}
+	}
+	pendingStores.erase(std::remove(pendingStores.begin(), pendingStores.end(), nullptr), pendingStores.end());
+	return pendingStores.empty();
+}
+
+AccelerationStructureCache::~AccelerationStructureCache()
+{
+	// Files that are being written are finished, device work that's still in flight is waited for and dropped
+	writer.reset();
+	for (auto& pendingStore : pendingStores) {
+		if (pendingStore->fence != VK_NULL_HANDLE) {
+			VK_CHECK_RESULT(vkWaitForFences(device->logicalDevice, 1, &pendingStore->fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT));
+			releaseSubmission(*pendingStore);
+		}
+		if (pendingStore->queryPool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device->logicalDevice, pendingStore->queryPool, nullptr);
+		}
+		pendingStore->stagingBuffer.unmap();
+		pendingStore->stagingBuffer.destroy();
+	}
+}
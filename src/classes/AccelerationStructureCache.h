@@ -0,0 +1,70 @@
+/* Copyright (c) 2021, Sascha Willems
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <atomic>
+
+#include "volk/volk.h"
+#include "VulkanDevice.h"
+#include "VulkanTools.h"
+#include "AccelerationStructure.h"
+#include "threadpool.hpp"
+
+/*
+	Persistent on-disk cache for built acceleration structures
+	Acceleration structures are serialized with vkCmdCopyAccelerationStructureToMemoryKHR and restored with vkCmdCopyMemoryToAccelerationStructureKHR
+	Files are keyed by the device's pipeline cache UUID, the driver version and a caller supplied content key
+	Stores can also be queued, they are then advanced by polling in fenced steps and the files are written on a worker thread
+*/
+class AccelerationStructureCache {
+private:
+	// Serialization queued with queueStore()
+	struct PendingStore {
+		enum class Stage { QueryingSize, Serializing, Writing };
+		Stage stage = Stage::QueryingSize;
+		VkAccelerationStructureKHR handle = VK_NULL_HANDLE;
+		uint64_t key = 0;
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+		vks::Buffer stagingBuffer;
+		VkDeviceSize serializedSize = 0;
+		// Set by the worker thread once the file has been written
+		std::atomic<bool> written{ false };
+	};
+	vks::VulkanDevice* device;
+	std::string path;
+	std::string deviceKey;
+	std::vector<std::unique_ptr<PendingStore>> pendingStores;
+	// Only created once a store is queued
+	std::unique_ptr<vks::Thread> writer;
+	std::string getFileName(uint64_t key);
+	void recordSizeQuery(VkCommandBuffer commandBuffer, VkAccelerationStructureKHR handle, VkQueryPool& queryPool);
+	void recordSerialization(VkCommandBuffer commandBuffer, VkAccelerationStructureKHR handle, VkDeviceSize serializedSize, vks::Buffer& stagingBuffer);
+	void writeFile(uint64_t key, const void* data, VkDeviceSize size);
+	void submitWithFence(PendingStore& pendingStore, VkQueue queue);
+	void releaseSubmission(PendingStore& pendingStore);
+public:
+	AccelerationStructureCache(vks::VulkanDevice* device, const std::string& path);
+	/** @brief Waits for queued stores that are still in flight */
+	~AccelerationStructureCache();
+	/** @brief Creates and restores the acceleration structure for the given key, returns false if there is no compatible cache entry */
+	bool load(AccelerationStructure& accelerationStructure, VkAccelerationStructureTypeKHR type, uint64_t key, VkQueue queue);
+	/** @brief Serializes a built acceleration structure to the cache, returns after the file has been written */
+	void store(AccelerationStructure& accelerationStructure, uint64_t key, VkQueue queue);
+	/** @brief Submits the serialization size query of a built acceleration structure, the store is finished by later calls to poll() */
+	void queueStore(AccelerationStructure& accelerationStructure, uint64_t key, VkQueue queue);
+	/** @brief Advances queued stores whose device work has finished without waiting, returns true once no stores are left */
+	bool poll(VkQueue queue);
+};
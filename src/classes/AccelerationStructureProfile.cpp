@@ -0,0 +1,111 @@
+/* Copyright (c) 2021, Sascha Willems
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#include "AccelerationStructureProfile.h"
+
+AccelerationStructureProfile::AccelerationStructureProfile(vks::VulkanDevice* device, const std::string& path)
+{
+	this->device = device;
+	this->path = path;
+	// Build performance depends on the device and driver
+	deviceKey = vks::tools::getDeviceCacheKey(device->properties);
+}
+
+std::string AccelerationStructureProfile::getFileName(uint64_t key)
+{
+	std::stringstream ss;
+	ss << path << "/" << deviceKey << "_" << std::hex << std::setfill('0') << std::setw(16) << key << ".profile";
+	return ss.str();
+}
+
+std::vector<AccelerationStructureProfile::Candidate> AccelerationStructureProfile::candidates()
+{
+	return {
+		{ "fast trace", VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR, false },
+		{ "fast trace, compacted", VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR, true },
+		{ "fast build", VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR, false },
+		{ "fast build, low memory", VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_LOW_MEMORY_BIT_KHR, false },
+		{ "low memory, compacted", VK_BUILD_ACCELERATION_STRUCTURE_LOW_MEMORY_BIT_KHR, true },
+	};
+}
+
+void AccelerationStructureProfile::select(const std::vector<Measurement>& measurements, uint32_t frameCount)
+{
+	size_t best = 0;
+	double bestCost = 0.0;
+	for (size_t i = 0; i < measurements.size(); i++) {
+		const double cost = measurements[i].buildTime + measurements[i].traceTime * frameCount;
+		// Ties go to the smaller acceleration structures
+		if ((i == 0) || (cost < bestCost) || ((cost == bestCost) && (measurements[i].size < measurements[best].size))) {
+			best = i;
+			bestCost = cost;
+		}
+	}
+	if (!measurements.empty()) {
+		selected = measurements[best].candidate;
+	}
+}
+
+bool AccelerationStructureProfile::load(uint64_t key)
+{
+	std::ifstream is(getFileName(key));
+	if (!is.is_open()) {
+		return false;
+	}
+	// Damaged or hand edited profiles keep the defaults
+	Candidate candidate = selected;
+	bool hasFlags = false;
+	std::string line;
+	while (std::getline(is, line)) {
+		const size_t separator = line.find('=');
+		if (separator == std::string::npos) {
+			continue;
+		}
+		const std::string name = line.substr(0, separator);
+		const std::string value = line.substr(separator + 1);
+		if (name == "name") {
+			candidate.name = value;
+		}
+		if (name == "flags") {
+			char* end;
+			const unsigned long flags = strtoul(value.c_str(), &end, 10);
+			if ((end == value.c_str()) || (*end != '\0')) {
+				std::cerr << "Invalid build flags \"" << value << "\" in acceleration structure profile " << getFileName(key) << "\n";
+				return false;
+			}
+			candidate.flags = static_cast<VkBuildAccelerationStructureFlagsKHR>(flags);
+			hasFlags = true;
+		}
+		if (name == "compact") {
+			candidate.compact = (value == "1");
+		}
+	}
+	if (hasFlags) {
+		selected = candidate;
+	}
+	return hasFlags;
+}
+
+void AccelerationStructureProfile::store(uint64_t key, const std::vector<Measurement>& measurements, uint32_t frameCount)
+{
+	if (!vks::tools::createDirectory(path)) {
+		std::cerr << "Could not create acceleration structure profile directory \"" << path << "\"\n";
+	}
+	std::ofstream os(getFileName(key), std::ios::out | std::ios::trunc);
+	if (!os.is_open()) {
+		std::cerr << "Could not write acceleration structure profile " << getFileName(key) << "\n";
+		return;
+	}
+	os << "name=" << selected.name << "\n";
+	os << "flags=" << selected.flags << "\n";
+	os << "compact=" << (selected.compact ? 1 : 0) << "\n";
+	// Measurements are informational only and ignored when loading
+	os << "frames=" << frameCount << "\n";
+	os << std::fixed << std::setprecision(3);
+	for (auto& measurement : measurements) {
+		os << "# " << measurement.candidate.name << ": build " << measurement.buildTime << " ms, trace " << measurement.traceTime << " ms/frame, " << measurement.size / 1024 << " KB\n";
+	}
+}
@@ -0,0 +1,61 @@
+/* Copyright (c) 2021, Sascha Willems
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <fstream>
+#include <iostream>
+#include <cstdlib>
+
+#include "volk/volk.h"
+#include "VulkanDevice.h"
+#include "VulkanTools.h"
+
+/*
+	Per scene build flags for bottom level acceleration structures, as picked by an autotuning run
+	Profiles are stored as small text files next to the acceleration structure cache
+	Like cached acceleration structures they are keyed by the device's pipeline cache UUID, the driver version and a caller supplied scene key
+*/
+class AccelerationStructureProfile {
+public:
+	/** @brief Build flag combination that is evaluated by the autotuner */
+	struct Candidate {
+		std::string name;
+		VkBuildAccelerationStructureFlagsKHR flags;
+		bool compact;
+	};
+	/** @brief Measured cost of building and tracing the scene with a candidate */
+	struct Measurement {
+		Candidate candidate;
+		// Wall clock time for building all bottom level acceleration structures (including compaction) in milliseconds
+		double buildTime;
+		// Device time of a single ray tracing frame in milliseconds
+		double traceTime;
+		// Total size of all bottom level acceleration structures
+		VkDeviceSize size;
+	};
+private:
+	vks::VulkanDevice* device;
+	std::string path;
+	std::string deviceKey;
+	std::string getFileName(uint64_t key);
+public:
+	/** @brief Selected candidate, valid after a successful load or select */
+	Candidate selected{ "fast trace", VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR, false };
+	AccelerationStructureProfile(vks::VulkanDevice* device, const std::string& path);
+	/** @brief Flag combinations evaluated by the autotuner */
+	static std::vector<Candidate> candidates();
+	/** @brief Selects the candidate with the lowest build time plus trace time for the given number of frames */
+	void select(const std::vector<Measurement>& measurements, uint32_t frameCount);
+	/** @brief Reads the profile for the given scene key, returns false if there is none */
+	bool load(uint64_t key);
+	/** @brief Writes the selected candidate and the measurements it was picked from */
+	void store(uint64_t key, const std::vector<Measurement>& measurements, uint32_t frameCount);
+};
@@ -0,0 +1,270 @@
+/* Copyright (c) 2021, Sascha Willems
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#include "AccelerationStructureReport.h"
+
+void AccelerationStructureReport::Bounds::grow(const glm::vec3& point)
+{
+	min = glm::min(min, point);
+	max = glm::max(max, point);
+}
+
+void AccelerationStructureReport::Bounds::grow(const Bounds& bounds)
+{
+	min = glm::min(min, bounds.min);
+	max = glm::max(max, bounds.max);
+}
+
+bool AccelerationStructureReport::Bounds::valid() const
+{
+	return (min.x <= max.x) && (min.y <= max.y) && (min.z <= max.z);
+}
+
+float AccelerationStructureReport::Bounds::surfaceArea() const
+{
+	if (!valid()) {
+		return 0.0f;
+	}
+	const glm::vec3 extent = max - min;
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+float AccelerationStructureReport::Bounds::volume() const
+{
+	if (!valid()) {
+		return 0.0f;
+	}
+	const glm::vec3 extent = max - min;
+	return extent.x * extent.y * extent.z;
+}
+
+// Top-down binned SAH build over the primitives' bounds, only the cost of the resulting tree is kept
+// Nodes are split along the longest axis of their centroid bounds until they fit into a leaf
+double AccelerationStructureReport::estimateSAHCost(const std::vector<Bounds>& primitives)
+{
+	if (primitives.empty()) {
+		return 0.0;
+	}
+	const uint32_t primitiveCount = static_cast<uint32_t>(primitives.size());
+	std::vector<uint32_t> indices(primitiveCount);
+	std::iota(indices.begin(), indices.end(), 0);
+	std::vector<glm::vec3> centroids(primitiveCount);
+	Bounds rootBounds;
+	for (uint32_t i = 0; i < primitiveCount; i++) {
+		centroids[i] = (primitives[i].min + primitives[i].max) * 0.5f;
+		rootBounds.grow(primitives[i]);
+	}
+	const double rootArea = std::max(static_cast<double>(rootBounds.surfaceArea()), static_cast<double>(FLT_MIN));
+
+	struct Bin {
+		Bounds bounds;
+		uint32_t count = 0;
+	};
+	std::vector<Bin> bins(binCount);
+	std::vector<float> rightAreas(binCount);
+	std::vector<uint32_t> rightCounts(binCount);
+
+	double cost = 0.0;
+	// Ranges of the index array that still have to be split
+	std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0, primitiveCount } };
+	while (!stack.empty()) {
+		const uint32_t first = stack.back().first;
+		const uint32_t count = stack.back().second;
+		stack.pop_back();
+
+		Bounds bounds;
+		Bounds centroidBounds;
+		for (uint32_t i = first; i < first + count; i++) {
+			bounds.grow(primitives[indices[i]]);
+			centroidBounds.grow(centroids[indices[i]]);
+		}
+		const double area = bounds.surfaceArea() / rootArea;
+
+		const glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+		const uint32_t axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : ((extent.y > extent.z) ? 1 : 2);
+		// Primitives with coincident centroids can't be split by position
+		if ((count <= maxLeafSize) || (extent[axis] <= 0.0f)) {
+			cost += intersectionCost * count * area;
+			continue;
+		}
+
+		for (auto& bin : bins) {
+			bin = Bin();
+		}
+		const float binScale = binCount / extent[axis];
+		auto getBin = [&](uint32_t index) {
+			return std::min(static_cast<uint32_t>((centroids[index][axis] - centroidBounds.min[axis]) * binScale), binCount - 1);
+		};
+		for (uint32_t i = first; i < first + count; i++) {
+			Bin& bin = bins[getBin(indices[i])];
+			bin.bounds.grow(primitives[indices[i]]);
+			bin.count++;
+		}
+		// Sweep from the right to get the bounds of all bins right of a split, then from the left to evaluate the splits
+		Bounds right;
+		uint32_t rightCount = 0;
+		for (uint32_t b = binCount - 1; b > 0; b--) {
+			right.grow(bins[b].bounds);
+			rightCount += bins[b].count;
+			rightAreas[b] = right.surfaceArea();
+			rightCounts[b] = rightCount;
+		}
+		Bounds left;
+		uint32_t leftCount = 0;
+		uint32_t bestSplit = 0;
+		double bestCost = DBL_MAX;
+		for (uint32_t b = 1; b < binCount; b++) {
+			left.grow(bins[b - 1].bounds);
+			leftCount += bins[b - 1].count;
+			if ((leftCount == 0) || (rightCounts[b] == 0)) {
+				continue;
+			}
+			const double splitCost = static_cast<double>(left.surfaceArea()) * leftCount + static_cast<double>(rightAreas[b]) * rightCounts[b];
+			if (splitCost < bestCost) {
+				bestCost = splitCost;
+				bestSplit = b;
+			}
+		}
+		if (bestSplit == 0) {
+			cost += intersectionCost * count * area;
+			continue;
+		}
+
+		cost += traversalCost * area;
+		const uint32_t middle = static_cast<uint32_t>(std::partition(indices.begin() + first, indices.begin() + first + count, [&](uint32_t index) { return getBin(index) < bestSplit; }) - indices.begin());
+		stack.push_back({ first, middle - first });
+		stack.push_back({ middle, first + count - middle });
+	}
+	return cost;
+}
+
+// Pairs are found with a sweep along the x axis, so only bounds overlapping on that axis are tested
+double AccelerationStructureReport::getOverlapRatio(const std::vector<Bounds>& bounds)
+{
+	std::vector<uint32_t> order(bounds.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return bounds[a].min.x < bounds[b].min.x; });
+	double totalVolume = 0.0;
+	double overlapVolume = 0.0;
+	for (size_t i = 0; i < order.size(); i++) {
+		const Bounds& a = bounds[order[i]];
+		totalVolume += a.volume();
+		for (size_t j = i + 1; (j < order.size()) && (bounds[order[j]].min.x <= a.max.x); j++) {
+			Bounds intersection;
+			intersection.min = glm::max(a.min, bounds[order[j]].min);
+			intersection.max = glm::min(a.max, bounds[order[j]].max);
+			overlapVolume += intersection.volume();
+		}
+	}
+	return (totalVolume > 0.0) ? overlapVolume / totalVolume : 0.0;
+}
+
+void AccelerationStructureReport::analyzeBottomLevel(uint32_t index, const AccelerationStructureBuilder::BuildInput& hostInput)
+{
+	if (bottomLevel.size() <= index) {
+		bottomLevel.resize(index + 1);
+	}
+	BottomLevel& entry = bottomLevel[index];
+	entry.name = hostInput.name;
+	entry.triangleCount = 0;
+	entry.bounds = Bounds();
+
+	// Positions are the first three floats of every vertex for all vertex formats used by the scene
+	std::vector<Bounds> triangles;
+	for (size_t g = 0; g < hostInput.geometries.size(); g++) {
+		const VkAccelerationStructureGeometryTrianglesDataKHR& data = hostInput.geometries[g].geometry.triangles;
+		const VkAccelerationStructureBuildRangeInfoKHR& buildRange = hostInput.buildRanges[g];
+		const uint8_t* vertexData = static_cast<const uint8_t*>(data.vertexData.hostAddress);
+		const uint8_t* indexData = static_cast<const uint8_t*>(data.indexData.hostAddress);
+		if (!vertexData) {
+			continue;
+		}
+		for (uint32_t t = 0; t < buildRange.primitiveCount; t++) {
+			Bounds triangle;
+			for (uint32_t v = 0; v < 3; v++) {
+				uint32_t vertexIndex = t * 3 + v;
+				const uint8_t* vertex = nullptr;
+				if (data.indexType == VK_INDEX_TYPE_NONE_KHR) {
+					// Non-indexed geometry starts at the range's primitive offset
+					vertex = vertexData + buildRange.primitiveOffset + (buildRange.firstVertex + vertexIndex) * data.vertexStride;
+				} else {
+					if (data.indexType == VK_INDEX_TYPE_UINT16) {
+						vertexIndex = reinterpret_cast<const uint16_t*>(indexData + buildRange.primitiveOffset)[vertexIndex];
+					} else {
+						vertexIndex = reinterpret_cast<const uint32_t*>(indexData + buildRange.primitiveOffset)[vertexIndex];
+					}
+					vertex = vertexData + (buildRange.firstVertex + vertexIndex) * data.vertexStride;
+				}
+				const float* position = reinterpret_cast<const float*>(vertex);
+				triangle.grow(glm::vec3(position[0], position[1], position[2]));
+			}
+			triangles.push_back(triangle);
+			entry.bounds.grow(triangle);
+		}
+		entry.triangleCount += buildRange.primitiveCount;
+	}
+	entry.sahCost = estimateSAHCost(triangles);
+}
+
+void AccelerationStructureReport::analyzeTopLevel(const std::vector<VkAccelerationStructureInstanceKHR>& instances, VkDeviceSize size, double buildTime)
+{
+	// World space bounds of the bottom level bounds' corners, inactive instances are skipped like in the traversal
+	std::vector<Bounds> instanceBounds;
+	for (auto& instance : instances) {
+		if ((instance.accelerationStructureReference == 0) || (instance.instanceCustomIndex >= bottomLevel.size()) || !bottomLevel[instance.instanceCustomIndex].bounds.valid()) {
+			continue;
+		}
+		const Bounds& local = bottomLevel[instance.instanceCustomIndex].bounds;
+		const float(*m)[4] = instance.transform.matrix;
+		Bounds world;
+		for (uint32_t c = 0; c < 8; c++) {
+			const glm::vec3 corner((c & 1) ? local.max.x : local.min.x, (c & 2) ? local.max.y : local.min.y, (c & 4) ? local.max.z : local.min.z);
+			world.grow(glm::vec3(
+				m[0][0] * corner.x + m[0][1] * corner.y + m[0][2] * corner.z + m[0][3],
+				m[1][0] * corner.x + m[1][1] * corner.y + m[1][2] * corner.z + m[1][3],
+				m[2][0] * corner.x + m[2][1] * corner.y + m[2][2] * corner.z + m[2][3]));
+		}
+		instanceBounds.push_back(world);
+	}
+	topLevel.instanceCount = static_cast<uint32_t>(instanceBounds.size());
+	topLevel.size = size;
+	topLevel.buildTime = buildTime;
+	topLevel.sahCost = estimateSAHCost(instanceBounds);
+	topLevel.overlapRatio = getOverlapRatio(instanceBounds);
+}
+
+bool AccelerationStructureReport::writeJSON(const std::string& fileName)
+{
+	std::ofstream os(fileName, std::ios::out | std::ios::trunc);
+	if (!os.is_open()) {
+		std::cerr << "Could not write acceleration structure report " << fileName << "\n";
+		return false;
+	}
+	auto escape = [](const std::string& value) {
+		std::string escaped;
+		for (char c : value) {
+			if ((c == '"') || (c == '\\')) {
+				escaped += '\\';
+			}
+			escaped += c;
+		}
+		return escaped;
+	};
+	os << std::fixed << std::setprecision(4);
+	os << "{\n";
+	os << "\t\"bottomLevel\": [\n";
+	for (size_t i = 0; i < bottomLevel.size(); i++) {
+		const BottomLevel& entry = bottomLevel[i];
+		os << "\t\t{ \"name\": \"" << escape(entry.name) << "\", \"triangles\": " << entry.triangleCount << ", \"size\": " << entry.size << ", \"compactedSize\": " << entry.compactedSize
+			<< ", \"buildTimeMs\": " << entry.buildTime << ", \"sahCost\": " << entry.sahCost << " }" << ((i + 1 < bottomLevel.size()) ? "," : "") << "\n";
+	}
+	os << "\t],\n";
+	os << "\t\"topLevel\": { \"instances\": " << topLevel.instanceCount << ", \"size\": " << topLevel.size << ", \"buildTimeMs\": " << topLevel.buildTime
+		<< ", \"sahCost\": " << topLevel.sahCost << ", \"instanceOverlapRatio\": " << topLevel.overlapRatio << " }\n";
+	os << "}\n";
+	std::cout << "Acceleration structure report written to " << fileName << "\n";
+	return true;
+}
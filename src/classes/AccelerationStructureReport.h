@@ -0,0 +1,79 @@
+/* Copyright (c) 2021, Sascha Willems
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <numeric>
+#include <cfloat>
+
+#include "volk/volk.h"
+#include "VulkanTools.h"
+#include "AccelerationStructureBuilder.h"
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+/*
+	Statistics and quality estimates for the scene's acceleration structures
+	The layout of driver built acceleration structures is opaque, so their quality is estimated with the surface area heuristic (SAH) cost of a binned SAH BVH built on the host from the same geometry
+	Costs are relative to the root's surface area, so they can be compared between acceleration structures of different size
+	The instance overlap ratio is the summed pairwise intersection volume of the instances' world space bounds divided by their summed volume, high values mean rays have to visit many instances at the same point
+*/
+class AccelerationStructureReport {
+public:
+	struct Bounds {
+		glm::vec3 min = glm::vec3(FLT_MAX);
+		glm::vec3 max = glm::vec3(-FLT_MAX);
+		void grow(const glm::vec3& point);
+		void grow(const Bounds& bounds);
+		bool valid() const;
+		float surfaceArea() const;
+		float volume() const;
+	};
+	struct BottomLevel {
+		std::string name;
+		uint64_t triangleCount = 0;
+		VkDeviceSize size = 0;
+		// 0 if the acceleration structure wasn't compacted
+		VkDeviceSize compactedSize = 0;
+		// Device time in milliseconds
+		double buildTime = 0.0;
+		double sahCost = 0.0;
+		Bounds bounds;
+	};
+	struct TopLevel {
+		uint32_t instanceCount = 0;
+		VkDeviceSize size = 0;
+		// Wall clock time in milliseconds
+		double buildTime = 0.0;
+		double sahCost = 0.0;
+		double overlapRatio = 0.0;
+	};
+private:
+	double estimateSAHCost(const std::vector<Bounds>& primitives);
+	static double getOverlapRatio(const std::vector<Bounds>& bounds);
+public:
+	std::vector<BottomLevel> bottomLevel;
+	TopLevel topLevel;
+	/** @brief Cost of visiting an inner node relative to intersecting a primitive */
+	float traversalCost = 1.0f;
+	float intersectionCost = 1.0f;
+	/** @brief Nodes with at most this number of primitives become leaves of the host BVH */
+	uint32_t maxLeafSize = 4;
+	uint32_t binCount = 16;
+	/** @brief Gathers the triangle count, bounds and SAH cost of a bottom level acceleration structure from a build input with host addresses */
+	void analyzeBottomLevel(uint32_t index, const AccelerationStructureBuilder::BuildInput& hostInput);
+	/** @brief Gathers the instance count, overlap ratio and SAH cost of the top level acceleration structure, instances reference the bottom levels via their custom index */
+	void analyzeTopLevel(const std::vector<VkAccelerationStructureInstanceKHR>& instances, VkDeviceSize size, double buildTime);
+	bool writeJSON(const std::string& fileName);
+};
@@ -0,0 +1,287 @@
+/* Copyright (c) 2021, Sascha Willems
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define ACCESSOR_DECODER_SSE2
+#include <emmintrin.h>
+#endif
+
+/*
+	Decoding of glTF accessor data into interleaved vertices and 32-bit indices
+	Decoders are instantiated per component type, component count and destination stride, so the loops over the elements don't branch on the accessor's layout
+	Elements are converted and indices are widened with SSE2 if the compiler targets it, the scalar decoder is the fallback for other architectures
+	Both decoders produce identical results, normalized integers are scaled by the reciprocal of their maximum in both
+*/
+namespace AccessorDecoder
+{
+	// Component types as defined by the glTF specification
+	enum ComponentType {
+		Byte = 5120,
+		UnsignedByte = 5121,
+		Short = 5122,
+		UnsignedShort = 5123,
+		UnsignedInt = 5125,
+		Float = 5126
+	};
+
+	// Normalized unsigned integers map to [0, 1], signed ones to [-1, 1]
+	template<typename T, bool Normalized>
+	inline float toFloat(T value)
+	{
+		if (!Normalized || std::numeric_limits<T>::is_iec559) {
+			return static_cast<float>(value);
+		}
+		return std::max(static_cast<float>(value) * (1.0f / static_cast<float>(std::numeric_limits<T>::max())), -1.0f);
+	}
+
+	struct Scalar {
+		template<typename T, uint32_t Components, bool Normalized, size_t DstStride>
+		static void decode(const uint8_t* src, size_t srcStride, size_t count, uint8_t* dst)
+		{
+			for (size_t i = 0; i < count; i++) {
+				T in[Components];
+				memcpy(in, src + i * srcStride, sizeof(in));
+				float out[Components];
+				for (uint32_t c = 0; c < Components; c++) {
+					out[c] = toFloat<T, Normalized>(in[c]);
+				}
+				memcpy(dst + i * DstStride, out, sizeof(out));
+			}
+		}
+
+		template<typename T>
+		static void widenIndices(const T* src, size_t count, uint32_t* dst)
+		{
+			for (size_t i = 0; i < count; i++) {
+				dst[i] = static_cast<uint32_t>(src[i]);
+			}
+		}
+
+		// Zero length vectors are left untouched
+		template<size_t Stride>
+		static void normalizeVec3(uint8_t* data, size_t count)
+		{
+			for (size_t i = 0; i < count; i++) {
+				float v[3];
+				memcpy(v, data + i * Stride, sizeof(v));
+				const float lengthSquared = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+				if (lengthSquared > 0.0f) {
+					const float scale = 1.0f / std::sqrt(lengthSquared);
+					v[0] *= scale;
+					v[1] *= scale;
+					v[2] *= scale;
+					memcpy(data + i * Stride, v, sizeof(v));
+				}
+			}
+		}
+	};
+
+#if defined(ACCESSOR_DECODER_SSE2)
+	struct Simd {
+		// Converts four components to float, components beyond the element's own are garbage and never stored
+		// Reading four components of an element stays within the next element, so this may be used for all but the last element of an accessor
+		template<typename T>
+		static __m128 load(const uint8_t* src)
+		{
+			if (std::numeric_limits<T>::is_iec559) {
+				return _mm_loadu_ps(reinterpret_cast<const float*>(src));
+			}
+			int64_t packed = 0;
+			memcpy(&packed, src, 4 * sizeof(T));
+			__m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(&packed));
+			const __m128i zero = _mm_setzero_si128();
+			if (sizeof(T) == 1) {
+				if (std::numeric_limits<T>::is_signed) {
+					// Sign extension by shifting the byte into the top of each lane
+					v = _mm_unpacklo_epi8(v, v);
+					v = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 24);
+				} else {
+					v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(v, zero), zero);
+				}
+			} else {
+				if (std::numeric_limits<T>::is_signed) {
+					v = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+				} else {
+					v = _mm_unpacklo_epi16(v, zero);
+				}
+			}
+			return _mm_cvtepi32_ps(v);
+		}
+
+		// Only the element's components are written, the following vertex members may already have been decoded
+		template<uint32_t Components>
+		static void store(uint8_t* dst, __m128 v)
+		{
+			switch (Components) {
+			case 4:
+				_mm_storeu_ps(reinterpret_cast<float*>(dst), v);
+				break;
+			case 3:
+				_mm_storel_pi(reinterpret_cast<__m64*>(dst), v);
+				_mm_store_ss(reinterpret_cast<float*>(dst) + 2, _mm_movehl_ps(v, v));
+				break;
+			case 2:
+				_mm_storel_pi(reinterpret_cast<__m64*>(dst), v);
+				break;
+			default:
+				_mm_store_ss(reinterpret_cast<float*>(dst), v);
+				break;
+			}
+		}
+
+		template<typename T, uint32_t Components, bool Normalized, size_t DstStride>
+		static void decode(const uint8_t* src, size_t srcStride, size_t count, uint8_t* dst)
+		{
+			if (count == 0) {
+				return;
+			}
+			const bool scaled = Normalized && !std::numeric_limits<T>::is_iec559;
+			const __m128 scale = _mm_set1_ps(1.0f / static_cast<float>(std::numeric_limits<T>::max()));
+			const __m128 minimum = _mm_set1_ps(-1.0f);
+			for (size_t i = 0; i < count - 1; i++) {
+				__m128 v = load<T>(src + i * srcStride);
+				if (scaled) {
+					v = _mm_mul_ps(v, scale);
+					if (std::numeric_limits<T>::is_signed) {
+						v = _mm_max_ps(v, minimum);
+					}
+				}
+				store<Components>(dst + i * DstStride, v);
+			}
+			// The last element may end the buffer
+			Scalar::decode<T, Components, Normalized, DstStride>(src + (count - 1) * srcStride, srcStride, 1, dst + (count - 1) * DstStride);
+		}
+
+		static void widenIndices(const uint32_t* src, size_t count, uint32_t* dst)
+		{
+			memcpy(dst, src, count * sizeof(uint32_t));
+		}
+
+		static void widenIndices(const uint16_t* src, size_t count, uint32_t* dst)
+		{
+			size_t i = 0;
+			const __m128i zero = _mm_setzero_si128();
+			for (; i + 8 <= count; i += 8) {
+				const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi16(v, zero));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), _mm_unpackhi_epi16(v, zero));
+			}
+			Scalar::widenIndices(src + i, count - i, dst + i);
+		}
+
+		static void widenIndices(const uint8_t* src, size_t count, uint32_t* dst)
+		{
+			size_t i = 0;
+			const __m128i zero = _mm_setzero_si128();
+			for (; i + 16 <= count; i += 16) {
+				const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+				const __m128i low = _mm_unpacklo_epi8(v, zero);
+				const __m128i high = _mm_unpackhi_epi8(v, zero);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi16(low, zero));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), _mm_unpackhi_epi16(low, zero));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpacklo_epi16(high, zero));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 12), _mm_unpackhi_epi16(high, zero));
+			}
+			Scalar::widenIndices(src + i, count - i, dst + i);
+		}
+
+		// Four vectors are normalized at once, with the same operation order as the scalar decoder so the results match
+		template<size_t Stride>
+		static void normalizeVec3(uint8_t* data, size_t count)
+		{
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 one = _mm_set1_ps(1.0f);
+			size_t i = 0;
+			for (; i + 4 <= count; i += 4) {
+				float* v[4];
+				for (uint32_t j = 0; j < 4; j++) {
+					v[j] = reinterpret_cast<float*>(data + (i + j) * Stride);
+				}
+				__m128 x = _mm_setr_ps(v[0][0], v[1][0], v[2][0], v[3][0]);
+				__m128 y = _mm_setr_ps(v[0][1], v[1][1], v[2][1], v[3][1]);
+				__m128 z = _mm_setr_ps(v[0][2], v[1][2], v[2][2], v[3][2]);
+				const __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+				// Zero length vectors are scaled by one, which leaves them untouched
+				const __m128 mask = _mm_cmpgt_ps(lengthSquared, zero);
+				const __m128 scale = _mm_or_ps(_mm_and_ps(mask, _mm_div_ps(one, _mm_sqrt_ps(lengthSquared))), _mm_andnot_ps(mask, one));
+				x = _mm_mul_ps(x, scale);
+				y = _mm_mul_ps(y, scale);
+				z = _mm_mul_ps(z, scale);
+				// Transpose back to one vector per register
+				const __m128 xy01 = _mm_unpacklo_ps(x, y);
+				const __m128 xy23 = _mm_unpackhi_ps(x, y);
+				store<3>(reinterpret_cast<uint8_t*>(v[0]), _mm_movelh_ps(xy01, _mm_shuffle_ps(z, z, _MM_SHUFFLE(0, 0, 0, 0))));
+				store<3>(reinterpret_cast<uint8_t*>(v[1]), _mm_shuffle_ps(xy01, _mm_shuffle_ps(z, z, _MM_SHUFFLE(1, 1, 1, 1)), _MM_SHUFFLE(1, 0, 3, 2)));
+				store<3>(reinterpret_cast<uint8_t*>(v[2]), _mm_movelh_ps(xy23, _mm_shuffle_ps(z, z, _MM_SHUFFLE(2, 2, 2, 2))));
+				store<3>(reinterpret_cast<uint8_t*>(v[3]), _mm_shuffle_ps(xy23, _mm_shuffle_ps(z, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(1, 0, 3, 2)));
+			}
+			Scalar::normalizeVec3<Stride>(data + i * Stride, count - i);
+		}
+	};
+	typedef Simd Native;
+#else
+	typedef Scalar Native;
+#endif
+
+	/** @brief Decodes count elements with Components components into floats written DstStride bytes apart, returns false for component types not allowed for vertex attributes */
+	template<uint32_t Components, size_t DstStride, typename Decoder = Native>
+	bool decodeAttribute(int componentType, bool normalized, const uint8_t* src, size_t srcStride, size_t count, uint8_t* dst)
+	{
+		switch (componentType) {
+		case Float:
+			Decoder::template decode<float, Components, false, DstStride>(src, srcStride, count, dst);
+			return true;
+		case UnsignedByte:
+			normalized ? Decoder::template decode<uint8_t, Components, true, DstStride>(src, srcStride, count, dst) : Decoder::template decode<uint8_t, Components, false, DstStride>(src, srcStride, count, dst);
+			return true;
+		case UnsignedShort:
+			normalized ? Decoder::template decode<uint16_t, Components, true, DstStride>(src, srcStride, count, dst) : Decoder::template decode<uint16_t, Components, false, DstStride>(src, srcStride, count, dst);
+			return true;
+		case Byte:
+			normalized ? Decoder::template decode<int8_t, Components, true, DstStride>(src, srcStride, count, dst) : Decoder::template decode<int8_t, Components, false, DstStride>(src, srcStride, count, dst);
+			return true;
+		case Short:
+			normalized ? Decoder::template decode<int16_t, Components, true, DstStride>(src, srcStride, count, dst) : Decoder::template decode<int16_t, Components, false, DstStride>(src, srcStride, count, dst);
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	/** @brief Widens tightly packed 8, 16 or 32-bit indices to 32-bit, returns false for other component types */
+	template<typename Decoder = Native>
+	bool decodeIndices(int componentType, const uint8_t* src, size_t count, uint32_t* dst)
+	{
+		switch (componentType) {
+		case UnsignedInt:
+			Decoder::widenIndices(reinterpret_cast<const uint32_t*>(src), count, dst);
+			return true;
+		case UnsignedShort:
+			Decoder::widenIndices(reinterpret_cast<const uint16_t*>(src), count, dst);
+			return true;
+		case UnsignedByte:
+			Decoder::widenIndices(src, count, dst);
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	/** @brief Normalizes count vec3s stored Stride bytes apart */
+	template<size_t Stride, typename Decoder = Native>
+	void normalizeVec3(uint8_t* data, size_t count)
+	{
+		Decoder::template normalizeVec3<Stride>(data, count);
+	}
+}
@@ -0,0 +1,519 @@
+/* Copyright (c) 2021, Sascha Willems
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#include "GeometryStreamer.h"
+
+// Acceleration structures have to be placed at multiples of 256 bytes, vertex and index data use the same alignment
+static const VkDeviceSize heapAlignment = 256;
+
+GeometryStreamer::GeometryStreamer(vks::VulkanDevice* device, VkPhysicalDeviceAccelerationStructurePropertiesKHR properties, uint32_t framesInFlight)
+{
+	this->device = device;
+	this->properties = properties;
+	this->framesInFlight = framesInFlight;
+}
+
+GeometryStreamer::~GeometryStreamer()
+{
+	for (auto& chunk : chunks) {
+		chunk.accelerationStructure.destroy();
+	}
+	heap.destroy();
+	staging.destroy();
+	hitCounters.destroy();
+	scratchBuffer.reset();
+}
+
+bool GeometryStreamer::allocate(VkDeviceSize size, VkDeviceSize& offset)
+{
+	for (auto it = freeRanges.begin(); it != freeRanges.end(); it++) {
+		if (it->second >= size) {
+			offset = it->first;
+			const VkDeviceSize remainder = it->second - size;
+			freeRanges.erase(it);
+			if (remainder > 0) {
+				freeRanges[offset + size] = remainder;
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+void GeometryStreamer::release(VkDeviceSize offset, VkDeviceSize size)
+{
+	auto next = freeRanges.lower_bound(offset);
+	// Merge with the following and the preceding free range
+	if ((next != freeRanges.end()) && (offset + size == next->first)) {
+		size += next->second;
+		next = freeRanges.erase(next);
+	}
+	if (next != freeRanges.begin()) {
+		auto previous = std::prev(next);
+		if (previous->first + previous->second == offset) {
+			previous->second += size;
+			return;
+		}
+	}
+	freeRanges[offset] = size;
+}
+
+// The chunk is left out of the next top level build, but frames in flight may still trace rays against it, so it's memory is released later
+void GeometryStreamer::evict(uint32_t index)
+{
+	Chunk& chunk = chunks[index];
+	chunk.residency = Residency::Evicting;
+	chunk.evictionFrame = frameIndex;
+	chunk.hitScore = 0.0f;
+	statistics.evictionCount++;
+}
+
+VkDeviceSize GeometryStreamer::getIndexOffset(const ChunkData& data)
+{
+	return vks::tools::alignedVkSize(data.vertices.size() * sizeof(vkglTF::Vertex), heapAlignment);
+}
+
+VkDeviceSize GeometryStreamer::getAccelerationStructureOffset(const ChunkData& data)
+{
+	return getIndexOffset(data) + vks::tools::alignedVkSize(data.indices.size() * sizeof(uint32_t), heapAlignment);
+}
+
+void GeometryStreamer::getBuildInput(const ChunkData& data, VkDeviceAddress vertexAddress, VkDeviceAddress indexAddress, std::vector<VkAccelerationStructureGeometryKHR>& geometries, std::vector<VkAccelerationStructureBuildRangeInfoKHR>& buildRanges)
+{
+	VkAccelerationStructureGeometryKHR accelerationStructureGeometry = vks::initializers::accelerationStructureGeometryKHR();
+	accelerationStructureGeometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+	accelerationStructureGeometry.geometry.triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
+	accelerationStructureGeometry.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+	accelerationStructureGeometry.geometry.triangles.vertexStride = sizeof(vkglTF::Vertex);
+	accelerationStructureGeometry.geometry.triangles.vertexData.deviceAddress = vertexAddress;
+	accelerationStructureGeometry.geometry.triangles.maxVertex = static_cast<uint32_t>(data.vertices.size());
+	accelerationStructureGeometry.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32;
+	accelerationStructureGeometry.geometry.triangles.indexData.deviceAddress = indexAddress;
+	for (auto& geometry : data.geometries) {
+		accelerationStructureGeometry.flags = geometry.opaque ? VK_GEOMETRY_OPAQUE_BIT_KHR : VK_GEOMETRY_NO_DUPLICATE_ANY_HIT_INVOCATION_BIT_KHR;
+		VkAccelerationStructureBuildRangeInfoKHR buildRange{};
+		buildRange.primitiveCount = geometry.indexCount / 3;
+		buildRange.primitiveOffset = geometry.firstIndex * sizeof(uint32_t);
+		geometries.push_back(accelerationStructureGeometry);
+		buildRanges.push_back(buildRange);
+	}
+}
+
+void GeometryStreamer::addModel(uint32_t modelIndex, const vkglTF::Model& model, uint32_t maxChunkTriangles)
+{
+	struct Triangle {
+		uint32_t geometryRange;
+		uint32_t firstIndex;
+		glm::vec3 centroid;
+	};
+	std::vector<Triangle> triangles;
+	for (uint32_t r = 0; r < static_cast<uint32_t>(model.geometryRanges.size()); r++) {
+		const vkglTF::Model::GeometryRange& geometryRange = model.geometryRanges[r];
+		for (uint32_t i = 0; i < geometryRange.indexCount; i += 3) {
+			const uint32_t firstIndex = geometryRange.firstIndex + i;
+			glm::vec3 centroid(0.0f);
+			for (uint32_t c = 0; c < 3; c++) {
+				centroid += model.hostVertices[geometryRange.firstVertex + model.hostIndices[firstIndex + c]].pos;
+			}
+			triangles.push_back({ r, firstIndex, centroid / 3.0f });
+		}
+	}
+	if (triangles.empty()) {
+		return;
+	}
+
+	const size_t firstChunkData = chunkData.size();
+	// Vertices shared by triangles of the same chunk are only stored once per chunk
+	std::vector<uint32_t> vertexChunk(model.hostVertices.size(), UINT32_MAX);
+	std::vector<uint32_t> vertexRemap(model.hostVertices.size());
+	// Median splits along the longest axis of the triangle centroids' bounds, until chunks are small enough
+	std::vector<std::pair<size_t, size_t>> stack = { { 0, triangles.size() } };
+	while (!stack.empty()) {
+		const size_t begin = stack.back().first;
+		const size_t end = stack.back().second;
+		stack.pop_back();
+		if (end - begin > maxChunkTriangles) {
+			glm::vec3 min(FLT_MAX);
+			glm::vec3 max(-FLT_MAX);
+			for (size_t t = begin; t < end; t++) {
+				min = glm::min(min, triangles[t].centroid);
+				max = glm::max(max, triangles[t].centroid);
+			}
+			const glm::vec3 extent = max - min;
+			const int axis = ((extent.x > extent.y) && (extent.x > extent.z)) ? 0 : ((extent.y > extent.z) ? 1 : 2);
+			const size_t middle = begin + (end - begin) / 2;
+			std::nth_element(triangles.begin() + begin, triangles.begin() + middle, triangles.begin() + end, [axis](const Triangle& a, const Triangle& b) { return a.centroid[axis] < b.centroid[axis]; });
+			stack.push_back({ begin, middle });
+			stack.push_back({ middle, end });
+			continue;
+		}
+		// Triangles of the same geometry range share a material and become one geometry of the chunk
+		std::sort(triangles.begin() + begin, triangles.begin() + end, [](const Triangle& a, const Triangle& b) { return (a.geometryRange < b.geometryRange) || ((a.geometryRange == b.geometryRange) && (a.firstIndex < b.firstIndex)); });
+		const uint32_t chunkIndex = static_cast<uint32_t>(chunkData.size());
+		ChunkData data{};
+		data.model = modelIndex;
+		data.firstGeometry = chunkData.empty() ? 0 : chunkData.back().firstGeometry + static_cast<uint32_t>(chunkData.back().geometries.size());
+		data.min = glm::vec3(FLT_MAX);
+		data.max = glm::vec3(-FLT_MAX);
+		for (size_t t = begin; t < end; t++) {
+			const Triangle& triangle = triangles[t];
+			const vkglTF::Model::GeometryRange& geometryRange = model.geometryRanges[triangle.geometryRange];
+			if ((t == begin) || (triangles[t - 1].geometryRange != triangle.geometryRange)) {
+				data.geometries.push_back({ static_cast<uint32_t>(data.indices.size()), 0, geometryRange.materialIndex, geometryRange.opaque });
+			}
+			for (uint32_t c = 0; c < 3; c++) {
+				const uint32_t vertex = geometryRange.firstVertex + model.hostIndices[triangle.firstIndex + c];
+				if (vertexChunk[vertex] != chunkIndex) {
+					vertexChunk[vertex] = chunkIndex;
+					vertexRemap[vertex] = static_cast<uint32_t>(data.vertices.size());
+					data.vertices.push_back(model.hostVertices[vertex]);
+					data.min = glm::min(data.min, model.hostVertices[vertex].pos);
+					data.max = glm::max(data.max, model.hostVertices[vertex].pos);
+				}
+				data.indices.push_back(vertexRemap[vertex]);
+			}
+			data.geometries.back().indexCount += 3;
+		}
+		chunkData.push_back(std::move(data));
+	}
+
+	// Every chunk's data is initially used by a single chunk at it's original position
+	for (size_t i = firstChunkData; i < chunkData.size(); i++) {
+		Chunk chunk{};
+		chunk.data = static_cast<uint32_t>(i);
+		chunk.offset = glm::vec3(0.0f);
+		chunk.min = chunkData[i].min;
+		chunk.max = chunkData[i].max;
+		chunks.push_back(chunk);
+	}
+	std::cout << "Geometry streaming: split " << triangles.size() << " triangles into " << chunkData.size() - firstChunkData << " chunks\n";
+}
+
+void GeometryStreamer::replicate(uint32_t copies)
+{
+	if (copies <= 1) {
+		return;
+	}
+	glm::vec3 min(FLT_MAX);
+	glm::vec3 max(-FLT_MAX);
+	for (auto& chunk : chunks) {
+		min = glm::min(min, chunk.min);
+		max = glm::max(max, chunk.max);
+	}
+	// Copies are laid out on the horizontal plane with a small gap between them
+	const glm::vec3 spacing = (max - min) * 1.05f;
+	std::vector<Chunk> original = chunks;
+	chunks.clear();
+	for (uint32_t z = 0; z < copies; z++) {
+		for (uint32_t x = 0; x < copies; x++) {
+			const glm::vec3 offset(x * spacing.x, 0.0f, z * spacing.z);
+			for (auto chunk : original) {
+				chunk.offset = offset;
+				chunk.min += offset;
+				chunk.max += offset;
+				chunks.push_back(chunk);
+			}
+		}
+	}
+}
+
+void GeometryStreamer::prepare()
+{
+	// Chunks are built in place, so their acceleration structures can't be compacted and are sized for the uncompacted build
+	VkDeviceSize maxUploadSize = 0;
+	VkDeviceSize maxScratchSize = 0;
+	for (auto& data : chunkData) {
+		std::vector<VkAccelerationStructureGeometryKHR> geometries;
+		std::vector<VkAccelerationStructureBuildRangeInfoKHR> buildRanges;
+		getBuildInput(data, 0, 0, geometries, buildRanges);
+		std::vector<uint32_t> primitiveCounts;
+		for (auto& buildRange : buildRanges) {
+			primitiveCounts.push_back(buildRange.primitiveCount);
+		}
+		VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo = vks::initializers::accelerationStructureBuildGeometryInfoKHR();
+		buildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+		buildGeometryInfo.flags = buildFlags;
+		buildGeometryInfo.geometryCount = static_cast<uint32_t>(geometries.size());
+		buildGeometryInfo.pGeometries = geometries.data();
+		VkAccelerationStructureBuildSizesInfoKHR buildSizes = vks::initializers::accelerationStructureBuildSizesInfoKHR();
+		vkGetAccelerationStructureBuildSizesKHR(device->logicalDevice, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildGeometryInfo, primitiveCounts.data(), &buildSizes);
+		data.accelerationStructureSize = buildSizes.accelerationStructureSize;
+		data.buildScratchSize = vks::tools::alignedVkSize(buildSizes.buildScratchSize, properties.minAccelerationStructureScratchOffsetAlignment);
+		data.footprint = getAccelerationStructureOffset(data) + vks::tools::alignedVkSize(data.accelerationStructureSize, heapAlignment);
+		maxUploadSize = std::max(maxUploadSize, getAccelerationStructureOffset(data));
+		maxScratchSize = std::max(maxScratchSize, data.buildScratchSize);
+	}
+
+	// Every staging slice must at least hold the largest chunk, scratch memory is usually in the order of the build input's size
+	stagingSliceSize = vks::tools::alignedVkSize(std::max(uploadBudget, maxUploadSize), heapAlignment);
+	scratchSize = std::max(maxScratchSize, stagingSliceSize);
+	VK_CHECK_RESULT(device->createBuffer(
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		&heap,
+		heapSize));
+	VkBufferDeviceAddressInfoKHR bufferDeviceAddressInfo{};
+	bufferDeviceAddressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+	bufferDeviceAddressInfo.buffer = heap.buffer;
+	heapAddress = vkGetBufferDeviceAddressKHR(device->logicalDevice, &bufferDeviceAddressInfo);
+	freeRanges.clear();
+	freeRanges[0] = heapSize;
+	VK_CHECK_RESULT(device->createBuffer(
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&staging,
+		stagingSliceSize * framesInFlight));
+	VK_CHECK_RESULT(staging.map());
+	// Scratch addresses have to be aligned, the buffer's address only has the alignment of its memory requirements
+	scratchBuffer.reset(new ScratchBuffer(device, scratchSize + properties.minAccelerationStructureScratchOffsetAlignment));
+	scratchBaseAddress = vks::tools::alignedVkSize(scratchBuffer->deviceAddress, properties.minAccelerationStructureScratchOffsetAlignment);
+	VK_CHECK_RESULT(device->createBuffer(
+		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&hitCounters,
+		std::max(chunks.size(), size_t(1)) * sizeof(uint32_t)));
+	VK_CHECK_RESULT(hitCounters.map());
+	memset(hitCounters.mapped, 0, chunks.size() * sizeof(uint32_t));
+
+	uint32_t oversizedCount = 0;
+	for (auto& data : chunkData) {
+		if (data.footprint > heapSize) {
+			oversizedCount++;
+		}
+	}
+	const VkDeviceSize totalSize = getTotalSize();
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "Geometry streaming: " << chunks.size() << " chunks (" << chunkData.size() << " unique) with " << totalSize / (1024.0 * 1024.0) << " MB of geometry and acceleration structures, streamed through a "
+		<< heapSize / (1024.0 * 1024.0) << " MB heap (" << static_cast<double>(totalSize) / heapSize << " times it's size)\n" << std::defaultfloat;
+	if (oversizedCount > 0) {
+		std::cerr << "Geometry streaming: " << oversizedCount << " chunks are larger than the heap and will never be resident, reduce the triangles per chunk or increase the heap size\n";
+	}
+}
+
+bool GeometryStreamer::update(const glm::vec3& cameraPosition, uint32_t slice)
+{
+	frameIndex++;
+	stagingSlice = slice;
+	pagedIn.clear();
+	pendingBuilds.clear();
+	bool changed = false;
+
+	// All frames that could trace rays against an evicted chunk have finished once the frame slot it was evicted in comes around again
+	for (auto& chunk : chunks) {
+		if ((chunk.residency == Residency::Evicting) && (frameIndex - chunk.evictionFrame >= framesInFlight)) {
+			chunk.accelerationStructure.destroy();
+			release(chunk.heapOffset, chunkData[chunk.data].footprint);
+			chunk.residency = Residency::NonResident;
+		}
+	}
+
+	// Hits are counted by frames that may still be in flight, so the statistics are approximate by design
+	if (frameIndex % hitStatisticsInterval == 0) {
+		uint32_t* counters = static_cast<uint32_t*>(hitCounters.mapped);
+		for (size_t i = 0; i < chunks.size(); i++) {
+			chunks[i].hitScore = chunks[i].hitScore * 0.5f + static_cast<float>(counters[i]);
+			counters[i] = 0;
+		}
+	}
+	float maxHitScore = 0.0f;
+	for (auto& chunk : chunks) {
+		maxHitScore = std::max(maxHitScore, chunk.hitScore);
+	}
+
+	// Chunks that rays actually hit are kept over closer ones that are occluded
+	std::vector<uint32_t> order(chunks.size());
+	for (uint32_t i = 0; i < static_cast<uint32_t>(chunks.size()); i++) {
+		Chunk& chunk = chunks[i];
+		const float distance = glm::length(glm::max(glm::max(chunk.min - cameraPosition, cameraPosition - chunk.max), glm::vec3(0.0f)));
+		const float hitFactor = (maxHitScore > 0.0f) ? chunk.hitScore / maxHitScore : 0.0f;
+		chunk.priority = distance / (1.0f + hitWeight * hitFactor);
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return chunks[a].priority < chunks[b].priority; });
+
+	// The chunks with the highest priority that fit into the heap should be resident
+	VkDeviceSize desiredSize = 0;
+	for (uint32_t index : order) {
+		Chunk& chunk = chunks[index];
+		const VkDeviceSize footprint = chunkData[chunk.data].footprint;
+		chunk.desired = (desiredSize + footprint <= heapSize);
+		if (chunk.desired) {
+			desiredSize += footprint;
+		}
+	}
+
+	// Page in missing chunks in order of priority, as far as this frame's staging and scratch memory allows
+	// If the heap is full, chunks that are no longer desired are evicted lowest priority first, their memory becomes available a few frames later
+	VkDeviceSize stagingOffset = 0;
+	VkDeviceSize scratchOffset = 0;
+	size_t evictionCursor = order.size();
+	for (uint32_t index : order) {
+		Chunk& chunk = chunks[index];
+		if (!chunk.desired || (chunk.residency != Residency::NonResident)) {
+			continue;
+		}
+		const ChunkData& data = chunkData[chunk.data];
+		const VkDeviceSize uploadSize = getAccelerationStructureOffset(data);
+		if ((stagingOffset + uploadSize > stagingSliceSize) || (scratchOffset + data.buildScratchSize > scratchSize)) {
+			break;
+		}
+		VkDeviceSize heapOffset = 0;
+		if (!allocate(data.footprint, heapOffset)) {
+			VkDeviceSize evictedSize = 0;
+			while ((evictedSize < data.footprint) && (evictionCursor > 0)) {
+				evictionCursor--;
+				const uint32_t candidate = order[evictionCursor];
+				if ((chunks[candidate].residency == Residency::Resident) && !chunks[candidate].desired) {
+					evict(candidate);
+					evictedSize += chunkData[chunks[candidate].data].footprint;
+					changed = true;
+				}
+			}
+			continue;
+		}
+
+		// Copies of a synthetic scene are translated on the fly, so they don't need host memory of their own
+		uint8_t* stagingData = static_cast<uint8_t*>(staging.mapped) + stagingSliceSize * slice + stagingOffset;
+		vkglTF::Vertex* vertices = reinterpret_cast<vkglTF::Vertex*>(stagingData);
+		memcpy(vertices, data.vertices.data(), data.vertices.size() * sizeof(vkglTF::Vertex));
+		if (chunk.offset != glm::vec3(0.0f)) {
+			for (size_t i = 0; i < data.vertices.size(); i++) {
+				vertices[i].pos += chunk.offset;
+			}
+		}
+		memcpy(stagingData + getIndexOffset(data), data.indices.data(), data.indices.size() * sizeof(uint32_t));
+
+		chunk.heapOffset = heapOffset;
+		chunk.accelerationStructure.create(device, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, heap.buffer, heapOffset + getAccelerationStructureOffset(data), data.accelerationStructureSize);
+		chunk.residency = Residency::Resident;
+		chunk.hitScore = 0.0f;
+		pendingBuilds.push_back({ index, stagingOffset, scratchOffset });
+		pagedIn.push_back(index);
+		stagingOffset += uploadSize;
+		scratchOffset += data.buildScratchSize;
+		statistics.pageInCount++;
+		statistics.uploadSize += uploadSize;
+		changed = true;
+	}
+
+	statistics.residentCount = 0;
+	statistics.residentSize = 0;
+	for (auto& chunk : chunks) {
+		if (chunk.residency == Residency::Resident) {
+			statistics.residentCount++;
+			statistics.residentSize += chunkData[chunk.data].footprint;
+		}
+	}
+	return changed;
+}
+
+void GeometryStreamer::record(VkCommandBuffer commandBuffer)
+{
+	if (pendingBuilds.empty()) {
+		return;
+	}
+
+	// Heap ranges may have been used by acceleration structures of evicted chunks, which earlier frames traced rays against
+	VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+	memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_SHADER_READ_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+	std::vector<VkBufferCopy> copyRegions;
+	for (auto& pendingBuild : pendingBuilds) {
+		const Chunk& chunk = chunks[pendingBuild.chunk];
+		const ChunkData& data = chunkData[chunk.data];
+		VkBufferCopy copyRegion{};
+		copyRegion.srcOffset = stagingSliceSize * stagingSlice + pendingBuild.stagingOffset;
+		copyRegion.dstOffset = chunk.heapOffset;
+		copyRegion.size = getAccelerationStructureOffset(data);
+		copyRegions.push_back(copyRegion);
+	}
+	vkCmdCopyBuffer(commandBuffer, staging.buffer, heap.buffer, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+
+	// Geometry is read by the builds and the hit shaders
+	memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+	// All builds of a frame use distinct ranges of the scratch buffer and are recorded with a single call
+	std::vector<std::vector<VkAccelerationStructureGeometryKHR>> geometries(pendingBuilds.size());
+	std::vector<std::vector<VkAccelerationStructureBuildRangeInfoKHR>> buildRanges(pendingBuilds.size());
+	std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildGeometryInfos;
+	std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> buildRangeInfos;
+	for (size_t i = 0; i < pendingBuilds.size(); i++) {
+		const Chunk& chunk = chunks[pendingBuilds[i].chunk];
+		const ChunkData& data = chunkData[chunk.data];
+		const VkDeviceAddress vertexAddress = heapAddress + chunk.heapOffset;
+		getBuildInput(data, vertexAddress, vertexAddress + getIndexOffset(data), geometries[i], buildRanges[i]);
+		VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo = vks::initializers::accelerationStructureBuildGeometryInfoKHR();
+		buildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+		buildGeometryInfo.flags = buildFlags;
+		buildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+		buildGeometryInfo.dstAccelerationStructure = chunk.accelerationStructure.handle;
+		buildGeometryInfo.geometryCount = static_cast<uint32_t>(geometries[i].size());
+		buildGeometryInfo.pGeometries = geometries[i].data();
+		buildGeometryInfo.scratchData.deviceAddress = scratchBaseAddress + pendingBuilds[i].scratchOffset;
+		buildGeometryInfos.push_back(buildGeometryInfo);
+		buildRangeInfos.push_back(buildRanges[i].data());
+	}
+	vkCmdBuildAccelerationStructuresKHR(commandBuffer, static_cast<uint32_t>(buildGeometryInfos.size()), buildGeometryInfos.data(), buildRangeInfos.data());
+
+	// The top level build reads the new bottom level acceleration structures
+	memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+	memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+}
+
+void GeometryStreamer::getInstances(std::vector<VkAccelerationStructureInstanceKHR>& instances)
+{
+	// Vertices are pre-transformed, so all instances use the identity transform
+	VkTransformMatrixKHR transform = {
+		1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, 1.0f, 0.0f, 0.0f,
+		0.0f, 0.0f, 1.0f, 0.0f
+	};
+	for (uint32_t i = 0; i < static_cast<uint32_t>(chunks.size()); i++) {
+		if (chunks[i].residency != Residency::Resident) {
+			continue;
+		}
+		VkAccelerationStructureInstanceKHR instance{};
+		instance.transform = transform;
+		instance.instanceCustomIndex = i;
+		instance.mask = 0xFF;
+		instance.instanceShaderBindingTableRecordOffset = 0;
+		instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+		instance.accelerationStructureReference = chunks[i].accelerationStructure.deviceAddress;
+		instances.push_back(instance);
+	}
+}
+
+VkDeviceAddress GeometryStreamer::getVertexAddress(uint32_t index)
+{
+	return heapAddress + chunks[index].heapOffset;
+}
+
+VkDeviceAddress GeometryStreamer::getIndexAddress(uint32_t index)
+{
+	return getVertexAddress(index) + getIndexOffset(chunkData[chunks[index].data]);
+}
+
+VkDeviceAddress GeometryStreamer::getHitCounterAddress(uint32_t index)
+{
+	VkBufferDeviceAddressInfoKHR bufferDeviceAddressInfo{};
+	bufferDeviceAddressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+	bufferDeviceAddressInfo.buffer = hitCounters.buffer;
+	return vkGetBufferDeviceAddressKHR(device->logicalDevice, &bufferDeviceAddressInfo) + index * sizeof(uint32_t);
+}
+
+VkDeviceSize GeometryStreamer::getTotalSize()
+{
+	VkDeviceSize size = 0;
+	for (auto& chunk : chunks) {
+		size += chunkData[chunk.data].footprint;
+	}
+	return size;
+}
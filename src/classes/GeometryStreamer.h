@@ -0,0 +1,147 @@
+/* Copyright (c) 2021, Sascha Willems
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#pragma once
+
+#include <vector>
+#include <map>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+
+#include "volk/volk.h"
+#include "VulkanDevice.h"
+#include "VulkanTools.h"
+#include "VulkanInitializers.hpp"
+#include "VulkanglTFModel.h"
+#include "AccelerationStructure.h"
+#include "ScratchBuffer.h"
+
+/*
+	Out-of-core geometry streaming for scenes that don't fit into device memory
+	Meshes are split into spatial chunks with their own bottom level acceleration structures, the chunks' geometry is kept in host memory
+	Chunks are paged in and out of a fixed-size device heap that holds both their vertex and index data and their acceleration structures
+	Residency follows the distance of the chunks to the camera, weighted with how often rays hit them in recent frames
+	Chunk indices double as the instance custom indices of the top level acceleration structure
+*/
+class GeometryStreamer {
+public:
+	/** @brief Triangles of a chunk that share a material, built as one geometry */
+	struct Geometry {
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		uint32_t materialIndex;
+		bool opaque;
+	};
+	/** @brief Host copy of a chunk's geometry, indices are relative to the chunk's vertices */
+	struct ChunkData {
+		uint32_t model;
+		std::vector<vkglTF::Vertex> vertices;
+		std::vector<uint32_t> indices;
+		std::vector<Geometry> geometries;
+		// Index of the first geometry in the concatenated geometries of all chunk data
+		uint32_t firstGeometry;
+		glm::vec3 min;
+		glm::vec3 max;
+		VkDeviceSize accelerationStructureSize = 0;
+		VkDeviceSize buildScratchSize = 0;
+		// Vertices, indices and acceleration structure in the heap, each aligned to 256 bytes
+		VkDeviceSize footprint = 0;
+	};
+	enum class Residency { NonResident, Resident, Evicting };
+	/** @brief Streamed chunk, copies of a synthetic scene share the same data with different offsets */
+	struct Chunk {
+		uint32_t data;
+		// Translation applied to the vertices while paging in, so every copy gets distinct geometry
+		glm::vec3 offset;
+		glm::vec3 min;
+		glm::vec3 max;
+		Residency residency = Residency::NonResident;
+		// Frame the chunk was evicted in
+		uint64_t evictionFrame = 0;
+		VkDeviceSize heapOffset = 0;
+		AccelerationStructure accelerationStructure{};
+		// Decaying sum of the sampled hits of recent frames
+		float hitScore = 0.0f;
+		float priority = 0.0f;
+		bool desired = false;
+	};
+	struct Statistics {
+		uint32_t residentCount = 0;
+		VkDeviceSize residentSize = 0;
+		uint64_t pageInCount = 0;
+		uint64_t evictionCount = 0;
+		VkDeviceSize uploadSize = 0;
+	};
+private:
+	struct PendingBuild {
+		uint32_t chunk;
+		VkDeviceSize stagingOffset;
+		VkDeviceSize scratchOffset;
+	};
+	vks::VulkanDevice* device;
+	VkPhysicalDeviceAccelerationStructurePropertiesKHR properties;
+	uint32_t framesInFlight;
+	uint64_t frameIndex = 0;
+	// First fit allocator over the heap, free ranges are keyed by their offset
+	std::map<VkDeviceSize, VkDeviceSize> freeRanges;
+	vks::Buffer heap;
+	VkDeviceAddress heapAddress = 0;
+	// Host visible staging memory with one slice per frame in flight
+	vks::Buffer staging;
+	VkDeviceSize stagingSliceSize = 0;
+	uint32_t stagingSlice = 0;
+	std::unique_ptr<ScratchBuffer> scratchBuffer;
+	VkDeviceSize scratchSize = 0;
+	// Start of the scratch buffer rounded up to the scratch offset alignment
+	VkDeviceAddress scratchBaseAddress = 0;
+	// One counter per chunk, incremented for a subset of all hits by the closest hit shader
+	vks::Buffer hitCounters;
+	std::vector<PendingBuild> pendingBuilds;
+	bool allocate(VkDeviceSize size, VkDeviceSize& offset);
+	void release(VkDeviceSize offset, VkDeviceSize size);
+	void evict(uint32_t index);
+	void getBuildInput(const ChunkData& data, VkDeviceAddress vertexAddress, VkDeviceAddress indexAddress, std::vector<VkAccelerationStructureGeometryKHR>& geometries, std::vector<VkAccelerationStructureBuildRangeInfoKHR>& buildRanges);
+	VkDeviceSize getIndexOffset(const ChunkData& data);
+	VkDeviceSize getAccelerationStructureOffset(const ChunkData& data);
+public:
+	std::vector<ChunkData> chunkData;
+	std::vector<Chunk> chunks;
+	/** @brief Chunks paged in by the last call to update(), their addresses changed */
+	std::vector<uint32_t> pagedIn;
+	Statistics statistics;
+	/** @brief Size of the device heap for chunk geometry and acceleration structures */
+	VkDeviceSize heapSize = 512 * 1024 * 1024;
+	/** @brief Upper limit for the geometry uploaded per frame */
+	VkDeviceSize uploadBudget = 32 * 1024 * 1024;
+	/** @brief Build flags of the chunks' acceleration structures (must be set before calling prepare) */
+	VkBuildAccelerationStructureFlagsKHR buildFlags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+	/** @brief Frames between reading back the hit counters */
+	uint32_t hitStatisticsInterval = 16;
+	/** @brief The most hit chunk's distance is divided by one plus this weight */
+	float hitWeight = 4.0f;
+	GeometryStreamer(vks::VulkanDevice* device, VkPhysicalDeviceAccelerationStructurePropertiesKHR properties, uint32_t framesInFlight);
+	~GeometryStreamer();
+	/** @brief Splits the host geometry of a pre-transformed model into chunks of up to the given number of triangles */
+	void addModel(uint32_t modelIndex, const vkglTF::Model& model, uint32_t maxChunkTriangles);
+	/** @brief Turns the scene into a synthetic one made of a grid of copies x copies, each with it's own chunks */
+	void replicate(uint32_t copies);
+	/** @brief Sizes the chunks' acceleration structures and creates the heap, staging and scratch memory */
+	void prepare();
+	/** @brief Decides which chunks are resident for the given frame in flight and stages the geometry of chunks to page in, returns true if the set of resident chunks changed */
+	bool update(const glm::vec3& cameraPosition, uint32_t slice);
+	/** @brief Records the uploads and acceleration structure builds of the chunks paged in by the last update */
+	void record(VkCommandBuffer commandBuffer);
+	/** @brief Appends one instance per resident chunk */
+	void getInstances(std::vector<VkAccelerationStructureInstanceKHR>& instances);
+	VkDeviceAddress getVertexAddress(uint32_t index);
+	VkDeviceAddress getIndexAddress(uint32_t index);
+	VkDeviceAddress getHitCounterAddress(uint32_t index);
+	/** @brief Device memory required to keep all chunks resident */
+	VkDeviceSize getTotalSize();
+};
@@ -0,0 +1,93 @@
+/* Copyright (c) 2021, Sascha Willems
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif !defined(__ANDROID__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const std::string& fileName)
+{
+	close();
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || (fileSize.QuadPart == 0)) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		CloseHandle(file);
+		return false;
+	}
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	fileHandle = file;
+	mappingHandle = mapping;
+	mappedData = static_cast<const uint8_t*>(view);
+	mappedSize = static_cast<size_t>(fileSize.QuadPart);
+	return true;
+#elif defined(__ANDROID__)
+	// Assets are packed into the apk and have to be read through the asset manager
+	return false;
+#else
+	int file = ::open(fileName.c_str(), O_RDONLY);
+	if (file < 0) {
+		return false;
+	}
+	struct stat fileStat;
+	if ((fstat(file, &fileStat) != 0) || (fileStat.st_size == 0)) {
+		::close(file);
+		return false;
+	}
+	void* view = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+	// The mapping keeps its own reference to the file
+	::close(file);
+	if (view == MAP_FAILED) {
+		return false;
+	}
+	mappedData = static_cast<const uint8_t*>(view);
+	mappedSize = static_cast<size_t>(fileStat.st_size);
+	return true;
+#endif
+}
+
+void MappedFile::close()
+{
+	if (!mappedData) {
+		return;
+	}
+#if defined(_WIN32)
+	UnmapViewOfFile(mappedData);
+	CloseHandle(mappingHandle);
+	CloseHandle(fileHandle);
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+#elif !defined(__ANDROID__)
+	munmap(const_cast<uint8_t*>(mappedData), mappedSize);
+#endif
+	mappedData = nullptr;
+	mappedSize = 0;
+}
@@ -0,0 +1,34 @@
+/* Copyright (c) 2021, Sascha Willems
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+/*
+	Read-only memory mapping of a whole file
+	Pages are only read from disk once they're accessed and can be dropped by the OS again without being written to the page file
+*/
+class MappedFile {
+private:
+	const uint8_t* mappedData = nullptr;
+	size_t mappedSize = 0;
+#if defined(_WIN32)
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#endif
+public:
+	MappedFile() {};
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+	/** @brief Maps the file, returns false if it can't be opened or mapping isn't supported on the platform */
+	bool open(const std::string& fileName);
+	void close();
+	const uint8_t* data() const { return mappedData; }
+	size_t size() const { return mappedSize; }
+};
@@ -0,0 +1,367 @@
+/* Copyright (c) 2021, Sascha Willems
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#include "UploadBatch.h"
+
+UploadBatch::UploadBatch(vks::VulkanDevice* device, VkQueue queue)
+{
+	this->device = device;
+	this->queue = queue;
+}
+
+UploadBatch::UploadBatch(vks::VulkanDevice* device, uint32_t transferQueueFamily, uint32_t graphicsQueueFamily)
+{
+	this->device = device;
+	this->transferQueueFamily = transferQueueFamily;
+	this->graphicsQueueFamily = graphicsQueueFamily;
+	deferred = true;
+	// Command buffers are recorded once and freed individually
+	transferCommandPool = device->createCommandPool(transferQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+	graphicsCommandPool = device->createCommandPool(graphicsQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+}
+
+UploadBatch::~UploadBatch()
+{
+	if (!deferred) {
+		flush();
+	}
+	for (auto& submission : submissions) {
+		for (auto& chunk : submission.chunks) {
+			destroyChunk(chunk.get());
+		}
+	}
+	for (auto& chunk : chunks) {
+		destroyChunk(chunk.get());
+	}
+	if (deferred) {
+		vkDestroyCommandPool(device->logicalDevice, transferCommandPool, nullptr);
+		vkDestroyCommandPool(device->logicalDevice, graphicsCommandPool, nullptr);
+	}
+}
+
+UploadBatch::Chunk* UploadBatch::createChunk(VkDeviceSize size)
+{
+	std::unique_ptr<Chunk> chunk(new Chunk());
+	VkBufferCreateInfo bufferCreateInfo{};
+	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferCreateInfo.size = size;
+	bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferCreateInfo, nullptr, &chunk->buffer));
+	VkMemoryRequirements memoryRequirements{};
+	vkGetBufferMemoryRequirements(device->logicalDevice, chunk->buffer, &memoryRequirements);
+	VkMemoryAllocateInfo memoryAllocateInfo{};
+	memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memoryAllocateInfo.allocationSize = memoryRequirements.size;
+	memoryAllocateInfo.memoryTypeIndex = device->getMemoryType(memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memoryAllocateInfo, nullptr, &chunk->memory));
+	VK_CHECK_RESULT(vkBindBufferMemory(device->logicalDevice, chunk->buffer, chunk->memory, 0));
+	VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, chunk->memory, 0, VK_WHOLE_SIZE, 0, reinterpret_cast<void**>(&chunk->mapped)));
+	chunk->size = size;
+	chunks.push_back(std::move(chunk));
+	return chunks.back().get();
+}
+
+void UploadBatch::destroyChunk(Chunk* chunk)
+{
+	vkUnmapMemory(device->logicalDevice, chunk->memory);
+	vkDestroyBuffer(device->logicalDevice, chunk->buffer, nullptr);
+	vkFreeMemory(device->logicalDevice, chunk->memory, nullptr);
+}
+
+UploadBatch::Allocation UploadBatch::allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+	std::lock_guard<std::mutex> lock(chunkMutex);
+	Chunk* chunk = chunks.empty() ? nullptr : chunks.back().get();
+	VkDeviceSize offset = chunk ? vks::tools::alignedVkSize(chunk->used, alignment) : 0;
+	if (!chunk || (offset + size > chunk->size)) {
+		chunk = createChunk(std::max(size, chunkSize));
+		offset = 0;
+	}
+	chunk->used = offset + size;
+	chunk->pendingAllocations++;
+	Allocation allocation;
+	allocation.buffer = chunk->buffer;
+	allocation.offset = offset;
+	allocation.size = size;
+	allocation.data = chunk->mapped + offset;
+	allocation.chunk = chunk;
+	return allocation;
+}
+
+void UploadBatch::recorded(const Allocation& allocation)
+{
+	{
+		std::lock_guard<std::mutex> lock(chunkMutex);
+		allocation.chunk->pendingAllocations--;
+	}
+	recordedSize += allocation.size;
+	statistics.size += allocation.size;
+	if (recordedSize >= flushThreshold) {
+		flush();
+	}
+}
+
+void UploadBatch::copyToBuffer(const Allocation& allocation, VkBuffer dstBuffer, VkDeviceSize dstOffset)
+{
+	VkBufferCopy region{};
+	region.srcOffset = allocation.offset;
+	region.dstOffset = dstOffset;
+	region.size = allocation.size;
+	bufferCopies.push_back({ allocation.buffer, dstBuffer, region });
+	statistics.bufferCopies++;
+	recorded(allocation);
+}
+
+void UploadBatch::copyToBuffer(const void* data, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset)
+{
+	if (size == 0) {
+		return;
+	}
+	Allocation allocation = allocate(size);
+	memcpy(allocation.data, data, size);
+	copyToBuffer(allocation, dstBuffer, dstOffset);
+}
+
+void UploadBatch::copyToImage(const Allocation& allocation, VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels)
+{
+	imageUploads.push_back({ allocation.buffer, allocation.offset, image, width, height, mipLevels });
+	statistics.imageUploads++;
+	recorded(allocation);
+}
+
+VkCommandBuffer UploadBatch::allocateCommandBuffer(VkCommandPool commandPool)
+{
+	VkCommandBufferAllocateInfo commandBufferAllocateInfo = vks::initializers::commandBufferAllocateInfo(commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+	VkCommandBuffer commandBuffer;
+	VK_CHECK_RESULT(vkAllocateCommandBuffers(device->logicalDevice, &commandBufferAllocateInfo, &commandBuffer));
+	VkCommandBufferBeginInfo commandBufferBeginInfo = vks::initializers::commandBufferBeginInfo();
+	commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo));
+	return commandBuffer;
+}
+
+static VkImageMemoryBarrier imageBarrier(VkImage image, uint32_t baseMipLevel, uint32_t levelCount, VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask)
+{
+	VkImageMemoryBarrier imageMemoryBarrier{};
+	imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	imageMemoryBarrier.oldLayout = oldLayout;
+	imageMemoryBarrier.newLayout = newLayout;
+	imageMemoryBarrier.srcAccessMask = srcAccessMask;
+	imageMemoryBarrier.dstAccessMask = dstAccessMask;
+	imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageMemoryBarrier.image = image;
+	imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, baseMipLevel, levelCount, 0, 1 };
+	return imageMemoryBarrier;
+}
+
+// All levels of all images are transitioned for the transfers at once, then the buffers and the images' base levels are copied
+void UploadBatch::recordCopies(VkCommandBuffer commandBuffer)
+{
+	std::vector<VkImageMemoryBarrier> imageBarriers;
+	for (auto& upload : imageUploads) {
+		imageBarriers.push_back(imageBarrier(upload.image, 0, upload.mipLevels, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT));
+	}
+	if (!imageBarriers.empty()) {
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+	}
+	for (auto& copy : bufferCopies) {
+		vkCmdCopyBuffer(commandBuffer, copy.srcBuffer, copy.dstBuffer, 1, &copy.region);
+	}
+	for (auto& upload : imageUploads) {
+		VkBufferImageCopy region{};
+		region.bufferOffset = upload.srcOffset;
+		region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		region.imageExtent = { upload.width, upload.height, 1 };
+		vkCmdCopyBufferToImage(commandBuffer, upload.srcBuffer, upload.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	}
+}
+
+// Release (on the transfer queue) and acquire (on the graphics queue) barriers need to match, images stay in the transfer destination layout
+void UploadBatch::recordOwnershipTransfer(VkCommandBuffer commandBuffer, bool release)
+{
+	const VkAccessFlags srcAccessMask = release ? VK_ACCESS_TRANSFER_WRITE_BIT : 0;
+	std::vector<VkBufferMemoryBarrier> bufferBarriers;
+	for (auto& copy : bufferCopies) {
+		VkBufferMemoryBarrier bufferMemoryBarrier{};
+		bufferMemoryBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		bufferMemoryBarrier.srcAccessMask = srcAccessMask;
+		bufferMemoryBarrier.dstAccessMask = release ? 0 : VK_ACCESS_MEMORY_READ_BIT;
+		bufferMemoryBarrier.srcQueueFamilyIndex = transferQueueFamily;
+		bufferMemoryBarrier.dstQueueFamilyIndex = graphicsQueueFamily;
+		bufferMemoryBarrier.buffer = copy.dstBuffer;
+		bufferMemoryBarrier.offset = copy.region.dstOffset;
+		bufferMemoryBarrier.size = copy.region.size;
+		bufferBarriers.push_back(bufferMemoryBarrier);
+	}
+	std::vector<VkImageMemoryBarrier> imageBarriers;
+	for (auto& upload : imageUploads) {
+		VkImageMemoryBarrier imageMemoryBarrier = imageBarrier(upload.image, 0, upload.mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, srcAccessMask, release ? 0 : (VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT));
+		imageMemoryBarrier.srcQueueFamilyIndex = transferQueueFamily;
+		imageMemoryBarrier.dstQueueFamilyIndex = graphicsQueueFamily;
+		imageBarriers.push_back(imageMemoryBarrier);
+	}
+	const VkPipelineStageFlags srcStageMask = release ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	const VkPipelineStageFlags dstStageMask = release ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0, 0, nullptr, static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(), static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+}
+
+// Mip chains are generated one level at a time for all images, so each level needs a single barrier
+void UploadBatch::recordMipChains(VkCommandBuffer commandBuffer)
+{
+	uint32_t maxMipLevels = 0;
+	for (auto& upload : imageUploads) {
+		maxMipLevels = std::max(maxMipLevels, upload.mipLevels);
+	}
+	std::vector<VkImageMemoryBarrier> imageBarriers;
+	for (uint32_t level = 1; level < maxMipLevels; level++) {
+		imageBarriers.clear();
+		for (auto& upload : imageUploads) {
+			if (level < upload.mipLevels) {
+				imageBarriers.push_back(imageBarrier(upload.image, level - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT));
+			}
+		}
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+		for (auto& upload : imageUploads) {
+			if (level < upload.mipLevels) {
+				VkImageBlit imageBlit{};
+				imageBlit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1 };
+				imageBlit.srcOffsets[1] = { std::max(int32_t(upload.width >> (level - 1)), 1), std::max(int32_t(upload.height >> (level - 1)), 1), 1 };
+				imageBlit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+				imageBlit.dstOffsets[1] = { std::max(int32_t(upload.width >> level), 1), std::max(int32_t(upload.height >> level), 1), 1 };
+				vkCmdBlitImage(commandBuffer, upload.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, upload.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageBlit, VK_FILTER_LINEAR);
+			}
+		}
+	}
+
+	// All but the last level of each image have been blit sources
+	imageBarriers.clear();
+	for (auto& upload : imageUploads) {
+		if (upload.mipLevels > 1) {
+			imageBarriers.push_back(imageBarrier(upload.image, 0, upload.mipLevels - 1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT));
+		}
+		imageBarriers.push_back(imageBarrier(upload.image, upload.mipLevels - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT));
+	}
+	// Buffers are read as vertex input, by shaders and by acceleration structure builds
+	VkMemoryBarrier memoryBarrier{};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &memoryBarrier, 0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+}
+
+void UploadBatch::flush()
+{
+	if (bufferCopies.empty() && imageUploads.empty()) {
+		return;
+	}
+	auto tStart = std::chrono::high_resolution_clock::now();
+
+	// Chunks with allocations that are still being written to by other threads are kept
+	std::vector<std::unique_ptr<Chunk>> recordedChunks;
+	{
+		std::lock_guard<std::mutex> lock(chunkMutex);
+		for (auto& chunk : chunks) {
+			if (chunk->pendingAllocations == 0) {
+				recordedChunks.push_back(std::move(chunk));
+			}
+		}
+		chunks.erase(std::remove(chunks.begin(), chunks.end(), nullptr), chunks.end());
+	}
+
+	if (deferred) {
+		// Without a dedicated transfer queue family no ownership transfer is required
+		const bool ownershipTransfer = (transferQueueFamily != graphicsQueueFamily);
+		Submission submission;
+		std::lock_guard<std::mutex> lock(submissionMutex);
+		submission.transferCommandBuffer = allocateCommandBuffer(transferCommandPool);
+		recordCopies(submission.transferCommandBuffer);
+		if (ownershipTransfer) {
+			recordOwnershipTransfer(submission.transferCommandBuffer, true);
+		}
+		VK_CHECK_RESULT(vkEndCommandBuffer(submission.transferCommandBuffer));
+		submission.graphicsCommandBuffer = allocateCommandBuffer(graphicsCommandPool);
+		if (ownershipTransfer) {
+			recordOwnershipTransfer(submission.graphicsCommandBuffer, false);
+		}
+		recordMipChains(submission.graphicsCommandBuffer);
+		VK_CHECK_RESULT(vkEndCommandBuffer(submission.graphicsCommandBuffer));
+		submission.chunks = std::move(recordedChunks);
+		submissions.push_back(std::move(submission));
+	} else {
+		VkCommandBuffer commandBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		recordCopies(commandBuffer);
+		recordMipChains(commandBuffer);
+		device->flushCommandBuffer(commandBuffer, queue, true);
+		statistics.submissions++;
+		for (auto& chunk : recordedChunks) {
+			destroyChunk(chunk.get());
+		}
+	}
+	bufferCopies.clear();
+	imageUploads.clear();
+	recordedSize = 0;
+
+	statistics.uploadTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+}
+
+void UploadBatch::submit(VkQueue transferQueue, VkQueue graphicsQueue, VkSemaphore transferTimeline, uint64_t& transferTimelineValue, VkSemaphore graphicsTimeline, uint64_t& graphicsTimelineValue)
+{
+	std::lock_guard<std::mutex> lock(submissionMutex);
+	for (auto& submission : submissions) {
+		if (submission.timelineValue != 0) {
+			continue;
+		}
+		const uint64_t transferValue = ++transferTimelineValue;
+		const uint64_t graphicsValue = ++graphicsTimelineValue;
+
+		VkTimelineSemaphoreSubmitInfo timelineSubmitInfo{};
+		timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineSubmitInfo.signalSemaphoreValueCount = 1;
+		timelineSubmitInfo.pSignalSemaphoreValues = &transferValue;
+		VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+		submitInfo.pNext = &timelineSubmitInfo;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &submission.transferCommandBuffer;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &transferTimeline;
+		VK_CHECK_RESULT(vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE));
+
+		const VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		timelineSubmitInfo.waitSemaphoreValueCount = 1;
+		timelineSubmitInfo.pWaitSemaphoreValues = &transferValue;
+		timelineSubmitInfo.pSignalSemaphoreValues = &graphicsValue;
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = &transferTimeline;
+		submitInfo.pSignalSemaphores = &graphicsTimeline;
+		submitInfo.pWaitDstStageMask = &waitStageMask;
+		submitInfo.pCommandBuffers = &submission.graphicsCommandBuffer;
+		VK_CHECK_RESULT(vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE));
+
+		submission.timelineValue = graphicsValue;
+		statistics.submissions += 2;
+	}
+}
+
+bool UploadBatch::release(uint64_t completedGraphicsTimelineValue)
+{
+	std::lock_guard<std::mutex> lock(submissionMutex);
+	auto completed = [completedGraphicsTimelineValue](const Submission& submission) {
+		return (submission.timelineValue != 0) && (submission.timelineValue <= completedGraphicsTimelineValue);
+	};
+	for (auto& submission : submissions) {
+		if (completed(submission)) {
+			vkFreeCommandBuffers(device->logicalDevice, transferCommandPool, 1, &submission.transferCommandBuffer);
+			vkFreeCommandBuffers(device->logicalDevice, graphicsCommandPool, 1, &submission.graphicsCommandBuffer);
+			for (auto& chunk : submission.chunks) {
+				destroyChunk(chunk.get());
+			}
+		}
+	}
+	submissions.erase(std::remove_if(submissions.begin(), submissions.end(), completed), submissions.end());
+	return submissions.empty();
+}
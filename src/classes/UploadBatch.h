@@ -0,0 +1,126 @@
+/* Copyright (c) 2021, Sascha Willems
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+
+#include "volk/volk.h"
+#include "VulkanDevice.h"
+#include "VulkanTools.h"
+
+/*
+	Collects the uploads of scene data into a host visible staging arena and records them into a single command buffer
+	Copies, mip chain generation and layout transitions of all images are batched with one barrier per step, and everything is submitted at once with a single wait
+	If the recorded data exceeds the flush threshold the batch is submitted early, so staging memory stays bounded for large scenes
+
+	Deferred batches can be filled and flushed on a loader thread without ever touching a queue
+	A flush records the copies for the transfer queue and the mip chain generation for the graphics queue (blits aren't supported on transfer queues), with queue family ownership transfers in between
+	The recorded work is submitted by the thread owning the queues, ordered and tracked by one timeline semaphore per queue
+	(a timeline's signals must increase in execution order, which two queues signaling the same semaphore can't guarantee)
+*/
+class UploadBatch {
+private:
+	struct Chunk {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		uint8_t* mapped = nullptr;
+		VkDeviceSize size = 0;
+		VkDeviceSize used = 0;
+		// Allocations handed out but not recorded yet, the chunk can't be released before they are
+		uint32_t pendingAllocations = 0;
+	};
+public:
+	struct Allocation {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		void* data = nullptr;
+		Chunk* chunk = nullptr;
+	};
+	struct Statistics {
+		uint32_t submissions = 0;
+		uint32_t bufferCopies = 0;
+		uint32_t imageUploads = 0;
+		VkDeviceSize size = 0;
+		// Wall time spent recording, submitting and waiting for the uploads in milliseconds, deferred batches only include the recording
+		double uploadTime = 0.0;
+	} statistics;
+private:
+	struct BufferCopy {
+		VkBuffer srcBuffer;
+		VkBuffer dstBuffer;
+		VkBufferCopy region;
+	};
+	struct ImageUpload {
+		VkBuffer srcBuffer;
+		VkDeviceSize srcOffset;
+		VkImage image;
+		uint32_t width;
+		uint32_t height;
+		uint32_t mipLevels;
+	};
+	// Work recorded by a flush of a deferred batch, the staging chunks it reads from are released once the graphics side has completed
+	struct Submission {
+		VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+		VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE;
+		std::vector<std::unique_ptr<Chunk>> chunks;
+		// Value of the graphics timeline signaled by the graphics submission, 0 until submitted
+		uint64_t timelineValue = 0;
+	};
+	vks::VulkanDevice* device;
+	VkQueue queue = VK_NULL_HANDLE;
+	std::mutex chunkMutex;
+	std::vector<std::unique_ptr<Chunk>> chunks;
+	std::vector<BufferCopy> bufferCopies;
+	std::vector<ImageUpload> imageUploads;
+	VkDeviceSize recordedSize = 0;
+	// Deferred batches only
+	bool deferred = false;
+	uint32_t transferQueueFamily = VK_QUEUE_FAMILY_IGNORED;
+	uint32_t graphicsQueueFamily = VK_QUEUE_FAMILY_IGNORED;
+	VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+	VkCommandPool graphicsCommandPool = VK_NULL_HANDLE;
+	// Guards the command pools and the submissions, which are used by the loader and the submitting thread
+	std::mutex submissionMutex;
+	std::vector<Submission> submissions;
+	Chunk* createChunk(VkDeviceSize size);
+	void destroyChunk(Chunk* chunk);
+	void recorded(const Allocation& allocation);
+	void recordCopies(VkCommandBuffer commandBuffer);
+	void recordOwnershipTransfer(VkCommandBuffer commandBuffer, bool release);
+	void recordMipChains(VkCommandBuffer commandBuffer);
+	VkCommandBuffer allocateCommandBuffer(VkCommandPool commandPool);
+public:
+	// Size of the staging buffers the arena is made of, larger allocations get a buffer of their own
+	VkDeviceSize chunkSize = 64 * 1024 * 1024;
+	// Recorded data after which the batch is submitted early
+	VkDeviceSize flushThreshold = 1024 * 1024 * 1024;
+	/** @brief Creates a batch that's submitted to the given queue and waited on by every flush */
+	UploadBatch(vks::VulkanDevice* device, VkQueue queue);
+	/** @brief Creates a deferred batch whose flushes are submitted with submit() and completed with release() */
+	UploadBatch(vks::VulkanDevice* device, uint32_t transferQueueFamily, uint32_t graphicsQueueFamily);
+	/** @brief Deferred batches must not have work in flight when destroyed */
+	~UploadBatch();
+	/** @brief Reserves staging memory that's written through the allocation's data pointer, can be called from multiple threads at once */
+	Allocation allocate(VkDeviceSize size, VkDeviceSize alignment = 16);
+	/** @brief Copies an allocation to a buffer, the allocation must not be written to afterwards */
+	void copyToBuffer(const Allocation& allocation, VkBuffer dstBuffer, VkDeviceSize dstOffset = 0);
+	void copyToBuffer(const void* data, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset = 0);
+	/** @brief Copies an allocation to the base level of an image and generates the other levels by blitting, the image is in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL after the flush */
+	void copyToImage(const Allocation& allocation, VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels);
+	/** @brief Submits all recorded uploads and waits for them to finish, deferred batches only record them for the next submit() */
+	void flush();
+	/** @brief Submits the flushed work of a deferred batch, the graphics queue waits for the transfers on the transfer timeline, the last signaled values of both timelines are advanced */
+	void submit(VkQueue transferQueue, VkQueue graphicsQueue, VkSemaphore transferTimeline, uint64_t& transferTimelineValue, VkSemaphore graphicsTimeline, uint64_t& graphicsTimelineValue);
+	/** @brief Frees the command buffers and staging memory of submissions the graphics timeline has passed, returns true if no flushed work is left */
+	bool release(uint64_t completedGraphicsTimelineValue);
+};
@@ -135,7 +135,7 @@ void VulkanApplication::renderFrame()
 	VulkanApplication::prepareFrame();
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
-	VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+	VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, waitFences[currentFrame]));
 	VulkanApplication::submitFrame();
 }
 
@@ -173,9 +173,58 @@ std::string VulkanApplication::getShadersPath() const
 
 void VulkanApplication::createPipelineCache()
 {
+	// Try to initialize the cache with data stored by a previous run
+	std::vector<char> cacheData;
+	std::ifstream is;
+	if (!settings.pipelineCacheFile.empty()) {
+		is.open(settings.pipelineCacheFile, std::ios::binary | std::ios::in | std::ios::ate);
+	}
+	if (is.is_open()) {
+		const size_t size = static_cast<size_t>(is.tellg());
+		cacheData.resize(size);
+		is.seekg(0, std::ios::beg);
+		is.read(cacheData.data(), size);
+		is.close();
+		// Only use the data if it was created by the same device and driver
+		VkPipelineCacheHeaderVersionOne header{};
+		bool valid = false;
+		if (size >= sizeof(VkPipelineCacheHeaderVersionOne)) {
+			memcpy(&header, cacheData.data(), sizeof(VkPipelineCacheHeaderVersionOne));
+			valid = (header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE) &&
+				(header.vendorID == deviceProperties.vendorID) &&
+				(header.deviceID == deviceProperties.deviceID) &&
+				(memcmp(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0);
+		}
+		if (!valid) {
+			std::cout << "Pipeline cache file \"" << settings.pipelineCacheFile << "\" does not match this device and driver, ignoring it\n";
+			cacheData.clear();
+		}
+	}
+
 	VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
 	pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	pipelineCacheCreateInfo.initialDataSize = cacheData.size();
+	pipelineCacheCreateInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
 	VK_CHECK_RESULT(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache));
+	pipelineCacheLoaded = !cacheData.empty();
+}
+
+void VulkanApplication::savePipelineCache()
+{
+	if (settings.pipelineCacheFile.empty()) {
+		return;
+	}
+	size_t size = 0;
+	VK_CHECK_RESULT(vkGetPipelineCacheData(device, pipelineCache, &size, nullptr));
+	std::vector<char> cacheData(size);
+	VK_CHECK_RESULT(vkGetPipelineCacheData(device, pipelineCache, &size, cacheData.data()));
+	std::ofstream os(settings.pipelineCacheFile, std::ios::binary | std::ios::out | std::ios::trunc);
+	if (os.is_open()) {
+		os.write(cacheData.data(), size);
+		os.close();
+	} else {
+		std::cerr << "Could not write pipeline cache file \"" << settings.pipelineCacheFile << "\"\n";
+	}
 }
 
 void VulkanApplication::prepare()
@@ -269,6 +318,7 @@ void VulkanApplication::nextFrame()
 void VulkanApplication::renderLoop()
 {
 	if (benchmark.active) {
+		benchmark.framesInFlight = settings.maxFramesInFlight;
 		benchmark.run([=] { render(); }, vulkanDevice->properties);
 		vkDeviceWaitIdle(device);
 		if (benchmark.filename != "") {
@@ -634,7 +684,13 @@ void VulkanApplication::updateOverlay()
 	//ImGui::PopStyleVar();
 	ImGui::Render();
 
-	if (UIOverlay.update() || UIOverlay.updated) {
+	// The overlay's buffers for the next frame are written now, so the frame that last used them has to be finished
+	VK_CHECK_RESULT(vkWaitForFences(device, 1, &waitFences[currentFrame], VK_TRUE, UINT64_MAX));
+	// Recreated buffers need no rebuild, the command buffer for the acquired image is recorded each frame while the overlay is visible
+	UIOverlay.update(currentFrame);
+	if (UIOverlay.updated) {
+		// The command buffers may still be in use by frames in flight
+		VK_CHECK_RESULT(vkQueueWaitIdle(queue));
 		buildCommandBuffers();
 		UIOverlay.updated = false;
 	}
@@ -654,14 +710,19 @@ void VulkanApplication::drawUI(const VkCommandBuffer commandBuffer)
 		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-		UIOverlay.draw(commandBuffer);
+		UIOverlay.draw(commandBuffer, currentFrame);
 	}
 }
 
 void VulkanApplication::prepareFrame()
 {
+	// Wait until the GPU has finished the frame that last used this frame's synchronization objects
+	auto tWaitStart = std::chrono::high_resolution_clock::now();
+	VK_CHECK_RESULT(vkWaitForFences(device, 1, &waitFences[currentFrame], VK_TRUE, UINT64_MAX));
+	auto tWait = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tWaitStart).count();
+
 	// Acquire the next image from the swap chain
-	VkResult result = swapChain.acquireNextImage(semaphores.presentComplete, &currentBuffer);
+	VkResult result = swapChain.acquireNextImage(semaphores.presentComplete[currentFrame], &currentBuffer);
 	// Recreate the swapchain if it's no longer compatible with the surface (OUT_OF_DATE) or no longer optimal for presentation (SUBOPTIMAL)
 	if ((result == VK_ERROR_OUT_OF_DATE_KHR) || (result == VK_SUBOPTIMAL_KHR)) {
 		windowResize();
@@ -669,11 +730,26 @@ void VulkanApplication::prepareFrame()
 	else {
 		VK_CHECK_RESULT(result);
 	}
+
+	// The acquired image may still be in use by an earlier frame in flight (if images are returned out of order)
+	if (imagesInFlight[currentBuffer] != VK_NULL_HANDLE) {
+		tWaitStart = std::chrono::high_resolution_clock::now();
+		VK_CHECK_RESULT(vkWaitForFences(device, 1, &imagesInFlight[currentBuffer], VK_TRUE, UINT64_MAX));
+		tWait += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tWaitStart).count();
+	}
+	imagesInFlight[currentBuffer] = waitFences[currentFrame];
+	benchmark.fenceWaitTime += tWait;
+
+	VK_CHECK_RESULT(vkResetFences(device, 1, &waitFences[currentFrame]));
+	submitInfo.pWaitSemaphores = &semaphores.presentComplete[currentFrame];
+	submitInfo.pSignalSemaphores = &semaphores.renderComplete[currentFrame];
 }
 
 void VulkanApplication::submitFrame()
 {
-	VkResult result = swapChain.queuePresent(queue, currentBuffer, semaphores.renderComplete);
+	VkResult result = swapChain.queuePresent(queue, currentBuffer, semaphores.renderComplete[currentFrame]);
+	// No need to wait for the queue to become idle, the CPU can start with the next frame while the GPU is still busy
+	currentFrame = (currentFrame + 1) % settings.maxFramesInFlight;
 	if (!((result == VK_SUCCESS) || (result == VK_SUBOPTIMAL_KHR))) {
 		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
 			// Swap chain is no longer compatible with the surface and needs to be recreated
@@ -683,7 +759,6 @@ void VulkanApplication::submitFrame()
 			VK_CHECK_RESULT(result);
 		}
 	}
-	VK_CHECK_RESULT(vkQueueWaitIdle(queue));
 }
 
 VulkanApplication::VulkanApplication(bool enableValidation)
@@ -703,6 +778,8 @@ VulkanApplication::VulkanApplication(bool enableValidation)
 	}
 #endif
 
+	startTimestamp = std::chrono::high_resolution_clock::now();
+
 	settings.validation = enableValidation;
 
 	char* numConvPtr;
@@ -719,6 +796,11 @@ VulkanApplication::VulkanApplication(bool enableValidation)
 		if ((args[i] == std::string("-f")) || (args[i] == std::string("--fullscreen"))) {
 			settings.fullscreen = true;
 		}
+		if ((args[i] == std::string("-pc")) || (args[i] == std::string("--pipelinecache"))) {
+			if (args.size() > i + 1) {
+				settings.pipelineCacheFile = args[i + 1];
+			}
+		}
 		if ((args[i] == std::string("-w")) || (args[i] == std::string("-width"))) {
 			uint32_t w = strtol(args[i + 1], &numConvPtr, 10);
 			if (numConvPtr != args[i + 1]) { width = w; };
@@ -781,6 +863,17 @@ VulkanApplication::VulkanApplication(bool enableValidation)
 		if ((args[i] == std::string("-bt")) || (args[i] == std::string("--benchframetimes"))) {
 			benchmark.outputFrameTimes = true;
 		}
+		// Number of frames in flight
+		if ((args[i] == std::string("-fif")) || (args[i] == std::string("--framesinflight"))) {
+			if (args.size() > i + 1) {
+				uint32_t num = strtol(args[i + 1], &numConvPtr, 10);
+				if ((numConvPtr != args[i + 1]) && (num > 0)) {
+					settings.maxFramesInFlight = num;
+				} else {
+					std::cerr << "Number of frames in flight must be specified as a number greater than zero!" << "\n";
+				}
+			}
+		}
 	}
 
 #if defined(VK_USE_PLATFORM_ANDROID_KHR)
@@ -829,12 +922,17 @@ VulkanApplication::~VulkanApplication()
 	vkDestroyImage(device, depthStencil.image, nullptr);
 	vkFreeMemory(device, depthStencil.mem, nullptr);
 
+	savePipelineCache();
 	vkDestroyPipelineCache(device, pipelineCache, nullptr);
 
 	vkDestroyCommandPool(device, cmdPool, nullptr);
 
-	vkDestroySemaphore(device, semaphores.presentComplete, nullptr);
-	vkDestroySemaphore(device, semaphores.renderComplete, nullptr);
+	for (auto& semaphore : semaphores.presentComplete) {
+		vkDestroySemaphore(device, semaphore, nullptr);
+	}
+	for (auto& semaphore : semaphores.renderComplete) {
+		vkDestroySemaphore(device, semaphore, nullptr);
+	}
 	for (auto& fence : waitFences) {
 		vkDestroyFence(device, fence, nullptr);
 	}
@@ -987,11 +1085,14 @@ bool VulkanApplication::initVulkan()
 	vkGetPhysicalDeviceFeatures(physicalDevice, &deviceFeatures);
 	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &deviceMemoryProperties);
 
+	// Derived examples can enable features based on the features supported by the physical device
+	getEnabledFeatures();
+
 	// Vulkan device creation
 	// This is handled by a separate class that gets a logical device representation
 	// and encapsulates functions related to a device
 	vulkanDevice = new vks::VulkanDevice(physicalDevice);
-	VkResult res = vulkanDevice->createLogicalDevice(enabledFeatures, enabledDeviceExtensions, deviceCreatepNextChain);
+	VkResult res = vulkanDevice->createLogicalDevice(enabledFeatures, enabledDeviceExtensions, deviceCreatepNextChain, true, requestedQueueTypes);
 	if (res != VK_SUCCESS) {
 		vks::tools::exitFatal("Could not create Vulkan device: \n" + vks::tools::errorString(res), res);
 		return false;
@@ -1007,24 +1108,13 @@ bool VulkanApplication::initVulkan()
 
 	swapChain.connect(instance, physicalDevice, device);
 
-	// Create synchronization objects
-	VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
-	// Create a semaphore used to synchronize image presentation
-	// Ensures that the image is displayed before we start submitting new commands to the queue
-	VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &semaphores.presentComplete));
-	// Create a semaphore used to synchronize command submission
-	// Ensures that the image is not presented until all commands have been submitted and executed
-	VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &semaphores.renderComplete));
-
 	// Set up submit info structure
-	// Semaphores will stay the same during application lifetime
+	// Semaphores are set per frame in flight by prepareFrame
 	// Command buffer submission info is set by each example
 	submitInfo = vks::initializers::submitInfo();
 	submitInfo.pWaitDstStageMask = &submitPipelineStages;
 	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = &semaphores.presentComplete;
 	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = &semaphores.renderComplete;
 
 	return true;
 }
@@ -2489,12 +2579,21 @@ void VulkanApplication::buildCommandBuffers() {}
 
 void VulkanApplication::createSynchronizationPrimitives()
 {
-	// Wait fences to sync command buffer access
+	// Each frame in flight has it's own set of synchronization objects
+	VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
 	VkFenceCreateInfo fenceCreateInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
-	waitFences.resize(drawCmdBuffers.size());
-	for (auto& fence : waitFences) {
-		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &fence));
+	semaphores.presentComplete.resize(settings.maxFramesInFlight);
+	semaphores.renderComplete.resize(settings.maxFramesInFlight);
+	waitFences.resize(settings.maxFramesInFlight);
+	for (uint32_t i = 0; i < settings.maxFramesInFlight; i++) {
+		// Ensures that the image is displayed before we start submitting new commands to the queue
+		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &semaphores.presentComplete[i]));
+		// Ensures that the image is not presented until all commands have been submitted and executed
+		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &semaphores.renderComplete[i]));
+		// Wait fences to sync command buffer and per-frame resource access
+		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &waitFences[i]));
 	}
+	imagesInFlight.assign(swapChain.imageCount, VK_NULL_HANDLE);
 }
 
 void VulkanApplication::createCommandPool()
@@ -2661,6 +2760,7 @@ void VulkanApplication::windowResize()
 	width = destWidth;
 	height = destHeight;
 	setupSwapChain();
+	imagesInFlight.assign(swapChain.imageCount, VK_NULL_HANDLE);
 
 	// Recreate the frame buffers
 	vkDestroyImageView(device, depthStencil.view, nullptr);
@@ -2732,6 +2832,8 @@ void VulkanApplication::handleMouseMove(int32_t x, int32_t y)
 
 void VulkanApplication::windowResized() {}
 
+void VulkanApplication::getEnabledFeatures() {}
+
 void VulkanApplication::initSwapchain()
 {
 #if defined(_WIN32)
@@ -82,6 +82,7 @@ private:
 	void nextFrame();
 	void updateOverlay();
 	void createPipelineCache();
+	void savePipelineCache();
 	void createCommandPool();
 	void createSynchronizationPrimitives();
 	void initSwapchain();
@@ -115,6 +116,8 @@ protected:
 	std::vector<const char*> enabledInstanceExtensions;
 	/** @brief Optional pNext structure for passing extension structures to device creation */
 	void* deviceCreatepNextChain = nullptr;
+	/** @brief Queue types requested at device creation, dedicated queue families are picked where available */
+	VkQueueFlags requestedQueueTypes = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
 	/** @brief Logical device, application's view of the physical device (GPU) */
 	VkDevice device;
 	// Handle to the device graphics queue that command buffers are submitted to
@@ -141,16 +144,25 @@ protected:
 	std::vector<VkShaderModule> shaderModules;
 	// Pipeline cache object
 	VkPipelineCache pipelineCache;
+	// True if the pipeline cache was initialized with data from a previous run
+	bool pipelineCacheLoaded = false;
+	// Taken before the command line is parsed, startup times are reported relative to it
+	std::chrono::time_point<std::chrono::high_resolution_clock> startTimestamp;
 	// Wraps the swap chain to present images (framebuffers) to the windowing system
 	VulkanSwapChain swapChain;
-	// Synchronization semaphores
+	// Synchronization semaphores (one per frame in flight)
 	struct {
 		// Swap chain image presentation
-		VkSemaphore presentComplete;
+		std::vector<VkSemaphore> presentComplete;
 		// Command buffer submission and execution
-		VkSemaphore renderComplete;
+		std::vector<VkSemaphore> renderComplete;
 	} semaphores;
+	// Fences signaled once the GPU has finished processing a frame in flight
 	std::vector<VkFence> waitFences;
+	// Fence of the frame in flight that currently uses a given swap chain image (not owned)
+	std::vector<VkFence> imagesInFlight;
+	// Index of the current frame in flight
+	uint32_t currentFrame = 0;
 public:
 	bool prepared = false;
 	bool resized = false;
@@ -177,6 +189,10 @@ public:
 		bool vsync = false;
 		/** @brief Enable UI overlay */
 		bool overlay = false;
+		/** @brief Number of frames the CPU may record and submit ahead of the GPU */
+		uint32_t maxFramesInFlight = 2;
+		/** @brief File the pipeline cache is loaded from at startup and saved to at exit, the cache is not persisted if empty */
+		std::string pipelineCacheFile;
 	} settings;
 
 	VkClearColorValue defaultClearColor = { { 0.025f, 0.025f, 0.025f, 1.0f } };
@@ -352,6 +368,8 @@ public:
 	virtual void setupFrameBuffer();
 	/** @brief (Virtual) Setup a default renderpass */
 	virtual void setupRenderPass();
+	/** @brief (Virtual) Called after the physical device features have been read, can be used to set features to enable on the device */
+	virtual void getEnabledFeatures();
 
 	/** @brief Prepares all Vulkan resources and functions required to run the sample */
 	virtual void prepare();
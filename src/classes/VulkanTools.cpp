@@ -8,6 +8,16 @@
 
 #include "VulkanTools.h"
 
+#include <sys/stat.h>
+#include <sstream>
+#include <iomanip>
+#if defined(_WIN32)
+#include <direct.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
 const std::string getAssetPath()
 {
 #if defined(VK_USE_PLATFORM_ANDROID_KHR)
@@ -336,10 +346,83 @@ namespace vks
 			return !f.fail();
 		}
 
+		bool createDirectory(const std::string &path)
+		{
+			struct stat info;
+			if (stat(path.c_str(), &info) == 0) {
+				return (info.st_mode & S_IFDIR) != 0;
+			}
+#if defined(_WIN32)
+			return _mkdir(path.c_str()) == 0;
+#else
+			return mkdir(path.c_str(), 0755) == 0;
+#endif
+		}
+
 		uint32_t alignedSize(uint32_t value, uint32_t alignment)
         {
 	        return (value + alignment - 1) & ~(alignment - 1);
         }
 
+		VkDeviceSize alignedVkSize(VkDeviceSize value, VkDeviceSize alignment)
+		{
+			return (value + alignment - 1) & ~(alignment - 1);
+		}
+
+		uint64_t hash(const void* data, size_t size, uint64_t seed)
+		{
+			const uint8_t* bytes = static_cast<const uint8_t*>(data);
+			uint64_t hash = seed;
+			for (size_t i = 0; i < size; i++) {
+				hash ^= bytes[i];
+				hash *= 1099511628211ull;
+			}
+			return hash;
+		}
+
+		uint64_t hashFileIdentity(const std::string &filename, uint64_t seed)
+		{
+			uint64_t hashValue = hash(filename.data(), filename.size(), seed);
+			struct stat info;
+			if (stat(filename.c_str(), &info) == 0) {
+				const uint64_t identity[2] = { static_cast<uint64_t>(info.st_size), static_cast<uint64_t>(info.st_mtime) };
+				hashValue = hash(identity, sizeof(identity), hashValue);
+			}
+			return hashValue;
+		}
+
+		std::string getDeviceCacheKey(const VkPhysicalDeviceProperties &properties)
+		{
+			std::stringstream ss;
+			ss << std::hex << std::setfill('0');
+			for (uint32_t i = 0; i < VK_UUID_SIZE; i++) {
+				ss << std::setw(2) << static_cast<uint32_t>(properties.pipelineCacheUUID[i]);
+			}
+			ss << "_" << std::setw(8) << properties.driverVersion;
+			return ss.str();
+		}
+
+		size_t getPeakResidentMemory()
+		{
+#if defined(_WIN32)
+			PROCESS_MEMORY_COUNTERS counters{};
+			if (K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+				return counters.PeakWorkingSetSize;
+			}
+			return 0;
+#else
+			struct rusage usage{};
+			if (getrusage(RUSAGE_SELF, &usage) != 0) {
+				return 0;
+			}
+#if defined(__APPLE__)
+			return static_cast<size_t>(usage.ru_maxrss);
+#else
+			// Reported in kilobytes on Linux
+			return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+		}
+
 	}
 }
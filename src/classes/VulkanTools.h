@@ -110,6 +110,22 @@ namespace vks
 		/** @brief Checks if a file exists */
 		bool fileExists(const std::string &filename);
 
+		/** @brief Creates a directory if it doesn't exist yet, returns true if the directory is available */
+		bool createDirectory(const std::string &path);
+
 		uint32_t alignedSize(uint32_t value, uint32_t alignment);
+		VkDeviceSize alignedVkSize(VkDeviceSize value, VkDeviceSize alignment);
+
+		/** @brief 64-bit FNV-1a hash of a block of memory, pass a previous hash as the seed to combine multiple blocks */
+		uint64_t hash(const void* data, size_t size, uint64_t seed = 14695981039346656037ull);
+
+		/** @brief Hashes the name, size and modification time of a file, cheap enough to key caches on files that are too large to hash */
+		uint64_t hashFileIdentity(const std::string &filename, uint64_t seed = 14695981039346656037ull);
+
+		/** @brief Identifies the device and driver in file names of caches that are only valid for both */
+		std::string getDeviceCacheKey(const VkPhysicalDeviceProperties &properties);
+
+		/** @brief Peak resident memory of the process in bytes, 0 if not available on the platform */
+		size_t getPeakResidentMemory();
 	}
 }
@@ -293,7 +293,8 @@ namespace vks
 	}
 
 	/** Update vertex and index buffer containing the imGui elements when required */
-	bool UIOverlay::update()
+	/** The frame's previous submission must have finished, its buffers are written without further synchronization */
+	bool UIOverlay::update(uint32_t frameIndex)
 	{
 		ImDrawData* imDrawData = ImGui::GetDrawData();
 		bool updateCmdBuffers = false;
@@ -304,18 +305,25 @@ namespace vks
 		VkDeviceSize vertexBufferSize = imDrawData->TotalVtxCount * sizeof(ImDrawVert);
 		VkDeviceSize indexBufferSize = imDrawData->TotalIdxCount * sizeof(ImDrawIdx);
 
-		// Update buffers only if vertex or index count has been changed compared to current buffer size
+		// Buffers only grow, so they are recreated only when the current draw data no longer fits
 		if ((vertexBufferSize == 0) || (indexBufferSize == 0)) {
 			return false;
 		}
 
+		if (frames.size() <= frameIndex) {
+			frames.resize(frameIndex + 1);
+		}
+		vks::Buffer& vertexBuffer = frames[frameIndex].vertexBuffer;
+		vks::Buffer& indexBuffer = frames[frameIndex].indexBuffer;
+		int32_t& vertexCount = frames[frameIndex].vertexCount;
+		int32_t& indexCount = frames[frameIndex].indexCount;
+
 		// Vertex buffer
-		if ((vertexBuffer.buffer == VK_NULL_HANDLE) || (vertexCount != imDrawData->TotalVtxCount)) {
+		if ((vertexBuffer.buffer == VK_NULL_HANDLE) || (vertexCount < imDrawData->TotalVtxCount)) {
 			vertexBuffer.unmap();
 			vertexBuffer.destroy();
 			VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &vertexBuffer, vertexBufferSize));
 			vertexCount = imDrawData->TotalVtxCount;
-			vertexBuffer.unmap();
 			vertexBuffer.map();
 			updateCmdBuffers = true;
 		}
@@ -350,13 +358,13 @@ namespace vks
 		return updateCmdBuffers;
 	}
 
-	void UIOverlay::draw(const VkCommandBuffer commandBuffer)
+	void UIOverlay::draw(const VkCommandBuffer commandBuffer, uint32_t frameIndex)
 	{
 		ImDrawData* imDrawData = ImGui::GetDrawData();
 		int32_t vertexOffset = 0;
 		int32_t indexOffset = 0;
 
-		if ((!imDrawData) || (imDrawData->CmdListsCount == 0)) {
+		if ((!imDrawData) || (imDrawData->CmdListsCount == 0) || (frameIndex >= frames.size()) || (frames[frameIndex].vertexBuffer.buffer == VK_NULL_HANDLE)) {
 			return;
 		}
 
@@ -370,8 +378,8 @@ namespace vks
 		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstBlock), &pushConstBlock);
 
 		VkDeviceSize offsets[1] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer.buffer, offsets);
-		vkCmdBindIndexBuffer(commandBuffer, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT16);
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &frames[frameIndex].vertexBuffer.buffer, offsets);
+		vkCmdBindIndexBuffer(commandBuffer, frames[frameIndex].indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT16);
 
 		for (int32_t i = 0; i < imDrawData->CmdListsCount; i++)
 		{
@@ -401,8 +409,11 @@ namespace vks
 	void UIOverlay::freeResources()
 	{
 		ImGui::DestroyContext();
-		vertexBuffer.destroy();
-		indexBuffer.destroy();
+		for (auto& frame : frames) {
+			frame.vertexBuffer.destroy();
+			frame.indexBuffer.destroy();
+		}
+		frames.clear();
 		vkDestroyImageView(device->logicalDevice, fontView, nullptr);
 		vkDestroyImage(device->logicalDevice, fontImage, nullptr);
 		vkFreeMemory(device->logicalDevice, fontMemory, nullptr);
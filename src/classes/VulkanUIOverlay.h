@@ -35,10 +35,14 @@ namespace vks
 		VkSampleCountFlagBits rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
 		uint32_t subpass = 0;
 
-		vks::Buffer vertexBuffer;
-		vks::Buffer indexBuffer;
-		int32_t vertexCount = 0;
-		int32_t indexCount = 0;
+		// Each frame in flight has it's own buffers, as the GPU may still read those of earlier frames while the UI of the next one is written
+		struct FrameBuffers {
+			vks::Buffer vertexBuffer;
+			vks::Buffer indexBuffer;
+			int32_t vertexCount = 0;
+			int32_t indexCount = 0;
+		};
+		std::vector<FrameBuffers> frames;
 
 		std::vector<VkPipelineShaderStageCreateInfo> shaders;
 
@@ -68,8 +72,8 @@ namespace vks
 		void preparePipeline(const VkPipelineCache pipelineCache, const VkRenderPass renderPass);
 		void prepareResources();
 
-		bool update();
-		void draw(const VkCommandBuffer commandBuffer);
+		bool update(uint32_t frameIndex = 0);
+		void draw(const VkCommandBuffer commandBuffer, uint32_t frameIndex = 0);
 		void resize(uint32_t width, uint32_t height);
 
 		void freeResources();
@@ -12,6 +12,8 @@
 #define TINYGLTF_NO_STB_IMAGE_WRITE
 
 #include "VulkanglTFModel.h"
+#include "threadpool.hpp"
+#include "AccessorDecoder.h"
 #include "basis_universal/zstd/zstddeclib.c"
 #include "basis_universal/transcoder/basisu_transcoder.cpp"
 
@@ -19,6 +21,22 @@ VkDescriptorSetLayout vkglTF::descriptorSetLayoutImage = VK_NULL_HANDLE;
 VkDescriptorSetLayout vkglTF::descriptorSetLayoutUbo = VK_NULL_HANDLE;
 VkMemoryPropertyFlags vkglTF::memoryPropertyFlags = 0;
 uint32_t vkglTF::descriptorBindingFlags = vkglTF::DescriptorBindingFlags::ImageBaseColor;
+std::string vkglTF::cacheDirectory = "";
+float vkglTF::splitThreshold = 8.0f;
+uint32_t vkglTF::maxSplitDepth = 3;
+uint32_t vkglTF::levelOfDetailCount = 3;
+uint32_t vkglTF::levelOfDetailGridResolution = 64;
+bool vkglTF::mapBinaryFiles = true;
+uint32_t vkglTF::imageDecodeThreadCount = 0;
+
+// Models may be loaded on multiple threads at once, so state shared by all models is set up under a lock
+static std::mutex sharedLayoutMutex;
+static std::once_flag transcoderInitFlag;
+
+static void initTranscoder()
+{
+	std::call_once(transcoderInitFlag, [] { basist::basisu_transcoder_init(); });
+}
 
 bool loadImageDataFunc(tinygltf::Image* image, const int imageIndex, std::string* error, std::string* warning, int req_width, int req_height, const unsigned char* bytes, int size, void* userData)
 {
@@ -54,413 +72,224 @@ void vkglTF::Texture::destroy()
 	}
 }
 
-void vkglTF::Texture::fromglTfImage(tinygltf::Image &gltfimage, std::string path, vks::VulkanDevice *device, VkQueue copyQueue)
+void vkglTF::Texture::createAlphaLevels(const uint8_t* rgba, uint32_t width, uint32_t height)
 {
-	this->device = device;
-
-	bool isKtx = false;
-
-	// MimeType does not work with tinyglTF and is always empty
-	if (gltfimage.uri.find(".ktx2") != std::string::npos) {
-		isKtx = true;
+	alphaLevels.clear();
+	std::vector<AlphaRange> baseLevel(width * height);
+	for (size_t i = 0; i < baseLevel.size(); i++) {
+		baseLevel[i] = { rgba[i * 4 + 3], rgba[i * 4 + 3] };
 	}
+	alphaLevels.push_back(std::move(baseLevel));
+	// Each cell of a level covers 2x2 cells of the previous one, so cell c of level l covers texels [c << l, ((c + 1) << l) - 1]
+	uint32_t w = width;
+	uint32_t h = height;
+	while ((w > 1) || (h > 1)) {
+		const uint32_t levelWidth = (w + 1) / 2;
+		const uint32_t levelHeight = (h + 1) / 2;
+		std::vector<AlphaRange> level(levelWidth * levelHeight);
+		const std::vector<AlphaRange>& src = alphaLevels.back();
+		for (uint32_t y = 0; y < levelHeight; y++) {
+			for (uint32_t x = 0; x < levelWidth; x++) {
+				AlphaRange range = { 255, 0 };
+				for (uint32_t sy = 2 * y; sy <= std::min(2 * y + 1, h - 1); sy++) {
+					for (uint32_t sx = 2 * x; sx <= std::min(2 * x + 1, w - 1); sx++) {
+						range.min = std::min(range.min, src[sy * w + sx].min);
+						range.max = std::max(range.max, src[sy * w + sx].max);
+					}
+				}
+				level[y * levelWidth + x] = range;
+			}
+		}
+		alphaLevels.push_back(std::move(level));
+		w = levelWidth;
+		h = levelHeight;
+	}
+}
 
-	VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
-
-	if (isKtx) {
-		std::string fp = path + "/" + gltfimage.uri;
-		if (!basist::g_transcoder_initialized) {
-			basist::basisu_transcoder_init();
+// Maps the texel interval [first, last] to intervals inside [0, size - 1] using mirrored repeat addressing (as used by the texture samplers)
+static void getMirroredIntervals(int64_t first, int64_t last, int64_t size, std::vector<std::pair<uint32_t, uint32_t>>& intervals)
+{
+	intervals.clear();
+	if (last - first + 1 >= size) {
+		intervals.push_back({ 0, static_cast<uint32_t>(size - 1) });
+		return;
+	}
+	int64_t start = first;
+	while (start <= last) {
+		const int64_t period = (start >= 0) ? start / size : -((-start + size - 1) / size);
+		const int64_t end = std::min(last, (period + 1) * size - 1);
+		int64_t a = start - period * size;
+		int64_t b = end - period * size;
+		// Every other period is mirrored
+		if (period & 1) {
+			const int64_t mirroredA = size - 1 - b;
+			b = size - 1 - a;
+			a = mirroredA;
 		}
-		basist::ktx2_transcoder transcoder;
+		intervals.push_back({ static_cast<uint32_t>(a), static_cast<uint32_t>(b) });
+		start = end + 1;
+	}
+}
 
-		std::ifstream is(fp, std::ios::binary | std::ios::in | std::ios::ate);
-		assert(is.is_open());
-		if (is.is_open()) {
-			size_t size = is.tellg();
-			is.seekg(0, std::ios::beg);
-			char* fdata = new char[size];
-			is.read(fdata, size);
-			is.close();
-			if (!transcoder.init(fdata, size)) {
-				assert(0);
-			}
-			if (!transcoder.start_transcoding()) {
-				assert(0);
+vkglTF::Texture::AlphaRange vkglTF::Texture::getAlphaRange(glm::vec2 uvMin, glm::vec2 uvMax)
+{
+	AlphaRange range = { 255, 0 };
+	// Texel footprint of the uv rectangle, including the neighbours fetched by bilinear filtering
+	const int64_t x0 = static_cast<int64_t>(floor(uvMin.x * width - 0.5f));
+	const int64_t x1 = static_cast<int64_t>(floor(uvMax.x * width - 0.5f)) + 1;
+	const int64_t y0 = static_cast<int64_t>(floor(uvMin.y * height - 0.5f));
+	const int64_t y1 = static_cast<int64_t>(floor(uvMax.y * height - 0.5f)) + 1;
+	std::vector<std::pair<uint32_t, uint32_t>> xIntervals, yIntervals;
+	getMirroredIntervals(x0, x1, width, xIntervals);
+	getMirroredIntervals(y0, y1, height, yIntervals);
+	for (auto& x : xIntervals) {
+		for (auto& y : yIntervals) {
+			// Use the finest level at which the rectangle is covered by at most 8x8 cells
+			uint32_t level = 0;
+			while ((level + 1 < alphaLevels.size()) && (((x.second >> level) - (x.first >> level) >= 8) || ((y.second >> level) - (y.first >> level) >= 8))) {
+				level++;
 			}
-			uint32_t w = width = transcoder.get_width();
-			uint32_t h = height = transcoder.get_height();
-			basist::ktx2_image_level_info levelInfo;
-			transcoder.get_image_level_info(levelInfo, 0, 0, 0);
-			uint32_t blockSizeBytes = 16;
-			uint32_t levelDataSizeBlocks = levelInfo.m_total_blocks;
-			uint32_t bufferSize = levelDataSizeBlocks * blockSizeBytes;
-			void* buffer = new char[bufferSize];
-			if (!transcoder.transcode_image_level(0, 0, 0, buffer, levelDataSizeBlocks, basist::transcoder_texture_format::cTFBC7_RGBA)) {
-				assert(0);
+			const uint32_t levelWidth = ((width - 1) >> level) + 1;
+			for (uint32_t cy = y.first >> level; cy <= (y.second >> level); cy++) {
+				for (uint32_t cx = x.first >> level; cx <= (x.second >> level); cx++) {
+					const AlphaRange& cell = alphaLevels[level][cy * levelWidth + cx];
+					range.min = std::min(range.min, cell.min);
+					range.max = std::max(range.max, cell.max);
+				}
 			}
-			assert(buffer);
-
-			//unsigned char* buffer = nullptr;
-			//VkDeviceSize bufferSize = 0;
-
-			std::string fp = path + "/" + gltfimage.uri;
-
-			format = VK_FORMAT_BC7_UNORM_BLOCK;
-
-			VkFormatProperties formatProperties;
-
-			mipLevels = 1;
-
-			vkGetPhysicalDeviceFormatProperties(device->physicalDevice, format, &formatProperties);
-
-			VkMemoryAllocateInfo memAllocInfo{};
-			memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-			VkMemoryRequirements memReqs{};
-
-			VkBuffer stagingBuffer;
-			VkDeviceMemory stagingMemory;
-
-			VkBufferCreateInfo bufferCreateInfo{};
-			bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-			bufferCreateInfo.size = bufferSize;
-			bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-			bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-			VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferCreateInfo, nullptr, &stagingBuffer));
-			vkGetBufferMemoryRequirements(device->logicalDevice, stagingBuffer, &memReqs);
-			memAllocInfo.allocationSize = memReqs.size;
-			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-			VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &stagingMemory));
-			VK_CHECK_RESULT(vkBindBufferMemory(device->logicalDevice, stagingBuffer, stagingMemory, 0));
-
-			uint8_t* data;
-			VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void**)&data));
-			memcpy(data, buffer, bufferSize);
-			vkUnmapMemory(device->logicalDevice, stagingMemory);
-
-			VkImageCreateInfo imageCreateInfo{};
-			imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-			imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-			imageCreateInfo.format = format;
-			imageCreateInfo.mipLevels = mipLevels;
-			imageCreateInfo.arrayLayers = 1;
-			imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-			imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-			imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
-			imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-			imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-			imageCreateInfo.extent = { width, height, 1 };
-			imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-			VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &image));
-			vkGetImageMemoryRequirements(device->logicalDevice, image, &memReqs);
-			memAllocInfo.allocationSize = memReqs.size;
-			memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-			VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &deviceMemory));
-			VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, image, deviceMemory, 0));
-
-			VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
-			VkImageSubresourceRange subresourceRange = {};
-			subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			subresourceRange.levelCount = 1;
-			subresourceRange.layerCount = 1;
+		}
+	}
+	return range;
+}
 
-			{
-				VkImageMemoryBarrier imageMemoryBarrier{};
-				imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-				imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-				imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-				imageMemoryBarrier.srcAccessMask = 0;
-				imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-				imageMemoryBarrier.image = image;
-				imageMemoryBarrier.subresourceRange = subresourceRange;
-				vkCmdPipelineBarrier(copyCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-			}
+// Only uses Vulkan functions that don't need external synchronization, so images can be decoded on multiple threads at once
+void vkglTF::Texture::decode(tinygltf::Image& gltfimage, std::string path, vks::VulkanDevice* device, UploadBatch& uploadBatch, bool keepAlpha, const unsigned char* imageData, size_t imageSize)
+{
+	this->device = device;
 
-			VkBufferImageCopy bufferCopyRegion = {};
-			bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			bufferCopyRegion.imageSubresource.mipLevel = 0;
-			bufferCopyRegion.imageSubresource.baseArrayLayer = 0;
-			bufferCopyRegion.imageSubresource.layerCount = 1;
-			bufferCopyRegion.imageExtent.width = width;
-			bufferCopyRegion.imageExtent.height = height;
-			bufferCopyRegion.imageExtent.depth = 1;
+	bool isKtx = false;
 
-			vkCmdCopyBufferToImage(copyCmd, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bufferCopyRegion);
+	// MimeType does not work with tinyglTF and is always empty for images referenced by uri
+	if ((gltfimage.uri.find(".ktx2") != std::string::npos) || (gltfimage.mimeType == "image/ktx2")) {
+		isKtx = true;
+	}
 
-			{
-				VkImageMemoryBarrier imageMemoryBarrier{};
-				imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-				imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-				imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-				imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-				imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-				imageMemoryBarrier.image = image;
-				imageMemoryBarrier.subresourceRange = subresourceRange;
-				vkCmdPipelineBarrier(copyCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-			}
+	const std::string fp = path + "/" + gltfimage.uri;
 
-			device->flushCommandBuffer(copyCmd, copyQueue, true);
-
-			vkFreeMemory(device->logicalDevice, stagingMemory, nullptr);
-			vkDestroyBuffer(device->logicalDevice, stagingBuffer, nullptr);
-
-			// Generate the mip chain (glTF uses jpg and png, so we need to create this manually)
-			VkCommandBuffer blitCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-			for (uint32_t i = 1; i < mipLevels; i++) {
-				VkImageBlit imageBlit{};
-
-				imageBlit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-				imageBlit.srcSubresource.layerCount = 1;
-				imageBlit.srcSubresource.mipLevel = i - 1;
-				imageBlit.srcOffsets[1].x = int32_t(width >> (i - 1));
-				imageBlit.srcOffsets[1].y = int32_t(height >> (i - 1));
-				imageBlit.srcOffsets[1].z = 1;
-
-				imageBlit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-				imageBlit.dstSubresource.layerCount = 1;
-				imageBlit.dstSubresource.mipLevel = i;
-				imageBlit.dstOffsets[1].x = int32_t(width >> i);
-				imageBlit.dstOffsets[1].y = int32_t(height >> i);
-				imageBlit.dstOffsets[1].z = 1;
-
-				VkImageSubresourceRange mipSubRange = {};
-				mipSubRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-				mipSubRange.baseMipLevel = i;
-				mipSubRange.levelCount = 1;
-				mipSubRange.layerCount = 1;
-
-				{
-					VkImageMemoryBarrier imageMemoryBarrier{};
-					imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-					imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-					imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-					imageMemoryBarrier.srcAccessMask = 0;
-					imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-					imageMemoryBarrier.image = image;
-					imageMemoryBarrier.subresourceRange = mipSubRange;
-					vkCmdPipelineBarrier(blitCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-				}
+	if (isKtx) {
+		initTranscoder();
+		basist::ktx2_transcoder transcoder;
 
-				vkCmdBlitImage(blitCmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageBlit, VK_FILTER_LINEAR);
-
-				{
-					VkImageMemoryBarrier imageMemoryBarrier{};
-					imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-					imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-					imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-					imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-					imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-					imageMemoryBarrier.image = image;
-					imageMemoryBarrier.subresourceRange = mipSubRange;
-					vkCmdPipelineBarrier(blitCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-				}
+		// Embedded images are transcoded straight from the glTF buffer
+		std::vector<char> fileData;
+		if (!imageData) {
+			std::ifstream is(fp, std::ios::binary | std::ios::in | std::ios::ate);
+			assert(is.is_open());
+			if (is.is_open()) {
+				fileData.resize(static_cast<size_t>(is.tellg()));
+				is.seekg(0, std::ios::beg);
+				is.read(fileData.data(), fileData.size());
+				is.close();
+				imageData = reinterpret_cast<const unsigned char*>(fileData.data());
+				imageSize = fileData.size();
 			}
+		}
+		if (!imageData) {
+			return;
+		}
+		if (!transcoder.init(imageData, static_cast<uint32_t>(imageSize))) {
+			assert(0);
+		}
+		if (!transcoder.start_transcoding()) {
+			assert(0);
+		}
+		uint32_t w = width = transcoder.get_width();
+		uint32_t h = height = transcoder.get_height();
+		mipLevels = 1;
+		staging.format = VK_FORMAT_BC7_UNORM_BLOCK;
+		basist::ktx2_image_level_info levelInfo;
+		transcoder.get_image_level_info(levelInfo, 0, 0, 0);
+		const uint32_t blockSizeBytes = 16;
+		const uint32_t levelDataSizeBlocks = levelInfo.m_total_blocks;
+
+		// Transcode straight into the upload batch's staging memory
+		staging.allocation = uploadBatch.allocate(levelDataSizeBlocks * blockSizeBytes, blockSizeBytes);
+		if (!transcoder.transcode_image_level(0, 0, 0, staging.allocation.data, levelDataSizeBlocks, basist::transcoder_texture_format::cTFBC7_RGBA)) {
+			assert(0);
+		}
 
-			subresourceRange.levelCount = mipLevels;
-			imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-			{
-				VkImageMemoryBarrier imageMemoryBarrier{};
-				imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-				imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-				imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-				imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-				imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-				imageMemoryBarrier.image = image;
-				imageMemoryBarrier.subresourceRange = subresourceRange;
-				vkCmdPipelineBarrier(blitCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
+		// Alpha values can't be read back from the block compressed data, so additionally transcode to uncompressed RGBA
+		if (keepAlpha) {
+			std::vector<uint8_t> rgba(w * h * 4);
+			if (transcoder.transcode_image_level(0, 0, 0, rgba.data(), w * h, basist::transcoder_texture_format::cTFRGBA32)) {
+				createAlphaLevels(rgba.data(), w, h);
 			}
-
-			device->flushCommandBuffer(blitCmd, copyQueue, true);
-
-			delete[] buffer;
 		}
 	} else {
-		VkDeviceSize bufferSize = 0;
-
-		std::string fp = path + "/" + gltfimage.uri;
-
 		int w, h, comp;
-		unsigned char* buffer = stbi_load(fp.c_str(), &w, &h, &comp, STBI_rgb_alpha);
-		bufferSize = w * h * 4;
+		unsigned char* buffer = imageData ? stbi_load_from_memory(imageData, static_cast<int>(imageSize), &w, &h, &comp, STBI_rgb_alpha) : stbi_load(fp.c_str(), &w, &h, &comp, STBI_rgb_alpha);
 		assert(buffer);
-
-		format = VK_FORMAT_R8G8B8A8_UNORM;
-
-		VkFormatProperties formatProperties;
+		if (!buffer) {
+			return;
+		}
 
 		width = w;
 		height = h;
 		mipLevels = static_cast<uint32_t>(floor(log2(std::max(width, height))) + 1.0);
+		staging.format = VK_FORMAT_R8G8B8A8_UNORM;
 
-		vkGetPhysicalDeviceFormatProperties(device->physicalDevice, format, &formatProperties);
-		assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT);
-		assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT);
-
-		VkMemoryAllocateInfo memAllocInfo{};
-		memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		VkMemoryRequirements memReqs{};
-
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingMemory;
-
-		VkBufferCreateInfo bufferCreateInfo{};
-		bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		bufferCreateInfo.size = bufferSize;
-		bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-		bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferCreateInfo, nullptr, &stagingBuffer));
-		vkGetBufferMemoryRequirements(device->logicalDevice, stagingBuffer, &memReqs);
-		memAllocInfo.allocationSize = memReqs.size;
-		memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &stagingMemory));
-		VK_CHECK_RESULT(vkBindBufferMemory(device->logicalDevice, stagingBuffer, stagingMemory, 0));
-
-		uint8_t* data;
-		VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void**)&data));
-		memcpy(data, buffer, bufferSize);
-		vkUnmapMemory(device->logicalDevice, stagingMemory);
-
-		VkImageCreateInfo imageCreateInfo{};
-		imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-		imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-		imageCreateInfo.format = format;
-		imageCreateInfo.mipLevels = mipLevels;
-		imageCreateInfo.arrayLayers = 1;
-		imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-		imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-		imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
-		imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		imageCreateInfo.extent = { width, height, 1 };
-		imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-		VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &image));
-		vkGetImageMemoryRequirements(device->logicalDevice, image, &memReqs);
-		memAllocInfo.allocationSize = memReqs.size;
-		memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &deviceMemory));
-		VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, image, deviceMemory, 0));
-
-		VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
-		VkImageSubresourceRange subresourceRange = {};
-		subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		subresourceRange.levelCount = 1;
-		subresourceRange.layerCount = 1;
-
-		{
-			VkImageMemoryBarrier imageMemoryBarrier{};
-			imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-			imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-			imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-			imageMemoryBarrier.srcAccessMask = 0;
-			imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			imageMemoryBarrier.image = image;
-			imageMemoryBarrier.subresourceRange = subresourceRange;
-			vkCmdPipelineBarrier(copyCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-		}
-
-		VkBufferImageCopy bufferCopyRegion = {};
-		bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		bufferCopyRegion.imageSubresource.mipLevel = 0;
-		bufferCopyRegion.imageSubresource.baseArrayLayer = 0;
-		bufferCopyRegion.imageSubresource.layerCount = 1;
-		bufferCopyRegion.imageExtent.width = width;
-		bufferCopyRegion.imageExtent.height = height;
-		bufferCopyRegion.imageExtent.depth = 1;
-
-		vkCmdCopyBufferToImage(copyCmd, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bufferCopyRegion);
-
-		{
-			VkImageMemoryBarrier imageMemoryBarrier{};
-			imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-			imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-			imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-			imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-			imageMemoryBarrier.image = image;
-			imageMemoryBarrier.subresourceRange = subresourceRange;
-			vkCmdPipelineBarrier(copyCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-		}
-
-		device->flushCommandBuffer(copyCmd, copyQueue, true);
-
-		vkFreeMemory(device->logicalDevice, stagingMemory, nullptr);
-		vkDestroyBuffer(device->logicalDevice, stagingBuffer, nullptr);
-
-		// Generate the mip chain (glTF uses jpg and png, so we need to create this manually)
-		VkCommandBuffer blitCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-		for (uint32_t i = 1; i < mipLevels; i++) {
-			VkImageBlit imageBlit{};
-
-			imageBlit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			imageBlit.srcSubresource.layerCount = 1;
-			imageBlit.srcSubresource.mipLevel = i - 1;
-			imageBlit.srcOffsets[1].x = int32_t(width >> (i - 1));
-			imageBlit.srcOffsets[1].y = int32_t(height >> (i - 1));
-			imageBlit.srcOffsets[1].z = 1;
-
-			imageBlit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			imageBlit.dstSubresource.layerCount = 1;
-			imageBlit.dstSubresource.mipLevel = i;
-			imageBlit.dstOffsets[1].x = int32_t(width >> i);
-			imageBlit.dstOffsets[1].y = int32_t(height >> i);
-			imageBlit.dstOffsets[1].z = 1;
-
-			VkImageSubresourceRange mipSubRange = {};
-			mipSubRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			mipSubRange.baseMipLevel = i;
-			mipSubRange.levelCount = 1;
-			mipSubRange.layerCount = 1;
-
-			{
-				VkImageMemoryBarrier imageMemoryBarrier{};
-				imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-				imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-				imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-				imageMemoryBarrier.srcAccessMask = 0;
-				imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-				imageMemoryBarrier.image = image;
-				imageMemoryBarrier.subresourceRange = mipSubRange;
-				vkCmdPipelineBarrier(blitCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-			}
-
-			vkCmdBlitImage(blitCmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageBlit, VK_FILTER_LINEAR);
-
-			{
-				VkImageMemoryBarrier imageMemoryBarrier{};
-				imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-				imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-				imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-				imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-				imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-				imageMemoryBarrier.image = image;
-				imageMemoryBarrier.subresourceRange = mipSubRange;
-				vkCmdPipelineBarrier(blitCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-			}
+		if (keepAlpha) {
+			createAlphaLevels(buffer, width, height);
 		}
 
-		subresourceRange.levelCount = mipLevels;
-		imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		const VkDeviceSize bufferSize = static_cast<VkDeviceSize>(w) * h * 4;
+		staging.allocation = uploadBatch.allocate(bufferSize, 4);
+		memcpy(staging.allocation.data, buffer, bufferSize);
 
-		{
-			VkImageMemoryBarrier imageMemoryBarrier{};
-			imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-			imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-			imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-			imageMemoryBarrier.image = image;
-			imageMemoryBarrier.subresourceRange = subresourceRange;
-			vkCmdPipelineBarrier(blitCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-		}
+		stbi_image_free(buffer);
+	}
+}
 
-		device->flushCommandBuffer(blitCmd, copyQueue, true);
+// Creates the image and adds the copy of the decoded base level to the upload batch, which also generates the remaining mip levels (glTF uses jpg and png, so we need to create them manually)
+void vkglTF::Texture::upload(UploadBatch& uploadBatch)
+{
+	if (staging.allocation.buffer == VK_NULL_HANDLE) {
+		return;
+	}
 
-		delete[] buffer;
+	const VkFormat format = staging.format;
+	if (mipLevels > 1) {
+		VkFormatProperties formatProperties;
+		vkGetPhysicalDeviceFormatProperties(device->physicalDevice, format, &formatProperties);
+		assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT);
+		assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT);
 	}
 
+	VkImageCreateInfo imageCreateInfo{};
+	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageCreateInfo.format = format;
+	imageCreateInfo.mipLevels = mipLevels;
+	imageCreateInfo.arrayLayers = 1;
+	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageCreateInfo.extent = { width, height, 1 };
+	imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &image));
+	VkMemoryRequirements memReqs{};
+	vkGetImageMemoryRequirements(device->logicalDevice, image, &memReqs);
+	VkMemoryAllocateInfo memAllocInfo{};
+	memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memAllocInfo.allocationSize = memReqs.size;
+	memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &deviceMemory));
+	VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, image, deviceMemory, 0));
+
+	uploadBatch.copyToImage(staging.allocation, image, width, height, mipLevels);
+	staging = Staging();
+	imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
 	VkSamplerCreateInfo samplerInfo{};
 	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -493,7 +322,14 @@ void vkglTF::Texture::fromglTfImage(tinygltf::Image &gltfimage, std::string path
 	descriptor.sampler = sampler;
 	descriptor.imageView = view;
 	descriptor.imageLayout = imageLayout;
+}
 
+void vkglTF::Texture::fromglTfImage(tinygltf::Image &gltfimage, std::string path, vks::VulkanDevice *device, VkQueue copyQueue, bool keepAlpha, const unsigned char* imageData, size_t imageSize)
+{
+	UploadBatch uploadBatch(device, copyQueue);
+	decode(gltfimage, path, device, uploadBatch, keepAlpha, imageData, imageSize);
+	upload(uploadBatch);
+	uploadBatch.flush();
 }
 
 /*
@@ -683,7 +519,7 @@ vkglTF::Texture* vkglTF::Model::getTexture(uint32_t index)
 	return nullptr;
 }
 
-void vkglTF::Model::createEmptyTexture(VkQueue transferQueue)
+void vkglTF::Model::createEmptyTexture(UploadBatch& uploadBatch)
 {
 	emptyTexture.device = device;
 	emptyTexture.width = 1;
@@ -691,39 +527,9 @@ void vkglTF::Model::createEmptyTexture(VkQueue transferQueue)
 	emptyTexture.layerCount = 1;
 	emptyTexture.mipLevels = 1;
 
-	size_t bufferSize = emptyTexture.width * emptyTexture.height * 4;
-	unsigned char* buffer = new unsigned char[bufferSize];
-	memset(buffer, 0, bufferSize);
-
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingMemory;
-	VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo();
-	bufferCreateInfo.size = bufferSize;
-	// This buffer is used as a transfer source for the buffer copy
-	bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-	bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferCreateInfo, nullptr, &stagingBuffer));
-
-	VkMemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
-	VkMemoryRequirements memReqs;
-	vkGetBufferMemoryRequirements(device->logicalDevice, stagingBuffer, &memReqs);
-	memAllocInfo.allocationSize = memReqs.size;
-	memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &stagingMemory));
-	VK_CHECK_RESULT(vkBindBufferMemory(device->logicalDevice, stagingBuffer, stagingMemory, 0));
-
-	// Copy texture data into staging buffer
-	uint8_t* data;
-	VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void**)&data));
-	memcpy(data, buffer, bufferSize);
-	vkUnmapMemory(device->logicalDevice, stagingMemory);
-
-	VkBufferImageCopy bufferCopyRegion = {};
-	bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	bufferCopyRegion.imageSubresource.layerCount = 1;
-	bufferCopyRegion.imageExtent.width = emptyTexture.width;
-	bufferCopyRegion.imageExtent.height = emptyTexture.height;
-	bufferCopyRegion.imageExtent.depth = 1;
+	const VkDeviceSize bufferSize = emptyTexture.width * emptyTexture.height * 4;
+	UploadBatch::Allocation staging = uploadBatch.allocate(bufferSize, 4);
+	memset(staging.data, 0, bufferSize);
 
 	// Create optimal tiled target image
 	VkImageCreateInfo imageCreateInfo = vks::initializers::imageCreateInfo();
@@ -739,29 +545,17 @@ void vkglTF::Model::createEmptyTexture(VkQueue transferQueue)
 	imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 	VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &emptyTexture.image));
 
+	VkMemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
+	VkMemoryRequirements memReqs;
 	vkGetImageMemoryRequirements(device->logicalDevice, emptyTexture.image, &memReqs);
 	memAllocInfo.allocationSize = memReqs.size;
 	memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 	VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &emptyTexture.deviceMemory));
 	VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, emptyTexture.image, emptyTexture.deviceMemory, 0));
 
-	VkImageSubresourceRange subresourceRange{};
-	subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	subresourceRange.baseMipLevel = 0;
-	subresourceRange.levelCount = 1;
-	subresourceRange.layerCount = 1;
-
-	VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-	vks::tools::setImageLayout(copyCmd, emptyTexture.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
-	vkCmdCopyBufferToImage(copyCmd, stagingBuffer, emptyTexture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bufferCopyRegion);
-	vks::tools::setImageLayout(copyCmd, emptyTexture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, subresourceRange);
-	device->flushCommandBuffer(copyCmd, transferQueue);
+	uploadBatch.copyToImage(staging, emptyTexture.image, emptyTexture.width, emptyTexture.height, 1);
 	emptyTexture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-	// Clean up staging resources
-	vkFreeMemory(device->logicalDevice, stagingMemory, nullptr);
-	vkDestroyBuffer(device->logicalDevice, stagingBuffer, nullptr);
-
 	VkSamplerCreateInfo samplerCreateInfo = vks::initializers::samplerCreateInfo();
 	samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
 	samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
@@ -796,6 +590,16 @@ vkglTF::Model::~Model()
 	vkFreeMemory(device->logicalDevice, vertices.memory, nullptr);
 	vkDestroyBuffer(device->logicalDevice, indices.buffer, nullptr);
 	vkFreeMemory(device->logicalDevice, indices.memory, nullptr);
+	if (attributes.buffer != VK_NULL_HANDLE) {
+		vkDestroyBuffer(device->logicalDevice, attributes.buffer, nullptr);
+		vkFreeMemory(device->logicalDevice, attributes.memory, nullptr);
+	}
+	if (splitGeometry.triangleCount > 0) {
+		vkDestroyBuffer(device->logicalDevice, splitGeometry.positions, nullptr);
+		vkFreeMemory(device->logicalDevice, splitGeometry.positionsMemory, nullptr);
+		vkDestroyBuffer(device->logicalDevice, splitGeometry.triangles, nullptr);
+		vkFreeMemory(device->logicalDevice, splitGeometry.trianglesMemory, nullptr);
+	}
 	for (auto texture : textures) {
 		texture.destroy();
 	}
@@ -814,7 +618,7 @@ vkglTF::Model::~Model()
 	emptyTexture.destroy();
 }
 
-void vkglTF::Model::loadNode(vkglTF::Node *parent, const tinygltf::Node &node, uint32_t nodeIndex, const tinygltf::Model &model, std::vector<uint32_t>& indexBuffer, std::vector<Vertex>& vertexBuffer, float globalscale)
+void vkglTF::Model::loadNode(vkglTF::Node *parent, const tinygltf::Node &node, uint32_t nodeIndex, const tinygltf::Model &model, std::vector<PrimitiveDecode>& primitiveDecodes, float globalscale)
 {
 	vkglTF::Node *newNode = new Node{};
 	newNode->index = nodeIndex;
@@ -849,216 +653,63 @@ void vkglTF::Model::loadNode(vkglTF::Node *parent, const tinygltf::Node &node, u
 	// Node with children
 	if (node.children.size() > 0) {
 		for (auto i = 0; i < node.children.size(); i++) {
-			loadNode(newNode, model.nodes[node.children[i]], node.children[i], model, indexBuffer, vertexBuffer, globalscale);
+			loadNode(newNode, model.nodes[node.children[i]], node.children[i], model, primitiveDecodes, globalscale);
 		}
 	}
 
+	// Nodes referencing an already loaded mesh share it's vertex and index data (unless vertices are pre-transformed)
+	Mesh* sharedMesh = nullptr;
+	if ((node.mesh > -1) && shareMeshData && (meshIndices.find(node.mesh) != meshIndices.end())) {
+		sharedMesh = meshes[meshIndices[node.mesh]];
+	}
+
 	// Node contains mesh data
-	if (node.mesh > -1) {
-		const tinygltf::Mesh mesh = model.meshes[node.mesh];
+	if (sharedMesh) {
+		Mesh *newMesh = new Mesh(device, newNode->matrix);
+		newMesh->name = sharedMesh->name;
+		newMesh->index = sharedMesh->index;
+		for (Primitive* primitive : sharedMesh->primitives) {
+			newMesh->primitives.push_back(new Primitive(*primitive));
+		}
+		newNode->mesh = newMesh;
+	} else if (node.mesh > -1) {
+		const tinygltf::Mesh &mesh = model.meshes[node.mesh];
 		Mesh *newMesh = new Mesh(device, newNode->matrix);
 		newMesh->name = mesh.name;
+		newMesh->index = static_cast<uint32_t>(meshes.size());
+		meshIndices[node.mesh] = newMesh->index;
+		meshes.push_back(newMesh);
 		for (size_t j = 0; j < mesh.primitives.size(); j++) {
 			const tinygltf::Primitive &primitive = mesh.primitives[j];
 			if (primitive.indices < 0) {
 				continue;
 			}
-			uint32_t indexStart = static_cast<uint32_t>(indexBuffer.size());
-			uint32_t vertexStart = static_cast<uint32_t>(vertexBuffer.size());
-			uint32_t indexCount = 0;
-			uint32_t vertexCount = 0;
-			glm::vec3 posMin{};
-			glm::vec3 posMax{};
-			bool hasSkin = false;
-			// Vertices
-			{
-				const float* bufferPos = nullptr;
-				const float* bufferNormals = nullptr;
-				const float* bufferTangents = nullptr;
-				const float* bufferTexCoordSet0 = nullptr;
-				const float* bufferTexCoordSet1 = nullptr;
-				const float* bufferColors = nullptr;
-				const void* bufferJoints = nullptr;
-				const float* bufferWeights = nullptr;
-
-				int posByteStride;
-				int normByteStride;
-				int tangentsByteStride;
-				int uv0ByteStride;
-				int uv1ByteStride;
-				int colorByteStride;
-				int jointByteStride;
-				int weightByteStride;
-				
-				uint32_t numColorComponents;
-
-				int jointComponentType;
-
-				// Position attribute is required
-				assert(primitive.attributes.find("POSITION") != primitive.attributes.end());
-
-				const tinygltf::Accessor& posAccessor = model.accessors[primitive.attributes.find("POSITION")->second];
-				const tinygltf::BufferView& posView = model.bufferViews[posAccessor.bufferView];
-				bufferPos = reinterpret_cast<const float*>(&(model.buffers[posView.buffer].data[posAccessor.byteOffset + posView.byteOffset]));
-				posMin = glm::vec3(posAccessor.minValues[0], posAccessor.minValues[1], posAccessor.minValues[2]);
-				posMax = glm::vec3(posAccessor.maxValues[0], posAccessor.maxValues[1], posAccessor.maxValues[2]);
-				vertexCount = static_cast<uint32_t>(posAccessor.count);
-				posByteStride = posAccessor.ByteStride(posView) ? (posAccessor.ByteStride(posView) / sizeof(float)) : tinygltf::GetTypeSizeInBytes(TINYGLTF_TYPE_VEC3);
-
-				if (primitive.attributes.find("NORMAL") != primitive.attributes.end()) {
-					const tinygltf::Accessor& normAccessor = model.accessors[primitive.attributes.find("NORMAL")->second];
-					const tinygltf::BufferView& normView = model.bufferViews[normAccessor.bufferView];
-					bufferNormals = reinterpret_cast<const float*>(&(model.buffers[normView.buffer].data[normAccessor.byteOffset + normView.byteOffset]));
-					normByteStride = normAccessor.ByteStride(normView) ? (normAccessor.ByteStride(normView) / sizeof(float)) : tinygltf::GetTypeSizeInBytes(TINYGLTF_TYPE_VEC3);
-				}
-
-				if (primitive.attributes.find("TEXCOORD_0") != primitive.attributes.end()) {
-					const tinygltf::Accessor& uvAccessor = model.accessors[primitive.attributes.find("TEXCOORD_0")->second];
-					const tinygltf::BufferView& uvView = model.bufferViews[uvAccessor.bufferView];
-					bufferTexCoordSet0 = reinterpret_cast<const float*>(&(model.buffers[uvView.buffer].data[uvAccessor.byteOffset + uvView.byteOffset]));
-					uv0ByteStride = uvAccessor.ByteStride(uvView) ? (uvAccessor.ByteStride(uvView) / sizeof(float)) : tinygltf::GetTypeSizeInBytes(TINYGLTF_TYPE_VEC2);
-				}
-				if (primitive.attributes.find("TEXCOORD_1") != primitive.attributes.end()) {
-					const tinygltf::Accessor& uvAccessor = model.accessors[primitive.attributes.find("TEXCOORD_1")->second];
-					const tinygltf::BufferView& uvView = model.bufferViews[uvAccessor.bufferView];
-					bufferTexCoordSet1 = reinterpret_cast<const float*>(&(model.buffers[uvView.buffer].data[uvAccessor.byteOffset + uvView.byteOffset]));
-					uv1ByteStride = uvAccessor.ByteStride(uvView) ? (uvAccessor.ByteStride(uvView) / sizeof(float)) : tinygltf::GetTypeSizeInBytes(TINYGLTF_TYPE_VEC2);
-				}
-				if (primitive.attributes.find("COLOR_0") != primitive.attributes.end())
-				{
-					const tinygltf::Accessor& colorAccessor = model.accessors[primitive.attributes.find("COLOR_0")->second];
-					const tinygltf::BufferView& colorView = model.bufferViews[colorAccessor.bufferView];
-					// Color buffer are either of type vec3 or vec4
-					numColorComponents = colorAccessor.type == TINYGLTF_PARAMETER_TYPE_FLOAT_VEC3 ? 3 : 4;
-					bufferColors = reinterpret_cast<const float*>(&(model.buffers[colorView.buffer].data[colorAccessor.byteOffset + colorView.byteOffset]));
-					colorByteStride = colorAccessor.ByteStride(colorView) ? (colorAccessor.ByteStride(colorView) / sizeof(float)) : tinygltf::GetTypeSizeInBytes(TINYGLTF_TYPE_VEC3);
-				}
-				if (primitive.attributes.find("TANGENT") != primitive.attributes.end())
-				{
-					const tinygltf::Accessor& tangentAccessor = model.accessors[primitive.attributes.find("TANGENT")->second];
-					const tinygltf::BufferView& tangentView = model.bufferViews[tangentAccessor.bufferView];
-					bufferTangents = reinterpret_cast<const float*>(&(model.buffers[tangentView.buffer].data[tangentAccessor.byteOffset + tangentView.byteOffset]));
-					tangentsByteStride = tangentAccessor.ByteStride(tangentView) ? (tangentAccessor.ByteStride(tangentView) / sizeof(float)) : tinygltf::GetTypeSizeInBytes(TINYGLTF_TYPE_VEC3);
-				}
-
-				// Skinning
-				// Joints
-				if (primitive.attributes.find("JOINTS_0") != primitive.attributes.end()) {
-					const tinygltf::Accessor& jointAccessor = model.accessors[primitive.attributes.find("JOINTS_0")->second];
-					const tinygltf::BufferView& jointView = model.bufferViews[jointAccessor.bufferView];
-					bufferJoints = &(model.buffers[jointView.buffer].data[jointAccessor.byteOffset + jointView.byteOffset]);
-					jointComponentType = jointAccessor.componentType;
-					jointByteStride = jointAccessor.ByteStride(jointView) ? (jointAccessor.ByteStride(jointView) / tinygltf::GetComponentSizeInBytes(jointComponentType)) : tinygltf::GetTypeSizeInBytes(TINYGLTF_TYPE_VEC4);
-				}
-
-				if (primitive.attributes.find("WEIGHTS_0") != primitive.attributes.end()) {
-					const tinygltf::Accessor& weightAccessor = model.accessors[primitive.attributes.find("WEIGHTS_0")->second];
-					const tinygltf::BufferView& weightView = model.bufferViews[weightAccessor.bufferView];
-					bufferWeights = reinterpret_cast<const float*>(&(model.buffers[weightView.buffer].data[weightAccessor.byteOffset + weightView.byteOffset]));
-					weightByteStride = weightAccessor.ByteStride(weightView) ? (weightAccessor.ByteStride(weightView) / sizeof(float)) : tinygltf::GetTypeSizeInBytes(TINYGLTF_TYPE_VEC4);
-				}
-
-				hasSkin = (bufferJoints && bufferWeights);
-
-				vertexCount = static_cast<uint32_t>(posAccessor.count);
-
-				bool isLight = false;
-				if (primitive.material > -1) {
-					if (materials[primitive.material].name == "Light") {
-						isLight = true;
-					}
-				}
-
-				for (size_t v = 0; v < posAccessor.count; v++) {
-					Vertex vert{};
-					vert.pos = glm::vec4(glm::make_vec3(&bufferPos[v * posByteStride]), 1.0f);
-					vert.normal = glm::normalize(glm::vec3(bufferNormals ? glm::make_vec3(&bufferNormals[v * normByteStride]) : glm::vec3(0.0f)));
-					vert.tangent = bufferTangents ? glm::vec4(glm::make_vec4(&bufferTangents[v * tangentsByteStride])) : glm::vec4(0.0f);
-					vert.uv =  bufferTexCoordSet0 ? glm::make_vec2(&bufferTexCoordSet0[v * uv0ByteStride]) : glm::vec3(0.0f);
-					//vert.uv1 = bufferTexCoordSet1 ? glm::make_vec2(&bufferTexCoordSet1[v * uv1ByteStride]) : glm::vec3(0.0f);
-					//if (bufferColors) {
-					//	switch (numColorComponents) {
-					//	case 3:
-					//		vert.color = glm::vec4(glm::make_vec3(&bufferColors[v * 3]), 1.0f);
-					//	case 4:
-					//		vert.color = glm::make_vec4(&bufferColors[v * 4]);
-					//	}
-					//} else {
-					//	vert.color = glm::vec4(1.0f);
-					//}
-					vert.color = glm::vec4(1.0f);
-					if (hasSkin)
-					{
-						switch (jointComponentType) {
-						case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
-							const uint16_t* buf = static_cast<const uint16_t*>(bufferJoints);
-							vert.joint0 = glm::vec4(glm::make_vec4(&buf[v * jointByteStride]));
-							break;
-						}
-						case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: {
-							const uint8_t* buf = static_cast<const uint8_t*>(bufferJoints);
-							vert.joint0 = glm::vec4(glm::make_vec4(&buf[v * jointByteStride]));
-							break;
-						}
-						default:
-							// Not supported by spec
-							std::cerr << "Joint component type " << jointComponentType << " not supported!" << std::endl;
-							break;
-						}
-					}
-					else {
-						vert.joint0 = glm::vec4(0.0f);
-					}
-					vert.weight0 = hasSkin ? glm::make_vec4(&bufferWeights[v * weightByteStride]) : glm::vec4(0.0f);
-					// Fix for all zero weights
-					if (glm::length(vert.weight0) == 0.0f) {
-						vert.weight0 = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
-					}
-					vert.materialIndex = primitive.material;
-					vertexBuffer.push_back(vert);
-				}
+			const tinygltf::Accessor &indexAccessor = model.accessors[primitive.indices];
+			if ((indexAccessor.componentType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT) && (indexAccessor.componentType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) && (indexAccessor.componentType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE)) {
+				std::cerr << "Index component type " << indexAccessor.componentType << " not supported!" << std::endl;
+				continue;
 			}
-			// Indices
-			{
-				const tinygltf::Accessor &accessor = model.accessors[primitive.indices];
-				const tinygltf::BufferView &bufferView = model.bufferViews[accessor.bufferView];
-				const tinygltf::Buffer &buffer = model.buffers[bufferView.buffer];
-
-				indexCount = static_cast<uint32_t>(accessor.count);
-
-				switch (accessor.componentType) {
-				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT: {
-					uint32_t *buf = new uint32_t[accessor.count];
-					memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(uint32_t));
-					for (size_t index = 0; index < accessor.count; index++) {
-						indexBuffer.push_back(buf[index] + vertexStart);
-					}
-					break;
-				}
-				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT: {
-					uint16_t *buf = new uint16_t[accessor.count];
-					memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(uint16_t));
-					for (size_t index = 0; index < accessor.count; index++) {
-						indexBuffer.push_back(buf[index] + vertexStart);
-					}
-					break;
-				}
-				case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE: {
-					uint8_t *buf = new uint8_t[accessor.count];
-					memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(uint8_t));
-					for (size_t index = 0; index < accessor.count; index++) {
-						indexBuffer.push_back(buf[index] + vertexStart);
-					}
-					break;
-				}
-				default:
-					std::cerr << "Index component type " << accessor.componentType << " not supported!" << std::endl;
-					return;
-				}
+			// Position attribute is required
+			assert(primitive.attributes.find("POSITION") != primitive.attributes.end());
+			const tinygltf::Accessor &posAccessor = model.accessors[primitive.attributes.find("POSITION")->second];
+
+			// Vertices and indices are appended to the model's buffers in the order the primitives are loaded
+			PrimitiveDecode decode{};
+			decode.mesh = node.mesh;
+			decode.primitive = j;
+			if (!primitiveDecodes.empty()) {
+				decode.firstIndex = primitiveDecodes.back().firstIndex + primitiveDecodes.back().indexCount;
+				decode.firstVertex = primitiveDecodes.back().firstVertex + primitiveDecodes.back().vertexCount;
 			}
-			Primitive *newPrimitive = new Primitive(indexStart, indexCount, primitive.material > -1 ? materials[primitive.material] : materials.back());
-			newPrimitive->firstVertex = vertexStart;
-			newPrimitive->vertexCount = vertexCount;
+			decode.indexCount = static_cast<uint32_t>(indexAccessor.count);
+			decode.vertexCount = static_cast<uint32_t>(posAccessor.count);
+			primitiveDecodes.push_back(decode);
+
+			const glm::vec3 posMin = glm::vec3(posAccessor.minValues[0], posAccessor.minValues[1], posAccessor.minValues[2]);
+			const glm::vec3 posMax = glm::vec3(posAccessor.maxValues[0], posAccessor.maxValues[1], posAccessor.maxValues[2]);
+			Primitive *newPrimitive = new Primitive(decode.firstIndex, decode.indexCount, primitive.material > -1 ? materials[primitive.material] : materials.back());
+			newPrimitive->firstVertex = decode.firstVertex;
+			newPrimitive->vertexCount = decode.vertexCount;
 			newPrimitive->setDimensions(posMin, posMax);
 			newMesh->primitives.push_back(newPrimitive);
 		}
@@ -1072,6 +723,126 @@ void vkglTF::Model::loadNode(vkglTF::Node *parent, const tinygltf::Node &node, u
 	linearNodes.push_back(newNode);
 }
 
+// Decodes an attribute for a range of a primitive's vertices into the vertex member at dst, returns false if the attribute's component type is not supported
+template<uint32_t Components>
+static bool decodeVertexAttribute(const tinygltf::Model& model, const tinygltf::Accessor& accessor, const unsigned char* data, uint32_t first, uint32_t count, void* dst)
+{
+	const int byteStride = accessor.ByteStride(model.bufferViews[accessor.bufferView]);
+	if (byteStride <= 0) {
+		return false;
+	}
+	return AccessorDecoder::decodeAttribute<Components, sizeof(vkglTF::Vertex)>(accessor.componentType, accessor.normalized, data + static_cast<size_t>(first) * byteStride, byteStride, count, static_cast<uint8_t*>(dst));
+}
+
+// Primitives are split into ranges of vertices and indices that are decoded in parallel for larger scenes
+void vkglTF::Model::decodePrimitives(const tinygltf::Model& model, const std::vector<PrimitiveDecode>& primitiveDecodes, std::vector<uint32_t>& indexBuffer, std::vector<Vertex>& vertexBuffer)
+{
+	auto tStart = std::chrono::high_resolution_clock::now();
+
+	const size_t indexCount = primitiveDecodes.empty() ? 0 : primitiveDecodes.back().firstIndex + primitiveDecodes.back().indexCount;
+	const size_t vertexCount = primitiveDecodes.empty() ? 0 : primitiveDecodes.back().firstVertex + primitiveDecodes.back().vertexCount;
+	indexBuffer.resize(indexCount);
+	vertexBuffer.resize(vertexCount);
+
+	struct Job {
+		size_t decode;
+		bool indices;
+		uint32_t first;
+		uint32_t count;
+	};
+	const uint32_t rangeSize = 65536;
+	std::vector<Job> jobs;
+	for (size_t i = 0; i < primitiveDecodes.size(); i++) {
+		for (uint32_t first = 0; first < primitiveDecodes[i].vertexCount; first += rangeSize) {
+			jobs.push_back({ i, false, first, std::min(rangeSize, primitiveDecodes[i].vertexCount - first) });
+		}
+		for (uint32_t first = 0; first < primitiveDecodes[i].indexCount; first += rangeSize) {
+			jobs.push_back({ i, true, first, std::min(rangeSize, primitiveDecodes[i].indexCount - first) });
+		}
+	}
+
+	std::atomic<bool> unsupportedAttributes(false);
+	auto findAccessor = [&model](const tinygltf::Primitive& primitive, const char* name) -> const tinygltf::Accessor* {
+		auto attribute = primitive.attributes.find(name);
+		return (attribute != primitive.attributes.end()) ? &model.accessors[attribute->second] : nullptr;
+	};
+	auto decodeJob = [&](const Job& job) {
+		const PrimitiveDecode& decode = primitiveDecodes[job.decode];
+		const tinygltf::Primitive& primitive = model.meshes[decode.mesh].primitives[decode.primitive];
+		if (job.indices) {
+			// Indices stay relative to the primitive's first vertex
+			const tinygltf::Accessor& accessor = model.accessors[primitive.indices];
+			const unsigned char* data = getAccessorData(model, accessor) + static_cast<size_t>(job.first) * tinygltf::GetComponentSizeInBytes(accessor.componentType);
+			AccessorDecoder::decodeIndices(accessor.componentType, data, job.count, &indexBuffer[decode.firstIndex + job.first]);
+			return;
+		}
+
+		Vertex* vertices = &vertexBuffer[decode.firstVertex + job.first];
+		for (uint32_t v = 0; v < job.count; v++) {
+			vertices[v].normal = glm::vec3(0.0f);
+			vertices[v].uv = glm::vec2(0.0f);
+			vertices[v].color = glm::vec4(1.0f);
+			vertices[v].joint0 = glm::vec4(0.0f);
+			vertices[v].weight0 = glm::vec4(0.0f);
+			vertices[v].tangent = glm::vec4(0.0f);
+		}
+		bool supported = true;
+		const tinygltf::Accessor* posAccessor = findAccessor(primitive, "POSITION");
+		supported &= decodeVertexAttribute<3>(model, *posAccessor, getAccessorData(model, *posAccessor), job.first, job.count, &vertices->pos);
+		if (const tinygltf::Accessor* normAccessor = findAccessor(primitive, "NORMAL")) {
+			supported &= decodeVertexAttribute<3>(model, *normAccessor, getAccessorData(model, *normAccessor), job.first, job.count, &vertices->normal);
+			AccessorDecoder::normalizeVec3<sizeof(Vertex)>(reinterpret_cast<uint8_t*>(&vertices->normal), job.count);
+		}
+		if (const tinygltf::Accessor* uvAccessor = findAccessor(primitive, "TEXCOORD_0")) {
+			supported &= decodeVertexAttribute<2>(model, *uvAccessor, getAccessorData(model, *uvAccessor), job.first, job.count, &vertices->uv);
+		}
+		if (const tinygltf::Accessor* tangentAccessor = findAccessor(primitive, "TANGENT")) {
+			supported &= decodeVertexAttribute<4>(model, *tangentAccessor, getAccessorData(model, *tangentAccessor), job.first, job.count, &vertices->tangent);
+		}
+		// Skinning
+		const tinygltf::Accessor* jointAccessor = findAccessor(primitive, "JOINTS_0");
+		const tinygltf::Accessor* weightAccessor = findAccessor(primitive, "WEIGHTS_0");
+		if (jointAccessor && weightAccessor) {
+			supported &= decodeVertexAttribute<4>(model, *jointAccessor, getAccessorData(model, *jointAccessor), job.first, job.count, &vertices->joint0);
+			supported &= decodeVertexAttribute<4>(model, *weightAccessor, getAccessorData(model, *weightAccessor), job.first, job.count, &vertices->weight0);
+		}
+		// Fix for all zero weights
+		for (uint32_t v = 0; v < job.count; v++) {
+			if (glm::length(vertices[v].weight0) == 0.0f) {
+				vertices[v].weight0 = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+			}
+		}
+		if (!supported) {
+			unsupportedAttributes = true;
+		}
+	};
+
+	// Small scenes aren't worth starting threads for
+	const bool parallel = (vertexCount + indexCount > 4 * rangeSize) && (std::thread::hardware_concurrency() > 1);
+	uint32_t threadCount = 1;
+	if (parallel) {
+		vks::ThreadPool threadPool;
+		threadPool.setThreadCount(std::max(1u, std::thread::hardware_concurrency()));
+		threadCount = static_cast<uint32_t>(threadPool.threads.size());
+		for (size_t j = 0; j < jobs.size(); j++) {
+			const Job* job = &jobs[j];
+			threadPool.threads[j % threadCount]->addJob([job, &decodeJob] { decodeJob(*job); });
+		}
+		threadPool.wait();
+	} else {
+		for (const Job& job : jobs) {
+			decodeJob(job);
+		}
+	}
+
+	if (unsupportedAttributes) {
+		std::cerr << "Vertex attributes with unsupported component types have been skipped!" << std::endl;
+	}
+	auto tEnd = std::chrono::high_resolution_clock::now();
+	std::cout << "Decoded " << vertexCount << " vertices and " << indexCount << " indices of " << primitiveDecodes.size() << " primitives in " << std::fixed << std::setprecision(2)
+		<< std::chrono::duration<double, std::milli>(tEnd - tStart).count() << " ms using " << threadCount << " thread(s)" << std::defaultfloat << "\n";
+}
+
 void vkglTF::Model::loadSkins(tinygltf::Model &gltfModel)
 {
 	for (tinygltf::Skin &source : gltfModel.skins) {
@@ -1094,26 +865,565 @@ void vkglTF::Model::loadSkins(tinygltf::Model &gltfModel)
 		// Get inverse bind matrices from buffer
 		if (source.inverseBindMatrices > -1) {
 			const tinygltf::Accessor &accessor = gltfModel.accessors[source.inverseBindMatrices];
-			const tinygltf::BufferView &bufferView = gltfModel.bufferViews[accessor.bufferView];
-			const tinygltf::Buffer &buffer = gltfModel.buffers[bufferView.buffer];
 			newSkin->inverseBindMatrices.resize(accessor.count);
-			memcpy(newSkin->inverseBindMatrices.data(), &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(glm::mat4));
+			memcpy(newSkin->inverseBindMatrices.data(), getAccessorData(gltfModel, accessor), accessor.count * sizeof(glm::mat4));
 		}
 
 		skins.push_back(newSkin);
 	}
 }
 
-void vkglTF::Model::loadImages(tinygltf::Model &gltfModel, vks::VulkanDevice *device, VkQueue transferQueue)
+void vkglTF::Model::loadImages(tinygltf::Model &gltfModel, vks::VulkanDevice *device, UploadBatch& uploadBatch, bool keepAlpha)
 {
-	for (tinygltf::Image &image : gltfModel.images) {
-		vkglTF::Texture texture;
-		texture.fromglTfImage(image, path, device, transferQueue);
-		texture.index = static_cast<uint32_t>(textures.size());
-		textures.push_back(texture);
+	// Alpha is only kept for images used as base color textures by alpha tested materials
+	std::vector<bool> alphaTested(gltfModel.images.size(), false);
+	if (keepAlpha) {
+		for (tinygltf::Material &mat : gltfModel.materials) {
+			const bool opaque = (mat.additionalValues.find("alphaMode") == mat.additionalValues.end()) || (mat.additionalValues["alphaMode"].string_value == "OPAQUE");
+			if (!opaque && (mat.values.find("baseColorTexture") != mat.values.end())) {
+				const int32_t source = gltfModel.textures[mat.values["baseColorTexture"].TextureIndex()].source;
+				if ((source > -1) && (source < static_cast<int32_t>(alphaTested.size()))) {
+					alphaTested[source] = true;
+				}
+			}
+		}
+	}
+
+	auto tStart = std::chrono::high_resolution_clock::now();
+	const size_t imageCount = gltfModel.images.size();
+	const size_t firstTexture = textures.size();
+	textures.resize(firstTexture + imageCount);
+	auto decodeImage = [&](size_t i) {
+		tinygltf::Image& image = gltfModel.images[i];
+		vkglTF::Texture& texture = textures[firstTexture + i];
+		texture.index = static_cast<uint32_t>(firstTexture + i);
+		if (image.bufferView > -1) {
+			const tinygltf::BufferView& bufferView = gltfModel.bufferViews[image.bufferView];
+			const unsigned char* imageData = bufferData[bufferView.buffer] + bufferView.byteOffset;
+			// Embedded images are keyed by their encoded data, the buffer is released before triangles are classified
+			if (alphaTested[i]) {
+				texture.contentKey = vks::tools::hash(imageData, bufferView.byteLength);
+			}
+			texture.decode(image, path, device, uploadBatch, alphaTested[i], imageData, bufferView.byteLength);
+		} else {
+			// Image files are keyed by their size and modification time
+			if (alphaTested[i]) {
+				texture.contentKey = vks::tools::hashFileIdentity(path + "/" + image.uri);
+			}
+			texture.decode(image, path, device, uploadBatch, alphaTested[i]);
+		}
+	};
+
+	const uint32_t threadCount = (imageDecodeThreadCount > 0) ? imageDecodeThreadCount : std::max(1u, std::thread::hardware_concurrency());
+	const bool parallel = (threadCount > 1) && (imageCount > 1);
+	VkDeviceSize decodedSize = 0;
+	if (!parallel) {
+		for (size_t i = 0; i < imageCount; i++) {
+			decodeImage(i);
+			decodedSize += textures[firstTexture + i].staging.allocation.size;
+			textures[firstTexture + i].upload(uploadBatch);
+		}
+	} else {
+		vks::ThreadPool threadPool;
+		threadPool.setThreadCount(threadCount);
+		// Only a limited number of images is decoded ahead of the uploads, so images finishing early don't have to wait long for their upload to be recorded
+		const size_t maxDecodesInFlight = static_cast<size_t>(threadCount) * 2;
+		std::mutex decodedMutex;
+		std::condition_variable decodedCondition;
+		std::queue<size_t> decoded;
+		size_t queued = 0;
+		auto queueDecode = [&]() {
+			const size_t i = queued++;
+			threadPool.threads[i % threadCount]->addJob([&, i] {
+				decodeImage(i);
+				std::lock_guard<std::mutex> lock(decodedMutex);
+				decoded.push(i);
+				decodedCondition.notify_one();
+			});
+		};
+		while (queued < std::min(imageCount, maxDecodesInFlight)) {
+			queueDecode();
+		}
+		// Uploads are recorded on this thread in the order the images finish decoding
+		for (size_t uploaded = 0; uploaded < imageCount; uploaded++) {
+			size_t i;
+			{
+				std::unique_lock<std::mutex> lock(decodedMutex);
+				decodedCondition.wait(lock, [&decoded] { return !decoded.empty(); });
+				i = decoded.front();
+				decoded.pop();
+			}
+			if (queued < imageCount) {
+				queueDecode();
+			}
+			decodedSize += textures[firstTexture + i].staging.allocation.size;
+			textures[firstTexture + i].upload(uploadBatch);
+		}
+		threadPool.wait();
+	}
+	if (imageCount > 0) {
+		const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+		const double decodedMB = static_cast<double>(decodedSize) / (1024.0 * 1024.0);
+		std::cout << "Loaded " << imageCount << " images (" << std::fixed << std::setprecision(2) << decodedMB << " MB decoded) in " << seconds * 1000.0 << " ms using " << (parallel ? threadCount : 1) << " thread(s): "
+			<< imageCount / seconds << " images/s, " << decodedMB / seconds << " MB/s\n";
 	}
+
 	// Create an empty texture to be used for empty material images
-	createEmptyTexture(transferQueue);
+	createEmptyTexture(uploadBatch);
+}
+
+// Classifies the triangles of alpha tested primitives by the alpha values of the base color texture inside their uv footprint
+void vkglTF::Model::classifyTriangles(const std::vector<uint32_t>& indexBuffer, const std::vector<Vertex>& vertexBuffer)
+{
+	auto tStart = std::chrono::high_resolution_clock::now();
+
+	// The classification depends on the geometry, the alpha testing state of all materials and their base color images
+	uint64_t key = contentHash;
+	for (Material& material : materials) {
+		key = vks::tools::hash(&material.alphaMode, sizeof(material.alphaMode), key);
+		key = vks::tools::hash(&material.alphaCutoff, sizeof(material.alphaCutoff), key);
+		if (material.baseColorTexture) {
+			key = vks::tools::hash(&material.baseColorTexture->contentKey, sizeof(material.baseColorTexture->contentKey), key);
+		}
+	}
+	std::string cacheFile;
+	if (!cacheDirectory.empty()) {
+		std::stringstream ss;
+		ss << cacheDirectory << "/" << std::hex << std::setfill('0') << std::setw(16) << key << ".alpha";
+		cacheFile = ss.str();
+	}
+
+	const size_t triangleCount = indexBuffer.size() / 3;
+	bool cached = false;
+	if (!cacheFile.empty()) {
+		std::ifstream is(cacheFile, std::ios::binary | std::ios::in | std::ios::ate);
+		if (is.is_open() && (static_cast<size_t>(is.tellg()) == triangleCount * sizeof(TriangleOpacity))) {
+			triangleOpacity.resize(triangleCount);
+			is.seekg(0, std::ios::beg);
+			is.read(reinterpret_cast<char*>(triangleOpacity.data()), triangleCount * sizeof(TriangleOpacity));
+			cached = std::all_of(triangleOpacity.begin(), triangleOpacity.end(), [](TriangleOpacity opacity) { return opacity <= TriangleOpacity::Unknown; });
+		}
+	}
+
+	if (!cached) {
+		triangleOpacity.assign(triangleCount, TriangleOpacity::Opaque);
+		for (Mesh* mesh : meshes) {
+			for (Primitive* primitive : mesh->primitives) {
+				const Material& material = primitive->material;
+				if (material.alphaMode == Material::ALPHAMODE_OPAQUE) {
+					continue;
+				}
+				Texture* texture = material.baseColorTexture;
+				for (uint32_t i = 0; i < primitive->indexCount; i += 3) {
+					TriangleOpacity& opacity = triangleOpacity[(primitive->firstIndex + i) / 3];
+					// Hits are always accepted by the any-hit shader for materials without a base color texture
+					if (!texture) {
+						opacity = TriangleOpacity::Opaque;
+						continue;
+					}
+					if (texture->alphaLevels.empty()) {
+						opacity = TriangleOpacity::Unknown;
+						continue;
+					}
+					const glm::vec2 uv0 = vertexBuffer[primitive->firstVertex + indexBuffer[primitive->firstIndex + i]].uv;
+					const glm::vec2 uv1 = vertexBuffer[primitive->firstVertex + indexBuffer[primitive->firstIndex + i + 1]].uv;
+					const glm::vec2 uv2 = vertexBuffer[primitive->firstVertex + indexBuffer[primitive->firstIndex + i + 2]].uv;
+					const Texture::AlphaRange range = texture->getAlphaRange(glm::min(uv0, glm::min(uv1, uv2)), glm::max(uv0, glm::max(uv1, uv2)));
+					// The any-hit shader ignores hits with alpha below the cutoff, allow for one step of filtering imprecision
+					if ((static_cast<float>(range.min) - 1.0f) / 255.0f >= material.alphaCutoff) {
+						opacity = TriangleOpacity::Opaque;
+					} else if ((static_cast<float>(range.max) + 1.0f) / 255.0f < material.alphaCutoff) {
+						opacity = TriangleOpacity::Transparent;
+					} else {
+						opacity = TriangleOpacity::Unknown;
+					}
+				}
+			}
+		}
+		if (!cacheFile.empty()) {
+			if (!vks::tools::createDirectory(cacheDirectory)) {
+				std::cerr << "Could not create cache directory \"" << cacheDirectory << "\"\n";
+			}
+			std::ofstream os(cacheFile, std::ios::binary | std::ios::out | std::ios::trunc);
+			if (os.is_open()) {
+				os.write(reinterpret_cast<const char*>(triangleOpacity.data()), triangleCount * sizeof(TriangleOpacity));
+			}
+		}
+	}
+
+	// The alpha levels are only required for the classification
+	for (Texture& texture : textures) {
+		texture.alphaLevels.clear();
+		texture.alphaLevels.shrink_to_fit();
+	}
+
+	uint32_t alphaTestedCount = 0;
+	uint32_t counts[3] = { 0, 0, 0 };
+	for (Mesh* mesh : meshes) {
+		for (Primitive* primitive : mesh->primitives) {
+			if (primitive->material.alphaMode == Material::ALPHAMODE_OPAQUE) {
+				continue;
+			}
+			for (uint32_t i = 0; i < primitive->indexCount; i += 3) {
+				counts[static_cast<uint32_t>(triangleOpacity[(primitive->firstIndex + i) / 3])]++;
+				alphaTestedCount++;
+			}
+		}
+	}
+	auto tEnd = std::chrono::high_resolution_clock::now();
+	const uint32_t anyHitCount = counts[static_cast<uint32_t>(TriangleOpacity::Unknown)];
+	std::cout << "Alpha classification" << (cached ? " (cached)" : "") << ": " << alphaTestedCount << " alpha tested triangles, "
+		<< counts[static_cast<uint32_t>(TriangleOpacity::Opaque)] << " opaque, "
+		<< counts[static_cast<uint32_t>(TriangleOpacity::Transparent)] << " transparent, "
+		<< anyHitCount << " unknown, " << std::chrono::duration<double, std::milli>(tEnd - tStart).count() << " ms\n";
+	if (alphaTestedCount > 0) {
+		std::cout << "Triangles invoking any-hit shaders reduced by " << std::fixed << std::setprecision(1) << 100.0 * (1.0 - static_cast<double>(anyHitCount) / alphaTestedCount) << "%" << std::defaultfloat << "\n";
+	}
+}
+
+// Creates one geometry range per primitive of all unique meshes
+// If triangles have been classified, the triangles of alpha tested primitives are sorted by opacity and split into an opaque and an alpha tested range, fully transparent ones are left out
+void vkglTF::Model::createGeometryRanges(std::vector<uint32_t>& indexBuffer)
+{
+	std::vector<uint32_t> groupedIndexBuffer;
+	groupedIndexBuffer.reserve(indexBuffer.size());
+	std::vector<TriangleOpacity> groupedTriangleOpacity;
+	groupedTriangleOpacity.reserve(triangleOpacity.size());
+	geometryRanges.clear();
+	auto addRange = [this](uint32_t firstIndex, uint32_t indexCount, Primitive* primitive, bool opaque) {
+		if (indexCount > 0) {
+			const uint32_t materialIndex = static_cast<uint32_t>(&primitive->material - materials.data());
+			geometryRanges.push_back({ firstIndex, indexCount, primitive->firstVertex, materialIndex, opaque });
+		}
+	};
+	for (Mesh* mesh : meshes) {
+		// The ranges of a mesh are consecutive, so a mesh can be built into a separate acceleration structure
+		mesh->firstGeometryRange = static_cast<uint32_t>(geometryRanges.size());
+		for (Primitive* primitive : mesh->primitives) {
+			const bool opaque = (primitive->material.alphaMode == Material::ALPHAMODE_OPAQUE);
+			const uint32_t firstIndex = static_cast<uint32_t>(groupedIndexBuffer.size());
+			if (opaque || triangleOpacity.empty()) {
+				groupedIndexBuffer.insert(groupedIndexBuffer.end(), indexBuffer.begin() + primitive->firstIndex, indexBuffer.begin() + primitive->firstIndex + primitive->indexCount);
+				if (!triangleOpacity.empty()) {
+					groupedTriangleOpacity.insert(groupedTriangleOpacity.end(), triangleOpacity.begin() + primitive->firstIndex / 3, triangleOpacity.begin() + (primitive->firstIndex + primitive->indexCount) / 3);
+				}
+				addRange(firstIndex, primitive->indexCount, primitive, opaque);
+			} else {
+				// Sorting stays within the primitive, so it's index range remains valid for rasterization
+				for (TriangleOpacity opacity : { TriangleOpacity::Opaque, TriangleOpacity::Unknown, TriangleOpacity::Transparent }) {
+					const uint32_t first = static_cast<uint32_t>(groupedIndexBuffer.size());
+					for (uint32_t i = 0; i < primitive->indexCount; i += 3) {
+						if (triangleOpacity[(primitive->firstIndex + i) / 3] == opacity) {
+							groupedIndexBuffer.insert(groupedIndexBuffer.end(), indexBuffer.begin() + primitive->firstIndex + i, indexBuffer.begin() + primitive->firstIndex + i + 3);
+							groupedTriangleOpacity.push_back(opacity);
+						}
+					}
+					if (opacity != TriangleOpacity::Transparent) {
+						addRange(first, static_cast<uint32_t>(groupedIndexBuffer.size()) - first, primitive, opacity == TriangleOpacity::Opaque);
+					}
+				}
+			}
+			primitive->firstIndex = firstIndex;
+		}
+		mesh->geometryRangeCount = static_cast<uint32_t>(geometryRanges.size()) - mesh->firstGeometryRange;
+	}
+	indexBuffer.swap(groupedIndexBuffer);
+	triangleOpacity.swap(groupedTriangleOpacity);
+	// Update the meshes sharing the data of another mesh
+	for (Node* node : linearNodes) {
+		if (node->mesh && (meshes[node->mesh->index] != node->mesh)) {
+			const Mesh* sharedMesh = meshes[node->mesh->index];
+			for (size_t i = 0; i < sharedMesh->primitives.size(); i++) {
+				node->mesh->primitives[i]->firstIndex = sharedMesh->primitives[i]->firstIndex;
+			}
+			node->mesh->firstGeometryRange = sharedMesh->firstGeometryRange;
+			node->mesh->geometryRangeCount = sharedMesh->geometryRangeCount;
+		}
+	}
+}
+
+/*
+	Generate coarser levels of detail for all meshes by vertex clustering
+	Vertices are snapped to a uniform grid over the mesh's bounds and each cell is represented by the existing vertex closest to the mean of it's vertices
+	Triangles that collapse are dropped, so coarser levels only add indices and keep referencing the original vertices with all their attributes
+	The geometry ranges of coarser levels are appended after those of all meshes
+*/
+void vkglTF::Model::generateLevelsOfDetail(std::vector<uint32_t>& indexBuffer, const std::vector<Vertex>& vertexBuffer)
+{
+	auto tStart = std::chrono::high_resolution_clock::now();
+	const size_t baseIndexCount = indexBuffer.size();
+	uint32_t levelCount = 0;
+	for (Mesh* mesh : meshes) {
+		mesh->levelsOfDetail.clear();
+		glm::vec3 min(FLT_MAX);
+		glm::vec3 max(-FLT_MAX);
+		uint32_t triangleCount = 0;
+		for (uint32_t r = mesh->firstGeometryRange; r < mesh->firstGeometryRange + mesh->geometryRangeCount; r++) {
+			const GeometryRange& range = geometryRanges[r];
+			for (uint32_t i = 0; i < range.indexCount; i++) {
+				const glm::vec3& pos = vertexBuffer[range.firstVertex + indexBuffer[range.firstIndex + i]].pos;
+				min = glm::min(min, pos);
+				max = glm::max(max, pos);
+			}
+			triangleCount += range.indexCount / 3;
+		}
+		if (triangleCount == 0) {
+			continue;
+		}
+		mesh->center = (min + max) * 0.5f;
+		mesh->radius = glm::length(max - min) * 0.5f;
+		const glm::vec3 extent = max - min;
+		const float longestAxis = std::max(extent.x, std::max(extent.y, extent.z));
+		uint32_t previousTriangleCount = triangleCount;
+		for (uint32_t resolution = levelOfDetailGridResolution; (resolution >= 2) && (mesh->levelsOfDetail.size() < levelOfDetailCount) && (longestAxis > 0.0f); resolution /= 2) {
+			const float cellSize = longestAxis / static_cast<float>(resolution);
+			const size_t firstLevelIndex = indexBuffer.size();
+			Mesh::LevelOfDetail levelOfDetail{};
+			levelOfDetail.firstGeometryRange = static_cast<uint32_t>(geometryRanges.size());
+			for (uint32_t r = mesh->firstGeometryRange; r < mesh->firstGeometryRange + mesh->geometryRangeCount; r++) {
+				// Copied, as appending ranges may reallocate
+				const GeometryRange range = geometryRanges[r];
+				// Indices are relative to the range's first vertex, so vertices are only clustered within a range
+				struct Cell {
+					glm::vec3 sum = glm::vec3(0.0f);
+					uint32_t count = 0;
+					uint32_t representative = 0;
+					float distance = FLT_MAX;
+				};
+				std::unordered_map<uint64_t, Cell> cells;
+				auto getCellKey = [&](const glm::vec3& pos) {
+					const glm::uvec3 cell = glm::uvec3(glm::clamp((pos - min) / cellSize, glm::vec3(0.0f), glm::vec3(static_cast<float>(resolution - 1))));
+					return static_cast<uint64_t>(cell.x) | (static_cast<uint64_t>(cell.y) << 21) | (static_cast<uint64_t>(cell.z) << 42);
+				};
+				for (uint32_t i = 0; i < range.indexCount; i++) {
+					const glm::vec3& pos = vertexBuffer[range.firstVertex + indexBuffer[range.firstIndex + i]].pos;
+					Cell& cell = cells[getCellKey(pos)];
+					cell.sum += pos;
+					cell.count++;
+				}
+				for (uint32_t i = 0; i < range.indexCount; i++) {
+					const uint32_t index = indexBuffer[range.firstIndex + i];
+					const glm::vec3& pos = vertexBuffer[range.firstVertex + index].pos;
+					Cell& cell = cells[getCellKey(pos)];
+					const glm::vec3 d = pos - cell.sum / static_cast<float>(cell.count);
+					if (glm::dot(d, d) < cell.distance) {
+						cell.distance = glm::dot(d, d);
+						cell.representative = index;
+					}
+				}
+				GeometryRange levelRange = range;
+				// Coarser levels have their own triangles, which aren't part of the split geometry stream
+				levelRange.firstSplitTriangle = 0;
+				levelRange.splitTriangleCount = 0;
+				levelRange.firstIndex = static_cast<uint32_t>(indexBuffer.size());
+				for (uint32_t i = 0; i < range.indexCount; i += 3) {
+					uint32_t triangle[3];
+					for (uint32_t j = 0; j < 3; j++) {
+						triangle[j] = cells[getCellKey(vertexBuffer[range.firstVertex + indexBuffer[range.firstIndex + i + j]].pos)].representative;
+					}
+					if ((triangle[0] != triangle[1]) && (triangle[1] != triangle[2]) && (triangle[0] != triangle[2])) {
+						indexBuffer.insert(indexBuffer.end(), triangle, triangle + 3);
+					}
+				}
+				levelRange.indexCount = static_cast<uint32_t>(indexBuffer.size()) - levelRange.firstIndex;
+				if (levelRange.indexCount > 0) {
+					geometryRanges.push_back(levelRange);
+					levelOfDetail.triangleCount += levelRange.indexCount / 3;
+				}
+			}
+			levelOfDetail.geometryRangeCount = static_cast<uint32_t>(geometryRanges.size()) - levelOfDetail.firstGeometryRange;
+			// Levels that don't remove a significant number of triangles aren't worth an acceleration structure of their own, a coarser grid is tried instead
+			if ((levelOfDetail.triangleCount == 0) || (levelOfDetail.triangleCount > previousTriangleCount * 3 / 4)) {
+				geometryRanges.resize(levelOfDetail.firstGeometryRange);
+				indexBuffer.resize(firstLevelIndex);
+				if (levelOfDetail.triangleCount == 0) {
+					break;
+				}
+				continue;
+			}
+			previousTriangleCount = levelOfDetail.triangleCount;
+			mesh->levelsOfDetail.push_back(levelOfDetail);
+			levelCount++;
+		}
+	}
+	// Update the meshes sharing the data of another mesh
+	for (Node* node : linearNodes) {
+		if (node->mesh && (meshes[node->mesh->index] != node->mesh)) {
+			const Mesh* sharedMesh = meshes[node->mesh->index];
+			node->mesh->levelsOfDetail = sharedMesh->levelsOfDetail;
+			node->mesh->center = sharedMesh->center;
+			node->mesh->radius = sharedMesh->radius;
+		}
+	}
+	auto tEnd = std::chrono::high_resolution_clock::now();
+	std::cout << "Generated " << levelCount << " levels of detail for " << meshes.size() << " meshes, " << (indexBuffer.size() - baseIndexCount) / 3 << " triangles in addition to " << baseIndexCount / 3
+		<< " (" << std::fixed << std::setprecision(1) << 100.0 * static_cast<double>(indexBuffer.size() - baseIndexCount) / static_cast<double>(baseIndexCount) << "% more index data) in "
+		<< std::setprecision(2) << std::chrono::duration<double, std::milli>(tEnd - tStart).count() << " ms" << std::defaultfloat << "\n";
+}
+
+struct SplitCorner {
+	glm::vec3 position;
+	// Barycentrics (u, v) in the original triangle
+	glm::vec2 barycentric;
+};
+
+// Triangles with a bounding box much larger than the triangle itself overlap with many others in a bounding volume hierarchy
+static bool isSplitCandidate(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+	const glm::vec3 extent = glm::max(a, glm::max(b, c)) - glm::min(a, glm::min(b, c));
+	const float boxArea = 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+	const float triangleArea = 0.5f * glm::length(glm::cross(b - a, c - a));
+	return (triangleArea > 0.0f) && (boxArea > vkglTF::splitThreshold * triangleArea);
+}
+
+// Recursively split at the midpoint of the longest edge, keeping the winding order
+// Midpoints have dyadic barycentrics, so they are stored exactly as 16-bit fixed point
+static void splitTriangle(const SplitCorner corners[3], uint32_t triangle, uint32_t depth, std::vector<glm::vec3>& positions, std::vector<vkglTF::Model::SplitTriangle>& triangles)
+{
+	if ((depth < vkglTF::maxSplitDepth) && isSplitCandidate(corners[0].position, corners[1].position, corners[2].position)) {
+		uint32_t edge = 0;
+		float longestEdge = 0.0f;
+		for (uint32_t i = 0; i < 3; i++) {
+			const glm::vec3 d = corners[(i + 1) % 3].position - corners[i].position;
+			if (glm::dot(d, d) > longestEdge) {
+				longestEdge = glm::dot(d, d);
+				edge = i;
+			}
+		}
+		const SplitCorner& a = corners[edge];
+		const SplitCorner& b = corners[(edge + 1) % 3];
+		const SplitCorner& c = corners[(edge + 2) % 3];
+		const SplitCorner m = { (a.position + b.position) * 0.5f, (a.barycentric + b.barycentric) * 0.5f };
+		const SplitCorner first[3] = { a, m, c };
+		const SplitCorner second[3] = { m, b, c };
+		splitTriangle(first, triangle, depth + 1, positions, triangles);
+		splitTriangle(second, triangle, depth + 1, positions, triangles);
+		return;
+	}
+	vkglTF::Model::SplitTriangle leaf{};
+	leaf.triangle = triangle;
+	for (uint32_t i = 0; i < 3; i++) {
+		positions.push_back(corners[i].position);
+		leaf.barycentrics[i] = static_cast<uint32_t>(corners[i].barycentric.x * 32768.0f) | (static_cast<uint32_t>(corners[i].barycentric.y * 32768.0f) << 16);
+	}
+	triangles.push_back(leaf);
+}
+
+/*
+	Pre-split the long and thin triangles of all geometry ranges
+	Ranges without any split candidates keep using the index buffer, all triangles of other ranges are emitted into the split geometry stream
+*/
+void vkglTF::Model::splitTriangles(const std::vector<uint32_t>& indexBuffer, const std::vector<Vertex>& vertexBuffer, std::vector<glm::vec3>& splitPositions, std::vector<SplitTriangle>& splitTriangleBuffer)
+{
+	auto tStart = std::chrono::high_resolution_clock::now();
+
+	// Ranges are processed in chunks of triangles that are distributed over worker threads
+	struct Job {
+		uint32_t range;
+		uint32_t firstTriangle;
+		uint32_t triangleCount;
+		uint32_t candidateCount;
+		std::vector<glm::vec3> positions;
+		std::vector<SplitTriangle> triangles;
+	};
+	const uint32_t chunkSize = 16384;
+	std::vector<Job> jobs;
+	for (uint32_t r = 0; r < static_cast<uint32_t>(geometryRanges.size()); r++) {
+		const uint32_t triangleCount = geometryRanges[r].indexCount / 3;
+		for (uint32_t first = 0; first < triangleCount; first += chunkSize) {
+			jobs.push_back({ r, first, std::min(chunkSize, triangleCount - first), 0 });
+		}
+	}
+	auto getCorners = [&](const GeometryRange& range, uint32_t triangle, SplitCorner corners[3]) {
+		for (uint32_t i = 0; i < 3; i++) {
+			corners[i].position = vertexBuffer[range.firstVertex + indexBuffer[range.firstIndex + triangle * 3 + i]].pos;
+		}
+		corners[0].barycentric = glm::vec2(0.0f, 0.0f);
+		corners[1].barycentric = glm::vec2(1.0f, 0.0f);
+		corners[2].barycentric = glm::vec2(0.0f, 1.0f);
+	};
+
+	vks::ThreadPool threadPool;
+	threadPool.setThreadCount(std::max(1u, std::thread::hardware_concurrency()));
+	const size_t threadCount = threadPool.threads.size();
+
+	// First pass counts the split candidates, so the split geometry stream only needs to be generated for ranges that contain any
+	for (size_t j = 0; j < jobs.size(); j++) {
+		Job* job = &jobs[j];
+		threadPool.threads[j % threadCount]->addJob([this, job, &getCorners] {
+			const GeometryRange& range = geometryRanges[job->range];
+			SplitCorner corners[3];
+			for (uint32_t t = job->firstTriangle; t < job->firstTriangle + job->triangleCount; t++) {
+				getCorners(range, t, corners);
+				if (isSplitCandidate(corners[0].position, corners[1].position, corners[2].position)) {
+					job->candidateCount++;
+				}
+			}
+		});
+	}
+	threadPool.wait();
+
+	std::vector<bool> splitRanges(geometryRanges.size(), false);
+	uint32_t candidateCount = 0;
+	for (auto& job : jobs) {
+		candidateCount += job.candidateCount;
+		if (job.candidateCount > 0) {
+			splitRanges[job.range] = true;
+		}
+	}
+	if (candidateCount == 0) {
+		std::cout << "Triangle pre-splitting: no triangles need to be split\n";
+		return;
+	}
+
+	// Second pass emits all triangles of the ranges to be split
+	for (size_t j = 0; j < jobs.size(); j++) {
+		Job* job = &jobs[j];
+		if (!splitRanges[job->range]) {
+			continue;
+		}
+		threadPool.threads[j % threadCount]->addJob([this, job, &getCorners] {
+			const GeometryRange& range = geometryRanges[job->range];
+			SplitCorner corners[3];
+			job->triangles.reserve(job->triangleCount + job->candidateCount * 2);
+			job->positions.reserve(job->triangles.capacity() * 3);
+			for (uint32_t t = job->firstTriangle; t < job->firstTriangle + job->triangleCount; t++) {
+				getCorners(range, t, corners);
+				splitTriangle(corners, t, 0, job->positions, job->triangles);
+			}
+		});
+	}
+	threadPool.wait();
+
+	// Jobs are in range order, so the triangles of a range are appended consecutively
+	uint64_t originalTriangleCount = 0;
+	uint32_t splitRangeCount = 0;
+	for (auto& range : geometryRanges) {
+		originalTriangleCount += range.indexCount / 3;
+	}
+	for (auto& job : jobs) {
+		if (!splitRanges[job.range]) {
+			continue;
+		}
+		GeometryRange& range = geometryRanges[job.range];
+		if (job.firstTriangle == 0) {
+			range.firstSplitTriangle = static_cast<uint32_t>(splitTriangleBuffer.size());
+			splitRangeCount++;
+		}
+		range.splitTriangleCount += static_cast<uint32_t>(job.triangles.size());
+		splitTriangleBuffer.insert(splitTriangleBuffer.end(), job.triangles.begin(), job.triangles.end());
+		splitPositions.insert(splitPositions.end(), job.positions.begin(), job.positions.end());
+	}
+
+	uint64_t blasTriangleCount = 0;
+	for (auto& range : geometryRanges) {
+		blasTriangleCount += (range.splitTriangleCount > 0) ? range.splitTriangleCount : range.indexCount / 3;
+	}
+	const size_t splitGeometrySize = splitPositions.size() * sizeof(glm::vec3) + splitTriangleBuffer.size() * sizeof(SplitTriangle);
+	auto tDuration = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+	std::cout << "Triangle pre-splitting: " << candidateCount << " of " << originalTriangleCount << " triangles split, " << splitRangeCount << " of " << geometryRanges.size() << " geometries use the split stream, "
+		<< blasTriangleCount << " acceleration structure triangles (+" << std::fixed << std::setprecision(1) << 100.0 * (static_cast<double>(blasTriangleCount) / originalTriangleCount - 1.0) << "%), "
+		<< splitGeometrySize / 1024 << " KB split geometry, " << std::setprecision(2) << tDuration << " ms on " << threadCount << " threads" << std::defaultfloat << "\n";
 }
 
 void vkglTF::Model::loadMaterials(tinygltf::Model &gltfModel)
@@ -1193,16 +1503,11 @@ void vkglTF::Model::loadAnimations(tinygltf::Model &gltfModel)
 			// Read sampler input time values
 			{
 				const tinygltf::Accessor &accessor = gltfModel.accessors[samp.input];
-				const tinygltf::BufferView &bufferView = gltfModel.bufferViews[accessor.bufferView];
-				const tinygltf::Buffer &buffer = gltfModel.buffers[bufferView.buffer];
 
 				assert(accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
 
-				float *buf = new float[accessor.count];
-				memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(float));
-				for (size_t index = 0; index < accessor.count; index++) {
-					sampler.inputs.push_back(buf[index]);
-				}
+				sampler.inputs.resize(accessor.count);
+				memcpy(sampler.inputs.data(), getAccessorData(gltfModel, accessor), accessor.count * sizeof(float));
 
 				for (auto input : sampler.inputs) {
 					if (input < animation.start) {
@@ -1217,26 +1522,21 @@ void vkglTF::Model::loadAnimations(tinygltf::Model &gltfModel)
 			// Read sampler output T/R/S values 
 			{
 				const tinygltf::Accessor &accessor = gltfModel.accessors[samp.output];
-				const tinygltf::BufferView &bufferView = gltfModel.bufferViews[accessor.bufferView];
-				const tinygltf::Buffer &buffer = gltfModel.buffers[bufferView.buffer];
 
 				assert(accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
 
 				switch (accessor.type) {
 				case TINYGLTF_TYPE_VEC3: {
-					glm::vec3 *buf = new glm::vec3[accessor.count];
-					memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(glm::vec3));
+					const glm::vec3 *buf = reinterpret_cast<const glm::vec3*>(getAccessorData(gltfModel, accessor));
+					sampler.outputsVec4.resize(accessor.count);
 					for (size_t index = 0; index < accessor.count; index++) {
-						sampler.outputsVec4.push_back(glm::vec4(buf[index], 0.0f));
+						sampler.outputsVec4[index] = glm::vec4(buf[index], 0.0f);
 					}
 					break;
 				}
 				case TINYGLTF_TYPE_VEC4: {
-					glm::vec4 *buf = new glm::vec4[accessor.count];
-					memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(glm::vec4));
-					for (size_t index = 0; index < accessor.count; index++) {
-						sampler.outputsVec4.push_back(buf[index]);
-					}
+					sampler.outputsVec4.resize(accessor.count);
+					memcpy(sampler.outputsVec4.data(), getAccessorData(gltfModel, accessor), accessor.count * sizeof(glm::vec4));
 					break;
 				}
 				default: {
@@ -1279,8 +1579,135 @@ void vkglTF::Model::loadAnimations(tinygltf::Model &gltfModel)
 	}
 }
 
-void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device, VkQueue transferQueue, uint32_t fileLoadingFlags, float scale)
+// Octahedral encoding of a direction into [-1, 1]^2
+static glm::vec2 octEncode(glm::vec3 v)
+{
+	const float l1 = fabs(v.x) + fabs(v.y) + fabs(v.z);
+	if (l1 == 0.0f) {
+		return glm::vec2(0.0f);
+	}
+	v /= l1;
+	glm::vec2 e = glm::vec2(v.x, v.y);
+	if (v.z < 0.0f) {
+		e = (1.0f - glm::abs(glm::vec2(e.y, e.x))) * glm::vec2(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return e;
+}
+
+const unsigned char* vkglTF::Model::getAccessorData(const tinygltf::Model& gltfModel, const tinygltf::Accessor& accessor) const
+{
+	const tinygltf::BufferView& bufferView = gltfModel.bufferViews[accessor.bufferView];
+	return bufferData[bufferView.buffer] + bufferView.byteOffset + accessor.byteOffset;
+}
+
+/*
+	Loads a binary glTF file without copying its binary chunk
+	tinygltf always copies the binary chunk into the buffer's data vector, so only the JSON chunk is passed to it, with the buffer stored in the binary chunk replaced by a one byte placeholder
+	Images stored in buffer views are detached from them the same way and reattached after parsing, as tinygltf would otherwise pass the placeholder's data to the image loader
+*/
+bool vkglTF::Model::loadBinaryFromMapping(tinygltf::TinyGLTF& gltfContext, tinygltf::Model& gltfModel, const MappedFile& file, std::string& error, std::string& warning)
+{
+	const char* placeholderUri = "data:application/octet-stream;base64,AA==";
+
+	// 12 byte file header followed by the header of the JSON chunk, which always comes first
+	uint32_t header[5];
+	if (file.size() < sizeof(header)) {
+		error = "File is too small for binary glTF";
+		return false;
+	}
+	memcpy(header, file.data(), sizeof(header));
+	const size_t fileLength = std::min(static_cast<size_t>(header[2]), file.size());
+	const size_t jsonLength = header[3];
+	if ((header[0] != 0x46546C67) || (header[4] != 0x4E4F534A) || (sizeof(header) + jsonLength > fileLength)) {
+		error = "Invalid binary glTF header";
+		return false;
+	}
+	const char* json = reinterpret_cast<const char*>(file.data() + sizeof(header));
+
+	// Optional binary chunk, chunks start at 4 byte boundaries
+	const unsigned char* binaryChunk = nullptr;
+	size_t binaryChunkLength = 0;
+	const size_t binaryChunkOffset = sizeof(header) + ((jsonLength + 3) & ~static_cast<size_t>(3));
+	if (binaryChunkOffset + 8 <= fileLength) {
+		uint32_t chunkHeader[2];
+		memcpy(chunkHeader, file.data() + binaryChunkOffset, sizeof(chunkHeader));
+		if ((chunkHeader[1] == 0x004E4942) && (binaryChunkOffset + 8 + chunkHeader[0] <= fileLength)) {
+			binaryChunk = file.data() + binaryChunkOffset + 8;
+			binaryChunkLength = chunkHeader[0];
+		}
+	}
+
+	nlohmann::json document = nlohmann::json::parse(json, json + jsonLength, nullptr, false);
+	if (!document.is_object()) {
+		error = "Failed to parse the JSON chunk";
+		return false;
+	}
+	// Only the first buffer may refer to the binary chunk, it's the one without an uri
+	int binaryBuffer = -1;
+	auto buffers = document.find("buffers");
+	if ((buffers != document.end()) && buffers->is_array() && !buffers->empty() && (*buffers)[0].is_object() && ((*buffers)[0].find("uri") == (*buffers)[0].end())) {
+		nlohmann::json& buffer = (*buffers)[0];
+		auto byteLengthValue = buffer.find("byteLength");
+		if ((byteLengthValue != buffer.end()) && !byteLengthValue->is_number_unsigned()) {
+			error = "Invalid byteLength of buffer 0";
+			return false;
+		}
+		const size_t byteLength = (byteLengthValue != buffer.end()) ? byteLengthValue->get<size_t>() : 0;
+		if (!binaryChunk || (byteLength > binaryChunkLength)) {
+			error = "Buffer 0 exceeds the binary chunk";
+			return false;
+		}
+		buffer["byteLength"] = 1;
+		buffer["uri"] = placeholderUri;
+		binaryBuffer = 0;
+	}
+	struct EmbeddedImage {
+		size_t index;
+		int bufferView;
+		std::string mimeType;
+	};
+	std::vector<EmbeddedImage> embeddedImages;
+	auto images = document.find("images");
+	if ((images != document.end()) && images->is_array()) {
+		for (size_t i = 0; i < images->size(); i++) {
+			nlohmann::json& image = (*images)[i];
+			if (image.is_object() && (image.find("bufferView") != image.end())) {
+				auto mimeType = image.find("mimeType");
+				if (!image["bufferView"].is_number_unsigned() || (image["bufferView"].get<size_t>() > static_cast<size_t>(std::numeric_limits<int>::max())) || ((mimeType != image.end()) && !mimeType->is_string())) {
+					error = "Invalid bufferView or mimeType of image " + std::to_string(i);
+					return false;
+				}
+				embeddedImages.push_back({ i, image["bufferView"].get<int>(), (mimeType != image.end()) ? mimeType->get<std::string>() : "" });
+				image.erase("bufferView");
+				image["uri"] = placeholderUri;
+			}
+		}
+	}
+
+	const std::string patchedJson = document.dump();
+	if (!gltfContext.LoadASCIIFromString(&gltfModel, &error, &warning, patchedJson.c_str(), static_cast<unsigned int>(patchedJson.size()), path)) {
+		return false;
+	}
+	for (auto& embeddedImage : embeddedImages) {
+		if (embeddedImage.bufferView >= static_cast<int>(gltfModel.bufferViews.size())) {
+			error = "Image " + std::to_string(embeddedImage.index) + " refers to a missing bufferView";
+			return false;
+		}
+		tinygltf::Image& image = gltfModel.images[embeddedImage.index];
+		image.bufferView = embeddedImage.bufferView;
+		image.mimeType = embeddedImage.mimeType;
+		image.uri.clear();
+	}
+	bufferData.resize(gltfModel.buffers.size());
+	for (size_t i = 0; i < gltfModel.buffers.size(); i++) {
+		bufferData[i] = (static_cast<int>(i) == binaryBuffer) ? binaryChunk : gltfModel.buffers[i].data.data();
+	}
+	return true;
+}
+
+void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device, VkQueue transferQueue, uint32_t fileLoadingFlags, float scale, UploadBatch* uploadBatch)
 {
+	auto tLoadStart = std::chrono::high_resolution_clock::now();
 	tinygltf::Model gltfModel;
 	tinygltf::TinyGLTF gltfContext;
 	if (fileLoadingFlags & FileLoadingFlags::DontLoadImages) {
@@ -1296,30 +1723,72 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 	size_t pos = filename.find_last_of('/');
 	path = filename.substr(0, pos);
 
+	// Identifies cached data derived from the geometry (e.g. acceleration structures) without hashing all of it
+	contentHash = vks::tools::hashFileIdentity(filename);
+	contentHash = vks::tools::hash(&fileLoadingFlags, sizeof(fileLoadingFlags), contentHash);
+	contentHash = vks::tools::hash(&scale, sizeof(scale), contentHash);
+	if (fileLoadingFlags & FileLoadingFlags::PreSplitTriangles) {
+		contentHash = vks::tools::hash(&splitThreshold, sizeof(splitThreshold), contentHash);
+		contentHash = vks::tools::hash(&maxSplitDepth, sizeof(maxSplitDepth), contentHash);
+	}
+	if (fileLoadingFlags & FileLoadingFlags::GenerateLevelsOfDetail) {
+		contentHash = vks::tools::hash(&levelOfDetailCount, sizeof(levelOfDetailCount), contentHash);
+		contentHash = vks::tools::hash(&levelOfDetailGridResolution, sizeof(levelOfDetailGridResolution), contentHash);
+	}
+
 	std::string error, warning;
 
 	this->device = device;
 
+	// Without a batch shared with other loads, all uploads of this model are submitted at once after loading
+	std::unique_ptr<UploadBatch> localUploadBatch;
+	if (!uploadBatch) {
+		localUploadBatch.reset(new UploadBatch(device, transferQueue));
+		uploadBatch = localUploadBatch.get();
+	}
+
 #if defined(__ANDROID__)
 	// On Android all assets are packed with the apk in a compressed form, so we need to open them using the asset manager
 	// We let tinygltf handle this, by passing the asset manager of our app
 	tinygltf::asset_manager = androidApp->activity->assetManager;
 #endif
-	bool fileLoaded = gltfContext.LoadASCIIFromFile(&gltfModel, &error, &warning, filename);
+	const bool binaryFile = (filename.size() > 4) && (filename.compare(filename.size() - 4, 4, ".glb") == 0);
+	// The mapping has to stay alive until all buffer data has been read
+	MappedFile mappedFile;
+	const bool mapped = binaryFile && mapBinaryFiles && mappedFile.open(filename);
+	bool fileLoaded = false;
+	if (mapped) {
+		fileLoaded = loadBinaryFromMapping(gltfContext, gltfModel, mappedFile, error, warning);
+	} else {
+		if (binaryFile) {
+			fileLoaded = gltfContext.LoadBinaryFromFile(&gltfModel, &error, &warning, filename);
+		} else {
+			fileLoaded = gltfContext.LoadASCIIFromFile(&gltfModel, &error, &warning, filename);
+		}
+		if (fileLoaded) {
+			bufferData.resize(gltfModel.buffers.size());
+			for (size_t i = 0; i < gltfModel.buffers.size(); i++) {
+				bufferData[i] = gltfModel.buffers[i].data.data();
+			}
+		}
+	}
 
 	std::vector<uint32_t> indexBuffer;
 	std::vector<Vertex> vertexBuffer;
 
 	if (fileLoaded) {
 		if (!(fileLoadingFlags & FileLoadingFlags::DontLoadImages)) {
-			loadImages(gltfModel, device, transferQueue);
+			loadImages(gltfModel, device, *uploadBatch, fileLoadingFlags & FileLoadingFlags::ClassifyAlphaTriangles);
 		}
 		loadMaterials(gltfModel);
+		shareMeshData = !(fileLoadingFlags & FileLoadingFlags::PreTransformVertices);
 		const tinygltf::Scene &scene = gltfModel.scenes[gltfModel.defaultScene > -1 ? gltfModel.defaultScene : 0];
+		std::vector<PrimitiveDecode> primitiveDecodes;
 		for (size_t i = 0; i < scene.nodes.size(); i++) {
 			const tinygltf::Node node = gltfModel.nodes[scene.nodes[i]];
-			loadNode(nullptr, node, scene.nodes[i], gltfModel, indexBuffer, vertexBuffer, scale);
+			loadNode(nullptr, node, scene.nodes[i], gltfModel, primitiveDecodes, scale);
 		}
+		decodePrimitives(gltfModel, primitiveDecodes, indexBuffer, vertexBuffer);
 		if (gltfModel.animations.size() > 0) {
 			loadAnimations(gltfModel);
 		}
@@ -1335,6 +1804,8 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 				node->update();
 			}
 		}
+		bufferData.clear();
+		mappedFile.close();
 	}
 	else {
 		// TODO: throw
@@ -1348,7 +1819,8 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 		const bool preMultiplyColor = fileLoadingFlags & FileLoadingFlags::PreMultiplyVertexColors;
 		const bool flipY = fileLoadingFlags & FileLoadingFlags::FlipY;
 		for (Node* node : linearNodes) {
-			if (node->mesh) {
+			// Shared vertex data must only be processed once
+			if (node->mesh && (meshes[node->mesh->index] == node->mesh)) {
 				const glm::mat4 localMatrix = node->getMatrix();
 				for (Primitive* primitive : node->mesh->primitives) {
 					for (uint32_t i = 0; i < primitive->vertexCount; i++) {
@@ -1380,6 +1852,21 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 		}
 	}
 
+	if (fileLoadingFlags & FileLoadingFlags::ClassifyAlphaTriangles) {
+		classifyTriangles(indexBuffer, vertexBuffer);
+	}
+	createGeometryRanges(indexBuffer);
+	std::vector<glm::vec3> splitPositionBuffer;
+	std::vector<SplitTriangle> splitTriangleBuffer;
+	if (fileLoadingFlags & FileLoadingFlags::PreSplitTriangles) {
+		splitTriangles(indexBuffer, vertexBuffer, splitPositionBuffer, splitTriangleBuffer);
+	}
+	splitGeometry.triangleCount = static_cast<uint32_t>(splitTriangleBuffer.size());
+	// Coarser levels are only built from the index buffer, so they don't use the split geometry
+	if (fileLoadingFlags & FileLoadingFlags::GenerateLevelsOfDetail) {
+		generateLevelsOfDetail(indexBuffer, vertexBuffer);
+	}
+
 	size_t vertexBufferSize = vertexBuffer.size() * sizeof(Vertex);
 	size_t indexBufferSize = indexBuffer.size() * sizeof(uint32_t);
 	indices.count = static_cast<uint32_t>(indexBuffer.size());
@@ -1387,62 +1874,128 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 
 	assert((vertexBufferSize > 0) && (indexBufferSize > 0));
 
-	struct StagingBuffer {
-		VkBuffer buffer;
-		VkDeviceMemory memory;
-	} vertexStaging, indexStaging;
-
-	// Create staging buffers
-	// Vertex data
-	VK_CHECK_RESULT(device->createBuffer(
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		vertexBufferSize,
-		&vertexStaging.buffer,
-		&vertexStaging.memory,
-		vertexBuffer.data()));
-	// Index data
-	VK_CHECK_RESULT(device->createBuffer(
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		indexBufferSize,
-		&indexStaging.buffer,
-		&indexStaging.memory,
-		indexBuffer.data()));
-
-	// Create device local buffers
-	// Vertex buffer
-	VK_CHECK_RESULT(device->createBuffer(
-	    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | memoryPropertyFlags,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		vertexBufferSize,
-		&vertices.buffer,
-		&vertices.memory));
-	// Index buffer
-	VK_CHECK_RESULT(device->createBuffer(
-	    VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | memoryPropertyFlags,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		indexBufferSize,
-		&indices.buffer,
-		&indices.memory));
-
-	// Copy from staging buffers
-	VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
-	VkBufferCopy copyRegion = {};
+	// Convert to the compact vertex layout used for ray tracing
+	compactVertices = fileLoadingFlags & FileLoadingFlags::CompactVertices;
+	std::vector<glm::vec3> positionBuffer;
+	std::vector<PackedAttributes> attributeBuffer;
+	std::vector<uint16_t> indexBuffer16;
+	const void* vertexData = vertexBuffer.data();
+	const void* indexData = indexBuffer.data();
+	size_t attributeBufferSize = 0;
+	if (compactVertices) {
+		positionBuffer.resize(vertexBuffer.size());
+		attributeBuffer.resize(vertexBuffer.size());
+		for (size_t i = 0; i < vertexBuffer.size(); i++) {
+			const Vertex& vertex = vertexBuffer[i];
+			const bool hasTangent = glm::length(glm::vec3(vertex.tangent)) > 0.0f;
+			positionBuffer[i] = vertex.pos;
+			attributeBuffer[i].normal = glm::packSnorm2x16(octEncode(vertex.normal));
+			attributeBuffer[i].tangent = hasTangent ? glm::packSnorm2x16(octEncode(glm::vec3(vertex.tangent))) : 0;
+			attributeBuffer[i].uv = glm::packHalf2x16(vertex.uv);
+			attributeBuffer[i].color = glm::packUnorm4x8(glm::vec4(glm::vec3(vertex.color), hasTangent ? (vertex.tangent.w < 0.0f ? 0.5f : 1.0f) : 0.0f));
+		}
+		vertexBufferSize = positionBuffer.size() * sizeof(glm::vec3);
+		attributeBufferSize = attributeBuffer.size() * sizeof(PackedAttributes);
+		vertexData = positionBuffer.data();
+		// Indices are relative to the primitive, so only the largest primitive decides if 16-bit indices can be used
+		uint32_t maxPrimitiveVertexCount = 0;
+		for (Mesh* mesh : meshes) {
+			for (Primitive* primitive : mesh->primitives) {
+				maxPrimitiveVertexCount = std::max(maxPrimitiveVertexCount, primitive->vertexCount);
+			}
+		}
+		if (maxPrimitiveVertexCount <= 65536) {
+			indices.type = VK_INDEX_TYPE_UINT16;
+			indexBuffer16.assign(indexBuffer.begin(), indexBuffer.end());
+			// Keep the buffer size a multiple of four bytes, as shaders read 16-bit indices in pairs
+			if (indexBuffer16.size() % 2 != 0) {
+				indexBuffer16.push_back(0);
+			}
+			indexBufferSize = indexBuffer16.size() * sizeof(uint16_t);
+			indexData = indexBuffer16.data();
+		}
+		// Per hit the hit shaders fetch three indices and the data for three vertices
+		const size_t fullSize = vertexBuffer.size() * sizeof(Vertex) + indexBuffer.size() * sizeof(uint32_t);
+		const size_t compactSize = vertexBufferSize + attributeBufferSize + indexBufferSize;
+		const size_t fullFetchSize = 3 * sizeof(uint32_t) + 3 * 6 * sizeof(glm::vec4);
+		const size_t compactFetchSize = 3 * (indices.type == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t)) + 3 * (sizeof(glm::vec3) + sizeof(PackedAttributes));
+		std::cout << "Compact vertex layout: " << std::fixed << std::setprecision(2) << static_cast<double>(compactSize) / (1024.0 * 1024.0) << " MB instead of " << static_cast<double>(fullSize) / (1024.0 * 1024.0) << " MB of vertex and index data ("
+			<< std::setprecision(1) << 100.0 * (1.0 - static_cast<double>(compactSize) / fullSize) << "% less), "
+			<< compactFetchSize << " instead of " << fullFetchSize << " bytes fetched per hit (" << 100.0 * (1.0 - static_cast<double>(compactFetchSize) / fullFetchSize) << "% less)" << std::defaultfloat << "\n";
+	}
 
-	copyRegion.size = vertexBufferSize;
-	vkCmdCopyBuffer(copyCmd, vertexStaging.buffer, vertices.buffer, 1, &copyRegion);
+	// Streamed geometry is only kept on the host and uploaded by the caller
+	const bool uploadGeometry = !(fileLoadingFlags & FileLoadingFlags::HostGeometryOnly);
+	if ((fileLoadingFlags & FileLoadingFlags::KeepHostGeometry) || !uploadGeometry) {
+		if (compactVertices) {
+			hostPositions = positionBuffer;
+		} else {
+			hostVertices = vertexBuffer;
+		}
+		hostIndices = indexBuffer;
+		hostSplitPositions = splitPositionBuffer;
+	}
 
-	copyRegion.size = indexBufferSize;
-	vkCmdCopyBuffer(copyCmd, indexStaging.buffer, indices.buffer, 1, &copyRegion);
+	const size_t splitPositionBufferSize = splitPositionBuffer.size() * sizeof(glm::vec3);
+	const size_t splitTriangleBufferSize = splitTriangleBuffer.size() * sizeof(SplitTriangle);
 
-	device->flushCommandBuffer(copyCmd, transferQueue, true);
+	// Create device local buffers
+	if (uploadGeometry) {
+		// Vertex buffer
+		VK_CHECK_RESULT(device->createBuffer(
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | memoryPropertyFlags,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			vertexBufferSize,
+			&vertices.buffer,
+			&vertices.memory));
+		// Index buffer
+		VK_CHECK_RESULT(device->createBuffer(
+			VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | memoryPropertyFlags,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			indexBufferSize,
+			&indices.buffer,
+			&indices.memory));
+	}
+	// Packed vertex attribute buffer
+	if (compactVertices) {
+		VK_CHECK_RESULT(device->createBuffer(
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT | memoryPropertyFlags,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			attributeBufferSize,
+			&attributes.buffer,
+			&attributes.memory));
+	}
+	// Split geometry buffers
+	if (splitGeometry.triangleCount > 0) {
+		VK_CHECK_RESULT(device->createBuffer(
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT | memoryPropertyFlags,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			splitPositionBufferSize,
+			&splitGeometry.positions,
+			&splitGeometry.positionsMemory));
+		VK_CHECK_RESULT(device->createBuffer(
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT | memoryPropertyFlags,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			splitTriangleBufferSize,
+			&splitGeometry.triangles,
+			&splitGeometry.trianglesMemory));
+	}
 
-	vkDestroyBuffer(device->logicalDevice, vertexStaging.buffer, nullptr);
-	vkFreeMemory(device->logicalDevice, vertexStaging.memory, nullptr);
-	vkDestroyBuffer(device->logicalDevice, indexStaging.buffer, nullptr);
-	vkFreeMemory(device->logicalDevice, indexStaging.memory, nullptr);
+	// Host data is copied to the upload batch's staging memory right away, so the host buffers can be released before the batch is flushed
+	if (uploadGeometry) {
+		uploadBatch->copyToBuffer(vertexData, vertexBufferSize, vertices.buffer);
+		uploadBatch->copyToBuffer(indexData, indexBufferSize, indices.buffer);
+	}
+	if (compactVertices) {
+		uploadBatch->copyToBuffer(attributeBuffer.data(), attributeBufferSize, attributes.buffer);
+	}
+	if (splitGeometry.triangleCount > 0) {
+		uploadBatch->copyToBuffer(splitPositionBuffer.data(), splitPositionBufferSize, splitGeometry.positions);
+		uploadBatch->copyToBuffer(splitTriangleBuffer.data(), splitTriangleBufferSize, splitGeometry.triangles);
+	}
+	if (localUploadBatch) {
+		localUploadBatch->flush();
+	}
 
 	getSceneDimensions();
 
@@ -1480,6 +2033,7 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 	// Descriptors for per-node uniform buffers
 	{
 		// Layout is global, so only create if it hasn't already been created before
+		std::unique_lock<std::mutex> lock(sharedLayoutMutex);
 		if (descriptorSetLayoutUbo == VK_NULL_HANDLE) {
 			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
 				vks::initializers::descriptorSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT),
@@ -1490,6 +2044,7 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 			descriptorLayoutCI.pBindings = setLayoutBindings.data();
 			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device->logicalDevice, &descriptorLayoutCI, nullptr, &descriptorSetLayoutUbo));
 		}
+		lock.unlock();
 		for (auto node : nodes) {
 			prepareNodeDescriptor(node, descriptorSetLayoutUbo);
 		}
@@ -1498,6 +2053,7 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 	// Descriptors for per-material images
 	{
 		// Layout is global, so only create if it hasn't already been created before
+		std::unique_lock<std::mutex> lock(sharedLayoutMutex);
 		if (descriptorSetLayoutImage == VK_NULL_HANDLE) {
 			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings{};
 			if (descriptorBindingFlags & DescriptorBindingFlags::ImageBaseColor) {
@@ -1512,19 +2068,25 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 			descriptorLayoutCI.pBindings = setLayoutBindings.data();
 			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device->logicalDevice, &descriptorLayoutCI, nullptr, &descriptorSetLayoutImage));
 		}
+		lock.unlock();
 		for (auto& material : materials) {
 			if (material.baseColorTexture != nullptr) {
 				material.createDescriptorSet(descriptorPool, vkglTF::descriptorSetLayoutImage, descriptorBindingFlags);
 			}
 		}
 	}
+
+	// Peak resident memory is process wide, so loading the same scene with and without file mapping has to be compared across separate runs
+	const double loadTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tLoadStart).count();
+	std::cout << "Loaded " << filename.substr(pos + 1) << (mapped ? " from a file mapping" : "") << " in " << std::fixed << std::setprecision(2) << loadTime << " ms, peak resident memory "
+		<< static_cast<double>(vks::tools::getPeakResidentMemory()) / (1024.0 * 1024.0) << " MB\n";
 }
 
 void vkglTF::Model::bindBuffers(VkCommandBuffer commandBuffer)
 {
 	const VkDeviceSize offsets[1] = {0};
 	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices.buffer, offsets);
-	vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+	vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, indices.type);
 	buffersBound = true;
 }
 
@@ -1547,7 +2109,7 @@ void vkglTF::Model::drawNode(Node *node, VkCommandBuffer commandBuffer, uint32_t
 				if (renderFlags & RenderFlags::BindImages) {
 					vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, bindImageSet, 1, &material.descriptorSet, 0, nullptr);
 				}
-				vkCmdDrawIndexed(commandBuffer, primitive->indexCount, 1, primitive->firstIndex, 0, 0);
+				vkCmdDrawIndexed(commandBuffer, primitive->indexCount, 1, primitive->firstIndex, primitive->firstVertex, 0);
 			}
 		}
 	}
@@ -1561,7 +2123,7 @@ void vkglTF::Model::draw(VkCommandBuffer commandBuffer, uint32_t renderFlags, Vk
 	if (!buffersBound) {
 		const VkDeviceSize offsets[1] = {0};
 		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices.buffer, offsets);
-		vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+		vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, indices.type);
 	}
 	for (auto& node : nodes) {
 		drawNode(node, commandBuffer, renderFlags, pipelineLayout, bindImageSet);
@@ -11,10 +11,19 @@
 #include <stdlib.h>
 #include <string>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <chrono>
 #include <vector>
+#include <map>
+#include <unordered_map>
+#include <atomic>
 
 #include "volk/volk.h"
 #include "VulkanDevice.h"
+#include "MappedFile.h"
+#include "UploadBatch.h"
 #include "basis_universal/transcoder/basisu_transcoder.h";
 
 #define GLM_FORCE_RADIANS
@@ -22,6 +31,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/packing.hpp>
 
 #define TINYGLTF_NO_STB_IMAGE_WRITE
 #ifdef VK_USE_PLATFORM_ANDROID_KHR
@@ -44,6 +54,20 @@ namespace vkglTF
 	extern VkDescriptorSetLayout descriptorSetLayoutUbo;
     extern VkMemoryPropertyFlags memoryPropertyFlags;
 	extern uint32_t descriptorBindingFlags;
+	// Directory for data derived from glTF files that is cached on disk (e.g. the per-triangle alpha classification), caching is disabled if empty
+	extern std::string cacheDirectory;
+	// Triangles whose bounding box surface area exceeds their area by this factor are pre-split (FileLoadingFlags::PreSplitTriangles)
+	extern float splitThreshold;
+	// Maximum number of recursive splits per triangle (each triangle is split into at most 2^maxSplitDepth triangles)
+	extern uint32_t maxSplitDepth;
+	// Number of coarser levels of detail generated per mesh (FileLoadingFlags::GenerateLevelsOfDetail)
+	extern uint32_t levelOfDetailCount;
+	// Vertex clustering grid cells along the longest axis of a mesh for the first coarser level of detail, halved for every further level
+	extern uint32_t levelOfDetailGridResolution;
+	// Read the binary chunk of .glb files through a memory mapping instead of copying it into host memory
+	extern bool mapBinaryFiles;
+	// Threads used to decode images while loading, 0 uses all hardware threads and 1 decodes and uploads them one after another
+	extern uint32_t imageDecodeThreadCount;
 
 	struct Node;
 
@@ -62,9 +86,30 @@ namespace vkglTF
 		VkDescriptorImageInfo descriptor{};
 		VkSampler sampler;
 		int32_t index;
+		// Min/max alpha of the base level and of coarser levels of 2x2 cells, only created for textures used for alpha testing
+		struct AlphaRange {
+			uint8_t min;
+			uint8_t max;
+		};
+		std::vector<std::vector<AlphaRange>> alphaLevels;
+		// Identifies the source image of the alpha levels, so cached triangle classifications are invalidated when it changes
+		uint64_t contentKey = 0;
+		// Decoded base level waiting for upload
+		struct Staging {
+			UploadBatch::Allocation allocation;
+			VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+		} staging;
 		void updateDescriptor();
 		void destroy();
-		void fromglTfImage(tinygltf::Image& gltfimage, std::string path, vks::VulkanDevice* device, VkQueue copyQueue);
+		// Images stored in a buffer view are decoded from imageData, others are read from their file
+		// Decoding is thread safe, uploads have to be done on the thread that flushes the upload batch
+		void decode(tinygltf::Image& gltfimage, std::string path, vks::VulkanDevice* device, UploadBatch& uploadBatch, bool keepAlpha = false, const unsigned char* imageData = nullptr, size_t imageSize = 0);
+		// The image can be used once the upload batch has been flushed
+		void upload(UploadBatch& uploadBatch);
+		void fromglTfImage(tinygltf::Image& gltfimage, std::string path, vks::VulkanDevice* device, VkQueue copyQueue, bool keepAlpha = false, const unsigned char* imageData = nullptr, size_t imageSize = 0);
+		void createAlphaLevels(const uint8_t* rgba, uint32_t width, uint32_t height);
+		/** @brief Returns the range of alpha values that bilinear sampling of the base level can return inside the given uv rectangle */
+		AlphaRange getAlphaRange(glm::vec2 uvMin, glm::vec2 uvMax);
 	};
 
 	/*
@@ -74,7 +119,7 @@ namespace vkglTF
 		vks::VulkanDevice* device;
 		enum AlphaMode { ALPHAMODE_OPAQUE, ALPHAMODE_MASK, ALPHAMODE_BLEND };
 		AlphaMode alphaMode = ALPHAMODE_OPAQUE;
-		float alphaCutoff = 1.0f;
+		float alphaCutoff = 0.5f;
 		float metallicFactor = 1.0f;
 		float roughnessFactor = 1.0f;
 		glm::vec4 baseColorFactor = glm::vec4(1.0f);
@@ -125,6 +170,21 @@ namespace vkglTF
 
 		std::vector<Primitive*> primitives;
 		std::string name;
+		// Index of the unique mesh in Model::meshes that owns the vertex and index data used by this mesh
+		uint32_t index = 0;
+		// Range of Model::geometryRanges belonging to this mesh
+		uint32_t firstGeometryRange = 0;
+		uint32_t geometryRangeCount = 0;
+		// Coarser levels of detail, each a separate range of Model::geometryRanges (FileLoadingFlags::GenerateLevelsOfDetail)
+		struct LevelOfDetail {
+			uint32_t firstGeometryRange;
+			uint32_t geometryRangeCount;
+			uint32_t triangleCount;
+		};
+		std::vector<LevelOfDetail> levelsOfDetail;
+		// Bounding sphere of the vertices in mesh space, used for selecting the level of detail
+		glm::vec3 center = glm::vec3(0.0f);
+		float radius = 0.0f;
 
 		struct UniformBuffer {
 			VkBuffer buffer;
@@ -209,7 +269,7 @@ namespace vkglTF
 	/*
 		glTF default vertex layout with easy Vulkan mapping functions
 	*/
-	enum class VertexComponent { Position, Normal, UV, Color, Tangent, Joint0, Weight0, MaterialId };
+	enum class VertexComponent { Position, Normal, UV, Color, Tangent, Joint0, Weight0 };
 
 	struct Vertex {
 		glm::vec3 pos;
@@ -219,8 +279,6 @@ namespace vkglTF
 		glm::vec4 joint0;
 		glm::vec4 weight0;
 		glm::vec4 tangent;
-		int32_t materialIndex;
-		glm::vec3 _pad;
 		static VkVertexInputBindingDescription vertexInputBindingDescription;
 		static std::vector<VkVertexInputAttributeDescription> vertexInputAttributeDescriptions;
 		static VkPipelineVertexInputStateCreateInfo pipelineVertexInputStateCreateInfo;
@@ -236,7 +294,14 @@ namespace vkglTF
 		PreTransformVertices = 0x00000001,
 		PreMultiplyVertexColors = 0x00000002,
 		FlipY = 0x00000004,
-		DontLoadImages = 0x00000008
+		DontLoadImages = 0x00000008,
+		KeepHostGeometry = 0x00000010,
+		ClassifyAlphaTriangles = 0x00000020,
+		CompactVertices = 0x00000040,
+		PreSplitTriangles = 0x00000080,
+		GenerateLevelsOfDetail = 0x00000100,
+		// Only keep host copies of the vertex and index data (implies KeepHostGeometry), without creating the device buffers
+		HostGeometryOnly = 0x00000200
 	};
 
 	enum RenderFlags {
@@ -251,26 +316,70 @@ namespace vkglTF
 	*/
 	class Model {
 	private:
+		// Maps glTF mesh indices to Model::meshes
+		std::map<int, uint32_t> meshIndices;
 		vkglTF::Texture* getTexture(uint32_t index);
 		vkglTF::Texture emptyTexture;
-		void createEmptyTexture(VkQueue transferQueue);
+		void createEmptyTexture(UploadBatch& uploadBatch);
 	public:
 		vks::VulkanDevice* device;
 		VkDescriptorPool descriptorPool;
 
 		struct Vertices {
 			int count;
-			VkBuffer buffer;
-			VkDeviceMemory memory;
+			VkBuffer buffer = VK_NULL_HANDLE;
+			VkDeviceMemory memory = VK_NULL_HANDLE;
 		} vertices;
 		struct Indices {
 			int count;
-			VkBuffer buffer;
-			VkDeviceMemory memory;
+			VkBuffer buffer = VK_NULL_HANDLE;
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+			VkIndexType type = VK_INDEX_TYPE_UINT32;
 		} indices;
 
+		/*
+			Compact vertex layout for ray tracing, only used if loaded with FileLoadingFlags::CompactVertices
+			The vertex buffer then only contains float3 positions (e.g. for building acceleration structures), all other attributes are stored packed in a separate buffer
+			Models whose primitives have up to 64k vertices each also use 16-bit indices
+		*/
+		struct PackedAttributes {
+			uint32_t normal;	// Octahedral encoded, snorm16x2
+			uint32_t tangent;	// Octahedral encoded, snorm16x2
+			uint32_t uv;		// half2
+			uint32_t color;		// unorm8x4, alpha stores the tangent's handedness (0 = no tangent, 0.5 = -1, 1 = +1)
+		};
+		struct Attributes {
+			VkBuffer buffer = VK_NULL_HANDLE;
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+		} attributes;
+		bool compactVertices = false;
+
+		/*
+			Pre-split triangles for ray tracing, only created if loaded with FileLoadingFlags::PreSplitTriangles
+			Long and thin triangles have large bounding boxes that overlap badly, so they are recursively split along their longest edge
+			Geometry ranges with split triangles are built from a separate non-indexed position stream instead of the index buffer
+			Each triangle of that stream references the original triangle and the barycentrics of it's corners in it, so shading data stays unchanged
+		*/
+		struct SplitTriangle {
+			uint32_t triangle;			// Relative to the geometry range
+			uint32_t barycentrics[3];	// Barycentrics (u, v) of the corners in the original triangle, 16-bit fixed point with 15 fractional bits
+		};
+		struct SplitGeometry {
+			uint32_t triangleCount = 0;
+			VkBuffer positions = VK_NULL_HANDLE;
+			VkDeviceMemory positionsMemory = VK_NULL_HANDLE;
+			VkBuffer triangles = VK_NULL_HANDLE;
+			VkDeviceMemory trianglesMemory = VK_NULL_HANDLE;
+		} splitGeometry;
+
 		std::vector<Node*> nodes;
 		std::vector<Node*> linearNodes;
+		/*
+			Meshes that own vertex and index data, nodes referencing the same glTF mesh share it's data if vertices are not pre-transformed
+			Meshes are owned by their nodes, this only references the first node's mesh
+		*/
+		std::vector<Mesh*> meshes;
+		bool shareMeshData = true;
 
 		std::vector<Skin*> skins;
 
@@ -289,15 +398,68 @@ namespace vkglTF
 		bool metallicRoughnessWorkflow = true;
 		bool buffersBound = false;
 		std::string path;
+		uint64_t contentHash = 0;
+
+		/*
+			Ranges of the index buffer that are passed as separate geometries to a ray tracing acceleration structure
+			Each primitive becomes (at least) one geometry, so per-geometry data like the material can be looked up via the geometry index in the hit shaders
+			Indices are relative to the primitive's first vertex
+		*/
+		struct GeometryRange {
+			uint32_t firstIndex;
+			uint32_t indexCount;
+			uint32_t firstVertex;
+			uint32_t materialIndex;
+			bool opaque;
+			// Triangles of the split geometry stream, only used if splitTriangleCount is not zero
+			uint32_t firstSplitTriangle = 0;
+			uint32_t splitTriangleCount = 0;
+		};
+		std::vector<GeometryRange> geometryRanges;
+		/*
+			Opacity of each triangle of the index buffer, only created if loaded with FileLoadingFlags::ClassifyAlphaTriangles
+			Triangles of alpha tested materials are classified by the base color texture's alpha inside their uv footprint
+			Fully transparent ones are left out of the geometry ranges and fully opaque ones don't need to invoke any-hit shaders
+		*/
+		enum class TriangleOpacity : uint8_t { Opaque, Transparent, Unknown };
+		std::vector<TriangleOpacity> triangleOpacity;
+		// Host copies of the vertex and index data, only kept if loaded with FileLoadingFlags::KeepHostGeometry or FileLoadingFlags::HostGeometryOnly
+		// With the compact vertex layout, only the positions are kept and indices are always kept as 32-bit
+		std::vector<Vertex> hostVertices;
+		std::vector<glm::vec3> hostPositions;
+		std::vector<uint32_t> hostIndices;
+		std::vector<glm::vec3> hostSplitPositions;
+		// Start of each glTF buffer's data while the file is loaded, the buffer stored in a .glb file's binary chunk may point into a mapping of the file
+		std::vector<const unsigned char*> bufferData;
+
+		// Location of a glTF primitive's vertices and indices in the model's buffers
+		// Primitives are only decoded after all nodes have been loaded, so the buffers can be sized once and decoded in parallel
+		struct PrimitiveDecode {
+			int mesh;
+			size_t primitive;
+			uint32_t firstIndex;
+			uint32_t indexCount;
+			uint32_t firstVertex;
+			uint32_t vertexCount;
+		};
 
 		Model() {};
 		~Model();
-		void loadNode(vkglTF::Node* parent, const tinygltf::Node& node, uint32_t nodeIndex, const tinygltf::Model& model, std::vector<uint32_t>& indexBuffer, std::vector<Vertex>& vertexBuffer, float globalscale);
+		bool loadBinaryFromMapping(tinygltf::TinyGLTF& gltfContext, tinygltf::Model& gltfModel, const MappedFile& file, std::string& error, std::string& warning);
+		const unsigned char* getAccessorData(const tinygltf::Model& gltfModel, const tinygltf::Accessor& accessor) const;
+		void loadNode(vkglTF::Node* parent, const tinygltf::Node& node, uint32_t nodeIndex, const tinygltf::Model& model, std::vector<PrimitiveDecode>& primitiveDecodes, float globalscale);
+		void decodePrimitives(const tinygltf::Model& model, const std::vector<PrimitiveDecode>& primitiveDecodes, std::vector<uint32_t>& indexBuffer, std::vector<Vertex>& vertexBuffer);
 		void loadSkins(tinygltf::Model& gltfModel);
-		void loadImages(tinygltf::Model& gltfModel, vks::VulkanDevice* device, VkQueue transferQueue);
+		void loadImages(tinygltf::Model& gltfModel, vks::VulkanDevice* device, UploadBatch& uploadBatch, bool keepAlpha = false);
 		void loadMaterials(tinygltf::Model& gltfModel);
 		void loadAnimations(tinygltf::Model& gltfModel);
-		void loadFromFile(std::string filename, vks::VulkanDevice* device, VkQueue transferQueue, uint32_t fileLoadingFlags = vkglTF::FileLoadingFlags::None, float scale = 1.0f);
+		void classifyTriangles(const std::vector<uint32_t>& indexBuffer, const std::vector<Vertex>& vertexBuffer);
+		void createGeometryRanges(std::vector<uint32_t>& indexBuffer);
+		void splitTriangles(const std::vector<uint32_t>& indexBuffer, const std::vector<Vertex>& vertexBuffer, std::vector<glm::vec3>& splitPositions, std::vector<SplitTriangle>& splitTriangleBuffer);
+		void generateLevelsOfDetail(std::vector<uint32_t>& indexBuffer, const std::vector<Vertex>& vertexBuffer);
+		// Uploads are added to the given batch, which has to be flushed before the model's buffers and images are used
+		// Without a batch the model's uploads are submitted before returning
+		void loadFromFile(std::string filename, vks::VulkanDevice* device, VkQueue transferQueue, uint32_t fileLoadingFlags = vkglTF::FileLoadingFlags::None, float scale = 1.0f, UploadBatch* uploadBatch = nullptr);
 	    void bindBuffers(VkCommandBuffer commandBuffer);
 		void drawNode(Node* node, VkCommandBuffer commandBuffer, uint32_t renderFlags = 0, VkPipelineLayout pipelineLayout = VK_NULL_HANDLE, uint32_t bindImageSet = 1);
 		void draw(VkCommandBuffer commandBuffer, uint32_t renderFlags = 0, VkPipelineLayout pipelineLayout = VK_NULL_HANDLE, uint32_t bindImageSet = 1);
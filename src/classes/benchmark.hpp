@@ -13,6 +13,7 @@
 #include <functional>
 #include <chrono>
 #include <iomanip>
+#include <numeric>
 
 namespace vks
 {
@@ -27,6 +28,11 @@ namespace vks
 		uint32_t duration = 10;
 		std::vector<double> frameTimes;
 		std::string filename = "";
+		/** @brief Number of frames the application keeps in flight (set by the application) */
+		uint32_t framesInFlight = 1;
+		/** @brief Time the CPU was blocked waiting for frames in flight during the current frame (accumulated by the application, in ms) */
+		double fenceWaitTime = 0.0;
+		std::vector<double> fenceWaitTimes;
 
 		double runtime = 0.0;
 		uint32_t frameCount = 0;
@@ -55,11 +61,13 @@ namespace vks
 			// Benchmark phase
 			{
 				while (runtime < (duration * 1000.0)) {
+					fenceWaitTime = 0.0;
 					auto tStart = std::chrono::high_resolution_clock::now();
 					renderFunc();
 					auto tDiff = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
 					runtime += tDiff;
 					frameTimes.push_back(tDiff);
+					fenceWaitTimes.push_back(fenceWaitTime);
 					frameCount++;
 				};
 				std::cout << "Benchmark finished" << "\n";
@@ -67,21 +75,32 @@ namespace vks
 				std::cout << "runtime: " << (runtime / 1000.0) << "\n";
 				std::cout << "frames : " << frameCount << "\n";
 				std::cout << "fps    : " << frameCount / (runtime / 1000.0) << "\n";
+				std::cout << "frames in flight: " << framesInFlight << "\n";
+				std::cout << "overlap: " << overlap() * 100.0 << " % (cpu blocked " << std::accumulate(fenceWaitTimes.begin(), fenceWaitTimes.end(), 0.0) / (double)frameCount << " ms/frame)" << "\n";
 			}
 		}
 
+		/** @brief Steady-state CPU/GPU overlap, i.e. the share of the frame time the CPU was not blocked waiting for the GPU */
+		double overlap() {
+			if (runtime <= 0.0) {
+				return 0.0;
+			}
+			const double waitTime = std::accumulate(fenceWaitTimes.begin(), fenceWaitTimes.end(), 0.0);
+			return std::max(0.0, 1.0 - waitTime / runtime);
+		}
+
 		void saveResults() {
 			std::ofstream result(filename, std::ios::out);
 			if (result.is_open()) {
 				result << std::fixed << std::setprecision(4);
 
-				result << "device,driverversion,duration (ms),frames,fps" << "\n";
-				result << deviceProps.deviceName << "," << deviceProps.driverVersion << "," << runtime << "," << frameCount << "," << frameCount / (runtime / 1000.0) << "\n";
+				result << "device,driverversion,duration (ms),frames,fps,frames in flight,overlap" << "\n";
+				result << deviceProps.deviceName << "," << deviceProps.driverVersion << "," << runtime << "," << frameCount << "," << frameCount / (runtime / 1000.0) << "," << framesInFlight << "," << overlap() << "\n";
 
 				if (outputFrameTimes) {
-					result << "\n" << "frame,ms" << "\n";
+					result << "\n" << "frame,ms,fence wait (ms)" << "\n";
 					for (size_t i = 0; i < frameTimes.size(); i++) {
-						result << i << "," << frameTimes[i] << "\n";
+						result << i << "," << frameTimes[i] << "," << fenceWaitTimes[i] << "\n";
 					}
 					double tMin = *std::min_element(frameTimes.begin(), frameTimes.end());
 					double tMax = *std::max_element(frameTimes.begin(), frameTimes.end());
@@ -14,6 +14,8 @@
 
 #include "main.h"
 
+#include <random>
+
 VulkanPathTracer::VulkanPathTracer() : VulkanApplication()
 {
 	title = "Hardware accelerated path tracing";
@@ -53,16 +55,331 @@ VulkanPathTracer::VulkanPathTracer() : VulkanApplication()
 	// Descriptor indexing
 	enabledDescriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
 	enabledDescriptorIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+	enabledDescriptorIndexingFeatures.descriptorBindingVariableDescriptorCount = VK_TRUE;
+	enabledDescriptorIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
 	enabledDescriptorIndexingFeatures.pNext = &enabledAccelerationStructureFeatures;
-	deviceCreatepNextChain = &enabledDescriptorIndexingFeatures;
+	// Timeline semaphores for tracking background uploads
+	enabledTimelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+	enabledTimelineSemaphoreFeatures.timelineSemaphore = VK_TRUE;
+	enabledTimelineSemaphoreFeatures.pNext = &enabledDescriptorIndexingFeatures;
+	deviceCreatepNextChain = &enabledTimelineSemaphoreFeatures;
+	// Background uploads use a dedicated transfer queue if the device has one
+	requestedQueueTypes |= VK_QUEUE_TRANSFER_BIT;
+
+	// Parse path tracer specific command line arguments
+	char* numConvPtr;
+	for (size_t i = 0; i < args.size(); i++) {
+		// Memory budget for acceleration structure build scratch memory (in MB)
+		if (args[i] == std::string("--scratchbudget")) {
+			if (args.size() > i + 1) {
+				uint32_t num = strtol(args[i + 1], &numConvPtr, 10);
+				if ((numConvPtr != args[i + 1]) && (num > 0)) {
+					options.scratchBudget = num;
+				} else {
+					std::cerr << "Scratch memory budget must be specified as a number (in MB) greater than zero!" << "\n";
+				}
+			}
+		}
+		// Compact bottom level acceleration structures
+		if (args[i] == std::string("--compact")) {
+			options.compactBLAS = true;
+		}
+		// Acceleration structure cache, only written to an explicitly given directory
+		if ((args[i] == std::string("--ascache")) && (args.size() > i + 1)) {
+			options.accelerationStructureCache = true;
+			options.accelerationStructureCachePath = args[i + 1];
+		}
+		// Build bottom level acceleration structures on the host
+		if (args[i] == std::string("--hostbuild")) {
+			options.hostBuild = true;
+		}
+		// Per-triangle alpha classification
+		if (args[i] == std::string("--alphaclassify")) {
+			options.classifyAlpha = true;
+		}
+		// Compact vertex layout
+		if (args[i] == std::string("--compactvertices")) {
+			options.compactVertices = true;
+		}
+		// Instanced meshes
+		if (args[i] == std::string("--instanced")) {
+			options.instanced = true;
+		}
+		// Animated scene with per-frame top level acceleration structure refits
+		if (args[i] == std::string("--dynamic")) {
+			options.dynamic = true;
+			options.instanced = true;
+		}
+		// Bottom level build flag autotuning
+		if (args[i] == std::string("--autotune")) {
+			options.autotune = true;
+		}
+		if (args[i] == std::string("--autotuneframes")) {
+			if (args.size() > i + 1) {
+				uint32_t num = strtol(args[i + 1], &numConvPtr, 10);
+				if ((numConvPtr != args[i + 1]) && (num > 0)) {
+					options.autotuneFrames = num;
+				} else {
+					std::cerr << "Autotune frame count must be specified as a number greater than zero!" << "\n";
+				}
+			}
+		}
+		if (args[i] == std::string("--nobuildprofile")) {
+			options.buildProfile = false;
+		}
+		// Per instance levels of detail
+		if (args[i] == std::string("--lod")) {
+			options.lod = true;
+			options.instanced = true;
+		}
+		if ((args[i] == std::string("--lodscreensize")) && (args.size() > i + 1)) {
+			float size = strtof(args[i + 1], &numConvPtr);
+			if ((numConvPtr != args[i + 1]) && (size > 0.0f)) {
+				options.lodScreenSize = size;
+			} else {
+				std::cerr << "Level of detail screen size must be specified as a number of pixels greater than zero!" << "\n";
+			}
+		}
+		// Out-of-core geometry streaming
+		if (args[i] == std::string("--streaming")) {
+			options.streaming = true;
+		}
+		if (args[i] == std::string("--streamingbudget")) {
+			if (args.size() > i + 1) {
+				uint32_t num = strtol(args[i + 1], &numConvPtr, 10);
+				if ((numConvPtr != args[i + 1]) && (num > 0)) {
+					options.streamingBudget = num;
+				} else {
+					std::cerr << "Streaming heap size must be specified as a number (in MB) greater than zero!" << "\n";
+				}
+			}
+		}
+		if (args[i] == std::string("--chunktriangles")) {
+			if (args.size() > i + 1) {
+				uint32_t num = strtol(args[i + 1], &numConvPtr, 10);
+				if ((numConvPtr != args[i + 1]) && (num > 0)) {
+					options.streamingChunkTriangles = num;
+				} else {
+					std::cerr << "Triangles per chunk must be specified as a number greater than zero!" << "\n";
+				}
+			}
+		}
+		// Synthetic scene for testing streaming with more geometry than fits into the heap
+		if (args[i] == std::string("--streamingcopies")) {
+			if (args.size() > i + 1) {
+				uint32_t num = strtol(args[i + 1], &numConvPtr, 10);
+				if ((numConvPtr != args[i + 1]) && (num > 0)) {
+					options.streamingCopies = num;
+					options.streaming = true;
+				} else {
+					std::cerr << "Number of scene copies must be specified as a number greater than zero!" << "\n";
+				}
+			}
+		}
+		if (args[i] == std::string("--tlasrebuild")) {
+			if (args.size() > i + 1) {
+				uint32_t num = strtol(args[i + 1], &numConvPtr, 10);
+				if (numConvPtr != args[i + 1]) {
+					options.tlasRebuildInterval = num;
+				} else {
+					std::cerr << "Top level acceleration structure rebuild interval must be specified as a number of frames!" << "\n";
+				}
+			}
+		}
+		// Instances scattered over the scene by a compute shader
+		if (args[i] == std::string("--scatter")) {
+			if (args.size() > i + 1) {
+				uint32_t num = strtol(args[i + 1], &numConvPtr, 10);
+				if (numConvPtr != args[i + 1]) {
+					options.scatterCount = num;
+				} else {
+					std::cerr << "Number of scattered instances must be specified as a number!" << "\n";
+				}
+			}
+		}
+		if (args[i] == std::string("--scatterseed")) {
+			if (args.size() > i + 1) {
+				uint32_t num = strtol(args[i + 1], &numConvPtr, 10);
+				if (numConvPtr != args[i + 1]) {
+					options.scatterSeed = num;
+				} else {
+					std::cerr << "Scatter seed must be specified as a number!" << "\n";
+				}
+			}
+		}
+		if (args[i] == std::string("--scatterbenchmark")) {
+			options.scatterBenchmark = true;
+		}
+		// Progressive scene bring-up
+		if (args[i] == std::string("--progressive")) {
+			options.progressive = true;
+		}
+		// Acceleration structure statistics and quality report
+		if (args[i] == std::string("--asreport")) {
+			options.accelerationStructureReport = true;
+		}
+		if ((args[i] == std::string("--asreportfile")) && (args.size() > i + 1)) {
+			options.accelerationStructureReport = true;
+			options.accelerationStructureReportFile = args[i + 1];
+		}
+		// Scene file loading
+		if ((args[i] == std::string("--scene")) && (args.size() > i + 1)) {
+			options.sceneFile = args[i + 1];
+		}
+		if (args[i] == std::string("--nofilemapping")) {
+			options.noFileMapping = true;
+		}
+		if (args[i] == std::string("--syncload")) {
+			options.syncLoading = true;
+		}
+		if (args[i] == std::string("--texturethreads")) {
+			if (args.size() > i + 1) {
+				uint32_t num = strtol(args[i + 1], &numConvPtr, 10);
+				if (numConvPtr != args[i + 1]) {
+					options.textureThreads = num;
+				} else {
+					std::cerr << "Texture thread count must be specified as a number!" << "\n";
+				}
+			}
+		}
+		// Split long and thin triangles
+		if (args[i] == std::string("--presplit")) {
+			options.preSplitTriangles = true;
+		}
+		if ((args[i] == std::string("--splitthreshold")) && (args.size() > i + 1)) {
+			float threshold = strtof(args[i + 1], &numConvPtr);
+			if ((numConvPtr != args[i + 1]) && (threshold > 1.0f)) {
+				vkglTF::splitThreshold = threshold;
+			} else {
+				std::cerr << "Split threshold must be specified as a ratio of bounding box to triangle area greater than one!" << "\n";
+			}
+		}
+	}
+	// Skinned meshes are deformed at full detail only
+	if (options.dynamic && options.lod) {
+		std::cerr << "Levels of detail are not supported for dynamic scenes\n";
+		options.lod = false;
+	}
+	// Refits of dynamic scenes depend on the flags of the initial builds, and both keep the top level acceleration structure's update resources
+	if ((options.dynamic || options.lod) && options.autotune) {
+		std::cerr << "Build flag autotuning is not supported for dynamic scenes or levels of detail\n";
+		options.autotune = false;
+	}
+	// Pre-split geometry is static, while skinned meshes are deformed every frame
+	if (options.dynamic && options.preSplitTriangles) {
+		std::cerr << "Triangle pre-splitting is not supported for dynamic scenes\n";
+		options.preSplitTriangles = false;
+	}
+	// The split geometry stream only covers the full detail triangles, coarser levels would be remapped to the wrong ones
+	if (options.lod && options.preSplitTriangles) {
+		std::cerr << "Triangle pre-splitting is not supported for levels of detail\n";
+		options.preSplitTriangles = false;
+	}
+	// Streamed chunks are built from pre-transformed vertices
+	if (options.streaming && options.instanced) {
+		std::cerr << "Geometry streaming is not supported for instanced, dynamic or level of detail scenes\n";
+		options.streaming = false;
+	}
+	// Chunks are built on the device at runtime from the full vertex layout
+	if (options.streaming && (options.autotune || options.compactVertices || options.preSplitTriangles || options.hostBuild)) {
+		std::cerr << "Build flag autotuning, the compact vertex layout, triangle pre-splitting and host builds are not supported for streamed scenes\n";
+		options.autotune = false;
+		options.compactVertices = false;
+		options.preSplitTriangles = false;
+		options.hostBuild = false;
+	}
+	// Scattered instances are generated once for a top level acceleration structure that is never updated
+	if ((options.scatterCount > 0) && (options.dynamic || options.lod || options.streaming)) {
+		std::cerr << "Scattered instances are only supported for static scenes\n";
+		options.scatterCount = 0;
+	}
+	if ((options.scatterCount == 0) && options.scatterBenchmark) {
+		std::cerr << "The scatter benchmark requires a number of scattered instances\n";
+		options.scatterBenchmark = false;
+	}
+	// Models built in the background are added by activating their instances in the static top level acceleration structure, the other modes replace the instances themselves
+	if (options.progressive && (options.dynamic || options.lod || options.streaming || (options.scatterCount > 0) || options.autotune || options.hostBuild)) {
+		std::cerr << "Progressive bring-up is not supported for dynamic, level of detail, streamed or scattered scenes, build flag autotuning and host builds\n";
+		options.progressive = false;
+	}
+	// Streamed chunks are built at runtime, and progressive bring-up finishes the builds after the report has been written
+	if (options.accelerationStructureReport && (options.streaming || options.progressive)) {
+		std::cerr << "The acceleration structure report is not supported for streamed scenes and progressive bring-up\n";
+		options.accelerationStructureReport = false;
+	}
+	// Skinning reads the joints and weights of the full vertex layout
+	if (options.dynamic && options.compactVertices) {
+		std::cerr << "The compact vertex layout has no joints and weights required for skinning, using the full vertex layout for dynamic scenes\n";
+		options.compactVertices = false;
+	}
 }
 
 VulkanPathTracer::~VulkanPathTracer()
 {
+	// Waits for background builds and cache writes that are still in flight
+	bringUp.pendingModels.clear();
+	bringUp.cache.reset();
+	if (sceneLoading.active) {
+		sceneLoading.threadPool.threads.clear();
+		vkDeviceWaitIdle(device);
+		sceneLoading.pendingModels.clear();
+		vkDestroySemaphore(device, sceneLoading.transferTimeline, nullptr);
+		vkDestroySemaphore(device, sceneLoading.graphicsTimeline, nullptr);
+	}
 	vkDestroyPipeline(device, pipeline, nullptr);
 	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 	ubo.destroy();
+	geometryBuffer.destroy();
+	if (traceStatistics.queryPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(device, traceStatistics.queryPool, nullptr);
+	}
+	if (options.dynamic || options.lod || options.streaming || options.progressive) {
+		vkFreeCommandBuffers(device, cmdPool, static_cast<uint32_t>(dynamicTLAS.commandBuffers.size()), dynamicTLAS.commandBuffers.data());
+		if (dynamicTLAS.queryPool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device, dynamicTLAS.queryPool, nullptr);
+		}
+		dynamicTLAS.instanceBuffer.destroy();
+		dynamicTLAS.scratchBuffer.reset();
+	}
+	geometryStreamer.reset();
+	if (!skinning.meshes.empty()) {
+		vkDestroyPipeline(device, skinning.pipeline, nullptr);
+		vkDestroyPipelineLayout(device, skinning.pipelineLayout, nullptr);
+		for (auto& deformedVertices : skinning.deformedVertices) {
+			deformedVertices.destroy();
+		}
+		skinning.jointBuffer.destroy();
+		skinning.scratchBuffer.reset();
+	}
+	if (scatter.pipeline != VK_NULL_HANDLE) {
+		vkDestroyPipeline(device, scatter.pipeline, nullptr);
+		vkDestroyPipelineLayout(device, scatter.pipelineLayout, nullptr);
+		scatter.prototypeBuffer.destroy();
+		scatter.densityMap.destroy();
+		if (scatter.queryPool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device, scatter.queryPool, nullptr);
+		}
+	}
+}
+
+void VulkanPathTracer::getEnabledFeatures()
+{
+	accelerationStructureFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
+	VkPhysicalDeviceFeatures2 deviceFeatures2{};
+	deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	deviceFeatures2.pNext = &accelerationStructureFeatures;
+	vkGetPhysicalDeviceFeatures2(physicalDevice, &deviceFeatures2);
+
+	// Host builds are optional and only enabled if requested
+	if (options.hostBuild) {
+		if (accelerationStructureFeatures.accelerationStructureHostCommands) {
+			enabledAccelerationStructureFeatures.accelerationStructureHostCommands = VK_TRUE;
+		} else {
+			std::cerr << "Device does not support building acceleration structures on the host, falling back to device builds\n";
+			options.hostBuild = false;
+		}
+	}
 }
 
 uint64_t VulkanPathTracer::getBufferDeviceAddress(VkBuffer buffer)
@@ -73,12 +390,20 @@ uint64_t VulkanPathTracer::getBufferDeviceAddress(VkBuffer buffer)
 	return vkGetBufferDeviceAddressKHR(vulkanDevice->logicalDevice, &bufferDeviceAI);
 }
 
-auto VulkanPathTracer::createBottomLevelAccelerationInstance(uint32_t index)
+// Instance transforms are row-major 3x4 matrices
+static VkTransformMatrixKHR getTransformMatrix(const glm::mat4& transform)
+{
+	VkTransformMatrixKHR transformMatrix{};
+	for (uint32_t row = 0; row < 3; row++) {
+		for (uint32_t col = 0; col < 4; col++) {
+			transformMatrix.matrix[row][col] = transform[col][row];
+		}
+	}
+	return transformMatrix;
+}
+
+auto VulkanPathTracer::createBottomLevelAccelerationInstance(uint32_t index, const glm::mat4& transform)
 {
-	VkTransformMatrixKHR transformMatrix = {
-		1.0f, 0.0f, 0.0f, 0.0f,
-		0.0f, 1.0f, 0.0f, 0.0f,
-		0.0f, 0.0f, 1.0f, 0.0f };
 	AccelerationStructure& blas = bottomLevelAS[index];
 
 	VkAccelerationStructureDeviceAddressInfoKHR accelerationDeviceAddressInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR };
@@ -86,201 +411,1197 @@ auto VulkanPathTracer::createBottomLevelAccelerationInstance(uint32_t index)
 	auto deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(device, &accelerationDeviceAddressInfo);
 
 	VkAccelerationStructureInstanceKHR blasInstance{};
-	blasInstance.transform = transformMatrix;
+	blasInstance.transform = getTransformMatrix(transform);
 	blasInstance.instanceCustomIndex = index;
 	blasInstance.mask = 0xFF;
 	blasInstance.instanceShaderBindingTableRecordOffset = 0;
 	blasInstance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-	blasInstance.accelerationStructureReference = deviceAddress;
+	// Instances of acceleration structures that are still being built in the background are inactive
+	blasInstance.accelerationStructureReference = bringUp.ready[index] ? deviceAddress : 0;
 
 	return blasInstance;
 }
 
-//Create the bottom level acceleration structure contains the scene's actual geometry (vertices, triangles)
-void VulkanPathTracer::createBottomLevelAccelerationStructure(vkglTF::Model& model)
+// Get the geometry description for the bottom level acceleration structure of a model, which contains the scene's actual geometry (vertices, triangles)
+// Each of the model's geometry ranges (one per primitive, or two for classified alpha tested primitives) becomes a separate geometry, opaque ones are flagged so they don't invoke the any-hit shader
+// Indices are relative to the primitive, so the range's first vertex is passed as the build range's vertex offset
+// Host builds source the geometry from the model's host copies instead of it's device buffers
+// If a mesh is passed, only the geometry ranges of that mesh (or of one of it's coarser levels of detail) are used
+AccelerationStructureBuilder::BuildInput VulkanPathTracer::getBottomLevelBuildInput(vkglTF::Model& model, bool hostAddresses, const vkglTF::Mesh* mesh, uint32_t level)
 {
-	VkTransformMatrixKHR transformMatrix = {
-		1.0f, 0.0f, 0.0f, 0.0f,
-		0.0f, 1.0f, 0.0f, 0.0f,
-		0.0f, 0.0f, 1.0f, 0.0f };
-	vks::Buffer transformMatrixBuffer;
-	VK_CHECK_RESULT(vulkanDevice->createBuffer(
-		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		&transformMatrixBuffer,
-		sizeof(VkTransformMatrixKHR),
-		&transformMatrix));
-
-	uint32_t numTriangles = static_cast<uint32_t>(model.indices.count) / 3;
-
 	VkAccelerationStructureGeometryKHR accelerationStructureGeometry = vks::initializers::accelerationStructureGeometryKHR();
-	accelerationStructureGeometry.flags = VK_GEOMETRY_NO_DUPLICATE_ANY_HIT_INVOCATION_BIT_KHR;
 	accelerationStructureGeometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
 	accelerationStructureGeometry.geometry.triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
-	accelerationStructureGeometry.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
-	accelerationStructureGeometry.geometry.triangles.vertexData.deviceAddress = getBufferDeviceAddress(model.vertices.buffer);
+	// With the compact vertex layout the vertex buffer is a tightly packed float3 position stream
+	if (model.compactVertices) {
+		accelerationStructureGeometry.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+		accelerationStructureGeometry.geometry.triangles.vertexStride = sizeof(glm::vec3);
+	} else {
+		accelerationStructureGeometry.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+		accelerationStructureGeometry.geometry.triangles.vertexStride = sizeof(vkglTF::Vertex);
+	}
+	if (hostAddresses) {
+		accelerationStructureGeometry.geometry.triangles.vertexData.hostAddress = model.compactVertices ? static_cast<const void*>(model.hostPositions.data()) : static_cast<const void*>(model.hostVertices.data());
+	} else {
+		accelerationStructureGeometry.geometry.triangles.vertexData.deviceAddress = getBufferDeviceAddress(model.vertices.buffer);
+	}
 	accelerationStructureGeometry.geometry.triangles.maxVertex = model.vertices.count;
-	accelerationStructureGeometry.geometry.triangles.vertexStride = sizeof(vkglTF::Vertex);
-	accelerationStructureGeometry.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32;
-	accelerationStructureGeometry.geometry.triangles.indexData.deviceAddress = getBufferDeviceAddress(model.indices.buffer);
-	accelerationStructureGeometry.geometry.triangles.transformData.deviceAddress = getBufferDeviceAddress(transformMatrixBuffer.buffer);
+	// Host copies of the indices are always 32-bit
+	const VkIndexType indexType = hostAddresses ? VK_INDEX_TYPE_UINT32 : model.indices.type;
+	const uint32_t indexSize = (indexType == VK_INDEX_TYPE_UINT16) ? sizeof(uint16_t) : sizeof(uint32_t);
+	accelerationStructureGeometry.geometry.triangles.indexType = indexType;
+	if (hostAddresses) {
+		accelerationStructureGeometry.geometry.triangles.indexData.hostAddress = model.hostIndices.data();
+	} else {
+		accelerationStructureGeometry.geometry.triangles.indexData.deviceAddress = getBufferDeviceAddress(model.indices.buffer);
+	}
+	// Vertices are already pre-transformed, so no transform is required (identity)
+	accelerationStructureGeometry.geometry.triangles.transformData.deviceAddress = 0;
 	accelerationStructureGeometry.geometry.triangles.transformData.hostAddress = nullptr;
 
+	AccelerationStructureBuilder::BuildInput buildInput{};
+	uint32_t firstGeometryRange = mesh ? mesh->firstGeometryRange : 0;
+	uint32_t geometryRangeCount = mesh ? mesh->geometryRangeCount : static_cast<uint32_t>(model.geometryRanges.size());
+	if (mesh && (level > 0)) {
+		firstGeometryRange = mesh->levelsOfDetail[level - 1].firstGeometryRange;
+		geometryRangeCount = mesh->levelsOfDetail[level - 1].geometryRangeCount;
+	}
+	for (uint32_t r = firstGeometryRange; r < firstGeometryRange + geometryRangeCount; r++) {
+		const vkglTF::Model::GeometryRange& geometryRange = model.geometryRanges[r];
+		accelerationStructureGeometry.flags = geometryRange.opaque ? VK_GEOMETRY_OPAQUE_BIT_KHR : VK_GEOMETRY_NO_DUPLICATE_ANY_HIT_INVOCATION_BIT_KHR;
+		VkAccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo{};
+		accelerationStructureBuildRangeInfo.primitiveCount = geometryRange.indexCount / 3;
+		accelerationStructureBuildRangeInfo.primitiveOffset = geometryRange.firstIndex * indexSize;
+		accelerationStructureBuildRangeInfo.firstVertex = geometryRange.firstVertex;
+		accelerationStructureBuildRangeInfo.transformOffset = 0;
+		if (geometryRange.splitTriangleCount > 0) {
+			// Pre-split geometries are built from the non-indexed split position stream
+			VkAccelerationStructureGeometryKHR splitGeometry = accelerationStructureGeometry;
+			splitGeometry.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+			splitGeometry.geometry.triangles.vertexStride = sizeof(glm::vec3);
+			splitGeometry.geometry.triangles.maxVertex = model.splitGeometry.triangleCount * 3 - 1;
+			splitGeometry.geometry.triangles.indexType = VK_INDEX_TYPE_NONE_KHR;
+			splitGeometry.geometry.triangles.indexData = {};
+			if (hostAddresses) {
+				splitGeometry.geometry.triangles.vertexData.hostAddress = model.hostSplitPositions.data();
+			} else {
+				splitGeometry.geometry.triangles.vertexData.deviceAddress = getBufferDeviceAddress(model.splitGeometry.positions);
+			}
+			accelerationStructureBuildRangeInfo.primitiveCount = geometryRange.splitTriangleCount;
+			accelerationStructureBuildRangeInfo.primitiveOffset = 0;
+			accelerationStructureBuildRangeInfo.firstVertex = geometryRange.firstSplitTriangle * 3;
+			buildInput.geometries.push_back(splitGeometry);
+			buildInput.buildRanges.push_back(accelerationStructureBuildRangeInfo);
+			continue;
+		}
+		buildInput.geometries.push_back(accelerationStructureGeometry);
+		buildInput.buildRanges.push_back(accelerationStructureBuildRangeInfo);
+	}
+	buildInput.flags = bottomLevelBuildFlags;
+	return buildInput;
+}
+
+// Get the model and mesh a bottom level acceleration structure is built from
+vkglTF::Mesh* VulkanPathTracer::getBottomLevelASMesh(const BottomLevelASSource& source)
+{
+	return (source.mesh > -1) ? models[source.model].meshes[source.mesh] : nullptr;
+}
+
+// Create the bottom level acceleration structures for all models (or all unique meshes of all models in instanced mode)
+// All builds are batched into a single submission with scratch memory coming from a pooled allocation
+// If enabled, acceleration structures are restored from the on-disk cache instead of being rebuilt
+void VulkanPathTracer::createBottomLevelAccelerationStructures()
+{
+	AccelerationStructureBuilder builder(vulkanDevice, accelerationStructureProperties);
+	builder.scratchBudget = static_cast<VkDeviceSize>(options.scratchBudget) * 1024 * 1024;
+	builder.hostBuild = options.hostBuild;
+	// The report needs build times and compacted sizes, so all acceleration structures are built and compacted
+	const bool report = options.accelerationStructureReport;
+	const bool useCache = options.accelerationStructureCache && !report;
+	builder.compact = options.compactBLAS || report;
+	builder.measureEachBuild = report;
+	AccelerationStructureCache cache(vulkanDevice, options.accelerationStructureCachePath);
+	bottomLevelASSources.clear();
+	for (uint32_t i = 0; i < static_cast<uint32_t>(models.size()); i++) {
+		if (options.instanced) {
+			for (uint32_t m = 0; m < static_cast<uint32_t>(models[i].meshes.size()); m++) {
+				bottomLevelASSources.push_back({ i, static_cast<int32_t>(m) });
+				// Coarser levels of detail directly follow the mesh's full detail acceleration structure
+				if (options.lod) {
+					for (uint32_t l = 1; l <= static_cast<uint32_t>(models[i].meshes[m]->levelsOfDetail.size()); l++) {
+						bottomLevelASSources.push_back({ i, static_cast<int32_t>(m), l });
+					}
+				}
+			}
+		} else {
+			bottomLevelASSources.push_back({ i, -1 });
+		}
+	}
+	bottomLevelAS.resize(bottomLevelASSources.size());
+	bringUp.ready.assign(bottomLevelASSources.size(), true);
+	bringUp.pendingModels.clear();
+	bringUp.cache.reset();
+	std::vector<uint64_t> cacheKeys(bottomLevelASSources.size());
+	std::vector<size_t> builtModels;
+	for (size_t i = 0; i < bottomLevelASSources.size(); i++) {
+		const BottomLevelASSource& source = bottomLevelASSources[i];
+		AccelerationStructureBuilder::BuildInput buildInput = getBottomLevelBuildInput(models[source.model], options.hostBuild, getBottomLevelASMesh(source), source.level);
+		// Skinned meshes are built from their deformed vertices, so they can be refit every frame
+		for (auto& skinnedMesh : skinning.meshes) {
+			if (skinnedMesh.bottomLevelAS == i) {
+				buildInput = skinnedMesh.buildInput;
+			}
+		}
+		buildInput.name = "Model " + std::to_string(source.model) + ((source.mesh > -1) ? " mesh " + std::to_string(source.mesh) : "") + ((source.level > 0) ? " level " + std::to_string(source.level) : "");
+		// The cache key covers the geometry and everything that affects the build result
+		cacheKeys[i] = vks::tools::hash(&buildInput.flags, sizeof(buildInput.flags), models[source.model].contentHash);
+		cacheKeys[i] = vks::tools::hash(&source.mesh, sizeof(source.mesh), cacheKeys[i]);
+		cacheKeys[i] = vks::tools::hash(&source.level, sizeof(source.level), cacheKeys[i]);
+		cacheKeys[i] = vks::tools::hash(&options.compactBLAS, sizeof(options.compactBLAS), cacheKeys[i]);
+		for (size_t g = 0; g < buildInput.geometries.size(); g++) {
+			cacheKeys[i] = vks::tools::hash(&buildInput.geometries[g].flags, sizeof(VkGeometryFlagsKHR), cacheKeys[i]);
+			cacheKeys[i] = vks::tools::hash(&buildInput.buildRanges[g], sizeof(VkAccelerationStructureBuildRangeInfoKHR), cacheKeys[i]);
+		}
+		if (useCache && cache.load(bottomLevelAS[i], VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, cacheKeys[i], queue)) {
+			std::cout << "Restored bottom level acceleration structure for " << buildInput.name << " from cache\n";
+			continue;
+		}
+		// With progressive bring-up only the first model is built before the first frame, the others get a builder of their own
+		if (options.progressive && (source.model > 0)) {
+			if (bringUp.pendingModels.empty() || (bringUp.pendingModels.back().model != source.model)) {
+				SceneBringUp::PendingModel pendingModel{};
+				pendingModel.model = source.model;
+				pendingModel.builder.reset(new AccelerationStructureBuilder(vulkanDevice, accelerationStructureProperties));
+				pendingModel.builder->scratchBudget = builder.scratchBudget;
+				pendingModel.builder->compact = builder.compact;
+				bringUp.pendingModels.push_back(std::move(pendingModel));
+			}
+			SceneBringUp::PendingModel& pendingModel = bringUp.pendingModels.back();
+			pendingModel.builder->add(bottomLevelAS[i], buildInput);
+			pendingModel.bottomLevelAS.push_back(static_cast<uint32_t>(i));
+			pendingModel.cacheKeys.push_back(cacheKeys[i]);
+			bringUp.ready[i] = false;
+			continue;
+		}
+		builder.add(bottomLevelAS[i], buildInput);
+		builtModels.push_back(i);
+	}
+	builder.build(queue);
+	if (useCache) {
+		for (auto i : builtModels) {
+			cache.store(bottomLevelAS[i], cacheKeys[i], queue);
+		}
+	}
+
+	if (report) {
+		accelerationStructureReport.bottomLevel.clear();
+		for (uint32_t i = 0; i < static_cast<uint32_t>(bottomLevelASSources.size()); i++) {
+			const BottomLevelASSource& source = bottomLevelASSources[i];
+			AccelerationStructureBuilder::BuildInput hostInput = getBottomLevelBuildInput(models[source.model], true, getBottomLevelASMesh(source), source.level);
+			hostInput.name = "Model " + std::to_string(source.model) + ((source.mesh > -1) ? " mesh " + std::to_string(source.mesh) : "") + ((source.level > 0) ? " level " + std::to_string(source.level) : "");
+			accelerationStructureReport.analyzeBottomLevel(i, hostInput);
+		}
+		for (size_t k = 0; k < builtModels.size(); k++) {
+			AccelerationStructureReport::BottomLevel& entry = accelerationStructureReport.bottomLevel[builtModels[k]];
+			entry.size = builder.buildStatistics[k].size;
+			entry.compactedSize = builder.buildStatistics[k].compactedSize;
+			entry.buildTime = builder.buildStatistics[k].buildTime;
+		}
+	}
+
+	// Compare host builds against building the same acceleration structures on the device
+	if (options.hostBuild && !builtModels.empty()) {
+		AccelerationStructureBuilder deviceBuilder(vulkanDevice, accelerationStructureProperties);
+		deviceBuilder.scratchBudget = builder.scratchBudget;
+		std::vector<AccelerationStructure> deviceBuiltAS(builtModels.size());
+		for (size_t i = 0; i < builtModels.size(); i++) {
+			const BottomLevelASSource& source = bottomLevelASSources[builtModels[i]];
+			AccelerationStructureBuilder::BuildInput buildInput = getBottomLevelBuildInput(models[source.model], false, getBottomLevelASMesh(source), source.level);
+			buildInput.name = "Model " + std::to_string(source.model) + ((source.mesh > -1) ? " mesh " + std::to_string(source.mesh) : "") + ((source.level > 0) ? " level " + std::to_string(source.level) : "");
+			deviceBuilder.add(deviceBuiltAS[i], buildInput);
+		}
+		deviceBuilder.build(queue);
+		for (auto& accelerationStructure : deviceBuiltAS) {
+			accelerationStructure.destroy();
+		}
+		std::cout << "Host build: " << builder.buildTime << " ms, device build: " << deviceBuilder.buildTime << " ms (wall clock)\n";
+	}
+}
+
+// The top level acceleration structure contains the scene's object instances
+void VulkanPathTracer::createTopLevelAccelerationStructure()
+{
+	std::vector<VkAccelerationStructureInstanceKHR> blasInstances{};
+	if (options.instanced) {
+		// One instance per node with a mesh, FlipY is applied through the instance transforms as vertices are not pre-transformed
+		const glm::mat4 flipY = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f, -1.0f, 1.0f));
+		uint64_t uniqueTriangleCount = 0;
+		dynamicTLAS.nodes.clear();
+		levelOfDetail.instances.clear();
+		uint64_t instancedTriangleCount = 0;
+		// Full detail acceleration structure of every unique mesh
+		std::vector<std::vector<uint32_t>> meshBLAS(models.size());
+		for (uint32_t i = 0; i < static_cast<uint32_t>(bottomLevelASSources.size()); i++) {
+			if (bottomLevelASSources[i].level == 0) {
+				meshBLAS[bottomLevelASSources[i].model].push_back(i);
+			}
+		}
+		for (uint32_t m = 0; m < static_cast<uint32_t>(models.size()); m++) {
+			vkglTF::Model& model = models[m];
+			for (auto mesh : model.meshes) {
+				for (uint32_t r = mesh->firstGeometryRange; r < mesh->firstGeometryRange + mesh->geometryRangeCount; r++) {
+					uniqueTriangleCount += model.geometryRanges[r].indexCount / 3;
+				}
+			}
+			for (auto node : model.linearNodes) {
+				if (node->mesh) {
+					const uint32_t blasIndex = meshBLAS[m][node->mesh->index];
+					const uint32_t levelCount = options.lod ? static_cast<uint32_t>(node->mesh->levelsOfDetail.size()) : 0;
+					// The second instance of a multi level mesh is only visible during transitions, both are set up by the level of detail selection
+					if (levelCount > 0) {
+						levelOfDetail.instances.push_back({ node, blasIndex, levelCount, static_cast<uint32_t>(blasInstances.size()) });
+						blasInstances.push_back(createBottomLevelAccelerationInstance(blasIndex, flipY * node->getMatrix()));
+						dynamicTLAS.nodes.push_back(node);
+					}
+					blasInstances.push_back(createBottomLevelAccelerationInstance(blasIndex, flipY * node->getMatrix()));
+					dynamicTLAS.nodes.push_back(node);
+					for (uint32_t r = node->mesh->firstGeometryRange; r < node->mesh->firstGeometryRange + node->mesh->geometryRangeCount; r++) {
+						instancedTriangleCount += model.geometryRanges[r].indexCount / 3;
+					}
+				}
+			}
+		}
+		VkDeviceSize bottomLevelASSize = 0;
+		levelOfDetail.fullDetailSize = 0;
+		levelOfDetail.coarseSize = 0;
+		for (size_t i = 0; i < bottomLevelAS.size(); i++) {
+			bottomLevelASSize += bottomLevelAS[i].size;
+			if (bottomLevelASSources[i].level == 0) {
+				levelOfDetail.fullDetailSize += bottomLevelAS[i].size;
+			} else {
+				levelOfDetail.coarseSize += bottomLevelAS[i].size;
+			}
+		}
+		std::cout << "Instanced scene: " << blasInstances.size() << " instances of " << bottomLevelAS.size() << " bottom level acceleration structures (" << bottomLevelASSize / 1024 << " KB), "
+			<< uniqueTriangleCount << " unique triangles for " << instancedTriangleCount << " triangles in the scene\n";
+		if (options.lod) {
+			std::cout << "Levels of detail: " << levelOfDetail.instances.size() << " instances with coarser levels, " << levelOfDetail.coarseSize / 1024 << " KB of coarser bottom level acceleration structures in addition to "
+				<< levelOfDetail.fullDetailSize / 1024 << " KB at full detail\n";
+		}
+	} else {
+		for (uint32_t i = 0; i < bottomLevelAS.size(); i++) {
+			blasInstances.push_back(createBottomLevelAccelerationInstance(i));
+		}
+	}
+
+	// Buffer for instance data
+	// Dynamic scenes keep it mapped with one slice per frame in flight, so the CPU can write the next frame's transforms while the GPU still reads the previous ones
+	// Level of detail selection changes instances in the same way, and streamed scenes add and remove instances as chunks are paged in and out
+	const bool updatable = options.dynamic || options.lod || options.streaming || options.progressive;
+	vks::Buffer instancesBuffer;
+	const VkDeviceSize instancesSize = sizeof(VkAccelerationStructureInstanceKHR) * blasInstances.size();
+	// Scattered instances are generated on the device behind the scene's instances, which are copied into the same device local buffer
+	const uint32_t scatterCount = updatable ? 0 : options.scatterCount;
+	vks::Buffer scatterInstancesBuffer;
+	// Streamed scenes start without any resident chunks, but are sized for all of them
+	const uint32_t maxInstanceCount = options.streaming ? static_cast<uint32_t>(geometryStreamer->chunks.size()) : static_cast<uint32_t>(blasInstances.size()) + scatterCount;
+	if (updatable) {
+		dynamicTLAS.instances = blasInstances;
+		if (options.lod) {
+			selectLevelsOfDetail();
+		}
+		dynamicTLAS.instanceSliceSize = vks::tools::alignedVkSize(sizeof(VkAccelerationStructureInstanceKHR) * std::max(maxInstanceCount, 1u), 16);
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&dynamicTLAS.instanceBuffer,
+			dynamicTLAS.instanceSliceSize * settings.maxFramesInFlight));
+		VK_CHECK_RESULT(dynamicTLAS.instanceBuffer.map());
+		memcpy(dynamicTLAS.instanceBuffer.mapped, dynamicTLAS.instances.data(), instancesSize);
+	} else {
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&instancesBuffer,
+			instancesSize,
+			blasInstances.data()));
+		if (scatterCount > 0) {
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(
+				VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				&scatterInstancesBuffer,
+				sizeof(VkAccelerationStructureInstanceKHR) * maxInstanceCount));
+		}
+	}
+
+	VkDeviceOrHostAddressConstKHR instanceDataDeviceAddress{};
+	if (updatable) {
+		instanceDataDeviceAddress.deviceAddress = getBufferDeviceAddress(dynamicTLAS.instanceBuffer.buffer);
+	} else {
+		instanceDataDeviceAddress.deviceAddress = getBufferDeviceAddress((scatterCount > 0) ? scatterInstancesBuffer.buffer : instancesBuffer.buffer);
+	}
+
+	VkAccelerationStructureGeometryKHR accelerationStructureGeometry = vks::initializers::accelerationStructureGeometryKHR();
+	accelerationStructureGeometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+	accelerationStructureGeometry.flags = VK_GEOMETRY_NO_DUPLICATE_ANY_HIT_INVOCATION_BIT_KHR;
+	accelerationStructureGeometry.geometry.instances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+	accelerationStructureGeometry.geometry.instances.arrayOfPointers = VK_FALSE;
+	accelerationStructureGeometry.geometry.instances.data = instanceDataDeviceAddress;
+
 	// Get size info
 	VkAccelerationStructureBuildGeometryInfoKHR accelerationStructureBuildGeometryInfo = vks::initializers::accelerationStructureBuildGeometryInfoKHR();
-	accelerationStructureBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+	accelerationStructureBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
 	accelerationStructureBuildGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+	if (updatable) {
+		accelerationStructureBuildGeometryInfo.flags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+	}
 	accelerationStructureBuildGeometryInfo.geometryCount = 1;
 	accelerationStructureBuildGeometryInfo.pGeometries = &accelerationStructureGeometry;
 
+	uint32_t primitive_count = maxInstanceCount;
+
 	VkAccelerationStructureBuildSizesInfoKHR accelerationStructureBuildSizesInfo = vks::initializers::accelerationStructureBuildSizesInfoKHR();
 	vkGetAccelerationStructureBuildSizesKHR(
 		device,
 		VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
 		&accelerationStructureBuildGeometryInfo,
-		&numTriangles,
+		&primitive_count,
 		&accelerationStructureBuildSizesInfo);
 
-	AccelerationStructure blas;
-	blas.create(vulkanDevice, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, accelerationStructureBuildSizesInfo);
+	topLevelAS.create(vulkanDevice, VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR, accelerationStructureBuildSizesInfo);
 
-	// Create a small scratch buffer used during build of the bottom level acceleration structure
-	ScratchBuffer scratchBuffer(vulkanDevice, accelerationStructureBuildSizesInfo.buildScratchSize);
+	// Create a small scratch buffer used during build of the top level acceleration structure
+	// Dynamic scenes keep it for the per-frame updates, which may need a different amount of scratch memory than full builds
+	VkDeviceSize scratchSize = accelerationStructureBuildSizesInfo.buildScratchSize;
+	if (updatable) {
+		scratchSize = std::max(scratchSize, accelerationStructureBuildSizesInfo.updateScratchSize);
+	}
+	std::unique_ptr<ScratchBuffer> scratchBuffer(new ScratchBuffer(vulkanDevice, scratchSize));
 
 	VkAccelerationStructureBuildGeometryInfoKHR accelerationBuildGeometryInfo = vks::initializers::accelerationStructureBuildGeometryInfoKHR();
-	accelerationBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-	accelerationBuildGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+	accelerationBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+	accelerationBuildGeometryInfo.flags = accelerationStructureBuildGeometryInfo.flags;
 	accelerationBuildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
-	accelerationBuildGeometryInfo.dstAccelerationStructure = blas.handle;
+	accelerationBuildGeometryInfo.dstAccelerationStructure = topLevelAS.handle;
 	accelerationBuildGeometryInfo.geometryCount = 1;
 	accelerationBuildGeometryInfo.pGeometries = &accelerationStructureGeometry;
-	accelerationBuildGeometryInfo.scratchData.deviceAddress = scratchBuffer.deviceAddress;
+	accelerationBuildGeometryInfo.scratchData.deviceAddress = scratchBuffer->deviceAddress;
 
 	VkAccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo{};
-	accelerationStructureBuildRangeInfo.primitiveCount = numTriangles;
+	accelerationStructureBuildRangeInfo.primitiveCount = static_cast<uint32_t>(blasInstances.size()) + scatterCount;
 	accelerationStructureBuildRangeInfo.primitiveOffset = 0;
 	accelerationStructureBuildRangeInfo.firstVertex = 0;
 	accelerationStructureBuildRangeInfo.transformOffset = 0;
 	std::vector<VkAccelerationStructureBuildRangeInfoKHR*> accelerationBuildStructureRangeInfos = { &accelerationStructureBuildRangeInfo };
 
-	if (accelerationStructureFeatures.accelerationStructureHostCommands)
-	{
-		// Implementation supports building acceleration structure building on host
-		vkBuildAccelerationStructuresKHR(
-			device,
-			VK_NULL_HANDLE,
-			1,
-			&accelerationBuildGeometryInfo,
-			accelerationBuildStructureRangeInfos.data());
-	}
-	else
-	{
-		// Acceleration structure needs to be build on the device
-		VkCommandBuffer commandBuffer = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-		vkCmdBuildAccelerationStructuresKHR(
+	// The top level acceleration structure is always built on the device, as the instance data references the bottom level acceleration structures by their device addresses
+	auto tStart = std::chrono::high_resolution_clock::now();
+	VkCommandBuffer commandBuffer = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	if (scatterCount > 0) {
+		if (instancesSize > 0) {
+			VkBufferCopy copyRegion{ 0, 0, instancesSize };
+			vkCmdCopyBuffer(commandBuffer, instancesBuffer.buffer, scatterInstancesBuffer.buffer, 1, &copyRegion);
+		}
+		recordScatter(commandBuffer, scatterInstancesBuffer, static_cast<uint32_t>(blasInstances.size()), scatterCount);
+		VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	}
+	vkCmdBuildAccelerationStructuresKHR(
+		commandBuffer,
+		1,
+		&accelerationBuildGeometryInfo,
+		accelerationBuildStructureRangeInfos.data());
+	if ((scatterCount > 0) && (scatter.queryPool != VK_NULL_HANDLE)) {
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, scatter.queryPool, 2);
+	}
+	vulkanDevice->flushCommandBuffer(commandBuffer, queue);
+	if (options.accelerationStructureReport) {
+		const double buildTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+		accelerationStructureReport.analyzeTopLevel(blasInstances, topLevelAS.size, buildTime);
+	}
+
+	if (!updatable) {
+		if (scatterCount > 0) {
+			std::cout << "Scattered instances: " << scatterCount << " generated on the device, " << blasInstances.size() + scatterCount << " instances in the top level acceleration structure (" << topLevelAS.size / 1024 << " KB)";
+			uint64_t timestamps[3];
+			if ((scatter.queryPool != VK_NULL_HANDLE) && (vkGetQueryPoolResults(device, scatter.queryPool, 0, 3, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) == VK_SUCCESS)) {
+				const double timestampPeriod = vulkanDevice->properties.limits.timestampPeriod / 1000000.0;
+				std::cout << std::fixed << std::setprecision(3) << ", generation " << (double)(timestamps[1] - timestamps[0]) * timestampPeriod << " ms, build " << (double)(timestamps[2] - timestamps[1]) * timestampPeriod << " ms" << std::defaultfloat;
+			}
+			std::cout << "\n";
+			scatterInstancesBuffer.destroy();
+		}
+		instancesBuffer.destroy();
+		return;
+	}
+
+	dynamicTLAS.scratchBuffer = std::move(scratchBuffer);
+	dynamicTLAS.buildTranslations.resize(dynamicTLAS.nodes.size());
+	for (size_t i = 0; i < dynamicTLAS.nodes.size(); i++) {
+		dynamicTLAS.buildTranslations[i] = glm::vec3(dynamicTLAS.nodes[i]->getMatrix()[3]);
+	}
+	dynamicTLAS.sceneRadius = 0.0f;
+	for (auto& model : models) {
+		dynamicTLAS.sceneRadius = std::max(dynamicTLAS.sceneRadius, model.dimensions.radius);
+	}
+	dynamicTLAS.commandBuffers.resize(settings.maxFramesInFlight);
+	VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(cmdPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, settings.maxFramesInFlight);
+	VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, dynamicTLAS.commandBuffers.data()));
+	dynamicTLAS.pendingUpdates.resize(settings.maxFramesInFlight, DynamicTopLevelAS::UpdateType::None);
+	if (vulkanDevice->properties.limits.timestampComputeAndGraphics) {
+		VkQueryPoolCreateInfo queryPoolCI{};
+		queryPoolCI.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolCI.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolCI.queryCount = settings.maxFramesInFlight * 4;
+		VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolCI, nullptr, &dynamicTLAS.queryPool));
+	}
+	uint32_t animationCount = 0;
+	for (auto& model : models) {
+		animationCount += static_cast<uint32_t>(model.animations.size());
+	}
+	if (options.dynamic && (animationCount == 0)) {
+		std::cout << "Dynamic scene: the scene contains no animations, instance transforms will stay static\n";
+	}
+}
+
+// Select the level of detail of all multi level instances from their projected size and write the selection to the top level acceleration structure's instances
+// Returns true if any instance changed
+bool VulkanPathTracer::selectLevelsOfDetail()
+{
+	const glm::mat4 flipY = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f, -1.0f, 1.0f));
+	const glm::vec3 cameraPosition = glm::vec3(glm::inverse(camera.matrices.view)[3]);
+	// Pixels covered by an object of unit size at unit distance
+	const float pixelScale = static_cast<float>(height) / (2.0f * tan(glm::radians(camera.fov) * 0.5f));
+	const float transitionWidth = glm::clamp(options.lodTransition, 0.01f, 1.0f);
+	bool changed = false;
+	levelOfDetail.histogram.assign(vkglTF::levelOfDetailCount + 1, 0);
+	for (auto& instance : levelOfDetail.instances) {
+		const glm::mat4 transform = flipY * instance.node->getMatrix();
+		const glm::vec3 center = glm::vec3(transform * glm::vec4(instance.node->mesh->center, 1.0f));
+		const float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+		const float radius = instance.node->mesh->radius * scale;
+		const float distance = glm::distance(cameraPosition, center);
+		// Continuous level, every halving of the projected size below the threshold moves one level coarser
+		float level = 0.0f;
+		if (distance > radius) {
+			const float projectedSize = 2.0f * radius / distance * pixelScale;
+			level = glm::clamp(log2(options.lodScreenSize / projectedSize), 0.0f, static_cast<float>(instance.levelCount));
+		}
+		const uint32_t levels[2] = { std::min(static_cast<uint32_t>(level), instance.levelCount), std::min(static_cast<uint32_t>(level) + 1, instance.levelCount) };
+		// At the end of a level's range the next coarser one takes over an increasing number of the mask bits
+		const float transition = glm::clamp((level - floor(level) - (1.0f - transitionWidth)) / transitionWidth, 0.0f, 1.0f);
+		const uint32_t coarseBits = (levels[0] != levels[1]) ? static_cast<uint32_t>(round(transition * 8.0f)) : 0;
+		const uint32_t masks[2] = { 0xFFu >> coarseBits, 0xFFu & ~(0xFFu >> coarseBits) };
+		for (uint32_t i = 0; i < 2; i++) {
+			VkAccelerationStructureInstanceKHR& blasInstance = dynamicTLAS.instances[instance.instance + i];
+			const uint32_t blasIndex = instance.firstBLAS + levels[i];
+			if ((blasInstance.instanceCustomIndex != blasIndex) || (blasInstance.mask != masks[i])) {
+				blasInstance.instanceCustomIndex = blasIndex;
+				blasInstance.accelerationStructureReference = bottomLevelAS[blasIndex].deviceAddress;
+				blasInstance.mask = masks[i];
+				changed = true;
+			}
+			if ((masks[i] != 0) && ((i == 0) || (levels[1] != levels[0]))) {
+				levelOfDetail.histogram[levels[i]]++;
+			}
+		}
+	}
+	return changed;
+}
+
+// Evaluates the scene's animations and records an update of the top level acceleration structure for the current frame in flight
+// Returns the command buffer to be submitted ahead of the frame's ray tracing command buffer, or VK_NULL_HANDLE if neither a static scene's level of detail selection nor it's resident chunks changed
+VkCommandBuffer VulkanPathTracer::updateTopLevelAccelerationStructure()
+{
+	auto tStart = std::chrono::high_resolution_clock::now();
+	// Timestamps are written before skinning, before the skinned bottom level refits, before and after the top level update
+	const uint32_t firstQuery = currentFrame * 4;
+
+	// The fence of this frame in flight has been waited on, so the timestamps of the update previously recorded for it are available
+	if ((dynamicTLAS.queryPool != VK_NULL_HANDLE) && (dynamicTLAS.pendingUpdates[currentFrame] != DynamicTopLevelAS::UpdateType::None)) {
+		uint64_t timestamps[4] = { 0, 0, 0, 0 };
+		if (vkGetQueryPoolResults(device, dynamicTLAS.queryPool, firstQuery, 4, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+			const double timestampPeriod = vulkanDevice->properties.limits.timestampPeriod / 1000000.0;
+			dynamicTLAS.statistics.lastSkinningTime = (double)(timestamps[1] - timestamps[0]) * timestampPeriod;
+			dynamicTLAS.statistics.lastSkinnedRefitTime = (double)(timestamps[2] - timestamps[1]) * timestampPeriod;
+			dynamicTLAS.statistics.skinningTime += dynamicTLAS.statistics.lastSkinningTime;
+			dynamicTLAS.statistics.skinnedRefitTime += dynamicTLAS.statistics.lastSkinnedRefitTime;
+			const double updateTime = (double)(timestamps[3] - timestamps[2]) * timestampPeriod;
+			if (dynamicTLAS.pendingUpdates[currentFrame] == DynamicTopLevelAS::UpdateType::Refit) {
+				dynamicTLAS.statistics.refitTime += updateTime;
+				dynamicTLAS.statistics.lastRefitTime = updateTime;
+			} else {
+				dynamicTLAS.statistics.rebuildTime += updateTime;
+				dynamicTLAS.statistics.lastRebuildTime = updateTime;
+			}
+		}
+	}
+
+	// Advance the first animation of every model, looping over it's time range
+	if (options.dynamic) {
+		dynamicTLAS.animationTime += frameTimer;
+		for (auto& model : models) {
+			if (model.animations.empty()) {
+				continue;
+			}
+			vkglTF::Animation& animation = model.animations[0];
+			const float duration = animation.end - animation.start;
+			if (duration > 0.0f) {
+				model.updateAnimation(0, animation.start + fmod(dynamicTLAS.animationTime, duration));
+			}
+		}
+	}
+	if (!skinning.meshes.empty()) {
+		updateJointMatrices(currentFrame);
+	}
+	// Static scenes only need an update if the level of detail selection or the resident chunks changed
+	const bool levelsOfDetailChanged = options.lod && selectLevelsOfDetail();
+	const bool residencyChanged = options.streaming && updateStreaming();
+	const bool modelAdded = options.progressive && updateBringUp();
+	if (!options.dynamic && !levelsOfDetailChanged && !residencyChanged && !modelAdded) {
+		dynamicTLAS.pendingUpdates[currentFrame] = DynamicTopLevelAS::UpdateType::None;
+		return VK_NULL_HANDLE;
+	}
+
+	// Refits only move the bounds of the existing tree, so quality degrades with the distance instances travel from where they were at the last build
+	const glm::mat4 flipY = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f, -1.0f, 1.0f));
+	float maxDisplacement = 0.0f;
+	for (size_t i = 0; i < dynamicTLAS.nodes.size(); i++) {
+		const glm::mat4 transform = dynamicTLAS.nodes[i]->getMatrix();
+		dynamicTLAS.instances[i].transform = getTransformMatrix(flipY * transform);
+		maxDisplacement = std::max(maxDisplacement, glm::distance(glm::vec3(transform[3]), dynamicTLAS.buildTranslations[i]));
+	}
+	dynamicTLAS.framesSinceRebuild++;
+	// Adding or removing instances always requires a full build
+	const bool rebuild = residencyChanged || modelAdded || ((options.tlasRebuildInterval > 0) && (dynamicTLAS.framesSinceRebuild >= options.tlasRebuildInterval)) || (maxDisplacement > options.tlasRebuildDisplacement * dynamicTLAS.sceneRadius);
+	if (rebuild) {
+		dynamicTLAS.framesSinceRebuild = 0;
+		for (size_t i = 0; i < dynamicTLAS.nodes.size(); i++) {
+			dynamicTLAS.buildTranslations[i] = glm::vec3(dynamicTLAS.nodes[i]->getMatrix()[3]);
+		}
+	}
+
+	const VkDeviceSize instanceOffset = dynamicTLAS.instanceSliceSize * currentFrame;
+	memcpy(static_cast<char*>(dynamicTLAS.instanceBuffer.mapped) + instanceOffset, dynamicTLAS.instances.data(), sizeof(VkAccelerationStructureInstanceKHR) * dynamicTLAS.instances.size());
+
+	VkAccelerationStructureGeometryKHR accelerationStructureGeometry = vks::initializers::accelerationStructureGeometryKHR();
+	accelerationStructureGeometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+	accelerationStructureGeometry.flags = VK_GEOMETRY_NO_DUPLICATE_ANY_HIT_INVOCATION_BIT_KHR;
+	accelerationStructureGeometry.geometry.instances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+	accelerationStructureGeometry.geometry.instances.arrayOfPointers = VK_FALSE;
+	accelerationStructureGeometry.geometry.instances.data.deviceAddress = getBufferDeviceAddress(dynamicTLAS.instanceBuffer.buffer) + instanceOffset;
+
+	VkAccelerationStructureBuildGeometryInfoKHR accelerationBuildGeometryInfo = vks::initializers::accelerationStructureBuildGeometryInfoKHR();
+	accelerationBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+	accelerationBuildGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+	accelerationBuildGeometryInfo.mode = rebuild ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+	accelerationBuildGeometryInfo.srcAccelerationStructure = rebuild ? VK_NULL_HANDLE : topLevelAS.handle;
+	accelerationBuildGeometryInfo.dstAccelerationStructure = topLevelAS.handle;
+	accelerationBuildGeometryInfo.geometryCount = 1;
+	accelerationBuildGeometryInfo.pGeometries = &accelerationStructureGeometry;
+	accelerationBuildGeometryInfo.scratchData.deviceAddress = dynamicTLAS.scratchBuffer->deviceAddress;
+
+	VkAccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo{};
+	accelerationStructureBuildRangeInfo.primitiveCount = static_cast<uint32_t>(dynamicTLAS.instances.size());
+	const VkAccelerationStructureBuildRangeInfoKHR* accelerationBuildStructureRangeInfo = &accelerationStructureBuildRangeInfo;
+
+	VkCommandBuffer commandBuffer = dynamicTLAS.commandBuffers[currentFrame];
+	VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+	cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+
+	// Acceleration structures and deformed vertices are updated in place, so earlier frames in flight must have finished tracing rays against them and the previous update must have released the scratch memory
+	VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+	memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_SHADER_READ_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+	if (dynamicTLAS.queryPool != VK_NULL_HANDLE) {
+		vkCmdResetQueryPool(commandBuffer, dynamicTLAS.queryPool, firstQuery, 4);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dynamicTLAS.queryPool, firstQuery);
+	}
+	if (!skinning.meshes.empty()) {
+		recordSkinning(commandBuffer, currentFrame);
+		// Deformed vertices are read by the bottom level refits and the hit shaders
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	}
+	if (dynamicTLAS.queryPool != VK_NULL_HANDLE) {
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, dynamicTLAS.queryPool, firstQuery + 1);
+	}
+	if (!skinning.meshes.empty()) {
+		recordSkinnedBottomLevelRefits(commandBuffer);
+		// The top level update reads the bounds of the refit bottom level acceleration structures
+		memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+		memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	}
+	// Chunks paged in are uploaded and built ahead of the top level build that adds them
+	if (residencyChanged) {
+		geometryStreamer->record(commandBuffer);
+	}
+	if (dynamicTLAS.queryPool != VK_NULL_HANDLE) {
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, dynamicTLAS.queryPool, firstQuery + 2);
+	}
+	vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &accelerationBuildGeometryInfo, &accelerationBuildStructureRangeInfo);
+	if (dynamicTLAS.queryPool != VK_NULL_HANDLE) {
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, dynamicTLAS.queryPool, firstQuery + 3);
+	}
+
+	// Make the updated acceleration structure visible to the ray tracing shaders of this frame
+	memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+	memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+
+	dynamicTLAS.pendingUpdates[currentFrame] = rebuild ? DynamicTopLevelAS::UpdateType::Rebuild : DynamicTopLevelAS::UpdateType::Refit;
+	DynamicTopLevelAS::Statistics& statistics = dynamicTLAS.statistics;
+	statistics.frameCount++;
+	if (rebuild) {
+		statistics.rebuildCount++;
+	} else {
+		statistics.refitCount++;
+	}
+	statistics.hostTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+
+	// The last update times are shown in the overlay, benchmark runs have no overlay and print the average update cost at regular intervals
+	if (statistics.frameCount == 256) {
+		if (benchmark.active) {
+			std::cout << std::fixed << std::setprecision(3);
+			std::cout << "Top level acceleration structure updates (" << dynamicTLAS.instances.size() << " instances): "
+				<< statistics.refitCount << " refits, " << statistics.rebuildCount << " rebuilds, "
+				<< statistics.hostTime / statistics.frameCount << " ms host time per frame";
+			if (dynamicTLAS.queryPool != VK_NULL_HANDLE) {
+				std::cout << ", device time " << (statistics.refitCount > 0 ? statistics.refitTime / statistics.refitCount : 0.0) << " ms per refit, "
+					<< (statistics.rebuildCount > 0 ? statistics.rebuildTime / statistics.rebuildCount : 0.0) << " ms per rebuild";
+				if (!skinning.meshes.empty()) {
+					std::cout << ", " << statistics.skinningTime / statistics.frameCount << " ms skinning and " << statistics.skinnedRefitTime / statistics.frameCount << " ms refitting " << skinning.meshes.size() << " skinned meshes per frame";
+				}
+			}
+			std::cout << "\n" << std::defaultfloat;
+		}
+		statistics.frameCount = statistics.refitCount = statistics.rebuildCount = 0;
+		statistics.refitTime = statistics.rebuildTime = statistics.skinningTime = statistics.skinnedRefitTime = statistics.hostTime = 0.0;
+	}
+
+	return commandBuffer;
+}
+
+// Submits the background builds of the next model once the previous model's builds have finished
+// Returns true if a model's bottom level acceleration structures have finished, it's instances are activated in that case
+bool VulkanPathTracer::updateBringUp()
+{
+	if (bringUp.cache && bringUp.cache->poll(queue) && bringUp.pendingModels.empty()) {
+		bringUp.cache.reset();
+	}
+	if (bringUp.pendingModels.empty()) {
+		return false;
+	}
+	SceneBringUp::PendingModel& pendingModel = bringUp.pendingModels.front();
+	if (!pendingModel.submitted) {
+		pendingModel.builder->submit(queue);
+		pendingModel.submitted = true;
+		return false;
+	}
+	if (!pendingModel.builder->poll()) {
+		return false;
+	}
+
+	for (size_t i = 0; i < pendingModel.bottomLevelAS.size(); i++) {
+		bringUp.ready[pendingModel.bottomLevelAS[i]] = true;
+		if (options.accelerationStructureCache) {
+			if (!bringUp.cache) {
+				bringUp.cache.reset(new AccelerationStructureCache(vulkanDevice, options.accelerationStructureCachePath));
+			}
+			bringUp.cache->queueStore(bottomLevelAS[pendingModel.bottomLevelAS[i]], pendingModel.cacheKeys[i], queue);
+		}
+	}
+	// Compaction replaces the acceleration structures, so references are taken after the builder has finished
+	for (auto& instance : dynamicTLAS.instances) {
+		if (bringUp.ready[instance.instanceCustomIndex]) {
+			instance.accelerationStructureReference = bottomLevelAS[instance.instanceCustomIndex].deviceAddress;
+		}
+	}
+	const double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTimestamp).count();
+	std::cout << "Model " << pendingModel.model << " added to the scene " << elapsed << " ms after application start\n";
+	bringUp.pendingModels.erase(bringUp.pendingModels.begin());
+	if (bringUp.pendingModels.empty()) {
+		std::cout << "All bottom level acceleration structures ready " << elapsed << " ms after application start\n";
+	}
+	// Samples accumulated without the model don't match the scene anymore
+	resetAccumulation();
+	return true;
+}
+
+// Pages chunks of a streamed scene in and out for the current camera position
+// Returns true if the resident chunks changed, the top level acceleration structure's instances are replaced with the resident ones in that case
+bool VulkanPathTracer::updateStreaming()
+{
+	const glm::vec3 cameraPosition = glm::vec3(glm::inverse(camera.matrices.view)[3]);
+	if (!geometryStreamer->update(cameraPosition, currentFrame)) {
+		return false;
+	}
+	// Chunks can't be paged in again before frames that traced rays against them earlier have finished, so their scene descriptions are updated in place
+	SceneModelInfo* sceneModelInfos = static_cast<SceneModelInfo*>(sceneDescBuffer.mapped);
+	for (uint32_t chunk : geometryStreamer->pagedIn) {
+		sceneModelInfos[chunk].vertices = geometryStreamer->getVertexAddress(chunk);
+		sceneModelInfos[chunk].indices = geometryStreamer->getIndexAddress(chunk);
+	}
+	dynamicTLAS.instances.clear();
+	geometryStreamer->getInstances(dynamicTLAS.instances);
+	// Samples accumulated with the previous set of chunks don't match the scene anymore
+	resetAccumulation();
+	return true;
+}
+
+// Point the scene's descriptor set to the current top level acceleration structure after it has been recreated
+void VulkanPathTracer::updateAccelerationStructureDescriptor()
+{
+	VkWriteDescriptorSetAccelerationStructureKHR descriptorAccelerationStructureInfo = vks::initializers::writeDescriptorSetAccelerationStructureKHR();
+	descriptorAccelerationStructureInfo.accelerationStructureCount = 1;
+	descriptorAccelerationStructureInfo.pAccelerationStructures = &topLevelAS.handle;
+	VkWriteDescriptorSet accelerationStructureWrite{};
+	accelerationStructureWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	accelerationStructureWrite.pNext = &descriptorAccelerationStructureInfo;
+	accelerationStructureWrite.dstSet = scene.descriptorSet;
+	accelerationStructureWrite.dstBinding = 0;
+	accelerationStructureWrite.descriptorCount = 1;
+	accelerationStructureWrite.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+	vkUpdateDescriptorSets(device, 1, &accelerationStructureWrite, 0, VK_NULL_HANDLE);
+}
+
+// Key for the scene's build profile, covering the loaded geometry and all options that change what the bottom level acceleration structures are built from
+uint64_t VulkanPathTracer::getSceneKey()
+{
+	uint64_t key = vks::tools::hash(&options.instanced, sizeof(options.instanced));
+	key = vks::tools::hash(&options.hostBuild, sizeof(options.hostBuild), key);
+	key = vks::tools::hash(&options.compactVertices, sizeof(options.compactVertices), key);
+	key = vks::tools::hash(&options.preSplitTriangles, sizeof(options.preSplitTriangles), key);
+	key = vks::tools::hash(&options.classifyAlpha, sizeof(options.classifyAlpha), key);
+	for (auto& model : models) {
+		key = vks::tools::hash(&model.contentHash, sizeof(model.contentHash), key);
+	}
+	return key;
+}
+
+// Trace a number of frames back to back and return the average device time per frame in milliseconds
+double VulkanPathTracer::traceCalibrationBurst(uint32_t frameCount)
+{
+	VkQueryPoolCreateInfo queryPoolCI{};
+	queryPoolCI.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCI.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolCI.queryCount = 2;
+	VkQueryPool queryPool;
+	VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolCI, nullptr, &queryPool));
+
+	updateUniformBuffers();
+	const uint32_t dynamicOffset = static_cast<uint32_t>(uboSliceSize * currentBuffer);
+	VkStridedDeviceAddressRegionKHR emptySbtEntry = {};
+	VkCommandBuffer commandBuffer = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	vkCmdResetQueryPool(commandBuffer, queryPool, 0, 2);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipelineLayout, 0, 1, &scene.descriptorSet, 1, &dynamicOffset);
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, queryPool, 0);
+	for (uint32_t i = 0; i < frameCount; i++) {
+		// Frames accumulate into the same images, like they do when rendering
+		VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		vkCmdTraceRaysKHR(
 			commandBuffer,
-			1,
-			&accelerationBuildGeometryInfo,
-			accelerationBuildStructureRangeInfos.data());
-		vulkanDevice->flushCommandBuffer(commandBuffer, queue);
+			&shaderBindingTables.raygen.stridedDeviceAddressRegion,
+			&shaderBindingTables.miss.stridedDeviceAddressRegion,
+			&shaderBindingTables.hit.stridedDeviceAddressRegion,
+			&emptySbtEntry,
+			width,
+			height,
+			1);
+	}
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, queryPool, 1);
+	vulkanDevice->flushCommandBuffer(commandBuffer, queue);
+
+	uint64_t timestamps[2] = { 0, 0 };
+	VK_CHECK_RESULT(vkGetQueryPoolResults(device, queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+	vkDestroyQueryPool(device, queryPool, nullptr);
+	return (double)(timestamps[1] - timestamps[0]) * vulkanDevice->properties.limits.timestampPeriod / 1000000.0 / frameCount;
+}
+
+// Build the bottom level acceleration structures with every candidate flag combination and trace a short calibration burst with each
+// The combination with the lowest build time plus the trace time of the expected number of frames is stored as the scene's build profile
+void VulkanPathTracer::autotuneBottomLevelBuildFlags()
+{
+	if (!vulkanDevice->properties.limits.timestampComputeAndGraphics) {
+		std::cerr << "Build flag autotuning requires timestamp support, keeping the default build flags\n";
+		return;
+	}
+	const uint32_t calibrationFrames = 16;
+	std::vector<AccelerationStructureProfile::Measurement> measurements;
+	for (auto& candidate : AccelerationStructureProfile::candidates()) {
+		for (auto& accelerationStructure : bottomLevelAS) {
+			accelerationStructure.destroy();
+		}
+		topLevelAS.destroy();
+
+		// Candidates are always built, as the cache would hide the build cost
+		AccelerationStructureBuilder builder(vulkanDevice, accelerationStructureProperties);
+		builder.scratchBudget = static_cast<VkDeviceSize>(options.scratchBudget) * 1024 * 1024;
+		builder.compact = candidate.compact;
+		builder.hostBuild = options.hostBuild;
+		for (size_t i = 0; i < bottomLevelASSources.size(); i++) {
+			const BottomLevelASSource& source = bottomLevelASSources[i];
+			AccelerationStructureBuilder::BuildInput buildInput = getBottomLevelBuildInput(models[source.model], options.hostBuild, getBottomLevelASMesh(source));
+			buildInput.name = "Model " + std::to_string(source.model) + ((source.mesh > -1) ? " mesh " + std::to_string(source.mesh) : "");
+			buildInput.flags = candidate.flags;
+			builder.add(bottomLevelAS[i], buildInput);
+		}
+		auto tStart = std::chrono::high_resolution_clock::now();
+		builder.build(queue);
+		auto tEnd = std::chrono::high_resolution_clock::now();
+
+		AccelerationStructureProfile::Measurement measurement{};
+		measurement.candidate = candidate;
+		measurement.buildTime = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+		for (auto& accelerationStructure : bottomLevelAS) {
+			measurement.size += accelerationStructure.size;
+		}
+		createTopLevelAccelerationStructure();
+		updateAccelerationStructureDescriptor();
+		measurement.traceTime = traceCalibrationBurst(calibrationFrames);
+		measurements.push_back(measurement);
+	}
+
+	AccelerationStructureProfile profile(vulkanDevice, options.accelerationStructureCachePath);
+	profile.select(measurements, options.autotuneFrames);
+	std::cout << std::fixed << std::setprecision(3) << "Bottom level build flags, cost weighted for " << options.autotuneFrames << " frames:\n";
+	for (auto& measurement : measurements) {
+		std::cout << ((measurement.candidate.name == profile.selected.name) ? "* " : "  ") << measurement.candidate.name << ": build " << measurement.buildTime << " ms, trace "
+			<< measurement.traceTime << " ms/frame, " << measurement.size / 1024 << " KB, cost " << measurement.buildTime + measurement.traceTime * options.autotuneFrames << " ms\n";
+	}
+	std::cout << std::defaultfloat;
+	// Profiles are stored next to the cached acceleration structures
+	if (options.accelerationStructureCache) {
+		profile.store(getSceneKey(), measurements, options.autotuneFrames);
+	}
+
+	// Rebuild with the selected flags through the regular path, so the result also ends up in the acceleration structure cache
+	for (auto& accelerationStructure : bottomLevelAS) {
+		accelerationStructure.destroy();
+	}
+	topLevelAS.destroy();
+	bottomLevelBuildFlags = profile.selected.flags;
+	// Compaction requested on the command line is kept, even if the selected candidate doesn't compact
+	options.compactBLAS = options.compactBLAS || profile.selected.compact;
+	createBottomLevelAccelerationStructures();
+	createTopLevelAccelerationStructure();
+	updateAccelerationStructureDescriptor();
+	resetAccumulation();
+}
+
+// Set up generating scattered instances on the device, they are placed on the ground plane (y = 0) within the horizontal bounds of the scene
+void VulkanPathTracer::createScatter()
+{
+	scatter.areaMin = glm::vec3(FLT_MAX);
+	scatter.areaMax = glm::vec3(-FLT_MAX);
+	for (auto& model : models) {
+		scatter.areaMin = glm::min(scatter.areaMin, model.dimensions.min);
+		scatter.areaMax = glm::max(scatter.areaMax, model.dimensions.max);
+	}
+	scatter.areaMin.y = 0.0f;
+	scatter.areaMax.y = 0.0f;
+
+	// Procedural density map with a sparse base density and a few clusters, so instances are clumped like vegetation
+	std::default_random_engine generator(options.scatterSeed);
+	std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+	struct Cluster {
+		glm::vec2 center;
+		float radius;
+		float strength;
+	};
+	std::vector<Cluster> clusters(16);
+	for (auto& cluster : clusters) {
+		cluster.center = glm::vec2(distribution(generator), distribution(generator));
+		cluster.radius = 0.05f + 0.2f * distribution(generator);
+		cluster.strength = 0.5f + 0.5f * distribution(generator);
+	}
+	std::vector<float> density(scatter.densityMapSize * scatter.densityMapSize);
+	for (uint32_t y = 0; y < scatter.densityMapSize; y++) {
+		for (uint32_t x = 0; x < scatter.densityMapSize; x++) {
+			const glm::vec2 uv = (glm::vec2(x, y) + 0.5f) / static_cast<float>(scatter.densityMapSize);
+			float value = 0.05f;
+			for (auto& cluster : clusters) {
+				const glm::vec2 d = uv - cluster.center;
+				value += cluster.strength * exp(-glm::dot(d, d) / (cluster.radius * cluster.radius));
+			}
+			density[y * scatter.densityMapSize + x] = std::min(value, 1.0f);
+		}
+	}
+	VK_CHECK_RESULT(vulkanDevice->createBuffer(
+		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&scatter.densityMap,
+		density.size() * sizeof(float),
+		density.data()));
+
+	// Every bottom level acceleration structure of the scene is a prototype
+	VK_CHECK_RESULT(vulkanDevice->createBuffer(
+		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&scatter.prototypeBuffer,
+		std::max(bottomLevelAS.size(), size_t(1)) * sizeof(Scatter::Prototype)));
+	VK_CHECK_RESULT(scatter.prototypeBuffer.map());
+
+	if (vulkanDevice->properties.limits.timestampComputeAndGraphics) {
+		VkQueryPoolCreateInfo queryPoolCI{};
+		queryPoolCI.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolCI.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolCI.queryCount = 3;
+		VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolCI, nullptr, &scatter.queryPool));
 	}
 
-	bottomLevelAS.push_back(std::move(blas));
+	// Compute pipeline, all buffers are passed as device addresses via push constants
+	VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, sizeof(Scatter::PushConstants), 0);
+	VkPipelineLayoutCreateInfo pipelineLayoutCI = vks::initializers::pipelineLayoutCreateInfo(0);
+	pipelineLayoutCI.pushConstantRangeCount = 1;
+	pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+	VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &scatter.pipelineLayout));
+	VkComputePipelineCreateInfo computePipelineCI = vks::initializers::computePipelineCreateInfo(scatter.pipelineLayout);
+	computePipelineCI.stage = loadShader(getShadersPath() + "scatter.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+	VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCI, nullptr, &scatter.pipeline));
 }
 
-// The top level acceleration structure contains the scene's object instances
-void VulkanPathTracer::createTopLevelAccelerationStructure()
+// Generate scattered instances into the given range of an instance buffer, the caller has to make them visible to the top level build
+void VulkanPathTracer::recordScatter(VkCommandBuffer commandBuffer, const vks::Buffer& instances, uint32_t firstInstance, uint32_t count)
 {
-	VkTransformMatrixKHR transformMatrix = {
-		1.0f, 0.0f, 0.0f, 0.0f,
-		0.0f, 1.0f, 0.0f, 0.0f,
-		0.0f, 0.0f, 1.0f, 0.0f };
-
-	std::vector<VkAccelerationStructureInstanceKHR> blasInstances{};
-	for (uint32_t i = 0; i < bottomLevelAS.size(); i++) {
-		blasInstances.push_back(createBottomLevelAccelerationInstance(i));
+	// Prototypes are written for every build, as bottom level acceleration structures may have been rebuilt since the last one
+	Scatter::Prototype* prototypes = static_cast<Scatter::Prototype*>(scatter.prototypeBuffer.mapped);
+	for (uint32_t i = 0; i < static_cast<uint32_t>(bottomLevelAS.size()); i++) {
+		prototypes[i] = { bottomLevelAS[i].deviceAddress, i, 0 };
 	}
 
-	// Buffer for instance data
-	vks::Buffer instancesBuffer;
-	VK_CHECK_RESULT(vulkanDevice->createBuffer(
-		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		&instancesBuffer,
-		sizeof(VkAccelerationStructureInstanceKHR) * blasInstances.size(),
-		blasInstances.data()));
-
-	VkDeviceOrHostAddressConstKHR instanceDataDeviceAddress{};
-	instanceDataDeviceAddress.deviceAddress = getBufferDeviceAddress(instancesBuffer.buffer);
+	Scatter::PushConstants pushConstants{};
+	pushConstants.areaMin = glm::vec4(scatter.areaMin, 0.0f);
+	pushConstants.areaMax = glm::vec4(scatter.areaMax, 0.0f);
+	pushConstants.instances = getBufferDeviceAddress(instances.buffer);
+	pushConstants.prototypes = getBufferDeviceAddress(scatter.prototypeBuffer.buffer);
+	pushConstants.densityMap = getBufferDeviceAddress(scatter.densityMap.buffer);
+	pushConstants.scaleRange = glm::vec2(options.scatterScaleMin, options.scatterScaleMax);
+	pushConstants.firstInstance = firstInstance;
+	pushConstants.instanceCount = count;
+	pushConstants.prototypeCount = static_cast<uint32_t>(bottomLevelAS.size());
+	pushConstants.densityMapSize = scatter.densityMapSize;
+	pushConstants.seed = options.scatterSeed;
+	// Vertices of instanced scenes are not pre-transformed, so FlipY is applied through the instance transforms
+	pushConstants.flipY = options.instanced ? 1 : 0;
+
+	if (scatter.queryPool != VK_NULL_HANDLE) {
+		vkCmdResetQueryPool(commandBuffer, scatter.queryPool, 0, 3);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, scatter.queryPool, 0);
+	}
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, scatter.pipeline);
+	vkCmdPushConstants(commandBuffer, scatter.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+	vkCmdDispatch(commandBuffer, (count + 63) / 64, 1, 1);
+	if (scatter.queryPool != VK_NULL_HANDLE) {
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, scatter.queryPool, 1);
+	}
+}
 
-	VkAccelerationStructureGeometryKHR accelerationStructureGeometry = vks::initializers::accelerationStructureGeometryKHR();
-	accelerationStructureGeometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
-	accelerationStructureGeometry.flags = VK_GEOMETRY_NO_DUPLICATE_ANY_HIT_INVOCATION_BIT_KHR;
-	accelerationStructureGeometry.geometry.instances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
-	accelerationStructureGeometry.geometry.instances.arrayOfPointers = VK_FALSE;
-	accelerationStructureGeometry.geometry.instances.data = instanceDataDeviceAddress;
+// Build the top level acceleration structure for an increasing number of scattered instances, up to the requested one
+void VulkanPathTracer::benchmarkScatter()
+{
+	const uint32_t targetCount = options.scatterCount;
+	for (uint32_t count = 1024; count < targetCount; count *= 4) {
+		options.scatterCount = count;
+		createTopLevelAccelerationStructure();
+		topLevelAS.destroy();
+	}
+	options.scatterCount = targetCount;
+}
 
-	// Get size info
-	VkAccelerationStructureBuildGeometryInfoKHR accelerationStructureBuildGeometryInfo = vks::initializers::accelerationStructureBuildGeometryInfoKHR();
-	accelerationStructureBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-	accelerationStructureBuildGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
-	accelerationStructureBuildGeometryInfo.geometryCount = 1;
-	accelerationStructureBuildGeometryInfo.pGeometries = &accelerationStructureGeometry;
+// Find the skinned meshes of all models and set up deforming them on the GPU
+// Called before the bottom level acceleration structures are built, as skinned ones are built from the deformed vertices with ALLOW_UPDATE
+void VulkanPathTracer::createSkinning()
+{
+	uint32_t firstBLAS = 0;
+	uint32_t jointCount = 0;
+	for (uint32_t m = 0; m < static_cast<uint32_t>(models.size()); m++) {
+		vkglTF::Model& model = models[m];
+		for (auto node : model.linearNodes) {
+			if (!node->mesh || !node->skin) {
+				continue;
+			}
+			// Nodes sharing a mesh also share it's bottom level acceleration structure
+			const uint32_t bottomLevelASIndex = firstBLAS + node->mesh->index;
+			if (std::any_of(skinning.meshes.begin(), skinning.meshes.end(), [bottomLevelASIndex](const SkinnedMesh& skinnedMesh) { return skinnedMesh.bottomLevelAS == bottomLevelASIndex; })) {
+				continue;
+			}
+			SkinnedMesh skinnedMesh{};
+			skinnedMesh.model = m;
+			skinnedMesh.bottomLevelAS = bottomLevelASIndex;
+			skinnedMesh.node = node;
+			// Primitives of a mesh are stored back to back in the model's vertex buffer
+			const vkglTF::Mesh* mesh = model.meshes[node->mesh->index];
+			uint32_t lastVertex = 0;
+			skinnedMesh.firstVertex = UINT32_MAX;
+			for (auto primitive : mesh->primitives) {
+				skinnedMesh.firstVertex = std::min(skinnedMesh.firstVertex, primitive->firstVertex);
+				lastVertex = std::max(lastVertex, primitive->firstVertex + primitive->vertexCount);
+			}
+			if (lastVertex == 0) {
+				continue;
+			}
+			skinnedMesh.vertexCount = lastVertex - skinnedMesh.firstVertex;
+			// Joint matrices are taken from the mesh's uniform block, which is limited to 64 joints
+			skinnedMesh.firstJoint = jointCount;
+			skinnedMesh.jointCount = std::min(static_cast<uint32_t>(node->skin->joints.size()), 64u);
+			jointCount += skinnedMesh.jointCount;
+			skinning.meshes.push_back(skinnedMesh);
+		}
+		firstBLAS += static_cast<uint32_t>(model.meshes.size());
+	}
+	if (skinning.meshes.empty()) {
+		return;
+	}
 
-	uint32_t primitive_count = static_cast<uint32_t>(blasInstances.size());
+	// Skinned bottom level acceleration structures are refit on the device every frame
+	if (options.hostBuild) {
+		std::cerr << "Skinned meshes are updated on the device, host builds are disabled for this scene\n";
+		options.hostBuild = false;
+	}
 
-	VkAccelerationStructureBuildSizesInfoKHR accelerationStructureBuildSizesInfo = vks::initializers::accelerationStructureBuildSizesInfoKHR();
-	vkGetAccelerationStructureBuildSizesKHR(
-		device,
-		VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-		&accelerationStructureBuildGeometryInfo,
-		&primitive_count,
-		&accelerationStructureBuildSizesInfo);
+	// The deformed vertex buffers use the same layout and indexing as the model's vertex buffer, so only the buffer address differs for the acceleration structures and the hit shaders
+	VkDeviceSize deformedVerticesSize = 0;
+	skinning.deformedVertices.resize(models.size());
+	for (uint32_t m = 0; m < static_cast<uint32_t>(models.size()); m++) {
+		if (std::none_of(skinning.meshes.begin(), skinning.meshes.end(), [m](const SkinnedMesh& skinnedMesh) { return skinnedMesh.model == m; })) {
+			continue;
+		}
+		const VkDeviceSize size = static_cast<VkDeviceSize>(models[m].vertices.count) * sizeof(vkglTF::Vertex);
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			&skinning.deformedVertices[m],
+			size));
+		deformedVerticesSize += size;
+	}
 
-	topLevelAS.create(vulkanDevice, VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR, accelerationStructureBuildSizesInfo);
+	skinning.jointSliceSize = vks::tools::alignedVkSize(jointCount * sizeof(glm::mat4), 256);
+	VK_CHECK_RESULT(vulkanDevice->createBuffer(
+		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&skinning.jointBuffer,
+		skinning.jointSliceSize * settings.maxFramesInFlight));
+	VK_CHECK_RESULT(skinning.jointBuffer.map());
+	for (uint32_t i = 0; i < settings.maxFramesInFlight; i++) {
+		updateJointMatrices(i);
+	}
 
-	// Create a small scratch buffer used during build of the top level acceleration structure
-	ScratchBuffer scratchBuffer(vulkanDevice, accelerationStructureBuildSizesInfo.buildScratchSize);
+	// Build inputs reading from the deformed vertices, and scratch memory for refitting all of them in one batch
+	const VkDeviceSize scratchAlignment = accelerationStructureProperties.minAccelerationStructureScratchOffsetAlignment;
+	VkDeviceSize scratchSize = 0;
+	for (auto& skinnedMesh : skinning.meshes) {
+		vkglTF::Model& model = models[skinnedMesh.model];
+		skinnedMesh.buildInput = getBottomLevelBuildInput(model, false, model.meshes[skinnedMesh.node->mesh->index]);
+		const uint64_t deformedVerticesAddress = getBufferDeviceAddress(skinning.deformedVertices[skinnedMesh.model].buffer);
+		for (auto& geometry : skinnedMesh.buildInput.geometries) {
+			geometry.geometry.triangles.vertexData.deviceAddress = deformedVerticesAddress;
+		}
+		skinnedMesh.buildInput.flags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+		// Updates must use the flags of the original build, which the builder extends for compaction
+		if (options.compactBLAS) {
+			skinnedMesh.buildInput.flags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+		}
 
-	VkAccelerationStructureBuildGeometryInfoKHR accelerationBuildGeometryInfo = vks::initializers::accelerationStructureBuildGeometryInfoKHR();
-	accelerationBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-	accelerationBuildGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
-	accelerationBuildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
-	accelerationBuildGeometryInfo.dstAccelerationStructure = topLevelAS.handle;
-	accelerationBuildGeometryInfo.geometryCount = 1;
-	accelerationBuildGeometryInfo.pGeometries = &accelerationStructureGeometry;
-	accelerationBuildGeometryInfo.scratchData.deviceAddress = scratchBuffer.deviceAddress;
+		std::vector<uint32_t> primitiveCounts;
+		for (auto& buildRange : skinnedMesh.buildInput.buildRanges) {
+			primitiveCounts.push_back(buildRange.primitiveCount);
+		}
+		VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo = vks::initializers::accelerationStructureBuildGeometryInfoKHR();
+		buildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+		buildGeometryInfo.flags = skinnedMesh.buildInput.flags;
+		buildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+		buildGeometryInfo.geometryCount = static_cast<uint32_t>(skinnedMesh.buildInput.geometries.size());
+		buildGeometryInfo.pGeometries = skinnedMesh.buildInput.geometries.data();
+		VkAccelerationStructureBuildSizesInfoKHR buildSizes = vks::initializers::accelerationStructureBuildSizesInfoKHR();
+		vkGetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildGeometryInfo, primitiveCounts.data(), &buildSizes);
+		skinnedMesh.scratchOffset = scratchSize;
+		scratchSize += vks::tools::alignedVkSize(buildSizes.updateScratchSize, scratchAlignment);
+	}
+	skinning.scratchBuffer.reset(new ScratchBuffer(vulkanDevice, scratchSize + scratchAlignment));
+	skinning.scratchAddress = vks::tools::alignedVkSize(skinning.scratchBuffer->deviceAddress, scratchAlignment);
+
+	// Compute pipeline, all buffers are passed as device addresses via push constants
+	VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, sizeof(Skinning::PushConstants), 0);
+	VkPipelineLayoutCreateInfo pipelineLayoutCI = vks::initializers::pipelineLayoutCreateInfo(0);
+	pipelineLayoutCI.pushConstantRangeCount = 1;
+	pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+	VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &skinning.pipelineLayout));
+	VkComputePipelineCreateInfo computePipelineCI = vks::initializers::computePipelineCreateInfo(skinning.pipelineLayout);
+	computePipelineCI.stage = loadShader(getShadersPath() + "skinning.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+	VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCI, nullptr, &skinning.pipeline));
+
+	// Skin the current pose, so the initial builds use valid vertices
+	VkCommandBuffer commandBuffer = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	recordSkinning(commandBuffer, 0);
+	VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	vulkanDevice->flushCommandBuffer(commandBuffer, queue);
+
+	std::cout << "GPU skinning: " << skinning.meshes.size() << " skinned meshes with " << jointCount << " joints, " << deformedVerticesSize / 1024 << " KB deformed vertices, " << scratchSize / 1024 << " KB refit scratch memory\n";
+}
 
-	VkAccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo{};
-	accelerationStructureBuildRangeInfo.primitiveCount = primitive_count;
-	accelerationStructureBuildRangeInfo.primitiveOffset = 0;
-	accelerationStructureBuildRangeInfo.firstVertex = 0;
-	accelerationStructureBuildRangeInfo.transformOffset = 0;
-	std::vector<VkAccelerationStructureBuildRangeInfoKHR*> accelerationBuildStructureRangeInfos = { &accelerationStructureBuildRangeInfo };
+// Copy the joint matrices of all skinned meshes into the given slice of the joint buffer
+void VulkanPathTracer::updateJointMatrices(uint32_t slice)
+{
+	for (auto& skinnedMesh : skinning.meshes) {
+		char* dst = static_cast<char*>(skinning.jointBuffer.mapped) + skinning.jointSliceSize * slice + skinnedMesh.firstJoint * sizeof(glm::mat4);
+		memcpy(dst, skinnedMesh.node->mesh->uniformBlock.jointMatrix, skinnedMesh.jointCount * sizeof(glm::mat4));
+	}
+}
 
-	if (accelerationStructureFeatures.accelerationStructureHostCommands)
-	{
-		// Implementation supports building acceleration structure building on host
-		vkBuildAccelerationStructuresKHR(
-			device,
-			VK_NULL_HANDLE,
-			1,
-			&accelerationBuildGeometryInfo,
-			accelerationBuildStructureRangeInfos.data());
-	}
-	else
-	{
-		// Acceleration structure needs to be build on the device
-		VkCommandBuffer commandBuffer = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-		vkCmdBuildAccelerationStructuresKHR(
-			commandBuffer,
-			1,
-			&accelerationBuildGeometryInfo,
-			accelerationBuildStructureRangeInfos.data());
-		vulkanDevice->flushCommandBuffer(commandBuffer, queue);
+// Deform the vertices of all skinned meshes with the joint matrices of the given slice
+void VulkanPathTracer::recordSkinning(VkCommandBuffer commandBuffer, uint32_t slice)
+{
+	const uint64_t jointBufferAddress = getBufferDeviceAddress(skinning.jointBuffer.buffer) + skinning.jointSliceSize * slice;
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, skinning.pipeline);
+	for (auto& skinnedMesh : skinning.meshes) {
+		Skinning::PushConstants pushConstants{};
+		pushConstants.vertices = getBufferDeviceAddress(models[skinnedMesh.model].vertices.buffer);
+		pushConstants.deformedVertices = getBufferDeviceAddress(skinning.deformedVertices[skinnedMesh.model].buffer);
+		pushConstants.jointMatrices = jointBufferAddress + skinnedMesh.firstJoint * sizeof(glm::mat4);
+		pushConstants.firstVertex = skinnedMesh.firstVertex;
+		pushConstants.vertexCount = skinnedMesh.vertexCount;
+		vkCmdPushConstants(commandBuffer, skinning.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+		vkCmdDispatch(commandBuffer, (skinnedMesh.vertexCount + 63) / 64, 1, 1);
 	}
+}
 
-	instancesBuffer.destroy();
+// Refit all skinned bottom level acceleration structures to their deformed vertices with a single build command
+void VulkanPathTracer::recordSkinnedBottomLevelRefits(VkCommandBuffer commandBuffer)
+{
+	std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildGeometryInfos(skinning.meshes.size());
+	std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> buildRangeInfos(skinning.meshes.size());
+	for (size_t i = 0; i < skinning.meshes.size(); i++) {
+		const SkinnedMesh& skinnedMesh = skinning.meshes[i];
+		AccelerationStructure& accelerationStructure = bottomLevelAS[skinnedMesh.bottomLevelAS];
+		VkAccelerationStructureBuildGeometryInfoKHR& buildGeometryInfo = buildGeometryInfos[i];
+		buildGeometryInfo = vks::initializers::accelerationStructureBuildGeometryInfoKHR();
+		buildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+		buildGeometryInfo.flags = skinnedMesh.buildInput.flags;
+		buildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+		buildGeometryInfo.srcAccelerationStructure = accelerationStructure.handle;
+		buildGeometryInfo.dstAccelerationStructure = accelerationStructure.handle;
+		buildGeometryInfo.geometryCount = static_cast<uint32_t>(skinnedMesh.buildInput.geometries.size());
+		buildGeometryInfo.pGeometries = skinnedMesh.buildInput.geometries.data();
+		buildGeometryInfo.scratchData.deviceAddress = skinning.scratchAddress + skinnedMesh.scratchOffset;
+		buildRangeInfos[i] = skinnedMesh.buildInput.buildRanges.data();
+	}
+	vkCmdBuildAccelerationStructuresKHR(commandBuffer, static_cast<uint32_t>(buildGeometryInfos.size()), buildGeometryInfos.data(), buildRangeInfos.data());
 }
 
 // Create the Shader Binding Tables that binds the programs and top-level acceleration structure
@@ -310,16 +1631,36 @@ void VulkanPathTracer::createShaderBindingTables() {
 // Create the descriptor sets used for the ray tracing dispatch
 void VulkanPathTracer::createDescriptorSets()
 {
+	std::vector<VkDescriptorImageInfo> imageInfos{};
+	for (auto& model : models) {
+		for (size_t i = 0; i < model.textures.size(); i++) {
+			imageInfos.push_back(model.textures[i].descriptor);
+		}
+	}
+	if (imageInfos.size() > maxTextureDescriptors) {
+		std::cerr << "Scene uses " << imageInfos.size() << " textures, only the first " << maxTextureDescriptors << " will be used\n";
+		imageInfos.resize(maxTextureDescriptors);
+	}
+	const uint32_t textureCount = static_cast<uint32_t>(imageInfos.size());
+
 	std::vector<VkDescriptorPoolSize> poolSizes = {
 		{ VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1 },
 		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2 },
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
-		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 }
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, std::max(textureCount, 1u) }
 	};
 	VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, 1);
 	VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolCreateInfo, nullptr, &descriptorPool));
 
+	// The texture array is sized to the number of textures in the scene
+	VkDescriptorSetVariableDescriptorCountAllocateInfo variableDescriptorCountAllocateInfo{};
+	variableDescriptorCountAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO;
+	variableDescriptorCountAllocateInfo.descriptorSetCount = 1;
+	variableDescriptorCountAllocateInfo.pDescriptorCounts = &textureCount;
+
 	VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayout, 1);
+	descriptorSetAllocateInfo.pNext = &variableDescriptorCountAllocateInfo;
 	VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo, &scene.descriptorSet));
 
 	VkWriteDescriptorSetAccelerationStructureKHR descriptorAccelerationStructureInfo = vks::initializers::writeDescriptorSetAccelerationStructureKHR();
@@ -338,73 +1679,67 @@ void VulkanPathTracer::createDescriptorSets()
 	VkDescriptorImageInfo storageImageDescriptor{ VK_NULL_HANDLE, storageImage.view, VK_IMAGE_LAYOUT_GENERAL };
 	VkDescriptorImageInfo accumImageDescriptor{ VK_NULL_HANDLE, accumulationImage.view, VK_IMAGE_LAYOUT_GENERAL };
 
-	std::vector<VkDescriptorBufferInfo> vBufferInfos(models.size());
-	std::vector<VkDescriptorBufferInfo> iBufferInfos(models.size());
-	for (auto& model : models) {
-		vBufferInfos.push_back({ model.vertices.buffer, 0, VK_WHOLE_SIZE });
-		iBufferInfos.push_back({ model.indices.buffer, 0, VK_WHOLE_SIZE });
-	}
-
 	// Binding points:
 	// 0: Top level acceleration structure
 	// 1: Ray tracing result image
 	// 2: Ray tracing accumulation image
 	// 3: Uniform data
 	// 4: Scene descriptors with buffer device addresses
+	// 5: Scene textures
 
 	std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
 		accelerationStructureWrite,
 		vks::initializers::writeDescriptorSet(scene.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, &storageImageDescriptor),
 		vks::initializers::writeDescriptorSet(scene.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2, &accumImageDescriptor),
-		vks::initializers::writeDescriptorSet(scene.descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3, &ubo.descriptor),
+		vks::initializers::writeDescriptorSet(scene.descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 3, &ubo.descriptor),
 		vks::initializers::writeDescriptorSet(scene.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4, &sceneDescBuffer.descriptor),
 	};
 
-	std::vector<VkDescriptorImageInfo> imageInfos{};
-	if (models[0].textures.size() > 0) {
-		for (auto& model : models) {
-			for (size_t i = 0; i < model.textures.size(); i++) {
-				imageInfos.push_back(model.textures[i].descriptor);
-			}
-			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(scene.descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 5, imageInfos.data(), static_cast<uint32_t>(imageInfos.size())));
-		}
+	if (textureCount > 0) {
+		writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(scene.descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 5, imageInfos.data(), textureCount));
 	}
 	vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, VK_NULL_HANDLE);
 }
 
 // Create our ray tracing pipeline
+// This is called before the scene is loaded, so nothing in here may depend on the scene
+// Pipeline creation is deferred to worker threads, call waitForRayTracingPipeline before using it
 void VulkanPathTracer::createRayTracingPipeline()
 {
 	// Binding points:
 	// 0: Top level acceleration structure
 	// 1: Ray tracing result image
 	// 2: Ray tracing accumulation image
-	// 3: Uniform data
+	// 3: Uniform data (dynamic, one slice per frame)
 	// 4: Scene descriptors with buffer device addresses
-	// 5: Scene textures (optional)
+	// 5: Scene textures (variable count)
+
+	maxTextureDescriptors = std::min({ 4096u, deviceProperties.limits.maxPerStageDescriptorSampledImages, deviceProperties.limits.maxPerStageDescriptorSamplers });
 
 	std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
 		vks::initializers::descriptorSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR),
 		vks::initializers::descriptorSetLayoutBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_RAYGEN_BIT_KHR),
 		vks::initializers::descriptorSetLayoutBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_RAYGEN_BIT_KHR),
-		vks::initializers::descriptorSetLayoutBinding(3, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR),
-		vks::initializers::descriptorSetLayoutBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR, static_cast<uint32_t>(models.size())),
+		vks::initializers::descriptorSetLayoutBinding(3, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR),
+		vks::initializers::descriptorSetLayoutBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR),
+		vks::initializers::descriptorSetLayoutBinding(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR, maxTextureDescriptors),
 	};
-	if (models[0].textures.size() > 0) {
-		uint32_t texCount{ 0 };
-		for (auto& model : models) {
-			texCount += static_cast<uint32_t>(model.textures.size());
-		}
-		setLayoutBindings.push_back(vks::initializers::descriptorSetLayoutBinding(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR, texCount));
-	}
+	// The actual number of textures is only known after loading the scene, so the texture array has a variable size
+	std::vector<VkDescriptorBindingFlags> bindingFlags(setLayoutBindings.size(), 0);
+	bindingFlags[5] = VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+	VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCI{};
+	bindingFlagsCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	bindingFlagsCI.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+	bindingFlagsCI.pBindingFlags = bindingFlags.data();
 	VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+	descriptorSetLayoutCI.pNext = &bindingFlagsCI;
 	VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCI, nullptr, &descriptorSetLayout));
 
 	VkPipelineLayoutCreateInfo pPipelineLayoutCI = vks::initializers::pipelineLayoutCreateInfo(&descriptorSetLayout, 1);
 	VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCI, nullptr, &pipelineLayout));
 
 	// Setup ray tracing shader groups
-	std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+	std::vector<VkPipelineShaderStageCreateInfo>& shaderStages = pipelineCreation.shaderStages;
 
 	// Ray generation group
 	{
@@ -446,18 +1781,54 @@ void VulkanPathTracer::createRayTracingPipeline()
 		shaderGroups.push_back(shaderGroup);
 	}
 
-	VkRayTracingPipelineCreateInfoKHR rayTracingPipelineCI = vks::initializers::rayTracingPipelineCreateInfoKHR();
+	VkRayTracingPipelineCreateInfoKHR& rayTracingPipelineCI = pipelineCreation.createInfo;
+	rayTracingPipelineCI = vks::initializers::rayTracingPipelineCreateInfoKHR();
 	rayTracingPipelineCI.stageCount = static_cast<uint32_t>(shaderStages.size());
 	rayTracingPipelineCI.pStages = shaderStages.data();
 	rayTracingPipelineCI.groupCount = static_cast<uint32_t>(shaderGroups.size());
 	rayTracingPipelineCI.pGroups = shaderGroups.data();
 	rayTracingPipelineCI.maxPipelineRayRecursionDepth = 1;
 	rayTracingPipelineCI.layout = pipelineLayout;
-	VK_CHECK_RESULT(vkCreateRayTracingPipelinesKHR(device, VK_NULL_HANDLE, VK_NULL_HANDLE, 1, &rayTracingPipelineCI, nullptr, &pipeline));
+
+	pipelineCreation.tStart = std::chrono::high_resolution_clock::now();
+	VK_CHECK_RESULT(vkCreateDeferredOperationKHR(device, nullptr, &pipelineCreation.deferredOperation));
+	VkResult result = vkCreateRayTracingPipelinesKHR(device, pipelineCreation.deferredOperation, pipelineCache, 1, &rayTracingPipelineCI, nullptr, &pipeline);
+	if (result == VK_OPERATION_DEFERRED_KHR) {
+		// Join the deferred operation from as many worker threads as the implementation can make use of
+		const uint32_t maxConcurrency = std::max(vkGetDeferredOperationMaxConcurrencyKHR(device, pipelineCreation.deferredOperation), 1u);
+		const uint32_t threadCount = std::min(maxConcurrency, std::max(std::thread::hardware_concurrency(), 1u));
+		pipelineCreation.threadPool.setThreadCount(threadCount);
+		VkDevice logicalDevice = device;
+		VkDeferredOperationKHR deferredOperation = pipelineCreation.deferredOperation;
+		for (auto& thread : pipelineCreation.threadPool.threads) {
+			thread->addJob([logicalDevice, deferredOperation] {
+				while (vkDeferredOperationJoinKHR(logicalDevice, deferredOperation) == VK_THREAD_IDLE_KHR) {
+					std::this_thread::yield();
+				}
+			});
+		}
+	} else if (result != VK_OPERATION_NOT_DEFERRED_KHR) {
+		VK_CHECK_RESULT(result);
+	}
+}
+
+// Wait for the deferred ray tracing pipeline creation to finish
+void VulkanPathTracer::waitForRayTracingPipeline()
+{
+	auto tWaitStart = std::chrono::high_resolution_clock::now();
+	pipelineCreation.threadPool.wait();
+	auto tEnd = std::chrono::high_resolution_clock::now();
+	VK_CHECK_RESULT(vkGetDeferredOperationResultKHR(device, pipelineCreation.deferredOperation));
+	vkDestroyDeferredOperationKHR(device, pipelineCreation.deferredOperation, nullptr);
+	pipelineCreation.deferredOperation = VK_NULL_HANDLE;
+	pipelineCreation.threadPool.threads.clear();
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "Ray tracing pipeline created in " << std::chrono::duration<double, std::milli>(tEnd - pipelineCreation.tStart).count() << " ms, ";
+	std::cout << std::chrono::duration<double, std::milli>(tEnd - tWaitStart).count() << " ms not hidden by scene loading (" << (pipelineCacheLoaded ? "warm" : "cold") << " pipeline cache)\n";
 }
 
 // Create and fill a buffer for passing the glTF materials to the shaders
-void VulkanPathTracer::createMaterialBuffer()
+void VulkanPathTracer::createMaterialBuffer(UploadBatch& uploadBatch)
 {
 	uint32_t textureOffset{ 0 };
 	std::vector<Material> materials;
@@ -468,6 +1839,7 @@ void VulkanPathTracer::createMaterialBuffer()
 			material.baseColorTextureIndex = mat.baseColorTexture ? mat.baseColorTexture->index + textureOffset : -1;
 			material.normalTextureIndex = mat.normalTexture ? mat.normalTexture->index + textureOffset : -1;
 			material.type = MaterialType::Lambertian;
+			material.alphaCutoff = mat.alphaCutoff;
 			if (mat.name == "Light") {
 				material.type = MaterialType::Light;
 			}
@@ -477,22 +1849,24 @@ void VulkanPathTracer::createMaterialBuffer()
 	}
 
 	const VkDeviceSize bufferSize = sizeof(Material) * materials.size();
-	vks::Buffer staging;
-
-	// Stage to VRAM
-	VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &staging, bufferSize, materials.data()));
 	VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &scene.materialBuffer, bufferSize));
-	vulkanDevice->copyBuffer(&staging, &scene.materialBuffer, queue);
-
-	// @todo: destroy staging
+	uploadBatch.copyToBuffer(materials.data(), bufferSize, scene.materialBuffer.buffer);
 }
 
 // Create and fill a uniform buffer for passing camera properties to the shaders
+// The buffer contains one slice per command buffer, so the CPU can update the data for the next frame while the GPU is still reading the previous ones
 void VulkanPathTracer::createUniformBuffer()
 {
-	VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &ubo, sizeof(uniformData), &uniformData));
+	uboSliceSize = vks::tools::alignedSize(static_cast<uint32_t>(sizeof(UniformData)), static_cast<uint32_t>(vulkanDevice->properties.limits.minUniformBufferOffsetAlignment));
+	VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &ubo, uboSliceSize * drawCmdBuffers.size()));
+	// The dynamic offset selects the slice, so the descriptor only covers a single one
+	ubo.setupDescriptor(sizeof(UniformData));
 	VK_CHECK_RESULT(ubo.map());
-	updateUniformBuffers();
+	for (uint32_t i = 0; i < drawCmdBuffers.size(); i++) {
+		currentBuffer = i;
+		updateUniformBuffers();
+	}
+	currentBuffer = 0;
 }
 
 void VulkanPathTracer::createImages()
@@ -506,6 +1880,11 @@ void VulkanPathTracer::handleResize()
 {
 	// Recreate image
 	createImages();
+	// The number of swap chain images may have changed, the query pool is recreated with the command buffers
+	if (traceStatistics.queryPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(device, traceStatistics.queryPool, nullptr);
+		traceStatistics.queryPool = VK_NULL_HANDLE;
+	}
 	// Update descriptor
 	// @todo
 	//VkDescriptorImageInfo storageImageDescriptor{ VK_NULL_HANDLE, storageImage.view, VK_IMAGE_LAYOUT_GENERAL };
@@ -516,73 +1895,106 @@ void VulkanPathTracer::handleResize()
 // Command buffer generation
 void VulkanPathTracer::buildCommandBuffers()
 {
+	// Loading frames are recorded when they are drawn, the scene's images are created at the current size once loading has finished
+	if (sceneLoading.active) {
+		resized = false;
+		return;
+	}
+
 	if (resized)
 	{
 		handleResize();
 	}
 
+	// Two timestamps per command buffer bracket the ray tracing dispatch
+	if ((traceStatistics.queryPool == VK_NULL_HANDLE) && vulkanDevice->properties.limits.timestampComputeAndGraphics) {
+		VkQueryPoolCreateInfo queryPoolCI{};
+		queryPoolCI.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolCI.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolCI.queryCount = static_cast<uint32_t>(drawCmdBuffers.size()) * 2;
+		VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolCI, nullptr, &traceStatistics.queryPool));
+	}
+	traceStatistics.pending.assign(drawCmdBuffers.size(), false);
+
+	for (uint32_t i = 0; i < static_cast<uint32_t>(drawCmdBuffers.size()); i++) {
+		recordCommandBuffer(i);
+	}
+}
+
+// Records the ray tracing commands for a swap chain image, followed by the UI overlay of the current frame in flight
+void VulkanPathTracer::recordCommandBuffer(uint32_t i)
+{
 	VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
 
 	VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
 
 	VkClearValue clearValues[2];
-	VkViewport viewport;
-	VkRect2D scissor;
-
-	for (int32_t i = 0; i < drawCmdBuffers.size(); ++i)
-	{
-		VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
-
-		clearValues[0].color = { { 0.0f, 0.0f, 0.2f, 1.0f } };;
-		clearValues[1].depthStencil = { 1.0f, 0 };
 
-		VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
-		renderPassBeginInfo.renderPass = renderPass;
-		renderPassBeginInfo.framebuffer = frameBuffers[i];
-		renderPassBeginInfo.renderArea.extent.width = width;
-		renderPassBeginInfo.renderArea.extent.height = height;
-		renderPassBeginInfo.clearValueCount = 2;
-		renderPassBeginInfo.pClearValues = clearValues;
+	VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
 
-		VkStridedDeviceAddressRegionKHR emptySbtEntry = {};
+	clearValues[0].color = { { 0.0f, 0.0f, 0.2f, 1.0f } };;
+	clearValues[1].depthStencil = { 1.0f, 0 };
 
-		// Dispatch the ray tracing commands
-		vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipeline);
-		vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipelineLayout, 0, 1, &scene.descriptorSet, 0, 0);
-
-		vkCmdTraceRaysKHR(
-			drawCmdBuffers[i],
-			&shaderBindingTables.raygen.stridedDeviceAddressRegion,
-			&shaderBindingTables.miss.stridedDeviceAddressRegion,
-			&shaderBindingTables.hit.stridedDeviceAddressRegion,
-			&emptySbtEntry,
-			width,
-			height,
-			1);
+	VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
+	renderPassBeginInfo.renderPass = renderPass;
+	renderPassBeginInfo.framebuffer = frameBuffers[i];
+	renderPassBeginInfo.renderArea.extent.width = width;
+	renderPassBeginInfo.renderArea.extent.height = height;
+	renderPassBeginInfo.clearValueCount = 2;
+	renderPassBeginInfo.pClearValues = clearValues;
 
-		// Copy ray tracing output to swap chain image
-		vks::tools::setImageLayout(drawCmdBuffers[i], swapChain.images[i], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
-		vks::tools::setImageLayout(drawCmdBuffers[i], storageImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, subresourceRange);
+	VkStridedDeviceAddressRegionKHR emptySbtEntry = {};
 
-		VkImageCopy copyRegion{};
-		copyRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
-		copyRegion.srcOffset = { 0, 0, 0 };
-		copyRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
-		copyRegion.dstOffset = { 0, 0, 0 };
-		copyRegion.extent = { width, height, 1 };
-		vkCmdCopyImage(drawCmdBuffers[i], storageImage.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, swapChain.images[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+	// With multiple frames in flight, the previous frame may still be writing the accumulation and storage images
+	VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(drawCmdBuffers[i], VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
 
-		vks::tools::setImageLayout(drawCmdBuffers[i], swapChain.images[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, subresourceRange);
-		vks::tools::setImageLayout(drawCmdBuffers[i], storageImage.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, subresourceRange);
+	// Dispatch the ray tracing commands
+	const uint32_t dynamicOffset = static_cast<uint32_t>(uboSliceSize * i);
+	vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipeline);
+	vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipelineLayout, 0, 1, &scene.descriptorSet, 1, &dynamicOffset);
 
-		if (UIOverlay.visible) {
-			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-			drawUI(drawCmdBuffers[i]);
-			vkCmdEndRenderPass(drawCmdBuffers[i]);
-		}
+	if (traceStatistics.queryPool != VK_NULL_HANDLE) {
+		vkCmdResetQueryPool(drawCmdBuffers[i], traceStatistics.queryPool, i * 2, 2);
+		vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, traceStatistics.queryPool, i * 2);
+	}
+	vkCmdTraceRaysKHR(
+		drawCmdBuffers[i],
+		&shaderBindingTables.raygen.stridedDeviceAddressRegion,
+		&shaderBindingTables.miss.stridedDeviceAddressRegion,
+		&shaderBindingTables.hit.stridedDeviceAddressRegion,
+		&emptySbtEntry,
+		width,
+		height,
+		1);
+	if (traceStatistics.queryPool != VK_NULL_HANDLE) {
+		vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, traceStatistics.queryPool, i * 2 + 1);
+	}
 
-		VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
+	// Copy ray tracing output to swap chain image
+	vks::tools::setImageLayout(drawCmdBuffers[i], swapChain.images[i], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
+	vks::tools::setImageLayout(drawCmdBuffers[i], storageImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, subresourceRange);
+
+	VkImageCopy copyRegion{};
+	copyRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+	copyRegion.srcOffset = { 0, 0, 0 };
+	copyRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+	copyRegion.dstOffset = { 0, 0, 0 };
+	copyRegion.extent = { width, height, 1 };
+	vkCmdCopyImage(drawCmdBuffers[i], storageImage.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, swapChain.images[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+	vks::tools::setImageLayout(drawCmdBuffers[i], swapChain.images[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, subresourceRange);
+	vks::tools::setImageLayout(drawCmdBuffers[i], storageImage.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, subresourceRange);
+
+	if (UIOverlay.visible) {
+		vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		drawUI(drawCmdBuffers[i]);
+		vkCmdEndRenderPass(drawCmdBuffers[i]);
 	}
+
+	VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
 }
 
 void VulkanPathTracer::updateUniformBuffers()
@@ -594,106 +2006,420 @@ void VulkanPathTracer::updateUniformBuffers()
 	uniformData.rayBounces = options.rayBounces;
 	uniformData.sky = (options.sky == 1);
 	uniformData.skyIntensity = options.skyIntensity;
-	memcpy(ubo.mapped, &uniformData, sizeof(uniformData));
+	// Only the slice of the current command buffer is updated, others may still be in use by the GPU
+	memcpy(static_cast<char*>(ubo.mapped) + uboSliceSize * currentBuffer, &uniformData, sizeof(uniformData));
+}
+
+// Collect the ray tracing time of the last submission of the current command buffer, whose fence has been waited on in prepareFrame
+// Reported as primary rays per second, as the number of secondary rays depends on the scene
+void VulkanPathTracer::updateTraceStatistics()
+{
+	if (traceStatistics.queryPool == VK_NULL_HANDLE) {
+		return;
+	}
+	if (traceStatistics.pending[currentBuffer]) {
+		uint64_t timestamps[2] = { 0, 0 };
+		if (vkGetQueryPoolResults(device, traceStatistics.queryPool, currentBuffer * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+			traceStatistics.lastTraceTime = (double)(timestamps[1] - timestamps[0]) * vulkanDevice->properties.limits.timestampPeriod / 1000000.0;
+			traceStatistics.traceTime += traceStatistics.lastTraceTime;
+			traceStatistics.frameCount++;
+		}
+	}
+	traceStatistics.pending[currentBuffer] = true;
+	// The last trace time is shown in the overlay, benchmark runs have no overlay and print averages instead
+	if (traceStatistics.frameCount == 256) {
+		if (benchmark.active) {
+			const double traceTime = traceStatistics.traceTime / traceStatistics.frameCount;
+			const double primaryRays = static_cast<double>(width) * height * options.samplesPerFrame;
+			std::cout << std::fixed << std::setprecision(3) << "Ray tracing: " << traceTime << " ms per frame (device), "
+				<< std::setprecision(1) << primaryRays / (traceTime * 1000.0) << " M primary rays/s with " << options.rayBounces << " bounces" << std::defaultfloat;
+			if (options.lod) {
+				std::cout << ", instances per level of detail:";
+				for (auto count : levelOfDetail.histogram) {
+					std::cout << " " << count;
+				}
+			}
+			std::cout << "\n";
+		}
+		traceStatistics.frameCount = 0;
+		traceStatistics.traceTime = 0.0;
+	}
 }
 
 void VulkanPathTracer::prepare()
 {
 	VulkanApplication::prepare();
 
+	// Start creating the ray tracing pipeline, so it overlaps with loading the scene
+	createRayTracingPipeline();
+
 	// Instead of a simple triangle, we'll be loading a more complex scene for this example
 	// The shaders are accessing the vertex and index buffers of the scene, so the proper usage flag has to be set on the vertex and index buffers for the scene
 	vkglTF::memoryPropertyFlags = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-	const uint32_t glTFLoadingFlags = vkglTF::FileLoadingFlags::PreTransformVertices | vkglTF::FileLoadingFlags::FlipY;
+	// In instanced mode vertices are kept in mesh space and node transforms are applied by the top level acceleration structure's instances
+	uint32_t glTFLoadingFlags = options.instanced ? vkglTF::FileLoadingFlags::None : (vkglTF::FileLoadingFlags::PreTransformVertices | vkglTF::FileLoadingFlags::FlipY);
+	// The acceleration structure report estimates the SAH cost from the host copies of the geometry
+	if (options.hostBuild || options.accelerationStructureReport) {
+		glTFLoadingFlags |= vkglTF::FileLoadingFlags::KeepHostGeometry;
+	}
+	if (options.compactVertices) {
+		glTFLoadingFlags |= vkglTF::FileLoadingFlags::CompactVertices;
+	}
+	if (options.preSplitTriangles) {
+		glTFLoadingFlags |= vkglTF::FileLoadingFlags::PreSplitTriangles;
+	}
+	if (options.lod) {
+		glTFLoadingFlags |= vkglTF::FileLoadingFlags::GenerateLevelsOfDetail;
+	}
+	if (options.streaming) {
+		glTFLoadingFlags |= vkglTF::FileLoadingFlags::HostGeometryOnly;
+	}
+	if (options.classifyAlpha) {
+		glTFLoadingFlags |= vkglTF::FileLoadingFlags::ClassifyAlphaTriangles;
+		// The classification is stored next to the cached acceleration structures
+		if (options.accelerationStructureCache) {
+			vkglTF::cacheDirectory = options.accelerationStructureCachePath;
+		}
+	}
 
-	sceneIndex = 3;
+	// A scene file passed on the command line replaces the built-in scenes
+	sceneIndex = options.sceneFile.empty() ? 3 : UINT32_MAX;
+	vkglTF::mapBinaryFiles = !options.noFileMapping;
+	vkglTF::imageDecodeThreadCount = options.textureThreads;
+
+	std::vector<std::string> sceneFiles;
+	if (!options.sceneFile.empty()) {
+		camera.setTranslation(glm::vec3(0.0f, 1.0f, -3.0f));
+		camera.setRotation(glm::vec3(0.0f, 0.0f, 0.0f));
+		sceneFiles = { options.sceneFile };
+	}
 
 	if (sceneIndex == 0) {
 		camera.setRotation(glm::vec3(0.0f, 0.0f, 0.0f));
 		camera.setTranslation(glm::vec3(0.0f, 1.0f, -3.0f));
 		options.sky = false;
-		models.resize(1);
-		models[0].loadFromFile(getAssetPath() + "models/CornellBox-Original.gltf", vulkanDevice, queue, glTFLoadingFlags);
+		sceneFiles = { getAssetPath() + "models/CornellBox-Original.gltf" };
 	}
 
 	if (sceneIndex == 1) {
 		camera.setTranslation(glm::vec3(-9.7f, 0.9f, 0.3f));
 		camera.setRotation(glm::vec3(4.75f, -90.0f, 0.0f));
 		options.skyIntensity = 7.5f;
-		models.resize(1);
-		models[0].loadFromFile(getAssetPath() + "models/sponza/Sponza.gltf", vulkanDevice, queue, glTFLoadingFlags);
+		sceneFiles = { getAssetPath() + "models/sponza/Sponza.gltf" };
 	}
 
 	if (sceneIndex == 2) {
 		camera.setRotation(glm::vec3(-7.5f, -27.25f, 0.0f));
 		camera.setTranslation(glm::vec3(-3.0f, 3.5f, -17.0f));
 		options.skyIntensity = 1.0f;
-		models.resize(1);
-		models[0].loadFromFile(getAssetPath() + "models/picapica/scene.gltf", vulkanDevice, queue, glTFLoadingFlags);
+		sceneFiles = { getAssetPath() + "models/picapica/scene.gltf" };
 	}
 
 	if (sceneIndex == 3) {
 		camera.setTranslation(glm::vec3(-9.7f, 0.9f, 0.3f));
 		camera.setRotation(glm::vec3(4.75f, -90.0f, 0.0f));
 		options.skyIntensity = 7.5f;
-		models.resize(3);
-		models[0].loadFromFile(getAssetPath() + "models/new_sponza/NewSponza_Main_Blender_glTF.gltf", vulkanDevice, queue, glTFLoadingFlags);
-		models[1].loadFromFile(getAssetPath() + "models/new_sponza_curtains/NewSponza_Curtains_glTF.gltf", vulkanDevice, queue, glTFLoadingFlags);
-		models[2].loadFromFile(getAssetPath() + "models/new_sponza_ivy/NewSponza_IvyGrowth_glTF.gltf", vulkanDevice, queue, glTFLoadingFlags);
+		sceneFiles = {
+			getAssetPath() + "models/new_sponza/NewSponza_Main_Blender_glTF.gltf",
+			getAssetPath() + "models/new_sponza_curtains/NewSponza_Curtains_glTF.gltf",
+			getAssetPath() + "models/new_sponza_ivy/NewSponza_IvyGrowth_glTF.gltf"
+		};
 	}
+	models.resize(sceneFiles.size());
 
+	// Benchmarks measure the scene, so they don't start before it has been loaded
+	if (!options.syncLoading && !benchmark.active) {
+		startSceneLoading(sceneFiles, glTFLoadingFlags);
+		prepared = true;
+		return;
+	}
+
+	// Textures, mip chains, geometry and materials of all models are uploaded with as few submissions as the staging threshold allows
+	UploadBatch uploadBatch(vulkanDevice, queue);
+	for (size_t i = 0; i < sceneFiles.size(); i++) {
+		models[i].loadFromFile(sceneFiles[i], vulkanDevice, queue, glTFLoadingFlags, 1.0f, &uploadBatch);
+	}
+	createMaterialBuffer(uploadBatch);
+	// Everything has to be on the device before the acceleration structures are built from it
+	uploadBatch.flush();
+	std::cout << "Uploaded " << std::fixed << std::setprecision(2) << static_cast<double>(uploadBatch.statistics.size) / (1024.0 * 1024.0) << " MB (" << uploadBatch.statistics.imageUploads << " images, "
+		<< uploadBatch.statistics.bufferCopies << " buffers) with " << uploadBatch.statistics.submissions << " submission(s) in " << uploadBatch.statistics.uploadTime << " ms\n" << std::defaultfloat;
+
+	prepareScene();
+	prepared = true;
+}
+
+// Starts loading all models of the scene at once, each on its own worker thread
+// Only the loader threads touch the models until they have been loaded, all queue submissions are done by the main thread in updateSceneLoading
+void VulkanPathTracer::startSceneLoading(const std::vector<std::string>& sceneFiles, uint32_t fileLoadingFlags)
+{
+	sceneLoading.active = true;
+	sceneLoading.tStart = std::chrono::high_resolution_clock::now();
+	const uint32_t transferQueueFamily = vulkanDevice->queueFamilyIndices.transfer;
+	const uint32_t graphicsQueueFamily = vulkanDevice->queueFamilyIndices.graphics;
+	vkGetDeviceQueue(device, transferQueueFamily, 0, &sceneLoading.transferQueue);
+	std::cout << "Loading scene in the background" << ((transferQueueFamily != graphicsQueueFamily) ? " using a dedicated transfer queue" : "") << "\n";
+
+	VkSemaphoreTypeCreateInfo semaphoreTypeCI{};
+	semaphoreTypeCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	semaphoreTypeCI.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	semaphoreTypeCI.initialValue = 0;
+	VkSemaphoreCreateInfo semaphoreCI = vks::initializers::semaphoreCreateInfo();
+	semaphoreCI.pNext = &semaphoreTypeCI;
+	VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCI, nullptr, &sceneLoading.transferTimeline));
+	VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCI, nullptr, &sceneLoading.graphicsTimeline));
+
+	sceneLoading.threadPool.setThreadCount(static_cast<uint32_t>(sceneFiles.size()));
+	for (size_t i = 0; i < sceneFiles.size(); i++) {
+		std::unique_ptr<SceneLoading::PendingModel> pendingModel(new SceneLoading::PendingModel());
+		pendingModel->fileName = sceneFiles[i];
+		pendingModel->uploadBatch.reset(new UploadBatch(vulkanDevice, transferQueueFamily, graphicsQueueFamily));
+		SceneLoading::PendingModel* model = pendingModel.get();
+		sceneLoading.threadPool.threads[i]->addJob([this, i, model, fileLoadingFlags] {
+			models[i].loadFromFile(model->fileName, vulkanDevice, queue, fileLoadingFlags, 1.0f, model->uploadBatch.get());
+			model->uploadBatch->flush();
+			model->loaded = true;
+		});
+		sceneLoading.pendingModels.push_back(std::move(pendingModel));
+	}
+}
+
+// Submits the uploads recorded by the loader threads and finishes preparing the scene once all of them have completed
+void VulkanPathTracer::updateSceneLoading()
+{
+	uint64_t completedValue = 0;
+	VK_CHECK_RESULT(vkGetSemaphoreCounterValue(device, sceneLoading.graphicsTimeline, &completedValue));
+	bool ready = true;
+	for (auto& model : sceneLoading.pendingModels) {
+		if (model->ready) {
+			continue;
+		}
+		// Read before submitting, so the last flush of a loaded model is submitted before its batch can be found empty
+		const bool loaded = model->loaded;
+		model->uploadBatch->submit(sceneLoading.transferQueue, queue, sceneLoading.transferTimeline, sceneLoading.transferTimelineValue, sceneLoading.graphicsTimeline, sceneLoading.graphicsTimelineValue);
+		if (model->uploadBatch->release(completedValue) && loaded) {
+			model->ready = true;
+			const double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - sceneLoading.tStart).count();
+			const UploadBatch::Statistics& statistics = model->uploadBatch->statistics;
+			std::cout << std::fixed << std::setprecision(2) << model->fileName.substr(model->fileName.find_last_of('/') + 1) << " ready after " << elapsed << " ms, uploaded "
+				<< static_cast<double>(statistics.size) / (1024.0 * 1024.0) << " MB (" << statistics.imageUploads << " images, " << statistics.bufferCopies << " buffers) with " << statistics.submissions << " submission(s)\n" << std::defaultfloat;
+		}
+		ready = ready && model->ready;
+	}
+	if (!ready) {
+		return;
+	}
+
+	sceneLoading.threadPool.threads.clear();
+	sceneLoading.pendingModels.clear();
+	vkDestroySemaphore(device, sceneLoading.transferTimeline, nullptr);
+	vkDestroySemaphore(device, sceneLoading.graphicsTimeline, nullptr);
+	sceneLoading.transferTimeline = VK_NULL_HANDLE;
+	sceneLoading.graphicsTimeline = VK_NULL_HANDLE;
+	sceneLoading.active = false;
+	const double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - sceneLoading.tStart).count();
+	std::cout << std::fixed << std::setprecision(2) << "Scene loaded in " << elapsed << " ms, " << sceneLoading.frameCount << " loading frames presented\n" << std::defaultfloat;
+
+	// Earlier loading frames may still be in flight and use the command buffers that are rebuilt for the scene
+	VK_CHECK_RESULT(vkQueueWaitIdle(queue));
+	UploadBatch uploadBatch(vulkanDevice, queue);
+	createMaterialBuffer(uploadBatch);
+	uploadBatch.flush();
+	prepareScene();
+}
+
+// Clears the screen and draws the UI overlay with the loading progress
+void VulkanPathTracer::drawLoadingFrame()
+{
+	VulkanApplication::prepareFrame();
+	VkCommandBuffer commandBuffer = drawCmdBuffers[currentBuffer];
+	VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+	VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+	VkClearValue clearValues[2];
+	clearValues[0].color = { { 0.0f, 0.0f, 0.2f, 1.0f } };
+	clearValues[1].depthStencil = { 1.0f, 0 };
+	VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
+	renderPassBeginInfo.renderPass = renderPass;
+	renderPassBeginInfo.framebuffer = frameBuffers[currentBuffer];
+	renderPassBeginInfo.renderArea.extent.width = width;
+	renderPassBeginInfo.renderArea.extent.height = height;
+	renderPassBeginInfo.clearValueCount = 2;
+	renderPassBeginInfo.pClearValues = clearValues;
+	vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+	// The render pass loads the color attachment, as it's usually drawn on top of the ray traced image
+	VkClearAttachment clearAttachment{};
+	clearAttachment.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	clearAttachment.colorAttachment = 0;
+	clearAttachment.clearValue = clearValues[0];
+	VkClearRect clearRect{};
+	clearRect.rect.extent = { width, height };
+	clearRect.layerCount = 1;
+	vkCmdClearAttachments(commandBuffer, 1, &clearAttachment, 1, &clearRect);
+	if (UIOverlay.visible) {
+		drawUI(commandBuffer);
+	}
+	vkCmdEndRenderPass(commandBuffer);
+	VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, waitFences[currentFrame]));
+	VulkanApplication::submitFrame();
+	sceneLoading.frameCount++;
+}
 
-	// Get ray tracing related properties and features
+// Creates everything that depends on the loaded models, from the acceleration structures to the command buffers
+void VulkanPathTracer::prepareScene()
+{
+	// Get ray tracing related properties (features are read in getEnabledFeatures)
 	rayTracingPipelineProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR;
+	accelerationStructureProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
+	rayTracingPipelineProperties.pNext = &accelerationStructureProperties;
 	VkPhysicalDeviceProperties2 deviceProperties2{};
 	deviceProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
 	deviceProperties2.pNext = &rayTracingPipelineProperties;
 	vkGetPhysicalDeviceProperties2(physicalDevice, &deviceProperties2);
 
-	accelerationStructureFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
-	VkPhysicalDeviceFeatures2 deviceFeatures2{};
-	deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
-	deviceFeatures2.pNext = &accelerationStructureFeatures;
-	vkGetPhysicalDeviceFeatures2(physicalDevice, &deviceFeatures2);
+	// Use the build flags picked by an earlier autotune run for this scene
+	if (options.buildProfile && options.accelerationStructureCache && !options.autotune) {
+		AccelerationStructureProfile profile(vulkanDevice, options.accelerationStructureCachePath);
+		if (profile.load(getSceneKey())) {
+			bottomLevelBuildFlags = profile.selected.flags;
+			// Compaction requested on the command line is kept, even if the profile doesn't compact
+			options.compactBLAS = options.compactBLAS || profile.selected.compact;
+			std::cout << "Using build profile \"" << profile.selected.name << "\" for bottom level acceleration structures\n";
+		}
+	}
 
 	// Create the acceleration structures used to render the ray traced scene
-	for (vkglTF::Model& model : models) {
-		createBottomLevelAccelerationStructure(model);
+	if (options.dynamic) {
+		createSkinning();
+	}
+	// Streamed scenes replace the bottom level acceleration structures of the models with chunks that are built once they are paged in
+	if (options.streaming) {
+		geometryStreamer.reset(new GeometryStreamer(vulkanDevice, accelerationStructureProperties, settings.maxFramesInFlight));
+		geometryStreamer->heapSize = static_cast<VkDeviceSize>(options.streamingBudget) * 1024 * 1024;
+		geometryStreamer->uploadBudget = static_cast<VkDeviceSize>(options.streamingUploadBudget) * 1024 * 1024;
+		geometryStreamer->buildFlags = bottomLevelBuildFlags;
+		for (uint32_t i = 0; i < static_cast<uint32_t>(models.size()); i++) {
+			geometryStreamer->addModel(i, models[i], options.streamingChunkTriangles);
+			// The chunks hold their own copy of the geometry
+			std::vector<vkglTF::Vertex>().swap(models[i].hostVertices);
+			std::vector<uint32_t>().swap(models[i].hostIndices);
+		}
+		geometryStreamer->replicate(options.streamingCopies);
+		geometryStreamer->prepare();
+	} else {
+		createBottomLevelAccelerationStructures();
+	}
+	if (options.scatterCount > 0) {
+		createScatter();
+		if (options.scatterBenchmark) {
+			benchmarkScatter();
+		}
 	}
 	createTopLevelAccelerationStructure();
-	createMaterialBuffer();
+	if (options.accelerationStructureReport) {
+		accelerationStructureReport.writeJSON(options.accelerationStructureReportFile);
+	}
+
+	// Per-geometry records for all models, in the same order as the geometries of the bottom level acceleration structures
+	std::vector<GeometryRecord> geometryRecords;
+	for (auto& model : models) {
+		for (auto& geometryRange : model.geometryRanges) {
+			const uint32_t firstSplitTriangle = (geometryRange.splitTriangleCount > 0) ? geometryRange.firstSplitTriangle : UINT32_MAX;
+			geometryRecords.push_back({ geometryRange.firstIndex, geometryRange.firstVertex, geometryRange.materialIndex, firstSplitTriangle });
+		}
+	}
+	// Geometries of streamed chunks follow those of the models, their indices are relative to the chunk's vertices
+	const uint32_t firstChunkGeometry = static_cast<uint32_t>(geometryRecords.size());
+	if (options.streaming) {
+		for (auto& data : geometryStreamer->chunkData) {
+			for (auto& geometry : data.geometries) {
+				geometryRecords.push_back({ geometry.firstIndex, 0, geometry.materialIndex, UINT32_MAX });
+			}
+		}
+	}
+	VK_CHECK_RESULT(vulkanDevice->createBuffer(
+		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&geometryBuffer,
+		sizeof(GeometryRecord) * geometryRecords.size(),
+		geometryRecords.data()));
 
-	// Create buffer references for the models in the scene
+	// Create buffer references for the bottom level acceleration structures in the scene, indexed via the instance custom index
+	std::vector<uint32_t> matIndexOffsets;
+	std::vector<uint32_t> geometryOffsets;
 	uint32_t matIndexOffset{ 0 };
-	std::vector<SceneModelInfo> sceneModelInfos;
+	uint32_t geometryOffset{ 0 };
 	for (auto& model : models) {
+		matIndexOffsets.push_back(matIndexOffset);
+		geometryOffsets.push_back(geometryOffset);
+		matIndexOffset += static_cast<uint32_t>(model.materials.size());
+		geometryOffset += static_cast<uint32_t>(model.geometryRanges.size());
+	}
+	std::vector<SceneModelInfo> sceneModelInfos;
+	for (auto& source : bottomLevelASSources) {
+		vkglTF::Model& model = models[source.model];
+		vkglTF::Mesh* mesh = getBottomLevelASMesh(source);
 		SceneModelInfo info{};
 		info.vertices = getBufferDeviceAddress(model.vertices.buffer);
 		info.indices = getBufferDeviceAddress(model.indices.buffer);
-		info.materials = getBufferDeviceAddress(scene.materialBuffer.buffer) +(matIndexOffset * sizeof(Material));
-		matIndexOffset += static_cast<uint32_t>(model.materials.size());
+		info.materials = getBufferDeviceAddress(scene.materialBuffer.buffer) + (matIndexOffsets[source.model] * sizeof(Material));
+		// Geometry indices are local to the acceleration structure, which only contains the mesh's geometries (at one level of detail) in instanced mode
+		uint32_t firstGeometryRange = mesh ? mesh->firstGeometryRange : 0;
+		if (mesh && (source.level > 0)) {
+			firstGeometryRange = mesh->levelsOfDetail[source.level - 1].firstGeometryRange;
+		}
+		info.geometries = getBufferDeviceAddress(geometryBuffer.buffer) + ((geometryOffsets[source.model] + firstGeometryRange) * sizeof(GeometryRecord));
+		if (model.compactVertices) {
+			info.attributes = getBufferDeviceAddress(model.attributes.buffer);
+			info.vertexFormat = 1;
+		}
+		info.indexFormat = (model.indices.type == VK_INDEX_TYPE_UINT16) ? 1 : 0;
+		if (model.splitGeometry.triangleCount > 0) {
+			info.splitTriangles = getBufferDeviceAddress(model.splitGeometry.triangles);
+		}
 		sceneModelInfos.emplace_back(info);
 	}
+	// Hit shaders of skinned meshes read the deformed vertices
+	for (auto& skinnedMesh : skinning.meshes) {
+		sceneModelInfos[skinnedMesh.bottomLevelAS].vertices = getBufferDeviceAddress(skinning.deformedVertices[skinnedMesh.model].buffer);
+	}
+	// Streamed scenes have one entry per chunk, vertex and index addresses are written when a chunk is paged in
+	if (options.streaming) {
+		for (uint32_t i = 0; i < static_cast<uint32_t>(geometryStreamer->chunks.size()); i++) {
+			const GeometryStreamer::ChunkData& data = geometryStreamer->chunkData[geometryStreamer->chunks[i].data];
+			SceneModelInfo info{};
+			info.materials = getBufferDeviceAddress(scene.materialBuffer.buffer) + (matIndexOffsets[data.model] * sizeof(Material));
+			info.geometries = getBufferDeviceAddress(geometryBuffer.buffer) + ((firstChunkGeometry + data.firstGeometry) * sizeof(GeometryRecord));
+			info.hitCounter = geometryStreamer->getHitCounterAddress(i);
+			sceneModelInfos.emplace_back(info);
+		}
+	}
 	VK_CHECK_RESULT(vulkanDevice->createBuffer(
 		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
 		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 		&sceneDescBuffer,
 		sizeof(SceneModelInfo) * static_cast<uint32_t>(sceneModelInfos.size()),
 		sceneModelInfos.data()))
+	if (options.streaming) {
+		VK_CHECK_RESULT(sceneDescBuffer.map());
+	}
 
 	createImages();
 	createUniformBuffer();
-	createRayTracingPipeline();
+	waitForRayTracingPipeline();
 	createShaderBindingTables();
 	createDescriptorSets();
 	buildCommandBuffers();
-	updateUniformBuffers();
+
+	if (options.autotune) {
+		autotuneBottomLevelBuildFlags();
+	}
 
 	if (vks::debugmarker::active) {
 		vks::debugmarker::setBufferName(device, scene.materialBuffer.buffer, "Material buffer");
 	}
-
-	prepared = true;
 }
 
 void VulkanPathTracer::resetAccumulation()
@@ -711,20 +2437,54 @@ void VulkanPathTracer::draw()
 		uniformData.currentSamplesCount += options.samplesPerFrame;
 	}
 
+	// Waits for the frame in flight that last used the acquired image, so it's uniform data slice can be updated
 	VulkanApplication::prepareFrame();
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
-	VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
-	VulkanApplication::submitFrame();
-		
 	updateUniformBuffers();
+	updateTraceStatistics();
+	// The UI overlay's buffers are per frame in flight, while the command buffers are per swap chain image
+	if (settings.overlay && UIOverlay.visible) {
+		recordCommandBuffer(currentBuffer);
+	}
+	// Dynamic scenes update the top level acceleration structure in the same submission, ahead of the ray tracing commands
+	// Level of detail selection and geometry streaming follow the camera, so they also run while paused
+	std::vector<VkCommandBuffer> commandBuffers;
+	if ((options.dynamic && !paused) || options.lod || options.streaming || options.progressive) {
+		VkCommandBuffer updateCommandBuffer = updateTopLevelAccelerationStructure();
+		if (updateCommandBuffer != VK_NULL_HANDLE) {
+			commandBuffers.push_back(updateCommandBuffer);
+		}
+	}
+	commandBuffers.push_back(drawCmdBuffers[currentBuffer]);
+	submitInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+	submitInfo.pCommandBuffers = commandBuffers.data();
+	VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, waitFences[currentFrame]));
+	VulkanApplication::submitFrame();
+
+	// Measured from application start to the submission of the first frame that ray traces the scene, loading screen frames don't count
+	if (bringUp.firstFrame) {
+		const double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTimestamp).count();
+		std::cout << std::fixed << std::setprecision(3) << "Time to first ray traced frame: " << elapsed << " ms after application start (" << (pipelineCacheLoaded ? "warm" : "cold") << " pipeline cache)";
+		if (options.progressive) {
+			std::cout << " with " << std::count(bringUp.ready.begin(), bringUp.ready.end(), true) << " of " << bringUp.ready.size() << " bottom level acceleration structures ready";
+		}
+		std::cout << "\n" << std::defaultfloat;
+		bringUp.firstFrame = false;
+	}
 }
 
 void VulkanPathTracer::render()
 {
 	if (!prepared)
 		return;
-	if (camera.updated) {
+	if (sceneLoading.active) {
+		updateSceneLoading();
+		if (sceneLoading.active) {
+			drawLoadingFrame();
+			return;
+		}
+	}
+	// Samples of previous frames don't match an animated scene
+	if (camera.updated || (options.dynamic && !paused)) {
 		resetAccumulation();
 	}
 	draw();
@@ -732,6 +2492,11 @@ void VulkanPathTracer::render()
 
 void VulkanPathTracer::OnUpdateUIOverlay(vks::UIOverlay* overlay)
 {
+	if (sceneLoading.active) {
+		const size_t readyCount = std::count_if(sceneLoading.pendingModels.begin(), sceneLoading.pendingModels.end(), [](const std::unique_ptr<SceneLoading::PendingModel>& model) { return model->ready; });
+		overlay->text("Loading scene: %d of %d models ready", static_cast<int32_t>(readyCount), static_cast<int32_t>(sceneLoading.pendingModels.size()));
+		return;
+	}
 	if (overlay->checkBox("Accumulate frames", &options.accumulate)) {
 		resetAccumulation();
 	}
@@ -747,6 +2512,70 @@ void VulkanPathTracer::OnUpdateUIOverlay(vks::UIOverlay* overlay)
 	if (overlay->sliderFloat("Sky intensity", &options.skyIntensity, 0.1f, 8.0f)) {
 		resetAccumulation();
 	}
+	if (traceStatistics.lastTraceTime > 0.0) {
+		overlay->text("Trace: %.2f ms (%.1f M primary rays/s)", traceStatistics.lastTraceTime, static_cast<double>(width) * height * options.samplesPerFrame / (traceStatistics.lastTraceTime * 1000.0));
+	}
+	if (options.lod && overlay->header("Levels of detail")) {
+		if (overlay->sliderFloat("Screen size", &options.lodScreenSize, 16.0f, 4096.0f)) {
+			resetAccumulation();
+		}
+		if (overlay->sliderFloat("Transition", &options.lodTransition, 0.0f, 1.0f)) {
+			resetAccumulation();
+		}
+		for (size_t i = 0; i < levelOfDetail.histogram.size(); i++) {
+			overlay->text("Level %d: %d instances", static_cast<int32_t>(i), levelOfDetail.histogram[i]);
+		}
+		overlay->text("BLAS: %.1f MB + %.1f MB coarser levels", static_cast<double>(levelOfDetail.fullDetailSize) / (1024.0 * 1024.0), static_cast<double>(levelOfDetail.coarseSize) / (1024.0 * 1024.0));
+	}
+	if (options.streaming && overlay->header("Geometry streaming")) {
+		const GeometryStreamer::Statistics& statistics = geometryStreamer->statistics;
+		overlay->text("Resident: %d of %d chunks", statistics.residentCount, static_cast<int32_t>(geometryStreamer->chunks.size()));
+		overlay->text("Heap: %.1f of %.1f MB", static_cast<double>(statistics.residentSize) / (1024.0 * 1024.0), static_cast<double>(geometryStreamer->heapSize) / (1024.0 * 1024.0));
+		overlay->text("Scene: %.1f MB", static_cast<double>(geometryStreamer->getTotalSize()) / (1024.0 * 1024.0));
+		overlay->text("Paged in: %d, evicted: %d", static_cast<int32_t>(statistics.pageInCount), static_cast<int32_t>(statistics.evictionCount));
+		overlay->text("Uploaded: %.1f MB", static_cast<double>(statistics.uploadSize) / (1024.0 * 1024.0));
+	}
+	if (!bringUp.pendingModels.empty()) {
+		overlay->text("Building: %d model(s) pending", static_cast<int32_t>(bringUp.pendingModels.size()));
+	}
+	if (options.accelerationStructureReport && overlay->header("Acceleration structures")) {
+		const AccelerationStructureReport& report = accelerationStructureReport;
+		uint64_t triangleCount = 0;
+		VkDeviceSize size = 0;
+		VkDeviceSize compactedSize = 0;
+		double buildTime = 0.0;
+		double weightedSAHCost = 0.0;
+		size_t worst = 0;
+		for (size_t i = 0; i < report.bottomLevel.size(); i++) {
+			const AccelerationStructureReport::BottomLevel& entry = report.bottomLevel[i];
+			triangleCount += entry.triangleCount;
+			size += entry.size;
+			compactedSize += entry.compactedSize;
+			buildTime += entry.buildTime;
+			weightedSAHCost += entry.sahCost * entry.triangleCount;
+			if (entry.sahCost > report.bottomLevel[worst].sahCost) {
+				worst = i;
+			}
+		}
+		overlay->text("BLAS: %d, %.2f M triangles", static_cast<int32_t>(report.bottomLevel.size()), static_cast<double>(triangleCount) / 1000000.0);
+		overlay->text("Size: %.1f MB, compacted %.1f MB", static_cast<double>(size) / (1024.0 * 1024.0), static_cast<double>(compactedSize) / (1024.0 * 1024.0));
+		overlay->text("Build: %.2f ms", buildTime);
+		overlay->text("SAH cost: %.2f (triangle weighted)", (triangleCount > 0) ? weightedSAHCost / triangleCount : 0.0);
+		if (!report.bottomLevel.empty()) {
+			overlay->text("Highest SAH cost: %s (%.2f)", report.bottomLevel[worst].name.c_str(), report.bottomLevel[worst].sahCost);
+		}
+		overlay->text("TLAS: %d instances, %.1f KB", report.topLevel.instanceCount, static_cast<double>(report.topLevel.size) / 1024.0);
+		overlay->text("TLAS build: %.2f ms, SAH cost %.2f", report.topLevel.buildTime, report.topLevel.sahCost);
+		overlay->text("Instance overlap: %.3f", report.topLevel.overlapRatio);
+	}
+	if (options.dynamic && overlay->header("Dynamic scene")) {
+		overlay->text("TLAS refit: %.3f ms", dynamicTLAS.statistics.lastRefitTime);
+		overlay->text("TLAS rebuild: %.3f ms", dynamicTLAS.statistics.lastRebuildTime);
+		if (!skinning.meshes.empty()) {
+			overlay->text("Skinning: %.3f ms", dynamicTLAS.statistics.lastSkinningTime);
+			overlay->text("Skinned BLAS refit: %.3f ms", dynamicTLAS.statistics.lastSkinnedRefitTime);
+		}
+	}
 }
 
 // Platform-specific application setup
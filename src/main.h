@@ -14,13 +14,23 @@
 #include "StorageImage.h"
 #include "ScratchBuffer.h"
 #include "AccelerationStructure.h"
+#include "AccelerationStructureBuilder.h"
+#include "AccelerationStructureCache.h"
+#include "AccelerationStructureProfile.h"
+#include "AccelerationStructureReport.h"
+#include "GeometryStreamer.h"
 #include "ShaderBindingTable.h"
+#include "UploadBatch.h"
+#include "threadpool.hpp"
+
+#include <atomic>
 
 class VulkanPathTracer : public VulkanApplication
 {
 public:
 	// Available features and properties
 	VkPhysicalDeviceRayTracingPipelinePropertiesKHR rayTracingPipelineProperties{};
+	VkPhysicalDeviceAccelerationStructurePropertiesKHR accelerationStructureProperties{};
 	VkPhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeatures{};
 
 	// Enabled features and properties
@@ -28,10 +38,95 @@ public:
 	VkPhysicalDeviceBufferDeviceAddressFeatures enabledBufferDeviceAddresFeatures{};
 	VkPhysicalDeviceRayTracingPipelineFeaturesKHR enabledRayTracingPipelineFeatures{};
 	VkPhysicalDeviceAccelerationStructureFeaturesKHR enabledAccelerationStructureFeatures{};
+	VkPhysicalDeviceTimelineSemaphoreFeatures enabledTimelineSemaphoreFeatures{};
 
 	std::vector<AccelerationStructure> bottomLevelAS{};
+	// Bottom level acceleration structures contain either a whole model or, in instanced mode, a single unique mesh of a model
+	struct BottomLevelASSource {
+		uint32_t model;
+		int32_t mesh;
+		// 0 = full detail, coarser levels of detail start at 1
+		uint32_t level = 0;
+	};
+	std::vector<BottomLevelASSource> bottomLevelASSources;
+	// Build flags of the bottom level acceleration structures, can be changed by a build profile
+	VkBuildAccelerationStructureFlagsKHR bottomLevelBuildFlags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
 	AccelerationStructure topLevelAS{};
 
+	// In dynamic mode the top level acceleration structure is refit every frame from animated node transforms
+	// Refits keep the tree topology of the last full build, so it's rebuilt periodically or once instances moved too far
+	struct DynamicTopLevelAS {
+		enum class UpdateType { None, Refit, Rebuild };
+		// Node of each instance, in the order of the top level acceleration structure's instances
+		std::vector<vkglTF::Node*> nodes;
+		std::vector<VkAccelerationStructureInstanceKHR> instances;
+		// Instance translations at the time of the last full build
+		std::vector<glm::vec3> buildTranslations;
+		float sceneRadius = 1.0f;
+		// Persistently mapped instance buffer with one slice per frame in flight
+		vks::Buffer instanceBuffer;
+		VkDeviceSize instanceSliceSize = 0;
+		// Sized for both builds and updates
+		std::unique_ptr<ScratchBuffer> scratchBuffer;
+		// One command buffer and a pair of timestamp queries per frame in flight
+		std::vector<VkCommandBuffer> commandBuffers;
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+		std::vector<UpdateType> pendingUpdates;
+		uint32_t framesSinceRebuild = 0;
+		float animationTime = 0.0f;
+		struct Statistics {
+			uint32_t frameCount = 0;
+			uint32_t refitCount = 0;
+			uint32_t rebuildCount = 0;
+			double refitTime = 0.0;
+			double rebuildTime = 0.0;
+			double skinningTime = 0.0;
+			double skinnedRefitTime = 0.0;
+			double hostTime = 0.0;
+			double lastRefitTime = 0.0;
+			double lastRebuildTime = 0.0;
+			double lastSkinningTime = 0.0;
+			double lastSkinnedRefitTime = 0.0;
+		} statistics;
+	} dynamicTLAS;
+
+	// Skinned meshes of dynamic scenes are deformed on the GPU by a compute pre-pass, and their bottom level acceleration structures are refit every frame
+	struct SkinnedMesh {
+		uint32_t model;
+		uint32_t bottomLevelAS;
+		// Node that provides the joint matrices (skinned copies of a shared mesh all use the first node's skin)
+		vkglTF::Node* node;
+		// Vertex range of all primitives of the mesh
+		uint32_t firstVertex;
+		uint32_t vertexCount;
+		// Range of the mesh's joint matrices in a slice of the joint buffer
+		uint32_t firstJoint;
+		uint32_t jointCount;
+		// Build input reading from the deformed vertices, built with ALLOW_UPDATE
+		AccelerationStructureBuilder::BuildInput buildInput;
+		VkDeviceSize scratchOffset;
+	};
+	struct Skinning {
+		struct PushConstants {
+			uint64_t vertices;
+			uint64_t deformedVertices;
+			uint64_t jointMatrices;
+			uint32_t firstVertex;
+			uint32_t vertexCount;
+		};
+		std::vector<SkinnedMesh> meshes;
+		// Per model copy of the vertex buffer holding the skinned vertices (only allocated for models with skins)
+		std::vector<vks::Buffer> deformedVertices;
+		// Persistently mapped joint matrices of all skinned meshes, one slice per frame in flight
+		vks::Buffer jointBuffer;
+		VkDeviceSize jointSliceSize = 0;
+		// Scratch memory for refitting all skinned bottom level acceleration structures in a single batched build
+		std::unique_ptr<ScratchBuffer> scratchBuffer;
+		VkDeviceAddress scratchAddress = 0;
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	} skinning;
+
 	std::vector<VkRayTracingShaderGroupCreateInfoKHR> shaderGroups{};
 	struct ShaderBindingTables {
 		ShaderBindingTable raygen;
@@ -49,7 +144,9 @@ public:
 		uint32_t sky = true;
 		float skyIntensity = 2.5f;
 	} uniformData;
+	// Ring of uniform data slices, one per command buffer, bound with a dynamic offset so frames in flight don't overwrite each other's data
 	vks::Buffer ubo;
+	VkDeviceSize uboSliceSize = 0;
 
 	struct Options {
 		int32_t maxSamples = 64 * 1024;
@@ -58,8 +155,187 @@ public:
 		bool accumulate = true;
 		bool sky = true;
 		float skyIntensity = 5.0f;
+		// Memory budget for the pooled acceleration structure build scratch allocation (in MB)
+		uint32_t scratchBudget = 256;
+		// Compact bottom level acceleration structures after building them
+		bool compactBLAS = false;
+		// Serialize built bottom level acceleration structures to disk and restore them on the next start
+		bool accelerationStructureCache = false;
+		std::string accelerationStructureCachePath;
+		// Build bottom level acceleration structures on the host using deferred operations
+		bool hostBuild = false;
+		// Classify triangles of alpha tested materials by their texture footprint, so only partially transparent ones invoke any-hit shaders
+		bool classifyAlpha = false;
+		// Use float3 positions and packed vertex attributes instead of the full glTF vertex layout
+		bool compactVertices = false;
+		// Keep the glTF node hierarchy: one bottom level acceleration structure per unique mesh, instanced for every node referencing it
+		bool instanced = false;
+		// Evaluate the scene's animations every frame and refit the top level acceleration structure (implies instanced)
+		bool dynamic = false;
+		// Rebuild the top level acceleration structure instead of refitting it every N frames (0 = only when the quality heuristic trips)
+		uint32_t tlasRebuildInterval = 120;
+		// Rebuild once an instance has moved further than this fraction of the scene's radius since the last rebuild
+		float tlasRebuildDisplacement = 0.25f;
+		// Split long and thin triangles before building the bottom level acceleration structures
+		bool preSplitTriangles = false;
+		// Use the bottom level build flags of an earlier autotune run for this scene, profiles are kept in the acceleration structure cache directory
+		bool buildProfile = true;
+		// Measure build and trace times for several bottom level build flag combinations and store the best one as the scene's build profile
+		bool autotune = false;
+		// Number of frames the trace time is weighted with against the build time when picking the best combination
+		uint32_t autotuneFrames = 1000;
+		// Generate coarser levels of detail for every mesh and select them per instance by projected size (implies instanced)
+		bool lod = false;
+		// Projected bounding sphere diameter (in pixels) below which an instance moves to the next coarser level, halved for every further level
+		float lodScreenSize = 256.0f;
+		// Fraction of a level's size range over which it's stochastically blended with the next coarser level
+		float lodTransition = 0.25f;
+		// Split the scene into spatial chunks that are paged in and out of a fixed-size device heap
+		bool streaming = false;
+		// Size of the device heap for streamed geometry and acceleration structures (in MB)
+		uint32_t streamingBudget = 512;
+		// Geometry uploaded per frame (in MB)
+		uint32_t streamingUploadBudget = 32;
+		uint32_t streamingChunkTriangles = 64 * 1024;
+		// Synthetic scene made of a grid of N x N copies of the scene, each streamed as separate geometry
+		uint32_t streamingCopies = 1;
+		// Number of instances scattered over the scene by a compute shader (static scenes only)
+		uint32_t scatterCount = 0;
+		uint32_t scatterSeed = 1;
+		// Uniform scale range of scattered instances
+		float scatterScaleMin = 0.1f;
+		float scatterScaleMax = 0.3f;
+		// Build the top level acceleration structure for an increasing number of scattered instances at startup and report the timings
+		bool scatterBenchmark = false;
+		// Start rendering once the first model's bottom level acceleration structures are built, the other models are built between frames and added as they finish
+		bool progressive = false;
+		// Gather statistics and SAH cost estimates for all acceleration structures and write them to a JSON report (builds bypass the cache and are compacted)
+		bool accelerationStructureReport = false;
+		std::string accelerationStructureReportFile = "asreport.json";
+		// glTF or binary glTF file loaded instead of the built-in scene
+		std::string sceneFile;
+		// Copy the binary chunk of .glb files into host memory instead of mapping the file (for comparing load time and memory use)
+		bool noFileMapping = false;
+		// Threads used to decode textures while loading, 0 uses all hardware threads and 1 keeps the serial path
+		uint32_t textureThreads = 0;
+		// Load the scene on the calling thread before the first frame instead of in the background (always done for benchmarks)
+		bool syncLoading = false;
 	} options;
 
+	// Per instance level of detail selection, which updates the top level acceleration structure through the same path as dynamic scenes
+	// Nodes with a multi level mesh get two instances, whose masks split the eight ray mask bits between two adjacent levels during a transition
+	// Every path traces with a single random mask bit, so transitions are dithered per pixel and blend smoothly when accumulating
+	struct LevelOfDetailSelection {
+		struct Instance {
+			vkglTF::Node* node;
+			// Bottom level acceleration structure of the mesh at full detail, followed by the coarser levels
+			uint32_t firstBLAS;
+			uint32_t levelCount;
+			// First of the node's two instances in the top level acceleration structure
+			uint32_t instance;
+		};
+		std::vector<Instance> instances;
+		// Number of instances per level, transitioning instances are counted for both levels
+		std::vector<uint32_t> histogram;
+		VkDeviceSize fullDetailSize = 0;
+		VkDeviceSize coarseSize = 0;
+	} levelOfDetail;
+
+	// Instances for scattering workloads (foliage, debris) are generated on the device from a placement description and written directly behind the scene's instances
+	// Each instance picks a random bottom level acceleration structure of the scene, a position on the ground plane, a yaw and a scale
+	// A density map gives the probability of an instance being placed, rejected ones are written as inactive instances
+	struct Scatter {
+		struct PushConstants {
+			glm::vec4 areaMin;
+			glm::vec4 areaMax;
+			uint64_t instances;
+			uint64_t prototypes;
+			uint64_t densityMap;
+			glm::vec2 scaleRange;
+			uint32_t firstInstance;
+			uint32_t instanceCount;
+			uint32_t prototypeCount;
+			uint32_t densityMapSize;
+			uint32_t seed;
+			uint32_t flipY;
+		};
+		struct Prototype {
+			uint64_t accelerationStructureReference;
+			uint32_t customIndex;
+			uint32_t padding;
+		};
+		// Rewritten for every build, as bottom level acceleration structures may have been rebuilt
+		vks::Buffer prototypeBuffer;
+		vks::Buffer densityMap;
+		uint32_t densityMapSize = 64;
+		glm::vec3 areaMin;
+		glm::vec3 areaMax;
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+		// Timestamps before and after generating the instances and after building the top level acceleration structure
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+	} scatter;
+
+	// Progressive scene bring-up, which rebuilds the top level acceleration structure through the same path as dynamic scenes whenever a model's builds have finished
+	// Builds of the models after the first one are submitted one model at a time, so frames in between only wait for a single model's builds
+	// Instances of acceleration structures that haven't been built yet are kept inactive
+	struct SceneBringUp {
+		struct PendingModel {
+			uint32_t model;
+			std::unique_ptr<AccelerationStructureBuilder> builder;
+			// Bottom level acceleration structures built by the builder and their cache keys
+			std::vector<uint32_t> bottomLevelAS;
+			std::vector<uint64_t> cacheKeys;
+			bool submitted = false;
+		};
+		std::vector<PendingModel> pendingModels;
+		// Writes the finished acceleration structures to the cache, polled every frame so it never waits for the device
+		std::unique_ptr<AccelerationStructureCache> cache;
+		// Per bottom level acceleration structure, true once it can be referenced by instances
+		std::vector<bool> ready;
+		bool firstFrame = true;
+	} bringUp;
+
+	AccelerationStructureReport accelerationStructureReport;
+
+	// Background scene loading, the models are loaded concurrently on worker threads while the main loop presents loading frames
+	// Uploads are recorded by the loader threads and submitted between frames to the transfer queue, the graphics queue acquires the data once the transfer timeline semaphore signals the transfers' completion
+	// Each queue signals a timeline of its own, as the signals of the two queues aren't ordered against each other
+	// The rest of the scene is prepared once all models are on the device
+	struct SceneLoading {
+		struct PendingModel {
+			std::string fileName;
+			std::unique_ptr<UploadBatch> uploadBatch;
+			// Set by the loader thread after the last flush of the upload batch
+			std::atomic<bool> loaded{ false };
+			bool ready = false;
+		};
+		bool active = false;
+		VkQueue transferQueue = VK_NULL_HANDLE;
+		VkSemaphore transferTimeline = VK_NULL_HANDLE;
+		VkSemaphore graphicsTimeline = VK_NULL_HANDLE;
+		// Last values signaled by submitted uploads
+		uint64_t transferTimelineValue = 0;
+		uint64_t graphicsTimelineValue = 0;
+		std::vector<std::unique_ptr<PendingModel>> pendingModels;
+		vks::ThreadPool threadPool;
+		uint32_t frameCount = 0;
+		std::chrono::time_point<std::chrono::high_resolution_clock> tStart;
+	} sceneLoading;
+
+	// Out-of-core geometry, the top level acceleration structure is rebuilt through the same path as dynamic scenes whenever chunks are paged in or out
+	std::unique_ptr<GeometryStreamer> geometryStreamer;
+
+	// Device time of the ray tracing dispatch, measured with timestamps in every draw command buffer
+	struct TraceStatistics {
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+		// Set once a command buffer with timestamps has been submitted
+		std::vector<bool> pending;
+		uint32_t frameCount = 0;
+		double traceTime = 0.0;
+		double lastTraceTime = 0.0;
+	} traceStatistics;
+
 	StorageImage accumulationImage;
 	StorageImage storageImage;
 	bool accumulationReset = true;
@@ -67,6 +343,18 @@ public:
 	VkPipeline pipeline;
 	VkPipelineLayout pipelineLayout;
 	VkDescriptorSetLayout descriptorSetLayout;
+	// Upper limit for the variable sized scene texture array, so the pipeline layout doesn't depend on the scene
+	uint32_t maxTextureDescriptors = 0;
+
+	// The ray tracing pipeline is created with a deferred operation that runs on worker threads while the scene is loaded
+	// All data passed to the deferred operation must be kept alive until it has completed
+	struct PipelineCreation {
+		VkDeferredOperationKHR deferredOperation = VK_NULL_HANDLE;
+		std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+		VkRayTracingPipelineCreateInfoKHR createInfo{};
+		vks::ThreadPool threadPool;
+		std::chrono::time_point<std::chrono::high_resolution_clock> tStart;
+	} pipelineCreation;
 
 	enum class MaterialType : uint32_t { 
 		Lambertian = 0,
@@ -77,6 +365,7 @@ public:
 		int32_t baseColorTextureIndex;
 		int32_t normalTextureIndex;
 		MaterialType type;
+		float alphaCutoff;
 	};
 
 	std::vector<vkglTF::Model> models;
@@ -94,24 +383,68 @@ public:
 		uint64_t vertices;
 		uint64_t indices;
 		uint64_t materials;
+		uint64_t geometries;
+		uint64_t attributes;
+		// 0 = vkglTF::Vertex, 1 = float3 positions with packed attributes
+		uint32_t vertexFormat;
+		// 0 = 32-bit, 1 = 16-bit
+		uint32_t indexFormat;
+		uint64_t splitTriangles;
+		// Hit counter of a streamed chunk, 0 if hits aren't counted
+		uint64_t hitCounter;
 	};
 	vks::Buffer sceneDescBuffer;
 
+	// Per-geometry data, indexed in the hit shaders via gl_GeometryIndexEXT
+	struct GeometryRecord {
+		uint32_t firstIndex;
+		uint32_t firstVertex;
+		uint32_t materialIndex;
+		// 0xFFFFFFFF if the geometry is built from the index buffer
+		uint32_t firstSplitTriangle;
+	};
+	vks::Buffer geometryBuffer;
+
 	VulkanPathTracer();
 	~VulkanPathTracer();
+	virtual void getEnabledFeatures();
 	uint64_t getBufferDeviceAddress(VkBuffer buffer);
-	auto createBottomLevelAccelerationInstance(uint32_t index);
-	void createBottomLevelAccelerationStructure(vkglTF::Model& model);
+	auto createBottomLevelAccelerationInstance(uint32_t index, const glm::mat4& transform = glm::mat4(1.0f));
+	AccelerationStructureBuilder::BuildInput getBottomLevelBuildInput(vkglTF::Model& model, bool hostAddresses = false, const vkglTF::Mesh* mesh = nullptr, uint32_t level = 0);
+	vkglTF::Mesh* getBottomLevelASMesh(const BottomLevelASSource& source);
+	void createBottomLevelAccelerationStructures();
 	void createTopLevelAccelerationStructure();
+	bool selectLevelsOfDetail();
+	bool updateStreaming();
+	bool updateBringUp();
+	void createScatter();
+	void recordScatter(VkCommandBuffer commandBuffer, const vks::Buffer& instances, uint32_t firstInstance, uint32_t count);
+	void benchmarkScatter();
+	void updateAccelerationStructureDescriptor();
+	uint64_t getSceneKey();
+	double traceCalibrationBurst(uint32_t frameCount);
+	void autotuneBottomLevelBuildFlags();
+	void createSkinning();
+	void updateJointMatrices(uint32_t slice);
+	void recordSkinning(VkCommandBuffer commandBuffer, uint32_t slice);
+	void recordSkinnedBottomLevelRefits(VkCommandBuffer commandBuffer);
+	VkCommandBuffer updateTopLevelAccelerationStructure();
 	void createShaderBindingTables();
 	void createDescriptorSets();
 	void createRayTracingPipeline();
-	void createMaterialBuffer();
+	void waitForRayTracingPipeline();
+	void createMaterialBuffer(UploadBatch& uploadBatch);
+	void startSceneLoading(const std::vector<std::string>& sceneFiles, uint32_t fileLoadingFlags);
+	void updateSceneLoading();
+	void drawLoadingFrame();
+	void prepareScene();
 	void createUniformBuffer();
 	void createImages();
 	void handleResize();
 	void buildCommandBuffers();
+	void recordCommandBuffer(uint32_t i);
 	void updateUniformBuffers();
+	void updateTraceStatistics();
 	void prepare();
 	void resetAccumulation();
 	void draw();